@@ -0,0 +1,473 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "directorytree.h"
+#include "file.h"
+#include "pathindex.h"
+#include "playlist.h"
+#include "songloader.h"
+#include "soundcommon.h"
+#include "visuals.h"
+
+/*
+
+bench.c
+
+ Headless microbenchmarks for kew's hot paths, run against a library made by
+ genlibrary. Results are written to stdout as JSON, one object per benchmark
+ with the time per iteration and, where it applies, items per second.
+
+ Usage: bench <library> [iterations]
+
+*/
+
+#define MAX_FILES_PER_FORMAT 50
+#define DECODE_CHUNK_FRAMES 4096
+#define VISUALIZER_BUFFER_SIZE 2048
+
+typedef struct
+{
+        struct timespec start;
+        double minMs;
+        double maxMs;
+        double totalMs;
+        int iterations;
+        double items;
+} BenchTimer;
+
+static bool firstResult = true;
+
+double elapsedMs(const struct timespec *start, const struct timespec *end)
+{
+        return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+void resetTimer(BenchTimer *timer)
+{
+        timer->minMs = 0.0;
+        timer->maxMs = 0.0;
+        timer->totalMs = 0.0;
+        timer->iterations = 0;
+        timer->items = 0.0;
+}
+
+void startIteration(BenchTimer *timer)
+{
+        clock_gettime(CLOCK_MONOTONIC, &timer->start);
+}
+
+// Ends an iteration that processed the given number of items (files, nodes, frames)
+void endIteration(BenchTimer *timer, double items)
+{
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double ms = elapsedMs(&timer->start, &end);
+
+        if (timer->iterations == 0 || ms < timer->minMs)
+                timer->minMs = ms;
+        if (ms > timer->maxMs)
+                timer->maxMs = ms;
+
+        timer->totalMs += ms;
+        timer->items += items;
+        timer->iterations++;
+}
+
+void printJsonString(const char *value)
+{
+        putchar('"');
+
+        for (const char *c = value; *c != '\0'; c++)
+        {
+                if (*c == '"' || *c == '\\')
+                        printf("\\%c", *c);
+                else if ((unsigned char)*c < 0x20)
+                        printf("\\u%04x", (unsigned char)*c);
+                else
+                        putchar(*c);
+        }
+
+        putchar('"');
+}
+
+void reportResult(const char *name, const char *itemName, BenchTimer *timer)
+{
+        if (timer->iterations == 0)
+                return;
+
+        printf("%s\n    {\"name\": ", firstResult ? "" : ",");
+        printJsonString(name);
+        printf(", \"iterations\": %d, \"mean_ms\": %.4f, \"min_ms\": %.4f, \"max_ms\": %.4f",
+               timer->iterations, timer->totalMs / timer->iterations, timer->minMs, timer->maxMs);
+
+        if (itemName != NULL && timer->totalMs > 0.0)
+        {
+                printf(", \"items\": ");
+                printJsonString(itemName);
+                printf(", \"items_per_iteration\": %.0f, \"items_per_second\": %.1f",
+                       timer->items / timer->iterations, timer->items / (timer->totalMs / 1000.0));
+        }
+
+        printf("}");
+
+        firstResult = false;
+}
+
+void benchDirectoryTree(const char *libraryPath, int iterations)
+{
+        BenchTimer timer;
+        resetTimer(&timer);
+
+        for (int i = 0; i < iterations; i++)
+        {
+                int numEntries = 0;
+
+                startIteration(&timer);
+                FileSystemEntry *root = createDirectoryTree(libraryPath, &numEntries);
+                endIteration(&timer, numEntries);
+
+                freeTree(root);
+        }
+
+        reportResult("createDirectoryTree", "entries", &timer);
+
+        char treeFile[MAXPATHLEN];
+        generateTempFilePath(treeFile, "benchlibrary", ".tree");
+
+        int numEntries = 0;
+        freeAndWriteTree(createDirectoryTree(libraryPath, &numEntries), treeFile);
+
+        resetTimer(&timer);
+
+        for (int i = 0; i < iterations; i++)
+        {
+                int numDirectoryEntries = 0;
+
+                startIteration(&timer);
+                FileSystemEntry *root = reconstructTreeFromFile(treeFile, libraryPath, &numDirectoryEntries);
+                endIteration(&timer, numEntries);
+
+                freeTree(root);
+        }
+
+        deleteFile(treeFile);
+
+        reportResult("reconstructTreeFromFile", "entries", &timer);
+}
+
+static int numFuzzyMatches = 0;
+
+void countFuzzyMatch(FileSystemEntry *entry, int distance)
+{
+        (void)entry;
+        (void)distance;
+
+        numFuzzyMatches++;
+}
+
+void benchFuzzySearch(FileSystemEntry *root, int numEntries, int iterations)
+{
+        const char *terms[] = {"track 007", "album", "artst 01", "zzzz"};
+        BenchTimer timer;
+        resetTimer(&timer);
+
+        for (int i = 0; i < iterations; i++)
+        {
+                for (size_t t = 0; t < sizeof(terms) / sizeof(terms[0]); t++)
+                {
+                        numFuzzyMatches = 0;
+
+                        startIteration(&timer);
+                        fuzzySearchRecursive(root, terms[t], 2, countFuzzyMatch);
+                        endIteration(&timer, numEntries);
+                }
+        }
+
+        reportResult("fuzzySearchRecursive", "entries", &timer);
+}
+
+void benchPlaylist(FileSystemEntry *root, int iterations)
+{
+        BenchTimer build, shuffle, shuffleOrder, lookup, destroy;
+        resetTimer(&build);
+        resetTimer(&shuffle);
+        resetTimer(&shuffleOrder);
+        resetTimer(&lookup);
+        resetTimer(&destroy);
+
+        for (int i = 0; i < iterations; i++)
+        {
+                PlayList list = {NULL, NULL, 0, PTHREAD_MUTEX_INITIALIZER, {0}, {0}};
+
+                startIteration(&build);
+                createPlayListFromFileSystemEntry(root, &list);
+                endIteration(&build, list.count);
+
+                startIteration(&shuffle);
+                shufflePlaylist(&list);
+                endIteration(&shuffle, list.count);
+
+                startIteration(&shuffleOrder);
+                shufflePlayOrder(&list, list.head);
+                endIteration(&shuffleOrder, list.count);
+
+                startIteration(&lookup);
+                for (int j = 0; j < list.count; j++)
+                {
+                        Node *node = getNodeAtPosition(&list, rand() % list.count);
+                        findNodeById(&list, node->id);
+                        findPathIdInPlaylist(node->track->pathId, &list);
+                }
+                endIteration(&lookup, list.count);
+
+                startIteration(&destroy);
+                deletePlaylist(&list);
+                endIteration(&destroy, 0);
+        }
+
+        reportResult("createPlayListFromFileSystemEntry", "songs", &build);
+        reportResult("shufflePlaylist", "songs", &shuffle);
+        reportResult("shufflePlayOrder", "songs", &shuffleOrder);
+        reportResult("playlistLookups", "lookups", &lookup);
+        reportResult("deletePlaylist", NULL, &destroy);
+}
+
+// Collects up to max audio files with the given extension from the tree
+void collectFiles(FileSystemEntry *entry, const char *extension, const char **files, int *count, int max)
+{
+        for (; entry != NULL && *count < max; entry = entry->next)
+        {
+                if (entry->isDirectory)
+                        collectFiles(entry->children, extension, files, count, max);
+                else if (endsWith(entry->fullPath, extension))
+                        files[(*count)++] = entry->fullPath;
+        }
+}
+
+void benchExtractTags(FileSystemEntry *root, const char *extension, int iterations)
+{
+        const char *files[MAX_FILES_PER_FORMAT];
+        int numFiles = 0;
+        collectFiles(root, extension, files, &numFiles, MAX_FILES_PER_FORMAT);
+
+        if (numFiles == 0)
+                return;
+
+        char coverPath[MAXPATHLEN];
+        generateTempFilePath(coverPath, "benchcover", ".jpg");
+
+        BenchTimer timer;
+        resetTimer(&timer);
+
+        for (int i = 0; i < iterations; i++)
+        {
+                startIteration(&timer);
+
+                for (int f = 0; f < numFiles; f++)
+                {
+                        TagSettings tags;
+                        double duration = 0.0;
+                        extractTags(files[f], &tags, &duration, coverPath);
+                }
+
+                endIteration(&timer, numFiles);
+        }
+
+        deleteFile(coverPath);
+
+        char name[64];
+        snprintf(name, sizeof(name), "extractTags.%s", extension);
+        reportResult(name, "files", &timer);
+}
+
+// Decodes a whole file with the decoder kew would use for it, returns the number of frames
+ma_uint64 decodeFile(const char *path, float *buffer)
+{
+        ma_uint64 total = 0;
+        ma_uint64 framesRead = 0;
+        ma_decoding_backend_config config = ma_decoding_backend_config_init(ma_format_f32, 0);
+
+        if (endsWith(path, "opus"))
+        {
+                ma_libopus opus;
+                if (ma_libopus_init_file(path, &config, NULL, &opus) != MA_SUCCESS)
+                        return 0;
+
+                while (ma_libopus_read_pcm_frames(&opus, buffer, DECODE_CHUNK_FRAMES, &framesRead) == MA_SUCCESS && framesRead > 0)
+                        total += framesRead;
+
+                ma_libopus_uninit(&opus, NULL);
+        }
+        else if (endsWith(path, "ogg"))
+        {
+                ma_libvorbis vorbis;
+                if (ma_libvorbis_init_file(path, &config, NULL, &vorbis) != MA_SUCCESS)
+                        return 0;
+
+                while (ma_libvorbis_read_pcm_frames(&vorbis, buffer, DECODE_CHUNK_FRAMES, &framesRead) == MA_SUCCESS && framesRead > 0)
+                        total += framesRead;
+
+                ma_libvorbis_uninit(&vorbis, NULL);
+        }
+        else if (endsWith(path, "m4a") || endsWith(path, "aac") || endsWith(path, "mp4"))
+        {
+                m4a_decoder m4a;
+                if (m4a_decoder_init_file(path, &config, NULL, &m4a) != MA_SUCCESS)
+                        return 0;
+
+                while (m4a_decoder_read_pcm_frames(&m4a, buffer, DECODE_CHUNK_FRAMES, &framesRead) == MA_SUCCESS && framesRead > 0)
+                        total += framesRead;
+
+                m4a_decoder_uninit(&m4a, NULL);
+        }
+        else
+        {
+                ma_decoder decoder;
+                ma_decoder_config decoderConfig = ma_decoder_config_init(ma_format_f32, 0, 0);
+                if (ma_decoder_init_file(path, &decoderConfig, &decoder) != MA_SUCCESS)
+                        return 0;
+
+                while (ma_decoder_read_pcm_frames(&decoder, buffer, DECODE_CHUNK_FRAMES, &framesRead) == MA_SUCCESS && framesRead > 0)
+                        total += framesRead;
+
+                ma_decoder_uninit(&decoder);
+        }
+
+        return total;
+}
+
+void benchDecoder(FileSystemEntry *root, const char *extension, int iterations)
+{
+        const char *files[MAX_FILES_PER_FORMAT];
+        int numFiles = 0;
+        collectFiles(root, extension, files, &numFiles, MAX_FILES_PER_FORMAT);
+
+        if (numFiles == 0)
+                return;
+
+        // Room for a chunk of up to 8 channels
+        float *buffer = malloc(DECODE_CHUNK_FRAMES * 8 * sizeof(float));
+        if (buffer == NULL)
+                return;
+
+        BenchTimer timer;
+        resetTimer(&timer);
+
+        for (int i = 0; i < iterations; i++)
+        {
+                ma_uint64 frames = 0;
+
+                startIteration(&timer);
+
+                for (int f = 0; f < numFiles; f++)
+                        frames += decodeFile(files[f], buffer);
+
+                endIteration(&timer, (double)frames);
+        }
+
+        free(buffer);
+
+        char name[64];
+        snprintf(name, sizeof(name), "decode.%s", extension);
+        reportResult(name, "frames", &timer);
+}
+
+void benchVisualizer(int iterations)
+{
+        const int height = 10;
+        const int numBars = 64;
+        const int calls = 1000;
+
+        setBufferSize(VISUALIZER_BUFFER_SIZE);
+
+        ma_int32 *audioBuffer = malloc(VISUALIZER_BUFFER_SIZE * sizeof(ma_int32));
+        fftwf_complex *fftInput = fftwf_malloc(VISUALIZER_BUFFER_SIZE * sizeof(fftwf_complex));
+        fftwf_complex *fftOutput = fftwf_malloc(VISUALIZER_BUFFER_SIZE * sizeof(fftwf_complex));
+        float *magnitudes = calloc(numBars, sizeof(float));
+
+        if (audioBuffer == NULL || fftInput == NULL || fftOutput == NULL || magnitudes == NULL)
+                goto end;
+
+        for (int i = 0; i < VISUALIZER_BUFFER_SIZE; i++)
+                audioBuffer[i] = (rand() % 65536) - 32768;
+
+        fftwf_plan plan = fftwf_plan_dft_1d(VISUALIZER_BUFFER_SIZE, fftInput, fftOutput, FFTW_FORWARD, FFTW_ESTIMATE);
+
+        BenchTimer timer;
+        resetTimer(&timer);
+
+        for (int i = 0; i < iterations; i++)
+        {
+                startIteration(&timer);
+
+                for (int j = 0; j < calls; j++)
+                        calc(height, numBars, audioBuffer, 16, fftInput, fftOutput, magnitudes, plan);
+
+                endIteration(&timer, calls);
+        }
+
+        fftwf_destroy_plan(plan);
+
+        reportResult("visualizer.calc", "calls", &timer);
+
+end:
+        free(audioBuffer);
+        fftwf_free(fftInput);
+        fftwf_free(fftOutput);
+        free(magnitudes);
+}
+
+int main(int argc, char *argv[])
+{
+        if (argc < 2)
+        {
+                fprintf(stderr, "Usage: bench <library> [iterations]\n");
+                return 1;
+        }
+
+        const char *libraryPath = argv[1];
+        int iterations = (argc > 2) ? atoi(argv[2]) : 5;
+
+        if (iterations <= 0)
+                iterations = 1;
+
+        srand(1);
+
+        int numEntries = 0;
+        FileSystemEntry *root = createDirectoryTree(libraryPath, &numEntries);
+
+        if (root == NULL || root->children == NULL)
+        {
+                fprintf(stderr, "No music found in %s\n", libraryPath);
+                return 1;
+        }
+
+        const char *formats[] = {"wav", "flac", "mp3", "ogg", "opus", "m4a"};
+
+        printf("{\n  \"library\": ");
+        printJsonString(libraryPath);
+        printf(",\n  \"entries\": %d,\n  \"iterations\": %d,\n  \"results\": [", numEntries, iterations);
+
+        benchDirectoryTree(libraryPath, iterations);
+        benchFuzzySearch(root, numEntries, iterations);
+        benchPlaylist(root, iterations);
+
+        for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+                benchExtractTags(root, formats[i], iterations);
+
+        for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+                benchDecoder(root, formats[i], iterations);
+
+        benchVisualizer(iterations);
+
+        printf("\n  ]\n}\n");
+
+        freeTree(root);
+        freePathIndex();
+
+        return 0;
+}
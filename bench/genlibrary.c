@@ -0,0 +1,421 @@
+#include <errno.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/*
+
+genlibrary.c
+
+ Generates a synthetic music library for the benchmarks: artists x albums x tracks
+ of short sine tones, encoded locally with libav so that no sample files need to
+ be downloaded. Every album uses one format, cycling through the formats given.
+
+ Usage: genlibrary <dir> <artists> <albums> <tracks> [--deep] [--seconds n] [--formats wav,flac,ogg,opus]
+
+ A wide library puts every album directly under <dir>. A deep library nests
+ artist, year, album and disc directories. Files that already exist are kept,
+ so running it again with the same shape is cheap.
+
+*/
+
+#define SAMPLE_RATE 48000
+#define NUM_CHANNELS 2
+#define MAX_FORMATS 8
+
+#ifndef MAXPATHLEN
+#define MAXPATHLEN 4096
+#endif
+
+typedef struct
+{
+        const char *extension;
+        const char *encoderName; // Preferred encoder, tried before the codec id
+        enum AVCodecID codecId;
+} FormatInfo;
+
+static const FormatInfo knownFormats[] = {
+    {"wav", NULL, AV_CODEC_ID_PCM_S16LE},
+    {"flac", NULL, AV_CODEC_ID_FLAC},
+    {"ogg", "libvorbis", AV_CODEC_ID_VORBIS},
+    {"opus", "libopus", AV_CODEC_ID_OPUS},
+    {"mp3", "libmp3lame", AV_CODEC_ID_MP3},
+    {"m4a", NULL, AV_CODEC_ID_AAC},
+};
+
+int makeDirectories(const char *path)
+{
+        char tmp[MAXPATHLEN];
+        snprintf(tmp, sizeof(tmp), "%s", path);
+
+        for (char *p = tmp + 1; *p != '\0'; p++)
+        {
+                if (*p != '/')
+                        continue;
+
+                *p = '\0';
+                if (mkdir(tmp, 0755) != 0 && errno != EEXIST)
+                        return -1;
+                *p = '/';
+        }
+
+        if (mkdir(tmp, 0755) != 0 && errno != EEXIST)
+                return -1;
+
+        return 0;
+}
+
+const FormatInfo *findFormat(const char *extension)
+{
+        for (size_t i = 0; i < sizeof(knownFormats) / sizeof(knownFormats[0]); i++)
+        {
+                if (strcmp(knownFormats[i].extension, extension) == 0)
+                        return &knownFormats[i];
+        }
+
+        return NULL;
+}
+
+const AVCodec *findEncoder(const FormatInfo *format)
+{
+        const AVCodec *codec = NULL;
+
+        if (format->encoderName != NULL)
+                codec = avcodec_find_encoder_by_name(format->encoderName);
+
+        if (codec == NULL)
+                codec = avcodec_find_encoder(format->codecId);
+
+        return codec;
+}
+
+enum AVSampleFormat chooseSampleFormat(const AVCodec *codec)
+{
+        if (codec->sample_fmts == NULL)
+                return AV_SAMPLE_FMT_S16;
+
+        // Prefer formats fillSamples can write, in this order
+        const enum AVSampleFormat preferred[] = {AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_FLT,
+                                                 AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_S32, AV_SAMPLE_FMT_S32P};
+
+        for (size_t i = 0; i < sizeof(preferred) / sizeof(preferred[0]); i++)
+        {
+                for (const enum AVSampleFormat *f = codec->sample_fmts; *f != AV_SAMPLE_FMT_NONE; f++)
+                {
+                        if (*f == preferred[i])
+                                return *f;
+                }
+        }
+
+        return codec->sample_fmts[0];
+}
+
+void fillSamples(AVFrame *frame, enum AVSampleFormat sampleFormat, double frequency, long firstSample)
+{
+        bool planar = av_sample_fmt_is_planar(sampleFormat);
+
+        for (int i = 0; i < frame->nb_samples; i++)
+        {
+                double value = 0.25 * sin(2.0 * M_PI * frequency * (double)(firstSample + i) / SAMPLE_RATE);
+
+                for (int ch = 0; ch < NUM_CHANNELS; ch++)
+                {
+                        int plane = planar ? ch : 0;
+                        int index = planar ? i : i * NUM_CHANNELS + ch;
+
+                        switch (sampleFormat)
+                        {
+                        case AV_SAMPLE_FMT_S16:
+                        case AV_SAMPLE_FMT_S16P:
+                                ((int16_t *)frame->data[plane])[index] = (int16_t)(value * 32767.0);
+                                break;
+                        case AV_SAMPLE_FMT_S32:
+                        case AV_SAMPLE_FMT_S32P:
+                                ((int32_t *)frame->data[plane])[index] = (int32_t)(value * 2147483647.0);
+                                break;
+                        case AV_SAMPLE_FMT_FLT:
+                        case AV_SAMPLE_FMT_FLTP:
+                                ((float *)frame->data[plane])[index] = (float)value;
+                                break;
+                        default:
+                                break;
+                        }
+                }
+        }
+}
+
+int writePackets(AVCodecContext *codecContext, AVFormatContext *formatContext, AVStream *stream, AVFrame *frame, AVPacket *packet)
+{
+        int ret = avcodec_send_frame(codecContext, frame);
+        if (ret < 0)
+                return ret;
+
+        while ((ret = avcodec_receive_packet(codecContext, packet)) >= 0)
+        {
+                av_packet_rescale_ts(packet, codecContext->time_base, stream->time_base);
+                packet->stream_index = stream->index;
+                ret = av_interleaved_write_frame(formatContext, packet);
+                if (ret < 0)
+                        return ret;
+        }
+
+        return (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ? 0 : ret;
+}
+
+// Encodes a sine tone of the given length into path, with the given tags
+int writeTrack(const char *path, const FormatInfo *format, double seconds, double frequency,
+               const char *title, const char *artist, const char *album, int trackNumber)
+{
+        const AVCodec *codec = findEncoder(format);
+        if (codec == NULL)
+        {
+                fprintf(stderr, "No encoder for %s\n", format->extension);
+                return -1;
+        }
+
+        AVFormatContext *formatContext = NULL;
+        AVCodecContext *codecContext = NULL;
+        AVFrame *frame = NULL;
+        AVPacket *packet = NULL;
+        int ret = -1;
+
+        if (avformat_alloc_output_context2(&formatContext, NULL, NULL, path) < 0 || formatContext == NULL)
+                goto end;
+
+        AVStream *stream = avformat_new_stream(formatContext, NULL);
+        codecContext = avcodec_alloc_context3(codec);
+        if (stream == NULL || codecContext == NULL)
+                goto end;
+
+        codecContext->sample_fmt = chooseSampleFormat(codec);
+        codecContext->sample_rate = SAMPLE_RATE;
+        codecContext->bit_rate = 96000;
+        codecContext->time_base = (AVRational){1, SAMPLE_RATE};
+        codecContext->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+#if (LIBAVCODEC_VERSION_MAJOR > 59) || ((LIBAVCODEC_VERSION_MAJOR == 59) && (LIBAVCODEC_VERSION_MINOR > 24))
+        av_channel_layout_default(&codecContext->ch_layout, NUM_CHANNELS);
+#else
+        codecContext->channels = NUM_CHANNELS;
+        codecContext->channel_layout = AV_CH_LAYOUT_STEREO;
+#endif
+
+        if (formatContext->oformat->flags & AVFMT_GLOBALHEADER)
+                codecContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+        if (avcodec_open2(codecContext, codec, NULL) < 0)
+                goto end;
+
+        if (avcodec_parameters_from_context(stream->codecpar, codecContext) < 0)
+                goto end;
+
+        stream->time_base = codecContext->time_base;
+
+        char number[16];
+        snprintf(number, sizeof(number), "%d", trackNumber);
+        av_dict_set(&formatContext->metadata, "title", title, 0);
+        av_dict_set(&formatContext->metadata, "artist", artist, 0);
+        av_dict_set(&formatContext->metadata, "album_artist", artist, 0);
+        av_dict_set(&formatContext->metadata, "album", album, 0);
+        av_dict_set(&formatContext->metadata, "track", number, 0);
+        av_dict_set(&formatContext->metadata, "date", "2024", 0);
+
+        if (!(formatContext->oformat->flags & AVFMT_NOFILE) && avio_open(&formatContext->pb, path, AVIO_FLAG_WRITE) < 0)
+                goto end;
+
+        if (avformat_write_header(formatContext, NULL) < 0)
+                goto end;
+
+        frame = av_frame_alloc();
+        packet = av_packet_alloc();
+        if (frame == NULL || packet == NULL)
+                goto end;
+
+        int frameSize = (codecContext->frame_size > 0) ? codecContext->frame_size : 1024;
+        long totalSamples = (long)(seconds * SAMPLE_RATE);
+
+        frame->format = codecContext->sample_fmt;
+        frame->sample_rate = SAMPLE_RATE;
+        frame->nb_samples = frameSize;
+#if (LIBAVCODEC_VERSION_MAJOR > 59) || ((LIBAVCODEC_VERSION_MAJOR == 59) && (LIBAVCODEC_VERSION_MINOR > 24))
+        av_channel_layout_copy(&frame->ch_layout, &codecContext->ch_layout);
+#else
+        frame->channels = NUM_CHANNELS;
+        frame->channel_layout = AV_CH_LAYOUT_STEREO;
+#endif
+
+        if (av_frame_get_buffer(frame, 0) < 0)
+                goto end;
+
+        for (long sample = 0; sample < totalSamples; sample += frameSize)
+        {
+                if (av_frame_make_writable(frame) < 0)
+                        goto end;
+
+                // Encoders with a fixed frame size need every frame but the last to be full
+                if (!(codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE) && codecContext->frame_size > 0)
+                        frame->nb_samples = frameSize;
+                else
+                        frame->nb_samples = (totalSamples - sample < frameSize) ? (int)(totalSamples - sample) : frameSize;
+
+                fillSamples(frame, codecContext->sample_fmt, frequency, sample);
+                frame->pts = sample;
+
+                if (writePackets(codecContext, formatContext, stream, frame, packet) < 0)
+                        goto end;
+        }
+
+        if (writePackets(codecContext, formatContext, stream, NULL, packet) < 0)
+                goto end;
+
+        if (av_write_trailer(formatContext) < 0)
+                goto end;
+
+        ret = 0;
+
+end:
+        av_frame_free(&frame);
+        av_packet_free(&packet);
+        avcodec_free_context(&codecContext);
+
+        if (formatContext != NULL)
+        {
+                if (!(formatContext->oformat->flags & AVFMT_NOFILE))
+                        avio_closep(&formatContext->pb);
+                avformat_free_context(formatContext);
+        }
+
+        if (ret < 0)
+        {
+                fprintf(stderr, "Failed to write %s\n", path);
+                unlink(path);
+        }
+
+        return ret;
+}
+
+int parseFormats(char *list, const FormatInfo **formats)
+{
+        int numFormats = 0;
+        char *savePtr = NULL;
+
+        for (char *token = strtok_r(list, ",", &savePtr); token != NULL && numFormats < MAX_FORMATS; token = strtok_r(NULL, ",", &savePtr))
+        {
+                const FormatInfo *format = findFormat(token);
+
+                if (format == NULL)
+                {
+                        fprintf(stderr, "Unknown format: %s\n", token);
+                        return -1;
+                }
+
+                formats[numFormats++] = format;
+        }
+
+        return numFormats;
+}
+
+void printUsage(void)
+{
+        fprintf(stderr, "Usage: genlibrary <dir> <artists> <albums> <tracks> [--deep] [--seconds n] [--formats wav,flac,ogg,opus]\n");
+}
+
+int main(int argc, char *argv[])
+{
+        if (argc < 5)
+        {
+                printUsage();
+                return 1;
+        }
+
+        const char *root = argv[1];
+        int numArtists = atoi(argv[2]);
+        int numAlbums = atoi(argv[3]);
+        int numTracks = atoi(argv[4]);
+        bool deep = false;
+        double seconds = 1.0;
+        char formatList[256] = "wav,flac,ogg,opus";
+
+        for (int i = 5; i < argc; i++)
+        {
+                if (strcmp(argv[i], "--deep") == 0)
+                        deep = true;
+                else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+                        seconds = atof(argv[++i]);
+                else if (strcmp(argv[i], "--formats") == 0 && i + 1 < argc)
+                        snprintf(formatList, sizeof(formatList), "%s", argv[++i]);
+                else
+                {
+                        printUsage();
+                        return 1;
+                }
+        }
+
+        const FormatInfo *formats[MAX_FORMATS];
+        int numFormats = parseFormats(formatList, formats);
+
+        if (numArtists <= 0 || numAlbums <= 0 || numTracks <= 0 || numFormats <= 0 || seconds <= 0)
+        {
+                printUsage();
+                return 1;
+        }
+
+        av_log_set_level(AV_LOG_ERROR);
+
+        int numWritten = 0;
+        int numFailed = 0;
+
+        for (int artist = 0; artist < numArtists; artist++)
+        {
+                char artistName[64];
+                snprintf(artistName, sizeof(artistName), "Artist %03d", artist + 1);
+
+                for (int album = 0; album < numAlbums; album++)
+                {
+                        const FormatInfo *format = formats[(artist * numAlbums + album) % numFormats];
+                        char albumName[64];
+                        char albumPath[MAXPATHLEN];
+                        snprintf(albumName, sizeof(albumName), "Album %03d", album + 1);
+
+                        if (deep)
+                                snprintf(albumPath, sizeof(albumPath), "%s/%s/%d/%s/CD1", root, artistName, 1990 + album % 30, albumName);
+                        else
+                                snprintf(albumPath, sizeof(albumPath), "%s/%s - %s", root, artistName, albumName);
+
+                        if (makeDirectories(albumPath) != 0)
+                        {
+                                fprintf(stderr, "Failed to create %s\n", albumPath);
+                                return 1;
+                        }
+
+                        for (int track = 0; track < numTracks; track++)
+                        {
+                                char title[64];
+                                char trackPath[MAXPATHLEN];
+                                snprintf(title, sizeof(title), "Track %03d", track + 1);
+                                snprintf(trackPath, sizeof(trackPath), "%s/%02d - %s.%s", albumPath, track + 1, title, format->extension);
+
+                                if (access(trackPath, F_OK) == 0)
+                                        continue;
+
+                                double frequency = 220.0 + 20.0 * (track % 24);
+
+                                if (writeTrack(trackPath, format, seconds, frequency, title, artistName, albumName, track + 1) == 0)
+                                        numWritten++;
+                                else
+                                        numFailed++;
+                        }
+                }
+        }
+
+        printf("Wrote %d files to %s, %d failed\n", numWritten, root, numFailed);
+
+        return (numFailed > 0) ? 1 : 0;
+}
@@ -0,0 +1,205 @@
+#include "audiostats.h"
+/*
+
+audiostats.c
+
+ Counters and timing histograms recorded from inside the audio callbacks.
+ Everything is a relaxed atomic so the callbacks never take a lock here, and
+ when collection is off the only cost is one flag load per call.
+
+*/
+
+static _Atomic bool audioStatsEnabled = false;
+static AudioStats audioStats;
+
+static const char *counterNames[AUDIO_COUNTER_COUNT] = {
+    "callbacks",
+    "frames_requested",
+    "frames_delivered",
+    "short_callbacks",
+    "trylock_misses",
+    "switch_returns",
+    "device_restarts"};
+
+static const char *histogramNames[AUDIO_HISTOGRAM_COUNT] = {
+    "callback_time",
+    "decoder_read_time"};
+
+void setAudioStatsEnabled(bool enabled)
+{
+        atomic_store(&audioStatsEnabled, enabled);
+}
+
+bool isAudioStatsEnabled()
+{
+        return atomic_load_explicit(&audioStatsEnabled, memory_order_relaxed);
+}
+
+// Returns a monotonic timestamp in nanoseconds, or 0 when collection is off
+uint64_t audioStatsNow()
+{
+        if (!isAudioStatsEnabled())
+                return 0;
+
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void countAudioEvent(AudioCounter counter, uint64_t amount)
+{
+        if (!isAudioStatsEnabled())
+                return;
+
+        atomic_fetch_add_explicit(&audioStats.counters[counter], amount, memory_order_relaxed);
+}
+
+void countAudioCallback(uint64_t framesRequested, uint64_t framesDelivered)
+{
+        if (!isAudioStatsEnabled())
+                return;
+
+        atomic_fetch_add_explicit(&audioStats.counters[AUDIO_CALLBACKS], 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&audioStats.counters[AUDIO_FRAMES_REQUESTED], framesRequested, memory_order_relaxed);
+        atomic_fetch_add_explicit(&audioStats.counters[AUDIO_FRAMES_DELIVERED], framesDelivered, memory_order_relaxed);
+
+        if (framesDelivered < framesRequested)
+                atomic_fetch_add_explicit(&audioStats.counters[AUDIO_SHORT_CALLBACKS], 1, memory_order_relaxed);
+}
+
+int audioStatsBucket(uint64_t microseconds)
+{
+        if (microseconds < 2)
+                return 0;
+
+        int bucket = 63 - __builtin_clzll(microseconds);
+
+        return (bucket < AUDIO_STATS_BUCKETS) ? bucket : AUDIO_STATS_BUCKETS - 1;
+}
+
+void recordAudioTime(AudioHistogram histogram, uint64_t start)
+{
+        if (start == 0 || !isAudioStatsEnabled())
+                return;
+
+        uint64_t end = audioStatsNow();
+        uint64_t microseconds = (end > start) ? (end - start) / 1000 : 0;
+
+        atomic_fetch_add_explicit(&audioStats.buckets[histogram][audioStatsBucket(microseconds)], 1, memory_order_relaxed);
+
+        uint64_t max = atomic_load_explicit(&audioStats.maxMicroseconds[histogram], memory_order_relaxed);
+
+        while (microseconds > max &&
+               !atomic_compare_exchange_weak_explicit(&audioStats.maxMicroseconds[histogram], &max, microseconds,
+                                                      memory_order_relaxed, memory_order_relaxed))
+        {
+        }
+}
+
+uint64_t getAudioCounter(AudioCounter counter)
+{
+        return atomic_load_explicit(&audioStats.counters[counter], memory_order_relaxed);
+}
+
+// Returns the upper bound in microseconds of the bucket the percentile falls in
+uint64_t getAudioPercentile(AudioHistogram histogram, double percentile)
+{
+        uint64_t counts[AUDIO_STATS_BUCKETS];
+        uint64_t total = 0;
+
+        for (int i = 0; i < AUDIO_STATS_BUCKETS; i++)
+        {
+                counts[i] = atomic_load_explicit(&audioStats.buckets[histogram][i], memory_order_relaxed);
+                total += counts[i];
+        }
+
+        if (total == 0)
+                return 0;
+
+        uint64_t target = (uint64_t)(total * percentile / 100.0);
+        uint64_t seen = 0;
+
+        for (int i = 0; i < AUDIO_STATS_BUCKETS; i++)
+        {
+                seen += counts[i];
+                if (seen > target)
+                        return 2ULL << i;
+        }
+
+        return 2ULL << (AUDIO_STATS_BUCKETS - 1);
+}
+
+uint64_t getAudioMaxTime(AudioHistogram histogram)
+{
+        return atomic_load_explicit(&audioStats.maxMicroseconds[histogram], memory_order_relaxed);
+}
+
+void resetAudioStats()
+{
+        for (int i = 0; i < AUDIO_COUNTER_COUNT; i++)
+                atomic_store(&audioStats.counters[i], 0);
+
+        for (int h = 0; h < AUDIO_HISTOGRAM_COUNT; h++)
+        {
+                for (int i = 0; i < AUDIO_STATS_BUCKETS; i++)
+                        atomic_store(&audioStats.buckets[h][i], 0);
+
+                atomic_store(&audioStats.maxMicroseconds[h], 0);
+        }
+}
+
+void formatAudioStatsSummary(char *text, size_t size)
+{
+        if (!isAudioStatsEnabled())
+        {
+                snprintf(text, size, " audio stats off");
+                return;
+        }
+
+        snprintf(text, size, " cb %llu short %llu miss %llu sw %llu restart %llu | cb p50 %lluus p99 %lluus max %lluus | read p99 %lluus",
+                 (unsigned long long)getAudioCounter(AUDIO_CALLBACKS),
+                 (unsigned long long)getAudioCounter(AUDIO_SHORT_CALLBACKS),
+                 (unsigned long long)getAudioCounter(AUDIO_TRYLOCK_MISSES),
+                 (unsigned long long)getAudioCounter(AUDIO_SWITCH_RETURNS),
+                 (unsigned long long)getAudioCounter(AUDIO_DEVICE_RESTARTS),
+                 (unsigned long long)getAudioPercentile(AUDIO_CALLBACK_TIME, 50.0),
+                 (unsigned long long)getAudioPercentile(AUDIO_CALLBACK_TIME, 99.0),
+                 (unsigned long long)getAudioMaxTime(AUDIO_CALLBACK_TIME),
+                 (unsigned long long)getAudioPercentile(AUDIO_DECODER_READ_TIME, 99.0));
+}
+
+void dumpAudioStats(FILE *file)
+{
+        time_t now = time(NULL);
+        char timeText[32];
+
+        strftime(timeText, sizeof(timeText), "%Y-%m-%d %H:%M:%S", localtime(&now));
+
+        fprintf(file, "kew audio stats %s%s\n", timeText, isAudioStatsEnabled() ? "" : " (collection off)");
+
+        for (int i = 0; i < AUDIO_COUNTER_COUNT; i++)
+                fprintf(file, "%-18s %llu\n", counterNames[i], (unsigned long long)getAudioCounter(i));
+
+        for (int h = 0; h < AUDIO_HISTOGRAM_COUNT; h++)
+        {
+                fprintf(file, "\n%s (us): p50 %llu p90 %llu p99 %llu max %llu\n", histogramNames[h],
+                        (unsigned long long)getAudioPercentile(h, 50.0),
+                        (unsigned long long)getAudioPercentile(h, 90.0),
+                        (unsigned long long)getAudioPercentile(h, 99.0),
+                        (unsigned long long)getAudioMaxTime(h));
+
+                for (int i = 0; i < AUDIO_STATS_BUCKETS; i++)
+                {
+                        uint64_t count = atomic_load_explicit(&audioStats.buckets[h][i], memory_order_relaxed);
+
+                        if (count == 0)
+                                continue;
+
+                        fprintf(file, "  < %10llu %llu\n", 2ULL << i, (unsigned long long)count);
+                }
+        }
+
+        fprintf(file, "\n");
+        fflush(file);
+}
@@ -0,0 +1,62 @@
+#ifndef AUDIOSTATS_H
+#define AUDIOSTATS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define AUDIO_STATS_BUCKETS 24 // log2 of microseconds, the last bucket holds everything above ~8 s
+
+typedef enum
+{
+        AUDIO_CALLBACKS,
+        AUDIO_FRAMES_REQUESTED,
+        AUDIO_FRAMES_DELIVERED,
+        AUDIO_SHORT_CALLBACKS, // Fewer frames delivered than the device asked for
+        AUDIO_TRYLOCK_MISSES,
+        AUDIO_SWITCH_RETURNS, // Callback gave up because an implementation switch was under way
+        AUDIO_DEVICE_RESTARTS,
+        AUDIO_COUNTER_COUNT
+} AudioCounter;
+
+typedef enum
+{
+        AUDIO_CALLBACK_TIME,
+        AUDIO_DECODER_READ_TIME,
+        AUDIO_HISTOGRAM_COUNT
+} AudioHistogram;
+
+typedef struct
+{
+        _Atomic uint64_t counters[AUDIO_COUNTER_COUNT];
+        _Atomic uint64_t buckets[AUDIO_HISTOGRAM_COUNT][AUDIO_STATS_BUCKETS];
+        _Atomic uint64_t maxMicroseconds[AUDIO_HISTOGRAM_COUNT];
+} AudioStats;
+
+void setAudioStatsEnabled(bool enabled);
+
+bool isAudioStatsEnabled();
+
+uint64_t audioStatsNow();
+
+void countAudioEvent(AudioCounter counter, uint64_t amount);
+
+void countAudioCallback(uint64_t framesRequested, uint64_t framesDelivered);
+
+void recordAudioTime(AudioHistogram histogram, uint64_t start);
+
+uint64_t getAudioCounter(AudioCounter counter);
+
+uint64_t getAudioPercentile(AudioHistogram histogram, double percentile);
+
+uint64_t getAudioMaxTime(AudioHistogram histogram);
+
+void resetAudioStats();
+
+void formatAudioStatsSummary(char *text, size_t size);
+
+void dumpAudioStats(FILE *file);
+
+#endif
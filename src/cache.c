@@ -1,55 +1,317 @@
 #define _XOPEN_SOURCE 700
 
+#include <sys/stat.h>
 #include "cache.h"
+#include "file.h"
+#include "pathindex.h"
 /*
 
 cache.c
 
- Related to cache which contains paths to cached files.
- 
+ Related to cache which contains temporary files, such as the covers
+ extracted from songs. Each file is stored under what it was made from, so a
+ song that is loaded again uses the cover extracted the last time. Entries
+ are kept in a hash set for constant time lookups, and in least recently
+ used order so that the oldest files can be deleted once the cache goes
+ over its size. A file is never deleted while a loaded song uses it, such
+ as the cover of the current song that is also published over MPRIS.
+
 */
 
-Cache *createCache()
+#define MIN_CACHE_BUCKETS 64
+
+Cache *createCache(off_t maxBytes)
 {
-        Cache *cache = (Cache *)malloc(sizeof(Cache));
-        cache->head = NULL;
+        Cache *cache = (Cache *)calloc(1, sizeof(Cache));
+
+        if (cache == NULL)
+                return NULL;
+
+        cache->maxBytes = maxBytes;
+        pthread_mutex_init(&(cache->mutex), NULL);
+
         return cache;
 }
 
-void addToCache(Cache *cache, const char *filePath)
+CacheNode *findCacheNode(Cache *cache, const char *key, unsigned int hash)
+{
+        if (cache->bucketCount == 0)
+                return NULL;
+
+        CacheNode *node = cache->buckets[hash & (cache->bucketCount - 1)];
+
+        while (node != NULL)
+        {
+                if (node->hash == hash && strcmp(node->key, key) == 0)
+                        return node;
+
+                node = node->nextInBucket;
+        }
+
+        return NULL;
+}
+
+int growCacheBuckets(Cache *cache)
+{
+        size_t newBucketCount = (cache->bucketCount > 0) ? cache->bucketCount * 2 : MIN_CACHE_BUCKETS;
+
+        CacheNode **newBuckets = calloc(newBucketCount, sizeof(CacheNode *));
+        if (newBuckets == NULL)
+                return -1;
+
+        for (CacheNode *node = cache->newest; node != NULL; node = node->older)
+        {
+                size_t bucket = node->hash & (newBucketCount - 1);
+                node->nextInBucket = newBuckets[bucket];
+                newBuckets[bucket] = node;
+        }
+
+        free(cache->buckets);
+        cache->buckets = newBuckets;
+        cache->bucketCount = newBucketCount;
+
+        return 0;
+}
+
+void unlinkCacheNode(Cache *cache, CacheNode *node)
+{
+        if (node->newer != NULL)
+                node->newer->older = node->older;
+        else
+                cache->newest = node->older;
+
+        if (node->older != NULL)
+                node->older->newer = node->newer;
+        else
+                cache->oldest = node->newer;
+
+        node->newer = NULL;
+        node->older = NULL;
+}
+
+void pushNewest(Cache *cache, CacheNode *node)
 {
-        CacheNode *newNode = (CacheNode *)malloc(sizeof(CacheNode));
-        newNode->filePath = strdup(filePath);
-        newNode->next = cache->head;
-        cache->head = newNode;
+        node->newer = NULL;
+        node->older = cache->newest;
+
+        if (cache->newest != NULL)
+                cache->newest->newer = node;
+        else
+                cache->oldest = node;
+
+        cache->newest = node;
+}
+
+void removeCacheNode(Cache *cache, CacheNode *node)
+{
+        CacheNode **link = &cache->buckets[node->hash & (cache->bucketCount - 1)];
+
+        while (*link != NULL && *link != node)
+                link = &(*link)->nextInBucket;
+
+        if (*link == node)
+                *link = node->nextInBucket;
+
+        unlinkCacheNode(cache, node);
+
+        cache->totalBytes -= node->size;
+        cache->count--;
+
+        free(node->key);
+        free(node->filePath);
+        free(node);
+}
+
+void evictFromCache(Cache *cache)
+{
+        CacheNode *node = cache->oldest;
+
+        while (cache->maxBytes > 0 && cache->totalBytes > cache->maxBytes && node != NULL)
+        {
+                CacheNode *newer = node->newer;
+
+                if (node->users == 0)
+                {
+                        if (isInTempDir(node->filePath))
+                                deleteFile(node->filePath);
+
+                        removeCacheNode(cache, node);
+                        cache->stats.evictions++;
+                }
+
+                node = newer;
+        }
 }
 
+// Marks an entry as used by the caller and copies its file path, the caller has to release it again
+void useCacheNode(Cache *cache, CacheNode *node, char *filePath, size_t size)
+{
+        cache->stats.hits++;
+        node->users++;
+        unlinkCacheNode(cache, node);
+        pushNewest(cache, node);
+
+        snprintf(filePath, size, "%s", node->filePath);
+}
+
+// Returns true and the cached file for key if there is one, the caller is then counted as a user of it
+bool acquireFromCache(Cache *cache, const char *key, char *filePath, size_t size)
+{
+        if (cache == NULL || key == NULL)
+                return false;
+
+        unsigned int hash = hashPath(key);
+
+        pthread_mutex_lock(&(cache->mutex));
+
+        CacheNode *node = findCacheNode(cache, key, hash);
+
+        if (node != NULL)
+                useCacheNode(cache, node, filePath, size);
+        else
+                cache->stats.misses++;
+
+        pthread_mutex_unlock(&(cache->mutex));
+
+        return node != NULL;
+}
+
+// Stores filePath as the file for key and counts the caller as a user of it. If another
+// caller got there first, filePath is deleted and replaced with the file already cached.
+void addToCache(Cache *cache, const char *key, char *filePath, size_t size)
+{
+        if (cache == NULL || key == NULL || filePath == NULL)
+                return;
+
+        unsigned int hash = hashPath(key);
+
+        struct stat fileStats;
+        off_t fileSize = (stat(filePath, &fileStats) == 0) ? fileStats.st_size : 0;
+
+        pthread_mutex_lock(&(cache->mutex));
+
+        CacheNode *node = findCacheNode(cache, key, hash);
+
+        if (node != NULL)
+        {
+                if (strcmp(node->filePath, filePath) != 0 && isInTempDir(filePath))
+                        deleteFile(filePath);
+
+                useCacheNode(cache, node, filePath, size);
+                pthread_mutex_unlock(&(cache->mutex));
+                return;
+        }
+
+        cache->stats.misses++;
+
+        if (cache->count >= cache->bucketCount && growCacheBuckets(cache) < 0)
+        {
+                pthread_mutex_unlock(&(cache->mutex));
+                return;
+        }
+
+        node = (CacheNode *)malloc(sizeof(CacheNode));
+        if (node == NULL)
+        {
+                pthread_mutex_unlock(&(cache->mutex));
+                return;
+        }
+
+        node->key = strdup(key);
+        node->filePath = strdup(filePath);
+        if (node->key == NULL || node->filePath == NULL)
+        {
+                free(node->key);
+                free(node->filePath);
+                free(node);
+                pthread_mutex_unlock(&(cache->mutex));
+                return;
+        }
+
+        size_t bucket = hash & (cache->bucketCount - 1);
+        node->hash = hash;
+        node->size = fileSize;
+        node->users = 1;
+        node->nextInBucket = cache->buckets[bucket];
+        cache->buckets[bucket] = node;
+        pushNewest(cache, node);
+
+        cache->totalBytes += fileSize;
+        cache->count++;
+
+        evictFromCache(cache);
+
+        pthread_mutex_unlock(&(cache->mutex));
+}
+
+// The file stays cached for the next time key is loaded, until it is evicted
+void releaseFromCache(Cache *cache, const char *key)
+{
+        if (cache == NULL || key == NULL)
+                return;
+
+        unsigned int hash = hashPath(key);
+
+        pthread_mutex_lock(&(cache->mutex));
+
+        CacheNode *node = findCacheNode(cache, key, hash);
+
+        if (node != NULL && node->users > 0)
+        {
+                node->users--;
+                evictFromCache(cache);
+        }
+
+        pthread_mutex_unlock(&(cache->mutex));
+}
+
+// The files themselves are left to deleteTempDir
 void deleteCache(Cache *cache)
 {
         if (cache)
         {
-                CacheNode *current = cache->head;
+                CacheNode *current = cache->newest;
                 while (current != NULL)
                 {
                         CacheNode *temp = current;
-                        current = current->next;
+                        current = current->older;
+                        free(temp->key);
                         free(temp->filePath);
                         free(temp);
                 }
+                free(cache->buckets);
+                pthread_mutex_destroy(&(cache->mutex));
                 free(cache);
         }
 }
 
-bool existsInCache(Cache *cache, char *filePath)
+// Only a lookup, it doesn't count as a use of the file
+bool existsInCache(Cache *cache, const char *key)
 {
-        CacheNode *current = cache->head;
-        while (current != NULL)
-        {
-                if (strcmp(filePath, current->filePath) == 0)
-                {
-                        return true;
-                }
-                current = current->next;
-        } 
-        return false;       
+        if (cache == NULL || key == NULL)
+                return false;
+
+        unsigned int hash = hashPath(key);
+
+        pthread_mutex_lock(&(cache->mutex));
+
+        bool found = (findCacheNode(cache, key, hash) != NULL);
+
+        pthread_mutex_unlock(&(cache->mutex));
+
+        return found;
+}
+
+void printCacheStats(Cache *cache, FILE *file)
+{
+        if (cache == NULL)
+                return;
+
+        pthread_mutex_lock(&(cache->mutex));
+
+        fprintf(file, "Cache: %zu files, %lld bytes, %lu hits, %lu misses, %lu evictions\n",
+                cache->count, (long long)cache->totalBytes,
+                cache->stats.hits, cache->stats.misses, cache->stats.evictions);
+
+        pthread_mutex_unlock(&(cache->mutex));
 }
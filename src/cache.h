@@ -1,28 +1,61 @@
 #ifndef CACHE_H
 #define CACHE_H
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+
+#ifndef CACHE_MAX_BYTES
+#define CACHE_MAX_BYTES (64 * 1024 * 1024)
+#endif
 
 typedef struct CacheNode
 {
+        char *key;      // What the file was made from, the song for an extracted cover
         char *filePath;
-        struct CacheNode *next;
+        unsigned int hash; // Of key
+        off_t size;
+        int users; // Loaded songs using the file, it isn't evicted while any are
+        struct CacheNode *nextInBucket;
+        struct CacheNode *newer; // Towards the most recently used file
+        struct CacheNode *older; // Towards the least recently used file
 } CacheNode;
 
+typedef struct
+{
+        unsigned long hits;
+        unsigned long misses;
+        unsigned long evictions;
+} CacheStats;
+
 typedef struct Cache
 {
-        CacheNode *head;
+        CacheNode **buckets;
+        size_t bucketCount;
+        size_t count;
+        CacheNode *newest;
+        CacheNode *oldest;
+        off_t totalBytes;
+        off_t maxBytes; // Least recently used files are deleted above this, 0 means no limit
+        CacheStats stats;
+        pthread_mutex_t mutex;
 } Cache;
 
-Cache *createCache(void);
+Cache *createCache(off_t maxBytes);
 
-void addToCache(Cache *cache, const char *filePath);
+bool acquireFromCache(Cache *cache, const char *key, char *filePath, size_t size);
+
+void addToCache(Cache *cache, const char *key, char *filePath, size_t size);
+
+void releaseFromCache(Cache *cache, const char *key);
 
 void deleteCache(Cache *cache);
 
-bool existsInCache(Cache *cache, char *filePath);
+bool existsInCache(Cache *cache, const char *key);
+
+void printCacheStats(Cache *cache, FILE *file);
 
 #endif
@@ -299,6 +299,8 @@ void printImage(const char *image_path, int width, int height)
 
 FIBITMAP *getBitmap(const char *image_path)
 {
+        TRACE_SCOPE("getBitmap");
+
         if (image_path == NULL)
                 return NULL;
 
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include "trace.h"
 
 float calcAspectRatio();
 void printImage(const char *image_path, int width, int height);
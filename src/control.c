@@ -0,0 +1,706 @@
+#ifdef __linux__
+#define _GNU_SOURCE // struct ucred
+#endif
+#include "control.h"
+/*
+
+control.c
+
+ A Unix domain socket through which later invocations of kew, and scripts,
+ control the instance that is already running. Commands are lines of text,
+ as many as wanted per connection:
+
+  add <path>          Enqueue a song, or every song under a directory
+  search <terms>      Enqueue what kew <terms> would play
+  play, pause, toggle, stop, next, prev, quit
+  seek <[+-]seconds>  Go to a position, or move from the current one
+  volume <[+-]pct>    Set the volume, or change it
+
+ A line that can't be run gets an "error: ..." line back. Only connections
+ from the same user are served, and the socket lives in $XDG_RUNTIME_DIR or
+ in a directory under /tmp that only the user can enter.
+
+ Everything runs on the main loop. Songs added one by one are joined onto
+ the playlist once per read instead of once per line, so a script can add
+ thousands of them in one go. Searches and directories are handed to the
+ playlist producer one at a time, in the order they came.
+
+*/
+
+typedef struct
+{
+        int fd;
+        guint source;
+        char line[CONTROL_LINE_MAX];
+        size_t length;
+        bool overlong; // Skipping the rest of a line that didn't fit
+} ControlClient;
+
+static int listenFd = -1;
+static void (*commandCallback)(void) = NULL;
+static char socketPath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+// Work that has to wait for the producer, the first character says what it is:
+// 'f' a song, 'd' a directory, 's' a search
+static GQueue pendingJobs = G_QUEUE_INIT;
+
+// Songs added since the last read, joined onto the playlist together
+static PlayList addedSongs = {NULL, NULL, 0, PTHREAD_MUTEX_INITIALIZER, {0}, {0}};
+
+static const char *controlVerbs[] = {"add", "search", "play", "pause", "toggle", "stop", "next", "prev", "seek", "volume", "quit"};
+
+// Anyone can create things in /tmp, so the directory has to be ours and closed to everyone else
+bool usePrivateDirectory(const char *directory, bool create)
+{
+        if (create && mkdir(directory, 0700) != 0 && errno != EEXIST)
+                return false;
+
+        struct stat st;
+
+        return lstat(directory, &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == getuid() && (st.st_mode & 077) == 0;
+}
+
+// create makes the fallback directory if it isn't there yet
+bool getControlSocketPath(char *path, size_t size, bool create)
+{
+        const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+        char directory[PATH_MAX];
+
+        if (runtimeDir != NULL && runtimeDir[0] != '\0')
+        {
+                c_strcpy(directory, sizeof(directory), runtimeDir);
+        }
+        else
+        {
+                snprintf(directory, sizeof(directory), CONTROL_SOCKET_DIR_TEMPLATE, (int)getuid());
+
+                if (!usePrivateDirectory(directory, create))
+                        return false;
+        }
+
+        int length = snprintf(path, size, "%s/%s", directory, CONTROL_SOCKET_NAME);
+
+        return length > 0 && (size_t)length < size;
+}
+
+// Only the user kew runs as may control it
+bool isPeerTrusted(int fd)
+{
+#ifdef __linux__
+        struct ucred credentials;
+        socklen_t length = sizeof(credentials);
+
+        return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0 && credentials.uid == getuid();
+#else
+        uid_t uid;
+        gid_t gid;
+
+        return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+#endif
+}
+
+bool setNonBlocking(int fd)
+{
+        int flags = fcntl(fd, F_GETFL, 0);
+
+        return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0 && fcntl(fd, F_SETFD, FD_CLOEXEC) == 0;
+}
+
+bool writeAll(int fd, const char *data, size_t size)
+{
+        while (size > 0)
+        {
+                ssize_t written = write(fd, data, size);
+
+                if (written < 0 && errno == EINTR)
+                        continue;
+
+                if (written <= 0)
+                        return false;
+
+                data += written;
+                size -= written;
+        }
+
+        return true;
+}
+
+bool isControlVerb(const char *word)
+{
+        for (size_t i = 0; i < sizeof(controlVerbs) / sizeof(controlVerbs[0]); i++)
+        {
+                if (strcmp(word, controlVerbs[i]) == 0)
+                        return true;
+        }
+
+        return false;
+}
+
+int connectToControlSocket()
+{
+        struct sockaddr_un address;
+
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+
+        if (!getControlSocketPath(address.sun_path, sizeof(address.sun_path), false))
+                return -1;
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (fd < 0)
+                return -1;
+
+        if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+        {
+                close(fd);
+                return -1;
+        }
+
+        return fd;
+}
+
+bool sendArguments(int fd, int argc, char *argv[], int verbIndex)
+{
+        GString *line = g_string_new(NULL);
+        bool sent = true;
+
+        if (strcmp(argv[verbIndex], "add") == 0)
+        {
+                // The running instance has its own working directory
+                for (int i = verbIndex + 1; i < argc && sent; i++)
+                {
+                        char path[PATH_MAX];
+
+                        if (realpath(argv[i], path) == NULL)
+                        {
+                                fprintf(stderr, "Couldn't find %s.\n", argv[i]);
+                                continue;
+                        }
+
+                        g_string_printf(line, "add %s\n", path);
+                        sent = writeAll(fd, line->str, line->len);
+                }
+        }
+        else
+        {
+                // Anything else is a search the way kew <terms> would be on its own, options included
+                int first = verbIndex;
+
+                if (!isControlVerb(argv[verbIndex]))
+                {
+                        g_string_append(line, "search");
+                        first = 1;
+                }
+
+                for (int i = first; i < argc; i++)
+                {
+                        if (line->len > 0)
+                                g_string_append_c(line, ' ');
+                        g_string_append(line, argv[i]);
+                }
+
+                g_string_append_c(line, '\n');
+                sent = writeAll(fd, line->str, line->len);
+        }
+
+        g_string_free(line, TRUE);
+
+        return sent;
+}
+
+bool sendStandardInput(int fd)
+{
+        char buffer[CONTROL_READ_SIZE];
+        ssize_t count;
+
+        while ((count = read(STDIN_FILENO, buffer, sizeof(buffer))) != 0)
+        {
+                if (count < 0 && errno == EINTR)
+                        continue;
+
+                if (count < 0 || !writeAll(fd, buffer, count))
+                        return false;
+        }
+
+        return true;
+}
+
+// Prints what the running instance answered, which is only ever errors
+bool readReplies(int fd)
+{
+        struct timeval timeout = {CONTROL_REPLY_SECONDS, 0};
+        char buffer[1024];
+        ssize_t count;
+        bool replied = false;
+
+        shutdown(fd, SHUT_WR);
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        while ((count = read(fd, buffer, sizeof(buffer))) != 0)
+        {
+                if (count < 0 && errno == EINTR)
+                        continue;
+
+                if (count < 0)
+                        break;
+
+                fwrite(buffer, 1, count, stderr);
+                replied = true;
+        }
+
+        return !replied;
+}
+
+// Sends the command line to kew if it is already running, returns false if it isn't or the command is one to run here
+bool forwardToRunningInstance(int argc, char *argv[])
+{
+        if (argc < 2)
+                return false;
+
+        int verbIndex = 1;
+
+        for (; verbIndex < argc && argv[verbIndex][0] == '-' && argv[verbIndex][1] != '\0'; verbIndex++)
+        {
+                const char *option = argv[verbIndex];
+
+                if (strcmp(option, "-h") == 0 || strcmp(option, "--help") == 0 || strcmp(option, "-?") == 0 ||
+                    strcmp(option, "-v") == 0 || strcmp(option, "--version") == 0)
+                        return false;
+        }
+
+        if (verbIndex == argc)
+                return false;
+
+        const char *first = argv[verbIndex];
+
+        if (strcmp(first, "path") == 0 || strcmp(first, ".") == 0 || strcmp(first, "albums") == 0)
+                return false;
+
+        bool fromInput = (strcmp(first, "-") == 0);
+        int fd = connectToControlSocket();
+
+        if (fd < 0)
+        {
+                if (!fromInput)
+                        return false;
+
+                fprintf(stderr, "kew isn't running.\n");
+                exit(EXIT_FAILURE);
+        }
+
+        signal(SIGPIPE, SIG_IGN);
+
+        bool sent = fromInput ? sendStandardInput(fd) : sendArguments(fd, argc, argv, verbIndex);
+        bool accepted = sent && readReplies(fd);
+
+        close(fd);
+
+        if (!sent)
+                fprintf(stderr, "Couldn't send the command to kew.\n");
+
+        if (!accepted)
+                exit(EXIT_FAILURE);
+
+        return true;
+}
+
+void flushAddedSongs()
+{
+        if (addedSongs.count == 0)
+                return;
+
+        assignNodeIds(&addedSongs);
+        appendSongsToPlaylist(&addedSongs, false);
+}
+
+// Best effort, a client that doesn't read its replies doesn't hold up the main loop
+void replyToClient(ControlClient *client, const char *format, ...)
+{
+        char reply[CONTROL_LINE_MAX + 64];
+        va_list args;
+
+        va_start(args, format);
+        int length = vsnprintf(reply, sizeof(reply), format, args);
+        va_end(args);
+
+        if (length > 0)
+                writeAll(client->fd, reply, ((size_t)length < sizeof(reply)) ? (size_t)length : sizeof(reply) - 1);
+}
+
+void addSong(const char *path)
+{
+        Node *node = NULL;
+
+        createNode(&node, path, -1);
+        addToList(&addedSongs, node);
+}
+
+// The same filter the library and the directory walk use
+bool isAudioFile(const char *path)
+{
+        static regex_t regex;
+        static bool compiled = false;
+
+        if (!compiled)
+        {
+                if (regcomp(&regex, AUDIO_EXTENSIONS, REG_EXTENDED) != 0)
+                        return false;
+
+                compiled = true;
+        }
+
+        char ext[6];
+        extractExtension(path, sizeof(ext) - 1, ext);
+
+        return match_regex(&regex, ext) == 0;
+}
+
+void addPath(ControlClient *client, const char *path)
+{
+        if (path[0] != '/')
+        {
+                replyToClient(client, "error: add needs an absolute path\n");
+                return;
+        }
+
+        int res = isDirectory(path);
+
+        if (res == 1)
+                g_queue_push_tail(&pendingJobs, g_strconcat("d", path, NULL));
+        else if (res == 0 && !isAudioFile(path))
+                replyToClient(client, "error: %s isn't an audio file kew plays\n", path);
+        else if (res == 0 && (isPlaylistProducerRunning() || !g_queue_is_empty(&pendingJobs)))
+                g_queue_push_tail(&pendingJobs, g_strconcat("f", path, NULL)); // After the songs of the directories and searches before it
+        else if (res == 0)
+                addSong(path);
+        else
+                replyToClient(client, "error: couldn't find %s\n", path);
+}
+
+// Searches only take the options that change what is found, the others only apply when kew starts
+bool checkSearchOptions(ControlClient *client, const char *terms)
+{
+        gchar **words = g_strsplit_set(terms, " \t", -1);
+        bool supported = true;
+
+        for (int i = 0; words[i] != NULL && supported; i++)
+        {
+                if (words[i][0] == '-' && strcmp(words[i], "-e") != 0 && strcmp(words[i], "--exact") != 0)
+                {
+                        replyToClient(client, "error: %s can't be used while kew is already running\n", words[i]);
+                        supported = false;
+                }
+        }
+
+        g_strfreev(words);
+
+        return supported;
+}
+
+void startSearchJob(const char *terms)
+{
+        gchar **words = g_strsplit_set(terms, " \t", -1);
+        int count = g_strv_length(words);
+        char **argv = g_new0(char *, count + 2);
+        int argc = 0;
+        bool exact = false;
+
+        argv[argc++] = "kew";
+
+        for (int i = 0; i < count; i++)
+        {
+                if (words[i][0] == '\0')
+                        continue;
+
+                if (strcmp(words[i], "-e") == 0 || strcmp(words[i], "--exact") == 0)
+                        exact = true;
+                else if (words[i][0] != '-') // Anything else was refused by checkSearchOptions
+                        argv[argc++] = words[i];
+        }
+
+        // An update could swap out the library while the producer is still
+        // searching it, so searches from here always go to disk
+        if (argc > 1)
+                enqueueSearch(argc, argv, exact, settings.path, NULL);
+
+        g_free(argv);
+        g_strfreev(words);
+}
+
+// Hands the next waiting directory or search to the playlist producer once it is idle
+void runControlJobs()
+{
+        if (g_queue_is_empty(&pendingJobs) || isPlaylistProducerRunning())
+                return;
+
+        // Whatever the last one found has to be taken before the producer is restarted
+        drainProducedSongs();
+
+        char *job;
+
+        while ((job = g_queue_peek_head(&pendingJobs)) != NULL && job[0] == 'f')
+        {
+                addSong(job + 1);
+                g_free(g_queue_pop_head(&pendingJobs));
+        }
+
+        flushAddedSongs();
+
+        job = g_queue_pop_head(&pendingJobs);
+
+        if (job == NULL)
+                return;
+
+        if (job[0] == 'd')
+                enqueueDirectory(job + 1);
+        else
+                startSearchJob(job + 1);
+
+        g_free(job);
+}
+
+bool hasPendingControlJobs()
+{
+        return !g_queue_is_empty(&pendingJobs);
+}
+
+void executeControlLine(ControlClient *client, char *line)
+{
+        line[strcspn(line, "\r")] = '\0';
+
+        char *verb = line + strspn(line, " \t");
+        char *arg = verb + strcspn(verb, " \t");
+
+        if (*arg != '\0')
+        {
+                *arg++ = '\0';
+                arg += strspn(arg, " \t");
+        }
+
+        if (verb[0] == '\0' || verb[0] == '#')
+                return;
+
+        if (strcmp(verb, "add") == 0)
+        {
+                addPath(client, arg);
+        }
+        else if (strcmp(verb, "search") == 0)
+        {
+                if (arg[0] != '\0' && checkSearchOptions(client, arg))
+                        g_queue_push_tail(&pendingJobs, g_strconcat("s", arg, NULL));
+        }
+        else if (strcmp(verb, "play") == 0)
+        {
+                playbackPlay(&totalPauseSeconds, &pauseSeconds);
+        }
+        else if (strcmp(verb, "pause") == 0)
+        {
+                playbackPause(&pause_time);
+        }
+        else if (strcmp(verb, "toggle") == 0)
+        {
+                togglePause(&totalPauseSeconds, &pauseSeconds, &pause_time);
+        }
+        else if (strcmp(verb, "stop") == 0)
+        {
+                if (!isStopped())
+                        stop();
+        }
+        else if (strcmp(verb, "next") == 0)
+        {
+                resetPlaylistDisplay = true;
+                skipToNextSong();
+        }
+        else if (strcmp(verb, "prev") == 0)
+        {
+                resetPlaylistDisplay = true;
+                skipToPrevSong();
+        }
+        else if (strcmp(verb, "seek") == 0)
+        {
+                gint64 position = (gint64)(strtod(arg, NULL) * G_USEC_PER_SEC);
+
+                if (arg[0] == '+' || arg[0] == '-')
+                        seekPosition(position);
+                else if (arg[0] != '\0')
+                        setPosition(position);
+        }
+        else if (strcmp(verb, "volume") == 0)
+        {
+                int volume = atoi(arg);
+
+                if (arg[0] == '+' || arg[0] == '-')
+                        adjustVolumePercent(volume);
+                else if (arg[0] != '\0')
+                        setVolume(volume);
+
+                emitVolumeChanged();
+        }
+        else if (strcmp(verb, "quit") == 0)
+        {
+                quit();
+        }
+        else
+        {
+                replyToClient(client, "error: unknown command %s\n", verb);
+        }
+
+        refresh = true;
+}
+
+// The source is removed first, so it never watches a closed or reused fd
+void closeControlClient(ControlClient *client)
+{
+        g_source_remove(client->source);
+        close(client->fd);
+        free(client);
+}
+
+gboolean readControlClient(gint fd, GIOCondition condition, gpointer data)
+{
+        (void)condition;
+
+        ControlClient *client = (ControlClient *)data;
+        char buffer[CONTROL_READ_SIZE];
+        ssize_t count = read(fd, buffer, sizeof(buffer));
+
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                return G_SOURCE_CONTINUE;
+
+        char *next = buffer;
+        char *end = buffer + ((count > 0) ? count : 0);
+
+        while (next < end)
+        {
+                char *newline = memchr(next, '\n', end - next);
+                size_t size = ((newline != NULL) ? newline : end) - next;
+
+                if (client->length + size < sizeof(client->line))
+                {
+                        memcpy(client->line + client->length, next, size);
+                        client->length += size;
+                }
+                else
+                {
+                        client->overlong = true;
+                }
+
+                if (newline == NULL)
+                        break;
+
+                client->line[client->length] = '\0';
+
+                if (!client->overlong)
+                        executeControlLine(client, client->line);
+
+                client->length = 0;
+                client->overlong = false;
+                next = newline + 1;
+        }
+
+        if (count <= 0)
+        {
+                // The last line doesn't need a newline
+                client->line[client->length] = '\0';
+
+                if (client->length > 0 && !client->overlong)
+                        executeControlLine(client, client->line);
+
+                closeControlClient(client);
+        }
+
+        flushAddedSongs();
+
+        if (commandCallback != NULL)
+                commandCallback();
+
+        return (count > 0) ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+gboolean acceptControlClients(gint fd, GIOCondition condition, gpointer data)
+{
+        (void)condition;
+        (void)data;
+
+        int clientFd;
+
+        while ((clientFd = accept(fd, NULL, NULL)) >= 0)
+        {
+                ControlClient *client = calloc(1, sizeof(ControlClient));
+
+                if (client == NULL || !isPeerTrusted(clientFd) || !setNonBlocking(clientFd))
+                {
+                        free(client);
+                        close(clientFd);
+                        continue;
+                }
+
+                client->fd = clientFd;
+
+                client->source = g_unix_fd_add(clientFd, G_IO_IN | G_IO_HUP | G_IO_ERR, readControlClient, client);
+        }
+
+        return G_SOURCE_CONTINUE;
+}
+
+// Listens for commands on the default main context, onCommand is called after each batch of them
+void startControlServer(void (*onCommand)(void))
+{
+        struct sockaddr_un address;
+
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+
+        if (!getControlSocketPath(address.sun_path, sizeof(address.sun_path), true))
+                return;
+
+        // Only one instance gets this far, so a socket of ours that is there was left by one that didn't exit cleanly
+        struct stat st;
+
+        if (lstat(address.sun_path, &st) == 0)
+        {
+                if (!S_ISSOCK(st.st_mode) || st.st_uid != getuid())
+                        return;
+
+                unlink(address.sun_path);
+        }
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (fd < 0)
+                return;
+
+        mode_t mask = umask(0177);
+        int res = bind(fd, (struct sockaddr *)&address, sizeof(address));
+        umask(mask);
+
+        if (res != 0 || listen(fd, SOMAXCONN) != 0 || !setNonBlocking(fd))
+        {
+                close(fd);
+                return;
+        }
+
+        listenFd = fd;
+        commandCallback = onCommand;
+        c_strcpy(socketPath, sizeof(socketPath), address.sun_path);
+
+        g_unix_fd_add(fd, G_IO_IN, acceptControlClients, NULL);
+}
+
+void stopControlServer()
+{
+        char *job;
+
+        while ((job = g_queue_pop_head(&pendingJobs)) != NULL)
+                g_free(job);
+
+        deletePlaylist(&addedSongs);
+
+        if (listenFd < 0)
+                return;
+
+        close(listenFd);
+        unlink(socketPath);
+        listenFd = -1;
+}
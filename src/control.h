@@ -0,0 +1,63 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include <limits.h>
+#include <regex.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "mpris.h"
+#include "playerops.h"
+#include "playlist.h"
+#include "settings.h"
+#include "soundcommon.h"
+#include "utils.h"
+
+#ifndef CONTROL_SOCKET_NAME
+#define CONTROL_SOCKET_NAME "kew.sock" // In $XDG_RUNTIME_DIR
+#endif
+
+#ifndef CONTROL_SOCKET_DIR_TEMPLATE
+#define CONTROL_SOCKET_DIR_TEMPLATE "/tmp/kew-%d" // Made private to the user, when $XDG_RUNTIME_DIR isn't set
+#endif
+
+#ifndef CONTROL_REPLY_SECONDS
+#define CONTROL_REPLY_SECONDS 5 // How long a forwarding kew waits for the running one to answer
+#endif
+
+#ifndef CONTROL_LINE_MAX
+#define CONTROL_LINE_MAX 4200 // A command and a path of up to MAXPATHLEN
+#endif
+
+#ifndef CONTROL_READ_SIZE
+#define CONTROL_READ_SIZE 65536
+#endif
+
+bool forwardToRunningInstance(int argc, char *argv[]);
+
+void startControlServer(void (*onCommand)(void));
+
+void runControlJobs(void);
+
+bool hasPendingControlJobs(void);
+
+void stopControlServer(void);
+
+#endif
@@ -0,0 +1,254 @@
+#include "crossfade.h"
+/*
+
+crossfade.c
+
+ Equal-power crossfade between the current decoder and the next one in the
+ chain. When the current track enters its last crossfadeSeconds, the next
+ decoder is detached from the chain and read alongside it, and the two are
+ mixed in the output path. When the current track ends the chain head is
+ pointed at the next decoder where the fade left it, instead of letting
+ miniaudio rewind it.
+
+ Everything here runs on the audio thread with dataSourceMutex held, and the
+ only buffer used is static, so nothing is allocated while playing.
+
+*/
+
+static _Atomic int crossfadeSeconds = 0;
+static _Atomic bool crossfadeSuspended = false;
+
+// Only touched from the audio thread
+static ma_data_source *fadeHead = NULL;
+static ma_data_source *fadeCurrent = NULL;
+static ma_data_source *fadeNext = NULL;
+
+static ma_int32 fadeScratch[CROSSFADE_CHUNK_FRAMES * CROSSFADE_MAX_CHANNELS];
+
+void setCrossfadeSeconds(int seconds)
+{
+        if (seconds < 0)
+                seconds = 0;
+        else if (seconds > CROSSFADE_MAX_SECONDS)
+                seconds = CROSSFADE_MAX_SECONDS;
+
+        atomic_store(&crossfadeSeconds, seconds);
+}
+
+int getCrossfadeSeconds()
+{
+        return atomic_load(&crossfadeSeconds);
+}
+
+// Set while another thread replaces the next decoder, which may free the one being faded in
+void setCrossfadeSuspended(bool suspended)
+{
+        atomic_store(&crossfadeSuspended, suspended);
+}
+
+void resetCrossfade()
+{
+        fadeHead = NULL;
+        fadeCurrent = NULL;
+        fadeNext = NULL;
+}
+
+// Puts the next decoder back in the chain, it is rewound when the chain reaches it
+void cancelCrossfade()
+{
+        if (fadeCurrent != NULL && fadeNext != NULL)
+                ma_data_source_set_next(fadeCurrent, fadeNext);
+
+        resetCrossfade();
+}
+
+// Called on the track switch, the next decoder carries on from where the fade left it
+void completeCrossfade()
+{
+        if (fadeHead != NULL && fadeNext != NULL && !atomic_load(&crossfadeSuspended))
+                ma_data_source_set_current(fadeHead, fadeNext);
+
+        resetCrossfade();
+}
+
+// The mix kernels step the gains per sample rather than per frame, so the
+// loops stay flat and vectorize. The skew between channels is negligible.
+void mixCrossfadeF32(float *restrict out, const float *restrict in, ma_uint64 count, float outGain, float outStep, float inGain, float inStep)
+{
+        for (ma_uint64 i = 0; i < count; i++)
+                out[i] = out[i] * (outGain + outStep * i) + in[i] * (inGain + inStep * i);
+}
+
+void mixCrossfadeS16(ma_int16 *restrict out, const ma_int16 *restrict in, ma_uint64 count, float outGain, float outStep, float inGain, float inStep)
+{
+        for (ma_uint64 i = 0; i < count; i++)
+        {
+                float value = out[i] * (outGain + outStep * i) + in[i] * (inGain + inStep * i);
+                value = (value > 32767.0f) ? 32767.0f : value;
+                value = (value < -32768.0f) ? -32768.0f : value;
+                out[i] = (ma_int16)value;
+        }
+}
+
+void mixCrossfadeS24(ma_uint8 *restrict out, const ma_uint8 *restrict in, ma_uint64 count, float outGain, float outStep, float inGain, float inStep)
+{
+        for (ma_uint64 i = 0; i < count; i++)
+        {
+                ma_uint8 *o = out + i * 3;
+                const ma_uint8 *n = in + i * 3;
+                int32_t a = (int32_t)((uint32_t)o[0] << 8 | (uint32_t)o[1] << 16 | (uint32_t)o[2] << 24) >> 8;
+                int32_t b = (int32_t)((uint32_t)n[0] << 8 | (uint32_t)n[1] << 16 | (uint32_t)n[2] << 24) >> 8;
+                float value = a * (outGain + outStep * i) + b * (inGain + inStep * i);
+
+                value = (value > 8388607.0f) ? 8388607.0f : value;
+                value = (value < -8388608.0f) ? -8388608.0f : value;
+
+                int32_t mixed = (int32_t)value;
+
+                o[0] = (ma_uint8)(mixed & 0xFF);
+                o[1] = (ma_uint8)((mixed >> 8) & 0xFF);
+                o[2] = (ma_uint8)((mixed >> 16) & 0xFF);
+        }
+}
+
+void mixCrossfadeS32(ma_int32 *restrict out, const ma_int32 *restrict in, ma_uint64 count, double outGain, double outStep, double inGain, double inStep)
+{
+        for (ma_uint64 i = 0; i < count; i++)
+        {
+                double value = out[i] * (outGain + outStep * i) + in[i] * (inGain + inStep * i);
+                value = (value > 2147483647.0) ? 2147483647.0 : value;
+                value = (value < -2147483648.0) ? -2147483648.0 : value;
+                out[i] = (ma_int32)value;
+        }
+}
+
+// Mixes frameCount frames of the next decoder into frames, fading in from position
+// (in frames since the start of the fade) over fadeFrames
+void mixNextDecoder(void *frames, ma_uint64 frameCount, ma_uint64 position, ma_uint64 fadeFrames,
+                    ma_format format, ma_uint32 channels)
+{
+        ma_data_source_base *next = (ma_data_source_base *)fadeNext;
+        ma_uint32 bytesPerFrame = ma_get_bytes_per_frame(format, channels);
+        ma_uint64 done = 0;
+        ma_uint64 available = ~(ma_uint64)0;
+        ma_uint64 rangeBeg = 0;
+        ma_uint64 rangeEnd = 0;
+        ma_uint64 nextCursor = 0;
+
+        // Reading past the range would play the padding trimmed for gapless playback
+        ma_data_source_get_range_in_pcm_frames(fadeNext, &rangeBeg, &rangeEnd);
+
+        if (rangeEnd != ~(ma_uint64)0 && ma_data_source_get_cursor_in_pcm_frames(fadeNext, &nextCursor) == MA_SUCCESS)
+                available = (rangeEnd - rangeBeg > nextCursor) ? rangeEnd - rangeBeg - nextCursor : 0;
+
+        while (done < frameCount)
+        {
+                ma_uint64 chunk = frameCount - done;
+                ma_uint64 chunkRead = 0;
+
+                if (chunk > CROSSFADE_CHUNK_FRAMES)
+                        chunk = CROSSFADE_CHUNK_FRAMES;
+
+                // Read the decoder itself, not through the chain
+                if (available > 0)
+                        next->vtable->onRead(fadeNext, fadeScratch, (chunk < available) ? chunk : available, &chunkRead);
+
+                available -= chunkRead;
+
+                if (chunkRead < chunk)
+                        memset((ma_uint8 *)fadeScratch + chunkRead * bytesPerFrame, 0, (chunk - chunkRead) * bytesPerFrame);
+
+                double start = (double)(position + done) / fadeFrames * (M_PI / 2.0);
+                double end = (double)(position + done + chunk) / fadeFrames * (M_PI / 2.0);
+                double outGain = cos(start);
+                double inGain = sin(start);
+                ma_uint64 samples = chunk * channels;
+                double outStep = (cos(end) - outGain) / samples;
+                double inStep = (sin(end) - inGain) / samples;
+                ma_uint8 *out = (ma_uint8 *)frames + done * bytesPerFrame;
+
+                switch (format)
+                {
+                case ma_format_f32:
+                        mixCrossfadeF32((float *)out, (const float *)fadeScratch, samples, outGain, outStep, inGain, inStep);
+                        break;
+                case ma_format_s16:
+                        mixCrossfadeS16((ma_int16 *)out, (const ma_int16 *)fadeScratch, samples, outGain, outStep, inGain, inStep);
+                        break;
+                case ma_format_s24:
+                        mixCrossfadeS24(out, (const ma_uint8 *)fadeScratch, samples, outGain, outStep, inGain, inStep);
+                        break;
+                case ma_format_s32:
+                        mixCrossfadeS32((ma_int32 *)out, (const ma_int32 *)fadeScratch, samples, outGain, outStep, inGain, inStep);
+                        break;
+                default:
+                        break;
+                }
+
+                done += chunk;
+        }
+}
+
+// Reads from the chain like ma_data_source_read_pcm_frames, mixing in the next
+// decoder over the last seconds of the current one. Pass next as NULL to get
+// hard cuts, the way repeat needs them.
+ma_result readCrossfaded(ma_data_source *head, ma_data_source *current, ma_data_source *next,
+                         ma_format format, ma_uint32 channels, ma_uint32 sampleRate,
+                         void *frames, ma_uint64 frameCount, ma_uint64 *framesRead)
+{
+        int seconds = atomic_load(&crossfadeSeconds);
+        ma_uint64 cursor = 0;
+        ma_uint64 length = 0;
+
+        if (fadeNext != NULL)
+        {
+                // The loader links whatever replaces the next decoder itself
+                if (atomic_load(&crossfadeSuspended) || (next != NULL && next != fadeNext))
+                        resetCrossfade();
+                else if (current != fadeCurrent || next == NULL || seconds <= 0)
+                        cancelCrossfade();
+        }
+
+        if (seconds <= 0 || current == NULL || channels > CROSSFADE_MAX_CHANNELS ||
+            ma_data_source_get_cursor_in_pcm_frames(current, &cursor) != MA_SUCCESS ||
+            ma_data_source_get_length_in_pcm_frames(current, &length) != MA_SUCCESS || length == 0)
+                return ma_data_source_read_pcm_frames(head, frames, frameCount, framesRead);
+
+        ma_uint64 fadeFrames = (ma_uint64)seconds * sampleRate;
+
+        if (fadeFrames > length / 2)
+                fadeFrames = length / 2;
+
+        ma_uint64 fadeStart = length - fadeFrames;
+
+        // Seeked back out of the fade
+        if (fadeNext != NULL && cursor < fadeStart)
+                cancelCrossfade();
+
+        if (fadeNext == NULL && next != NULL && fadeFrames > 0 && cursor + frameCount > fadeStart && cursor < length &&
+            !atomic_load(&crossfadeSuspended) && ma_data_source_get_current(head) == current && ma_data_source_get_next(current) == next)
+        {
+                // Detached so the chain stops at the end of the current track instead of rewinding next
+                ma_data_source_set_next(current, NULL);
+                fadeHead = head;
+                fadeCurrent = current;
+                fadeNext = next;
+        }
+
+        ma_result result = ma_data_source_read_pcm_frames(head, frames, frameCount, framesRead);
+
+        if (fadeNext == NULL || *framesRead == 0)
+                return result;
+
+        ma_uint64 offset = (cursor < fadeStart) ? fadeStart - cursor : 0;
+
+        if (offset < *framesRead)
+        {
+                ma_uint32 bytesPerFrame = ma_get_bytes_per_frame(format, channels);
+
+                mixNextDecoder((ma_uint8 *)frames + offset * bytesPerFrame, *framesRead - offset,
+                               cursor + offset - fadeStart, fadeFrames, format, channels);
+        }
+
+        return result;
+}
@@ -0,0 +1,37 @@
+#ifndef CROSSFADE_H
+#define CROSSFADE_H
+
+#include <math.h>
+#include <miniaudio.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef CROSSFADE_MAX_SECONDS
+#define CROSSFADE_MAX_SECONDS 12
+#endif
+
+#ifndef CROSSFADE_CHUNK_FRAMES
+#define CROSSFADE_CHUNK_FRAMES 1024 // Gains are interpolated linearly within a chunk
+#endif
+
+#ifndef CROSSFADE_MAX_CHANNELS
+#define CROSSFADE_MAX_CHANNELS 8
+#endif
+
+void setCrossfadeSeconds(int seconds);
+
+int getCrossfadeSeconds();
+
+void setCrossfadeSuspended(bool suspended);
+
+ma_result readCrossfaded(ma_data_source *head, ma_data_source *current, ma_data_source *next,
+                         ma_format format, ma_uint32 channels, ma_uint32 sampleRate,
+                         void *frames, ma_uint64 frameCount, ma_uint64 *framesRead);
+
+void completeCrossfade();
+
+void resetCrossfade();
+
+#endif
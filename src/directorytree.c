@@ -2,6 +2,12 @@
 
 static int lastUsedId = 0;
 
+// Directories seen so far by the current scan or cache read, for showing progress
+static _Atomic int scannedDirectories = 0;
+
+// Set once on exit, a scan or cache read that is still running then gives up
+static _Atomic bool scanCancelled = false;
+
 typedef void (*TimeoutCallback)(void);
 
 FileSystemEntry *createEntry(const char *name, int isDirectory, FileSystemEntry *parent)
@@ -13,6 +19,8 @@ FileSystemEntry *createEntry(const char *name, int isDirectory, FileSystemEntry
 
                 newEntry->isDirectory = isDirectory;
                 newEntry->isEnqueued = 0;
+                newEntry->pathId = -1;
+                newEntry->row = -1;
                 newEntry->parent = parent;
                 newEntry->children = NULL;
                 newEntry->next = NULL;
@@ -201,6 +209,8 @@ int compareLibEntries(const struct dirent **a, const struct dirent **b)
 
 int readDirectory(const char *path, FileSystemEntry *parent)
 {
+        if (atomic_load(&scanCancelled))
+                return 0;
 
         DIR *directory = opendir(path);
         if (directory == NULL)
@@ -209,6 +219,8 @@ int readDirectory(const char *path, FileSystemEntry *parent)
                 return 0;
         }
 
+        atomic_fetch_add(&scannedDirectories, 1);
+
         struct dirent **entries;
         int dirEntries = scandir(path, &entries, NULL, compareLibEntries);
         if (dirEntries < 0)
@@ -227,6 +239,12 @@ int readDirectory(const char *path, FileSystemEntry *parent)
         {
                 struct dirent *entry = entries[i];
 
+                if (atomic_load(&scanCancelled))
+                {
+                        free(entry);
+                        continue;
+                }
+
                 if (entry->d_name[0] != '.' && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
                 {
                         char childPath[MAXPATHLEN];
@@ -322,6 +340,8 @@ FileSystemEntry *createDirectoryTree(const char *startPath, int *numEntries)
 
         setFullPath(root, "", "");
 
+        atomic_store(&scannedDirectories, 0);
+
         *numEntries = readDirectory(startPath, root);
         *numEntries -= removeEmptyDirectories(root);
 
@@ -330,6 +350,21 @@ FileSystemEntry *createDirectoryTree(const char *startPath, int *numEntries)
         return root;
 }
 
+void cancelDirectoryScans()
+{
+        atomic_store(&scanCancelled, true);
+}
+
+bool isDirectoryScanCancelled()
+{
+        return atomic_load(&scanCancelled);
+}
+
+int getScannedDirectoryCount()
+{
+        return atomic_load(&scannedDirectories);
+}
+
 FileSystemEntry **resizeNodesArray(FileSystemEntry **nodes, int oldSize, int newSize)
 {
         FileSystemEntry **newNodes = realloc(nodes, newSize * sizeof(FileSystemEntry *));
@@ -362,7 +397,9 @@ FileSystemEntry *reconstructTreeFromFile(const char *filename, const char *start
 
         FileSystemEntry *root = NULL;
 
-        while (fgets(line, sizeof(line), file))
+        atomic_store(&scannedDirectories, 0);
+
+        while (!atomic_load(&scanCancelled) && fgets(line, sizeof(line), file))
         {
                 int id, parentId, isDirectory;
                 char name[256];
@@ -406,6 +443,8 @@ FileSystemEntry *reconstructTreeFromFile(const char *filename, const char *start
                         node->name = strdup(name);
                         node->isDirectory = isDirectory;
                         node->isEnqueued = 0;
+                        node->pathId = -1;
+                        node->row = -1;
                         node->children = node->next = node->parent = NULL;
                         nodes[id] = node;
                         nodesCount++;
@@ -430,7 +469,10 @@ FileSystemEntry *reconstructTreeFromFile(const char *filename, const char *start
                                 setFullPath(node, nodes[parentId]->fullPath, node->name);
 
                                 if (isDirectory)
+                                {
                                         *numDirectoryEntries = *numDirectoryEntries + 1;
+                                        atomic_fetch_add(&scannedDirectories, 1);
+                                }
                         }
                         else
                         {
@@ -511,6 +553,38 @@ char *strLower(char *str)
         return lowerStr;
 }
 
+// Finds the first entry a walker() search would find, without touching the disk.
+// Both go depth first in the library's order, so a search finds the same entry
+// whether or not the library has been loaded.
+// Returns 0 and puts the full path in result if found.
+int findInDirectoryTree(FileSystemEntry *node, const char *searching, char *result, enum SearchType searchType, bool exactSearch)
+{
+        for (; node != NULL; node = node->next)
+        {
+                bool matches = exactSearch ? (strcasecmp(node->name, searching) == 0)
+                                           : (c_strcasestr(node->name, searching) != NULL);
+
+                if (node->isDirectory)
+                {
+                        if (matches && searchType != FileOnly && searchType != SearchPlayList)
+                        {
+                                c_strcpy(result, MAXPATHLEN, node->fullPath);
+                                return 0;
+                        }
+
+                        if (findInDirectoryTree(node->children, searching, result, searchType, exactSearch) == 0)
+                                return 0;
+                }
+                else if (matches && searchType != DirOnly)
+                {
+                        c_strcpy(result, MAXPATHLEN, node->fullPath);
+                        return 0;
+                }
+        }
+
+        return 1;
+}
+
 // Traverses the tree and applies fuzzy search on each node
 void fuzzySearchRecursive(FileSystemEntry *node, const char *searchTerm, int threshold, void (*callback)(FileSystemEntry *, int))
 {
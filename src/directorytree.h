@@ -4,6 +4,7 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <regex.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,6 +23,8 @@ typedef struct FileSystemEntry
         int isDirectory; // 1 for directory, 0 for file
         int isEnqueued;
         int parentId;
+        int pathId; // Interned path id, set for files once the tree is indexed
+        int row;    // Index in the library view's rows, only valid while that row still holds this entry
         struct FileSystemEntry *parent;
         struct FileSystemEntry *children;
         struct FileSystemEntry *next; // For siblings (next node in the same directory)
@@ -37,6 +40,10 @@ FileSystemEntry *createDirectoryTree(const char *startPath, int *numEntries);
 void freeTree(FileSystemEntry *root);
 void freeAndWriteTree(FileSystemEntry *root, const char *filename);
 FileSystemEntry *reconstructTreeFromFile(const char *filename, const char *startMusicPath, int *numDirectoryEntries);
+int getScannedDirectoryCount(void);
+void cancelDirectoryScans(void);
+bool isDirectoryScanCancelled(void);
+int findInDirectoryTree(FileSystemEntry *node, const char *searching, char *result, enum SearchType searchType, bool exactSearch);
 void fuzzySearchRecursive(FileSystemEntry *node, const char *searchTerm, int threshold, void (*callback)(FileSystemEntry *, int));
 
 #endif
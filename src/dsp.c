@@ -0,0 +1,87 @@
+#include "dsp.h"
+/*
+
+dsp.c
+
+ Processing chain between the decoders and the device. Stages are added at
+ startup and work on interleaved float frames. Frames in an integer format
+ are converted to float through a static buffer, a chunk at a time, and
+ back again with clipping, so nothing is allocated or locked on the audio
+ thread. When no stage is active the frames are left untouched.
+
+*/
+
+static DspStage dspStages[DSP_MAX_STAGES];
+static _Atomic int dspStageCount = 0;
+
+static float dspScratch[DSP_CHUNK_FRAMES * DSP_MAX_CHANNELS];
+
+// Not thread safe against other callers, stages are meant to be added before playback starts
+bool addDspStage(DspProcess process, DspIsActive isActive, void *state)
+{
+        int count = atomic_load(&dspStageCount);
+
+        if (process == NULL || count >= DSP_MAX_STAGES)
+                return false;
+
+        dspStages[count].process = process;
+        dspStages[count].isActive = isActive;
+        dspStages[count].state = state;
+
+        atomic_store(&dspStageCount, count + 1);
+
+        return true;
+}
+
+void runDspStages(const bool *active, int count, float *frames, ma_uint64 frameCount, ma_uint32 channels, ma_uint32 sampleRate)
+{
+        for (int i = 0; i < count; i++)
+        {
+                if (active[i])
+                        dspStages[i].process(dspStages[i].state, frames, frameCount, channels, sampleRate);
+        }
+}
+
+void applyDsp(void *frames, ma_uint64 frameCount, ma_format format, ma_uint32 channels, ma_uint32 sampleRate)
+{
+        if (frames == NULL || frameCount == 0 || channels == 0 || channels > DSP_MAX_CHANNELS)
+                return;
+
+        int count = atomic_load(&dspStageCount);
+        bool active[DSP_MAX_STAGES];
+        bool anyActive = false;
+
+        for (int i = 0; i < count; i++)
+        {
+                active[i] = (dspStages[i].isActive == NULL || dspStages[i].isActive(dspStages[i].state));
+                anyActive = anyActive || active[i];
+        }
+
+        if (!anyActive)
+                return;
+
+        if (format == ma_format_f32)
+        {
+                runDspStages(active, count, (float *)frames, frameCount, channels, sampleRate);
+                return;
+        }
+
+        ma_uint32 bytesPerFrame = ma_get_bytes_per_frame(format, channels);
+        ma_uint64 done = 0;
+
+        while (done < frameCount)
+        {
+                ma_uint64 chunk = frameCount - done;
+
+                if (chunk > DSP_CHUNK_FRAMES)
+                        chunk = DSP_CHUNK_FRAMES;
+
+                ma_uint8 *pcm = (ma_uint8 *)frames + done * bytesPerFrame;
+
+                ma_pcm_convert(dspScratch, ma_format_f32, pcm, format, chunk * channels, ma_dither_mode_none);
+                runDspStages(active, count, dspScratch, chunk, channels, sampleRate);
+                ma_pcm_convert(pcm, format, dspScratch, ma_format_f32, chunk * channels, ma_dither_mode_none);
+
+                done += chunk;
+        }
+}
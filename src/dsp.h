@@ -0,0 +1,42 @@
+#ifndef DSP_H
+#define DSP_H
+
+#include <miniaudio.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#ifndef DSP_MAX_STAGES
+#define DSP_MAX_STAGES 4
+#endif
+
+#ifndef DSP_MAX_CHANNELS
+#define DSP_MAX_CHANNELS 8
+#endif
+
+#ifndef DSP_CHUNK_FRAMES
+#define DSP_CHUNK_FRAMES 1024 // Integer formats are converted to float this many frames at a time
+#endif
+
+// Processes interleaved float frames in place. Runs on the audio thread, so it must not allocate or block.
+typedef void (*DspProcess)(void *state, float *frames, ma_uint64 frameCount, ma_uint32 channels, ma_uint32 sampleRate);
+
+// Returns false when the stage has nothing to do, so an idle chain costs nothing
+typedef bool (*DspIsActive)(void *state);
+
+#ifndef DSPSTAGE_STRUCT
+#define DSPSTAGE_STRUCT
+
+typedef struct
+{
+        DspProcess process;
+        DspIsActive isActive;
+        void *state;
+} DspStage;
+
+#endif
+
+bool addDspStage(DspProcess process, DspIsActive isActive, void *state);
+
+void applyDsp(void *frames, ma_uint64 frameCount, ma_format format, ma_uint32 channels, ma_uint32 sampleRate);
+
+#endif
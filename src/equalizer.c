@@ -0,0 +1,314 @@
+#include "equalizer.h"
+/*
+
+equalizer.c
+
+ Parametric equalizer, a DSP stage made of a cascade of biquads (peaking
+ and shelving filters from the Audio EQ Cookbook). All bands run per frame
+ with the channels innermost, so the channel loop becomes SIMD and each
+ sample stays in a register through the whole cascade.
+
+ Bands are set from the settings side and picked up by the audio thread
+ through a sequence count instead of a lock. Coefficients are computed on
+ the audio thread when the bands or the sample rate change, with enough
+ preamp folded into the first band to keep boosts from clipping.
+
+*/
+
+// Built-in presets, in the same format as the equalizerCustom setting
+static const char *eqPresets[][2] = {
+    {"bass", "lowshelf:100:6:0.7"},
+    {"treble", "highshelf:8000:6:0.7"},
+    {"vocal", "lowshelf:120:-3:0.7,peak:1000:2:0.8,peak:3000:3:1.0"},
+    {"loudness", "lowshelf:80:6:0.7,peak:3000:-1:1.0,highshelf:10000:4:0.7"},
+    {"lofi", "lowshelf:200:-6:0.7,peak:1500:2:0.7,highshelf:4000:-9:0.7"},
+};
+
+// Written by setEqualizerBands, read by the audio thread when the sequence is even and unchanged
+static EqBand pendingBands[EQ_MAX_BANDS];
+static _Atomic int pendingCount = 0;
+static _Atomic unsigned int pendingSequence = 0;
+
+// Only touched from the audio thread
+static EqBand activeBands[EQ_MAX_BANDS];
+static int activeCount = 0;
+static unsigned int activeSequence = 0;
+static ma_uint32 activeRate = 0;
+static ma_uint32 activeChannels = 0;
+static float coeffB0[EQ_MAX_BANDS];
+static float coeffB1[EQ_MAX_BANDS];
+static float coeffB2[EQ_MAX_BANDS];
+static float coeffA1[EQ_MAX_BANDS];
+static float coeffA2[EQ_MAX_BANDS];
+static float stateZ1[EQ_MAX_BANDS][DSP_MAX_CHANNELS];
+static float stateZ2[EQ_MAX_BANDS][DSP_MAX_CHANNELS];
+
+// Parses "type:frequency:gain[:q]" bands separated by commas, type is peak, lowshelf or highshelf
+int parseEqualizerBands(const char *value, EqBand *bands, int maxBands)
+{
+        char copy[512];
+        char *savePtr = NULL;
+        int count = 0;
+
+        if (value == NULL)
+                return 0;
+
+        snprintf(copy, sizeof(copy), "%s", value);
+
+        for (char *token = strtok_r(copy, ",", &savePtr); token != NULL && count < maxBands; token = strtok_r(NULL, ",", &savePtr))
+        {
+                char type[16];
+                double frequency = 0.0;
+                double gain = 0.0;
+                double q = 0.0;
+
+                int fields = sscanf(token, " %15[^:]:%lf:%lf:%lf", type, &frequency, &gain, &q);
+
+                if (fields < 3 || frequency <= 0.0)
+                        continue;
+
+                EqBand *band = &bands[count];
+
+                if (strcasecmp(type, "peak") == 0)
+                        band->type = EQ_PEAK;
+                else if (strcasecmp(type, "lowshelf") == 0)
+                        band->type = EQ_LOW_SHELF;
+                else if (strcasecmp(type, "highshelf") == 0)
+                        band->type = EQ_HIGH_SHELF;
+                else
+                        continue;
+
+                if (gain > EQ_MAX_GAIN_DB)
+                        gain = EQ_MAX_GAIN_DB;
+                else if (gain < -EQ_MAX_GAIN_DB)
+                        gain = -EQ_MAX_GAIN_DB;
+
+                band->frequency = frequency;
+                band->gain = gain;
+                band->q = (fields == 4 && q > 0.0) ? q : ((band->type == EQ_PEAK) ? 1.0 : M_SQRT1_2);
+
+                // Flat bands only cost time
+                if (band->gain != 0.0)
+                        count++;
+        }
+
+        return count;
+}
+
+// Bands for a preset name from kewrc: off, custom (read from custom) or one of the built-in ones
+int getEqualizerPreset(const char *name, const char *custom, EqBand *bands, int maxBands)
+{
+        if (name == NULL || name[0] == '\0' || strcasecmp(name, "off") == 0 || strcasecmp(name, "flat") == 0)
+                return 0;
+
+        if (strcasecmp(name, "custom") == 0)
+                return parseEqualizerBands(custom, bands, maxBands);
+
+        for (size_t i = 0; i < sizeof(eqPresets) / sizeof(eqPresets[0]); i++)
+        {
+                if (strcasecmp(name, eqPresets[i][0]) == 0)
+                        return parseEqualizerBands(eqPresets[i][1], bands, maxBands);
+        }
+
+        return 0;
+}
+
+// Only one thread may call this at a time
+void setEqualizerBands(const EqBand *bands, int count)
+{
+        if (count < 0)
+                count = 0;
+        else if (count > EQ_MAX_BANDS)
+                count = EQ_MAX_BANDS;
+
+        atomic_fetch_add(&pendingSequence, 1);
+
+        if (count > 0)
+                memcpy(pendingBands, bands, sizeof(EqBand) * count);
+
+        atomic_store(&pendingCount, count);
+        atomic_fetch_add(&pendingSequence, 1);
+}
+
+bool isEqualizerActive(void *state)
+{
+        (void)state;
+
+        return atomic_load(&pendingCount) > 0;
+}
+
+// Magnitude of the cascade at angular frequency w, used to find the preamp
+double getCascadeMagnitude(double w)
+{
+        double magnitude = 1.0;
+        double c1 = cos(w), s1 = sin(w);
+        double c2 = cos(2.0 * w), s2 = sin(2.0 * w);
+
+        for (int i = 0; i < activeCount; i++)
+        {
+                double numRe = coeffB0[i] + coeffB1[i] * c1 + coeffB2[i] * c2;
+                double numIm = -(coeffB1[i] * s1 + coeffB2[i] * s2);
+                double denRe = 1.0 + coeffA1[i] * c1 + coeffA2[i] * c2;
+                double denIm = -(coeffA1[i] * s1 + coeffA2[i] * s2);
+
+                magnitude *= sqrt((numRe * numRe + numIm * numIm) / (denRe * denRe + denIm * denIm));
+        }
+
+        return magnitude;
+}
+
+void computeEqualizerCoefficients(ma_uint32 sampleRate)
+{
+        for (int i = 0; i < activeCount; i++)
+        {
+                const EqBand *band = &activeBands[i];
+                double frequency = band->frequency;
+
+                if (frequency > sampleRate * 0.45)
+                        frequency = sampleRate * 0.45;
+
+                double A = pow(10.0, band->gain / 40.0);
+                double w0 = 2.0 * M_PI * frequency / sampleRate;
+                double cosW0 = cos(w0);
+                double alpha = sin(w0) / (2.0 * band->q);
+                double twoSqrtAAlpha = 2.0 * sqrt(A) * alpha;
+                double b0, b1, b2, a0, a1, a2;
+
+                switch (band->type)
+                {
+                case EQ_LOW_SHELF:
+                        b0 = A * ((A + 1.0) - (A - 1.0) * cosW0 + twoSqrtAAlpha);
+                        b1 = 2.0 * A * ((A - 1.0) - (A + 1.0) * cosW0);
+                        b2 = A * ((A + 1.0) - (A - 1.0) * cosW0 - twoSqrtAAlpha);
+                        a0 = (A + 1.0) + (A - 1.0) * cosW0 + twoSqrtAAlpha;
+                        a1 = -2.0 * ((A - 1.0) + (A + 1.0) * cosW0);
+                        a2 = (A + 1.0) + (A - 1.0) * cosW0 - twoSqrtAAlpha;
+                        break;
+                case EQ_HIGH_SHELF:
+                        b0 = A * ((A + 1.0) + (A - 1.0) * cosW0 + twoSqrtAAlpha);
+                        b1 = -2.0 * A * ((A - 1.0) + (A + 1.0) * cosW0);
+                        b2 = A * ((A + 1.0) + (A - 1.0) * cosW0 - twoSqrtAAlpha);
+                        a0 = (A + 1.0) - (A - 1.0) * cosW0 + twoSqrtAAlpha;
+                        a1 = 2.0 * ((A - 1.0) - (A + 1.0) * cosW0);
+                        a2 = (A + 1.0) - (A - 1.0) * cosW0 - twoSqrtAAlpha;
+                        break;
+                case EQ_PEAK:
+                default:
+                        b0 = 1.0 + alpha * A;
+                        b1 = -2.0 * cosW0;
+                        b2 = 1.0 - alpha * A;
+                        a0 = 1.0 + alpha / A;
+                        a1 = -2.0 * cosW0;
+                        a2 = 1.0 - alpha / A;
+                        break;
+                }
+
+                coeffB0[i] = (float)(b0 / a0);
+                coeffB1[i] = (float)(b1 / a0);
+                coeffB2[i] = (float)(b2 / a0);
+                coeffA1[i] = (float)(a1 / a0);
+                coeffA2[i] = (float)(a2 / a0);
+        }
+
+        // Scan the response on a log scale from 20 Hz to Nyquist and take back the largest boost
+        double peak = 1.0;
+
+        for (int i = 0; i <= 64; i++)
+        {
+                double frequency = 20.0 * pow(sampleRate / 2.0 / 20.0, i / 64.0);
+                double magnitude = getCascadeMagnitude(2.0 * M_PI * frequency / sampleRate);
+
+                if (magnitude > peak)
+                        peak = magnitude;
+        }
+
+        if (activeCount > 0 && peak > 1.0)
+        {
+                coeffB0[0] /= (float)peak;
+                coeffB1[0] /= (float)peak;
+                coeffB2[0] /= (float)peak;
+        }
+
+        memset(stateZ1, 0, sizeof(stateZ1));
+        memset(stateZ2, 0, sizeof(stateZ2));
+}
+
+// Transposed direct form II. Inlined with a constant channel count, the channel loop vectorizes.
+static inline void filterFrames(float *restrict frames, ma_uint64 frameCount, ma_uint32 channels, int bandCount)
+{
+        for (ma_uint64 i = 0; i < frameCount; i++)
+        {
+                float *frame = frames + i * channels;
+
+                for (int b = 0; b < bandCount; b++)
+                {
+                        const float b0 = coeffB0[b], b1 = coeffB1[b], b2 = coeffB2[b];
+                        const float a1 = coeffA1[b], a2 = coeffA2[b];
+                        float *restrict z1 = stateZ1[b];
+                        float *restrict z2 = stateZ2[b];
+
+                        for (ma_uint32 c = 0; c < channels; c++)
+                        {
+                                float in = frame[c];
+                                float out = b0 * in + z1[c];
+
+                                z1[c] = b1 * in - a1 * out + z2[c];
+                                z2[c] = b2 * in - a2 * out;
+                                frame[c] = out;
+                        }
+                }
+        }
+}
+
+void processEqualizer(void *state, float *frames, ma_uint64 frameCount, ma_uint32 channels, ma_uint32 sampleRate)
+{
+        (void)state;
+
+        unsigned int sequence = atomic_load(&pendingSequence);
+
+        if (sequence != activeSequence && (sequence & 1) == 0)
+        {
+                EqBand bands[EQ_MAX_BANDS];
+                int count = atomic_load(&pendingCount);
+
+                memcpy(bands, pendingBands, sizeof(bands));
+
+                // Keep the old bands if they were being rewritten meanwhile, try again next time
+                if (atomic_load(&pendingSequence) == sequence)
+                {
+                        memcpy(activeBands, bands, sizeof(bands));
+                        activeCount = count;
+                        activeSequence = sequence;
+                        activeRate = 0;
+                }
+        }
+
+        if (activeCount == 0 || channels > DSP_MAX_CHANNELS || sampleRate == 0)
+                return;
+
+        if (sampleRate != activeRate || channels != activeChannels)
+        {
+                computeEqualizerCoefficients(sampleRate);
+                activeRate = sampleRate;
+                activeChannels = channels;
+        }
+
+        if (channels == 2)
+                filterFrames(frames, frameCount, 2, activeCount);
+        else if (channels == 1)
+                filterFrames(frames, frameCount, 1, activeCount);
+        else
+                filterFrames(frames, frameCount, channels, activeCount);
+
+        // Flush denormals, the filters ring down into them on silence and they are slow on many CPUs
+        for (int b = 0; b < activeCount; b++)
+        {
+                for (ma_uint32 c = 0; c < channels; c++)
+                {
+                        if (fabsf(stateZ1[b][c]) < 1e-20f)
+                                stateZ1[b][c] = 0.0f;
+                        if (fabsf(stateZ2[b][c]) < 1e-20f)
+                                stateZ2[b][c] = 0.0f;
+                }
+        }
+}
@@ -0,0 +1,52 @@
+#ifndef EQUALIZER_H
+#define EQUALIZER_H
+
+#include <math.h>
+#include <miniaudio.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "dsp.h"
+
+#ifndef EQ_MAX_BANDS
+#define EQ_MAX_BANDS 10
+#endif
+
+#ifndef EQ_MAX_GAIN_DB
+#define EQ_MAX_GAIN_DB 18.0
+#endif
+
+typedef enum
+{
+        EQ_PEAK,
+        EQ_LOW_SHELF,
+        EQ_HIGH_SHELF
+} EqBandType;
+
+#ifndef EQBAND_STRUCT
+#define EQBAND_STRUCT
+
+typedef struct
+{
+        EqBandType type;
+        double frequency; // Hz
+        double gain;      // dB
+        double q;
+} EqBand;
+
+#endif
+
+int parseEqualizerBands(const char *value, EqBand *bands, int maxBands);
+
+int getEqualizerPreset(const char *name, const char *custom, EqBand *bands, int maxBands);
+
+void setEqualizerBands(const EqBand *bands, int count);
+
+bool isEqualizerActive(void *state);
+
+void processEqualizer(void *state, float *frames, ma_uint64 frameCount, ma_uint32 channels, ma_uint32 sampleRate);
+
+#endif
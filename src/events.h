@@ -30,11 +30,14 @@ enum EventType
         EVENT_SCROLLPREV,
         EVENT_SEEKBACK,
         EVENT_SEEKFORWARD,
+        EVENT_INCREASESPEED,
+        EVENT_DECREASESPEED,
         EVENT_SHOWLIBRARY,
         EVENT_SHOWTRACK,
         EVENT_NEXTPAGE,
         EVENT_PREVPAGE,
         EVENT_REMOVE,
+        EVENT_TOGGLEAUDIOSTATS,
         EVENT_SEARCH
 };
 
@@ -51,129 +51,299 @@ int isDirectory(const char *path)
         }
 }
 
-// Traverse a directory tree and search for a given file or directory
-int walker(const char *startPath, const char *searching, char *result,
-           const char *allowedExtensions, enum SearchType searchType, bool exactSearch)
+#define MAX_WALKER_THREADS 8
+
+typedef struct
 {
-        DIR *d;
-        struct dirent *dir;
-        struct stat file_stat;
-        char ext[6]; // +1 for null-terminator
+        char *name;
+        unsigned char type; // d_type, DT_UNKNOWN when the file system doesn't say
+} WalkerName;
+
+typedef struct
+{
+        const char *searching;
+        enum SearchType searchType;
+        bool exactSearch;
         regex_t regex;
-        int ret = regcomp(&regex, allowedExtensions, REG_EXTENDED);
-        if (ret != 0)
+        int rootFd;
+        const char *rootPath;
+        WalkerName *names; // Entries directly under the start path, in library order
+        int numNames;
+        int nextName;      // Next top level entry for a worker to take
+        int bestIndex;     // Top level entry of the best match so far
+        char *result;
+        pthread_mutex_t mutex;
+} WalkerSearch;
+
+// The order the library lists entries in: names starting with '_' first, then ignoring case and spaces
+int compareLibraryNames(const char *a, const char *b)
+{
+        while (isspace((unsigned char)*a))
+                a++;
+        while (isspace((unsigned char)*b))
+                b++;
+
+        if ((a[0] == '_') != (b[0] == '_'))
+                return (a[0] == '_') ? -1 : 1;
+
+        while (true)
         {
-                return -1;
+                while (isspace((unsigned char)*a))
+                        a++;
+                while (isspace((unsigned char)*b))
+                        b++;
+
+                int charA = toupper((unsigned char)*a);
+                int charB = toupper((unsigned char)*b);
+
+                if (charA != charB || charA == '\0')
+                        return charA - charB;
+
+                a++;
+                b++;
         }
+}
+
+int compareWalkerNames(const void *a, const void *b)
+{
+        return compareLibraryNames(((const WalkerName *)a)->name, ((const WalkerName *)b)->name);
+}
+
+void freeWalkerNames(WalkerName *names, int numNames)
+{
+        for (int i = 0; i < numNames; i++)
+                free(names[i].name);
+
+        free(names);
+}
+
+// Reads the entries of d that the library would show, leaving out hidden ones, sorted like the library.
+// Returns the number of entries.
+int readWalkerNames(DIR *d, WalkerName **names)
+{
+        int numNames = 0;
+        int capacity = 0;
+        struct dirent *dir;
 
-        bool copyresult = false;
+        *names = NULL;
 
-        if (startPath != NULL)
+        while ((dir = readdir(d)) != NULL)
         {
-                d = opendir(startPath);
-                if (d == NULL)
-                {
-                        fprintf(stderr, "Failed to open directory.\n");
-                        return 0;
-                }
-                int chdirResult = chdir(startPath);
+                if (dir->d_name[0] == '.')
+                        continue;
 
-                if (chdirResult != 0)
+                if (numNames >= capacity)
                 {
-                        fprintf(stderr, "Failed to change directory: %s\n", startPath);
-                        return 0;
+                        capacity = (capacity > 0) ? capacity * 2 : 64;
+                        WalkerName *grown = realloc(*names, capacity * sizeof(WalkerName));
+                        if (grown == NULL)
+                                break;
+                        *names = grown;
                 }
+
+                (*names)[numNames].name = strdup(dir->d_name);
+                (*names)[numNames].type = dir->d_type;
+
+                if ((*names)[numNames].name != NULL)
+                        numNames++;
         }
-        else
+
+        if (numNames > 1)
+                qsort(*names, numNames, sizeof(WalkerName), compareWalkerNames);
+
+        return numNames;
+}
+
+bool nameMatches(const char *name, const char *searching, bool exactSearch)
+{
+        if (exactSearch)
+                return strcasecmp(name, searching) == 0;
+
+        return c_strcasestr(name, searching) != NULL;
+}
+
+bool walkerShouldStop(WalkerSearch *search, int index)
+{
+        return __atomic_load_n(&search->bestIndex, __ATOMIC_RELAXED) < index;
+}
+
+void walkerFound(WalkerSearch *search, int index, const char *path)
+{
+        pthread_mutex_lock(&search->mutex);
+
+        if (index < search->bestIndex)
         {
-                d = opendir(".");
-                if (d == NULL)
-                {
-                        fprintf(stderr, "Failed to open current directory.\n");
-                        return 0;
-                }
+                c_strcpy(search->result, MAXPATHLEN, path);
+                __atomic_store_n(&search->bestIndex, index, __ATOMIC_RELAXED);
         }
 
-        while ((dir = readdir(d)))
+        pthread_mutex_unlock(&search->mutex);
+}
+
+bool isDirectoryAt(int dirFd, const char *name, unsigned char type)
+{
+        struct stat fileStats;
+
+        if (type == DT_DIR)
+                return true;
+        if (type == DT_REG)
+                return false;
+
+        // Unknown types and symlinks need a stat to find out what they are
+        if (fstatat(dirFd, name, &fileStats, 0) != 0)
+                return false;
+
+        return S_ISDIR(fileStats.st_mode);
+}
+
+// Checks one entry and descends into it if it is a directory that doesn't match.
+// Returns true if a match was found.
+bool walkEntry(WalkerSearch *search, int index, int dirFd, const char *dirPath, const char *name, bool isDir)
+{
+        char entryPath[MAXPATHLEN];
+        snprintf(entryPath, sizeof(entryPath), "%s/%s", dirPath, name);
+
+        if (isDir)
         {
-                if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0)
+                if (search->searchType != FileOnly && search->searchType != SearchPlayList &&
+                    nameMatches(name, search->searching, search->exactSearch))
                 {
-                        continue;
+                        walkerFound(search, index, entryPath);
+                        return true;
                 }
 
-                char entryPath[MAXPATHLEN];
-                char *currentDir = getcwd(NULL, 0);                
-                snprintf(entryPath, sizeof(entryPath), "%s/%s", currentDir, dir->d_name);
-                free(currentDir);
+                int fd = openat(dirFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (fd < 0)
+                        return false;
 
-                if (stat(entryPath, &file_stat) != 0)
+                DIR *d = fdopendir(fd);
+                if (d == NULL)
                 {
-                        continue;
+                        close(fd);
+                        return false;
                 }
 
-                if (S_ISDIR(file_stat.st_mode))
-                {
-                        if (((exactSearch && (strcasecmp(dir->d_name, searching) == 0)) || (!exactSearch && c_strcasestr(dir->d_name, searching) != NULL)) &&
-                            (searchType != FileOnly) && (searchType != SearchPlayList))
-                        {
-                                char *curDir = getcwd(NULL, 0);
-                                snprintf(result, MAXPATHLEN, "%s/%s", curDir, dir->d_name);
-                                free(curDir);
-                                copyresult = true;
-                                break;
-                        }
-                        else
-                        {
-                                if (chdir(dir->d_name) == -1)
-                                {
-                                        fprintf(stderr, "Failed to change directory: %s\n", dir->d_name);
-                                        continue;
-                                }
-                                if (walker(NULL, searching, result, allowedExtensions, searchType, exactSearch) == 0)
-                                {
-                                        copyresult = true;
-                                        break;
-                                }
-                                if (chdir("..") == -1)
-                                {
-                                        fprintf(stderr, "Failed to change directory to parent.\n");
-                                        break;
-                                }
-                        }
-                }
-                else
-                {
-                        if (searchType == DirOnly)
-                        {
-                                continue;
-                        }
+                WalkerName *names;
+                int numNames = readWalkerNames(d, &names);
+                bool found = false;
 
-                        char *filename = dir->d_name;
-                        if (strlen(filename) <= 4)
-                        {
-                                continue;
-                        }
+                for (int i = 0; i < numNames && !found && !walkerShouldStop(search, index); i++)
+                        found = walkEntry(search, index, fd, entryPath, names[i].name, isDirectoryAt(fd, names[i].name, names[i].type));
 
-                        extractExtension(filename, sizeof(ext) - 1, ext);
-                        if (match_regex(&regex, ext) != 0)
-                        {
-                                continue;
-                        }
+                freeWalkerNames(names, numNames);
+                closedir(d);
 
-                        if ((exactSearch && (strcasecmp(dir->d_name, searching) == 0)) || (!exactSearch && c_strcasestr(dir->d_name, searching) != NULL))
-                        {
-                                char *curDir = getcwd(NULL, 0);
-                                snprintf(result, MAXPATHLEN, "%s/%s", curDir, dir->d_name);
-                                copyresult = true;
-                                free(curDir);
-                                break;
-                        }
-                }
+                return found;
+        }
+
+        if (search->searchType == DirOnly || strlen(name) <= 4)
+                return false;
+
+        char ext[6]; // +1 for null-terminator
+        extractExtension(name, sizeof(ext) - 1, ext);
+        if (match_regex(&search->regex, ext) != 0)
+                return false;
+
+        if (!nameMatches(name, search->searching, search->exactSearch))
+                return false;
+
+        walkerFound(search, index, entryPath);
+        return true;
+}
+
+void *walkerThread(void *arg)
+{
+        WalkerSearch *search = (WalkerSearch *)arg;
+
+        while (true)
+        {
+                pthread_mutex_lock(&search->mutex);
+                int index = search->nextName++;
+                pthread_mutex_unlock(&search->mutex);
+
+                if (index >= search->numNames || walkerShouldStop(search, index))
+                        break;
+
+                WalkerName *entry = &search->names[index];
+                walkEntry(search, index, search->rootFd, search->rootPath, entry->name, isDirectoryAt(search->rootFd, entry->name, entry->type));
+        }
+
+        return NULL;
+}
+
+// Traverse a directory tree and search for a given file or directory.
+// The subtrees under the start path are searched in parallel, but the result
+// is the first match of a depth first walk in the library's order, the same
+// one findInDirectoryTree finds in the loaded library. Hidden entries are
+// skipped like the library skips them.
+int walker(const char *startPath, const char *searching, char *result,
+           const char *allowedExtensions, enum SearchType searchType, bool exactSearch)
+{
+        WalkerSearch search;
+        search.searching = searching;
+        search.searchType = searchType;
+        search.exactSearch = exactSearch;
+        search.rootPath = (startPath != NULL) ? startPath : ".";
+        search.names = NULL;
+        search.numNames = 0;
+        search.nextName = 0;
+        search.bestIndex = INT_MAX;
+        search.result = result;
+
+        if (regcomp(&search.regex, allowedExtensions, REG_EXTENDED) != 0)
+        {
+                return -1;
+        }
+
+        search.rootFd = open(search.rootPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR *d = (search.rootFd >= 0) ? fdopendir(dup(search.rootFd)) : NULL;
+
+        if (d == NULL)
+        {
+                fprintf(stderr, "Failed to open directory.\n");
+                if (search.rootFd >= 0)
+                        close(search.rootFd);
+                regfree(&search.regex);
+                return 1;
         }
+
+        search.numNames = readWalkerNames(d, &search.names);
+
         closedir(d);
-        regfree(&regex);
 
-        return copyresult ? 0 : 1;
+        pthread_mutex_init(&search.mutex, NULL);
+
+        long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+        int numThreads = (numCpus > 1) ? (int)numCpus : 1;
+
+        if (numThreads > MAX_WALKER_THREADS)
+                numThreads = MAX_WALKER_THREADS;
+        if (numThreads > search.numNames)
+                numThreads = search.numNames;
+
+        pthread_t threads[MAX_WALKER_THREADS];
+        int numStarted = 0;
+
+        for (int i = 1; i < numThreads; i++)
+        {
+                if (pthread_create(&threads[numStarted], NULL, walkerThread, &search) == 0)
+                        numStarted++;
+        }
+
+        // The calling thread takes part in the search too
+        walkerThread(&search);
+
+        for (int i = 0; i < numStarted; i++)
+                pthread_join(threads[i], NULL);
+
+        bool found = (search.bestIndex != INT_MAX);
+
+        freeWalkerNames(search.names, search.numNames);
+        pthread_mutex_destroy(&search.mutex);
+        close(search.rootFd);
+        regfree(&search.regex);
+
+        return found ? 0 : 1;
 }
 
 int expandPath(const char *inputPath, char *expandedPath)
@@ -3,7 +3,10 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <regex.h>
 #include <stdbool.h>
@@ -0,0 +1,248 @@
+#include "gain.h"
+/*
+
+gain.c
+
+ Software volume. The gain is applied to the frames the callbacks produce,
+ and every change is ramped per sample over GAIN_RAMP_MILLISECONDS so that
+ holding the volume key doesn't click. The volume is multiplied by the
+ loudness normalization gain of the current track, which may boost, so the
+ integer formats saturate. Outside of a ramp s16 is scaled in Q14 fixed
+ point with 32 bit products, s24 and s32 in Q15 with 64 bit products, and
+ f32 in float. During a ramp every format is scaled in floating point.
+ Ramps and the steady state are both one flat loop per format over the
+ whole block, which compilers vectorize.
+
+*/
+
+static _Atomic float targetGain = 1.0f;
+static _Atomic float loudnessGain = 1.0f;
+
+// Only touched from the audio thread
+static float currentGain = 1.0f;
+static float rampTarget = 1.0f;
+static float rampStep = 0.0f;
+
+void setTargetGain(float gain)
+{
+        if (gain < 0.0f)
+                gain = 0.0f;
+        else if (gain > 1.0f)
+                gain = 1.0f;
+
+        atomic_store_explicit(&targetGain, gain, memory_order_relaxed);
+}
+
+float getTargetGain()
+{
+        return atomic_load_explicit(&targetGain, memory_order_relaxed);
+}
+
+// Normalization for the current track, multiplied with the volume and ramped the same way
+void setLoudnessGain(float gain)
+{
+        if (gain < 0.0f)
+                gain = 0.0f;
+        else if (gain > GAIN_MAX_LOUDNESS)
+                gain = GAIN_MAX_LOUDNESS;
+
+        atomic_store_explicit(&loudnessGain, gain, memory_order_relaxed);
+}
+
+float getLoudnessGain()
+{
+        return atomic_load_explicit(&loudnessGain, memory_order_relaxed);
+}
+
+// Q14 and not Q15, so the product stays inside 32 bits for gains up to GAIN_MAX_LOUDNESS
+void scaleS16(ma_int16 *restrict samples, ma_uint64 count, float gain)
+{
+        int32_t q14 = (int32_t)(gain * 16384.0f);
+
+        for (ma_uint64 i = 0; i < count; i++)
+        {
+                int32_t value = ((int32_t)samples[i] * q14) >> 14;
+                value = (value > 32767) ? 32767 : value;
+                value = (value < -32768) ? -32768 : value;
+                samples[i] = (ma_int16)value;
+        }
+}
+
+void scaleS24(ma_uint8 *restrict samples, ma_uint64 count, float gain)
+{
+        int64_t q15 = (int64_t)(gain * 32768.0f);
+
+        for (ma_uint64 i = 0; i < count; i++)
+        {
+                ma_uint8 *s = samples + i * 3;
+                int32_t value = (int32_t)((uint32_t)s[0] << 8 | (uint32_t)s[1] << 16 | (uint32_t)s[2] << 24) >> 8;
+
+                value = (int32_t)((value * q15) >> 15);
+                value = (value > 8388607) ? 8388607 : value;
+                value = (value < -8388608) ? -8388608 : value;
+
+                s[0] = (ma_uint8)(value & 0xFF);
+                s[1] = (ma_uint8)((value >> 8) & 0xFF);
+                s[2] = (ma_uint8)((value >> 16) & 0xFF);
+        }
+}
+
+void scaleS32(ma_int32 *restrict samples, ma_uint64 count, float gain)
+{
+        int64_t q15 = (int64_t)(gain * 32768.0f);
+
+        for (ma_uint64 i = 0; i < count; i++)
+        {
+                int64_t value = ((int64_t)samples[i] * q15) >> 15;
+                value = (value > INT32_MAX) ? INT32_MAX : value;
+                value = (value < INT32_MIN) ? INT32_MIN : value;
+                samples[i] = (ma_int32)value;
+        }
+}
+
+void scaleF32(float *restrict samples, ma_uint64 count, float gain)
+{
+        for (ma_uint64 i = 0; i < count; i++)
+                samples[i] *= gain;
+}
+
+// Scales count samples starting at sample index first
+void scaleSamples(void *frames, ma_format format, ma_uint64 first, ma_uint64 count, float gain)
+{
+        switch (format)
+        {
+        case ma_format_s16:
+                scaleS16((ma_int16 *)frames + first, count, gain);
+                break;
+        case ma_format_s24:
+                scaleS24((ma_uint8 *)frames + first * 3, count, gain);
+                break;
+        case ma_format_s32:
+                scaleS32((ma_int32 *)frames + first, count, gain);
+                break;
+        case ma_format_f32:
+                scaleF32((float *)frames + first, count, gain);
+                break;
+        default:
+                break;
+        }
+}
+
+// Ramps move the gain by step every sample, so the channels of one frame differ by less than a step
+void rampS16(ma_int16 *restrict samples, int count, float gain, float step)
+{
+        for (int i = 0; i < count; i++)
+        {
+                float value = (float)samples[i] * (gain + step * (float)i);
+                value = (value > 32767.0f) ? 32767.0f : value;
+                value = (value < -32768.0f) ? -32768.0f : value;
+                samples[i] = (ma_int16)value;
+        }
+}
+
+void rampS24(ma_uint8 *restrict samples, int count, float gain, float step)
+{
+        for (int i = 0; i < count; i++)
+        {
+                ma_uint8 *s = samples + i * 3;
+                int32_t sample = (int32_t)((uint32_t)s[0] << 8 | (uint32_t)s[1] << 16 | (uint32_t)s[2] << 24) >> 8;
+
+                float value = (float)sample * (gain + step * (float)i);
+                value = (value > 8388607.0f) ? 8388607.0f : value;
+                value = (value < -8388608.0f) ? -8388608.0f : value;
+                sample = (int32_t)value;
+
+                s[0] = (ma_uint8)(sample & 0xFF);
+                s[1] = (ma_uint8)((sample >> 8) & 0xFF);
+                s[2] = (ma_uint8)((sample >> 16) & 0xFF);
+        }
+}
+
+// Double, a float can't hold every 32 bit sample
+void rampS32(ma_int32 *restrict samples, int count, float gain, float step)
+{
+        for (int i = 0; i < count; i++)
+        {
+                double value = (double)samples[i] * ((double)gain + (double)step * (double)i);
+                value = (value > (double)INT32_MAX) ? (double)INT32_MAX : value;
+                value = (value < (double)INT32_MIN) ? (double)INT32_MIN : value;
+                samples[i] = (ma_int32)value;
+        }
+}
+
+void rampF32(float *restrict samples, int count, float gain, float step)
+{
+        for (int i = 0; i < count; i++)
+                samples[i] *= gain + step * (float)i;
+}
+
+// In blocks, so the gain of each sample can be computed from a 32 bit index that vectorizes
+void rampSamples(void *frames, ma_format format, ma_uint64 count, float gain, float step)
+{
+        for (ma_uint64 first = 0; first < count; first += GAIN_RAMP_BLOCK)
+        {
+                int blockCount = (count - first < GAIN_RAMP_BLOCK) ? (int)(count - first) : GAIN_RAMP_BLOCK;
+                float blockGain = gain + step * (float)first;
+
+                switch (format)
+                {
+                case ma_format_s16:
+                        rampS16((ma_int16 *)frames + first, blockCount, blockGain, step);
+                        break;
+                case ma_format_s24:
+                        rampS24((ma_uint8 *)frames + first * 3, blockCount, blockGain, step);
+                        break;
+                case ma_format_s32:
+                        rampS32((ma_int32 *)frames + first, blockCount, blockGain, step);
+                        break;
+                case ma_format_f32:
+                        rampF32((float *)frames + first, blockCount, blockGain, step);
+                        break;
+                default:
+                        return;
+                }
+        }
+}
+
+void applyGain(void *frames, ma_uint64 frameCount, ma_format format, ma_uint32 channels, ma_uint32 sampleRate)
+{
+        if (frames == NULL || frameCount == 0 || channels == 0)
+                return;
+
+        float target = getTargetGain() * getLoudnessGain();
+
+        if (target != rampTarget)
+        {
+                ma_uint64 rampFrames = (ma_uint64)sampleRate * GAIN_RAMP_MILLISECONDS / 1000;
+
+                rampTarget = target;
+                rampStep = (target - currentGain) / (float)(rampFrames > 0 ? rampFrames : 1);
+        }
+
+        ma_uint64 frame = 0;
+
+        if (currentGain != rampTarget)
+        {
+                float framesLeft = (rampStep != 0.0f) ? ceilf((rampTarget - currentGain) / rampStep) : 0.0f;
+                float sampleStep = rampStep / (float)channels;
+                bool ends = (framesLeft <= (float)frameCount);
+
+                if (ends)
+                {
+                        // Land on the target exactly with the last sample of the ramp
+                        frame = (framesLeft > 0.0f) ? (ma_uint64)framesLeft : 0;
+                        sampleStep = (frame > 0) ? (rampTarget - currentGain) / (float)(frame * channels) : 0.0f;
+                }
+                else
+                {
+                        frame = frameCount;
+                }
+
+                rampSamples(frames, format, frame * channels, currentGain + sampleStep, sampleStep);
+
+                currentGain = ends ? rampTarget : currentGain + sampleStep * (float)(frame * channels);
+        }
+
+        if (frame < frameCount && currentGain != 1.0f)
+                scaleSamples(frames, format, frame * channels, (frameCount - frame) * channels, currentGain);
+}
@@ -0,0 +1,32 @@
+#ifndef GAIN_H
+#define GAIN_H
+
+#include <math.h>
+#include <miniaudio.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef GAIN_RAMP_MILLISECONDS
+#define GAIN_RAMP_MILLISECONDS 20 // Gain changes are spread over this long to avoid zipper noise
+#endif
+
+#ifndef GAIN_RAMP_BLOCK
+#define GAIN_RAMP_BLOCK 1024 // Samples scaled per loop during a ramp
+#endif
+
+#ifndef GAIN_MAX_LOUDNESS
+#define GAIN_MAX_LOUDNESS 4.0f // +12 dB, the integer paths saturate above full scale
+#endif
+
+void setTargetGain(float gain);
+
+float getTargetGain();
+
+void setLoudnessGain(float gain);
+
+float getLoudnessGain();
+
+void applyGain(void *frames, ma_uint64 frameCount, ma_format format, ma_uint32 channels, ma_uint32 sampleRate);
+
+#endif
@@ -0,0 +1,141 @@
+#include "gapless.h"
+/*
+
+gapless.c
+
+ Encoder delay and padding of mp3 and AAC files, so that decoders chained
+ for gapless playback start and stop on the first and last real sample.
+ mp3 files carry the values in the LAME extension of the Xing/Info header,
+ m4a files in the iTunSMPB atom. They are read along with the rest of the
+ metadata, so switching tracks doesn't touch the file again.
+
+*/
+
+ma_uint32 readBE32(const unsigned char *bytes)
+{
+        return (ma_uint32)bytes[0] << 24 | (ma_uint32)bytes[1] << 16 | (ma_uint32)bytes[2] << 8 | (ma_uint32)bytes[3];
+}
+
+bool readLameGapless(const char *filePath, GaplessInfo *gapless)
+{
+        unsigned char buffer[GAPLESS_SCAN_BYTES];
+        long offset = 0;
+
+        FILE *file = fopen(filePath, "rb");
+
+        if (file == NULL)
+                return false;
+
+        // Skip the ID3v2 tag, its size is stored as a syncsafe integer
+        size_t bytesRead = fread(buffer, 1, 10, file);
+
+        if (bytesRead == 10 && memcmp(buffer, "ID3", 3) == 0)
+        {
+                offset = 10 + ((long)(buffer[6] & 0x7F) << 21 | (long)(buffer[7] & 0x7F) << 14 |
+                               (long)(buffer[8] & 0x7F) << 7 | (long)(buffer[9] & 0x7F));
+
+                if (buffer[5] & 0x10)
+                        offset += 10; // Footer
+        }
+
+        if (fseek(file, offset, SEEK_SET) != 0)
+        {
+                fclose(file);
+                return false;
+        }
+
+        bytesRead = fread(buffer, 1, sizeof(buffer), file);
+        fclose(file);
+
+        size_t position = 0;
+
+        while (position + 4 <= bytesRead && !(buffer[position] == 0xFF && (buffer[position + 1] & 0xE0) == 0xE0))
+                position++;
+
+        if (position + 4 > bytesRead)
+                return false;
+
+        const unsigned char *header = buffer + position;
+        int version = (header[1] >> 3) & 0x03; // 3 is MPEG-1, 2 MPEG-2, 0 MPEG-2.5
+        int layer = (header[1] >> 1) & 0x03;   // 1 is Layer III
+        bool mono = (header[3] >> 6) == 3;
+
+        if (version == 1 || layer != 1)
+                return false;
+
+        // The Info tag follows the side information of the first frame
+        size_t sideInfoSize = (version == 3) ? (mono ? 17 : 32) : (mono ? 9 : 17);
+        size_t tag = position + 4 + sideInfoSize;
+        ma_uint64 frameSamples = (version == 3) ? 1152 : 576;
+
+        if (tag + 8 > bytesRead || (memcmp(buffer + tag, "Xing", 4) != 0 && memcmp(buffer + tag, "Info", 4) != 0))
+                return false;
+
+        ma_uint32 flags = readBE32(buffer + tag + 4);
+        size_t field = tag + 8;
+        ma_uint64 frames = 0;
+
+        if (flags & 0x01)
+        {
+                if (field + 4 > bytesRead)
+                        return false;
+
+                frames = readBE32(buffer + field);
+                field += 4;
+        }
+
+        if (flags & 0x02)
+                field += 4; // Byte count
+        if (flags & 0x04)
+                field += 100; // Seek table
+        if (flags & 0x08)
+                field += 4; // Quality
+
+        // The tag frame itself decodes to a frame of silence
+        gapless->startPadding = frameSamples;
+        gapless->validFrames = 0;
+
+        if (field + 24 > bytesRead ||
+            (memcmp(buffer + field, "LAME", 4) != 0 && memcmp(buffer + field, "Lavf", 4) != 0 && memcmp(buffer + field, "Lavc", 4) != 0))
+                return true;
+
+        // 12 bits of encoder delay and 12 bits of padding, 21 bytes into the LAME extension
+        const unsigned char *delayPadding = buffer + field + 21;
+        ma_uint64 delay = (ma_uint64)delayPadding[0] << 4 | delayPadding[1] >> 4;
+        ma_uint64 padding = (ma_uint64)(delayPadding[1] & 0x0F) << 8 | delayPadding[2];
+
+        gapless->startPadding += delay + GAPLESS_MP3_DECODER_DELAY;
+
+        if (frames * frameSamples > delay + padding)
+                gapless->validFrames = frames * frameSamples - delay - padding;
+
+        return true;
+}
+
+// iTunSMPB is " 00000000 <priming> <padding> <original sample count> ..." in hex
+bool parseITunSMPB(const char *value, GaplessInfo *gapless)
+{
+        unsigned int priming = 0;
+        unsigned int padding = 0;
+        unsigned long long samples = 0;
+
+        if (value == NULL || sscanf(value, " %*x %x %x %llx", &priming, &padding, &samples) != 3 || samples == 0)
+                return false;
+
+        // FFmpeg's mov demuxer already drops the priming samples, only the end is left to us
+        gapless->startPadding = 0;
+        gapless->validFrames = samples;
+
+        return true;
+}
+
+// Restricts a miniaudio decoder to the trimmed range, reads, seeks, cursor and length all follow it
+void applyGaplessRange(ma_data_source *dataSource, const GaplessInfo *gapless)
+{
+        if (dataSource == NULL || gapless == NULL || (gapless->startPadding == 0 && gapless->validFrames == 0))
+                return;
+
+        ma_uint64 end = (gapless->validFrames > 0) ? gapless->startPadding + gapless->validFrames : ~(ma_uint64)0;
+
+        ma_data_source_set_range_in_pcm_frames(dataSource, gapless->startPadding, end);
+}
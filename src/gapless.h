@@ -0,0 +1,35 @@
+#ifndef GAPLESS_H
+#define GAPLESS_H
+
+#include <miniaudio.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef GAPLESS_SCAN_BYTES
+#define GAPLESS_SCAN_BYTES 4096 // How far past the ID3v2 tag to look for the first mp3 frame
+#endif
+
+#ifndef GAPLESS_MP3_DECODER_DELAY
+#define GAPLESS_MP3_DECODER_DELAY 529 // Delay of the mp3 synthesis filterbank, in samples
+#endif
+
+#ifndef GAPLESSINFO_STRUCT
+#define GAPLESSINFO_STRUCT
+
+typedef struct
+{
+        ma_uint64 startPadding; // Decoded frames to drop at the start of the track
+        ma_uint64 validFrames;  // Frames left after trimming, 0 when unknown
+} GaplessInfo;
+
+#endif
+
+bool readLameGapless(const char *filePath, GaplessInfo *gapless);
+
+bool parseITunSMPB(const char *value, GaplessInfo *gapless);
+
+void applyGaplessRange(ma_data_source *dataSource, const GaplessInfo *gapless);
+
+#endif
@@ -48,12 +48,17 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE. */
 #include <time.h>
 #include <unistd.h>
 #include "cache.h"
+#include "control.h"
+#include "equalizer.h"
 #include "events.h"
 #include "file.h"
+#include "loudness.h"
 #include "mpris.h"
 #include "player.h"
 #include "playerops.h"
 #include "playlist.h"
+#include "prefetch.h"
+#include "rendernull.h"
 #include "search_ui.h"
 #include "settings.h"
 #include "sound.h"
@@ -68,6 +73,9 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE. */
 #define MAX_TMP_SEQ_LEN 256 // Maximum length of temporary sequence buffer
 #define COOLDOWN_MS 500
 #define COOLDOWN2_MS 100
+#define TICK_MS 50
+#define IDLE_TICK_MS 1000   // With the quiet power profile, while nothing on screen moves
+#define ACTIVITY_SECONDS 3  // Ticks stay fast this long after input, and before a song ends
 
 FILE *logFile = NULL;
 struct winsize windowSize;
@@ -76,11 +84,18 @@ char digitsPressed[MAX_SEQ_LEN];
 int digitsPressedCount = 0;
 int maxDigitsPressedCount = 9;
 static unsigned int updateCounter = 0;
+static guint tickSource = 0;
+static guint tickInterval = 0;
+static guint inputSource = 0;
+static bool stdinClosed = false;
+static struct timespec lastActivityTime;
+static bool terminalFocused = true;
 bool gPressed = false;
 bool loadingAudioData = false;
 bool goingToSong = false;
 bool startFromTop = false;
 bool exactSearch = false;
+bool daemonEnabled = false;
 AppSettings settings;
 int fuzzySearchThreshold = 2;
 
@@ -94,6 +109,11 @@ bool isCooldownElapsed(int milliSeconds)
         return elapsedMilliseconds >= milliSeconds;
 }
 
+void noteActivity()
+{
+        clock_gettime(CLOCK_MONOTONIC, &lastActivityTime);
+}
+
 struct Event processInput()
 {
         struct Event event;
@@ -155,6 +175,13 @@ struct Event processInput()
         if (keyReleased)
                 return event;
 
+        // Focus reports, asked for by the quiet power profile
+        if (strcmp(seq, "\033[I") == 0 || strcmp(seq, "\033[O") == 0)
+        {
+                terminalFocused = (seq[2] == 'I');
+                return event;
+        }
+
         eventProcessed = true;
         event.type = EVENT_NONE;
 
@@ -195,6 +222,8 @@ struct Event processInput()
                                       {settings.switchNumberedSong, EVENT_GOTOSONG},
                                       {settings.seekBackward, EVENT_SEEKBACK},
                                       {settings.seekForward, EVENT_SEEKFORWARD},
+                                      {settings.increaseSpeed, EVENT_INCREASESPEED},
+                                      {settings.decreaseSpeed, EVENT_DECREASESPEED},
                                       {settings.toggleRepeat, EVENT_TOGGLEREPEAT},
                                       {settings.savePlaylist, EVENT_EXPORTPLAYLIST},
                                       {settings.toggleColorsDerivedFrom, EVENT_TOGGLE_PROFILE_COLORS},
@@ -224,7 +253,8 @@ struct Event processInput()
                                       {settings.showSearchAlt, EVENT_SHOWSEARCH},
                                       {settings.hardNextPage, EVENT_NEXTPAGE},
                                       {settings.hardPrevPage, EVENT_PREVPAGE},
-                                      {settings.hardRemove, EVENT_REMOVE}};
+                                      {settings.hardRemove, EVENT_REMOVE},
+                                      {settings.hardToggleAudioStats, EVENT_TOGGLEAUDIOSTATS}};
 
         int numKeyMappings = sizeof(keyMappings) / sizeof(EventMapping);
 
@@ -409,8 +439,8 @@ void handleGoToSong()
 
                         if (lastSong == NULL)
                         {
-                                if (playlist.tail != NULL)
-                                        lastPlayedId = playlist.tail->id;
+                                if (getListTail(&playlist) != NULL)
+                                        lastPlayedId = getListTail(&playlist)->id;
                                 else
                                 {
                                         lastPlayedId = -1;
@@ -503,6 +533,9 @@ void handleInput()
 {
         struct Event event = processInput();
 
+        if (event.type != EVENT_NONE)
+                noteActivity();
+
         switch (event.type)
         {
         case EVENT_GOTOBEGINNINGOFPLAYLIST:
@@ -564,6 +597,14 @@ void handleInput()
         case EVENT_SEEKFORWARD:
                 seekForward();
                 break;
+        case EVENT_INCREASESPEED:
+                adjustPlaybackRate(STRETCH_RATE_STEP);
+                emitRateChanged();
+                break;
+        case EVENT_DECREASESPEED:
+                adjustPlaybackRate(-STRETCH_RATE_STEP);
+                emitRateChanged();
+                break;
         case EVENT_ADDTOMAINPLAYLIST:
                 addToSpecialPlaylist();
                 break;
@@ -571,7 +612,10 @@ void handleInput()
                 savePlaylist(settings.path);
                 break;
         case EVENT_UPDATELIBRARY:
-                updateLibrary(settings.path);
+                if (appState.currentView == LIBRARY_VIEW && isLibraryCacheOffered())
+                        acceptLibraryCache();
+                else
+                        updateLibrary(settings.path);
                 break;
         case EVENT_SHOWKEYBINDINGS:
                 toggleShowKeyBindings();
@@ -597,6 +641,9 @@ void handleInput()
         case EVENT_SHOWTRACK:
                 showTrack();
                 break;
+        case EVENT_TOGGLEAUDIOSTATS:
+                toggleAudioStatsOverlay();
+                break;
         default:
                 fastForwarding = false;
                 rewinding = false;
@@ -652,26 +699,26 @@ void loadAudioData()
 
                         if (waitingForPlaylist)
                         {
-                                currentSong = playlist.head;
+                                currentSong = getListHead(&playlist);
                         }
                         else if (waitingForNext)
                         {
                                 if (lastPlayedId >= 0)
                                 {
                                         currentSong = findSelectedEntryById(&playlist, lastPlayedId);
-                                        if (currentSong != NULL && currentSong->next != NULL)
-                                                currentSong = currentSong->next;
+                                        if (currentSong != NULL && getListNext(currentSong) != NULL)
+                                                currentSong = getListNext(currentSong);
                                 }
 
                                 if (currentSong == NULL)
                                 {
                                         if (startFromTop)
                                         {
-                                                currentSong = playlist.head;
+                                                currentSong = getListHead(&playlist);
                                                 startFromTop = false;
                                         }
                                         else
-                                                currentSong = playlist.tail;
+                                                currentSong = getListTail(&playlist);
                                 }
                         }
                         audioData.restart = false;
@@ -716,9 +763,9 @@ void tryLoadNext()
         clearingErrors = true;
 
         if (tryNextSong == NULL && currentSong != NULL)
-                tryNextSong = currentSong->next;
+                tryNextSong = getListNext(currentSong);
         else if (tryNextSong != NULL)
-                tryNextSong = tryNextSong->next;
+                tryNextSong = getListNext(tryNextSong);
 
         if (tryNextSong != NULL)
         {
@@ -754,6 +801,8 @@ bool determineCurrentSongData(SongData **currentSongData)
 
 void prepareNextSong()
 {
+        TRACE_SCOPE("prepareNextSong");
+
         if (!skipOutOfOrder && !isRepeatEnabled())
         {
                 setCurrentSongToNext();
@@ -805,18 +854,102 @@ void handleSkipFromStopped()
         }
 }
 
+// With a quiet power profile the loop ticks once a second while nothing on screen moves and nothing needs doing soon
+bool canTickSlowly()
+{
+        if (!throttlesIdleTicks())
+                return false;
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        if (now.tv_sec - lastActivityTime.tv_sec < ACTIVITY_SECONDS)
+                return false;
+
+        if (songLoading || !loadedNextSong || nextSongNeedsRebuilding || waitingForNext || waitingForPlaylist || skipping ||
+            songHasErrors || clearingErrors || fastForwarding || rewinding || appState.currentView == SEARCH_VIEW ||
+            isPlaylistProducerRunning() || hasPendingControlJobs() || isLibraryLoading())
+                return false;
+
+        bool playing = (currentSong != NULL && !isPaused() && !isStopped());
+
+        // The next song is switched to from here
+        if (playing && duration - elapsedSeconds < getCrossfadeSeconds() + ACTIVITY_SECONDS)
+                return false;
+
+        bool animating = (playing && visualizerEnabled && appState.currentView == SONG_VIEW);
+
+        return !animating || !terminalFocused || daemonEnabled;
+}
+
+gboolean mainloop_callback(gpointer data);
+
+void wakeMainLoop(void);
+
+gboolean wakeOnInput(gint fd, GIOCondition condition, gpointer data)
+{
+        (void)fd;
+        (void)data;
+
+        inputSource = 0;
+
+        // A closed terminal would fire again on every iteration and keep the loop from ever ticking slowly
+        if (condition & (G_IO_HUP | G_IO_ERR | G_IO_NVAL))
+        {
+                stdinClosed = true;
+                return G_SOURCE_REMOVE;
+        }
+
+        wakeMainLoop();
+
+        return G_SOURCE_REMOVE;
+}
+
+// Only a terminal the UI reads keys from is worth watching, anything else on stdin is always readable
+bool canWakeOnInput()
+{
+        return uiEnabled && !daemonEnabled && !stdinClosed && isatty(STDIN_FILENO);
+}
+
+void setTickInterval(guint interval)
+{
+        if (tickSource != 0)
+                g_source_remove(tickSource);
+
+        tickInterval = interval;
+        tickSource = g_timeout_add(interval, mainloop_callback, NULL);
+
+        // Keys and focus changes don't wait for the next slow tick
+        if (interval == IDLE_TICK_MS && inputSource == 0 && canWakeOnInput())
+                inputSource = g_unix_fd_add(STDIN_FILENO, G_IO_IN | G_IO_HUP | G_IO_ERR, wakeOnInput, NULL);
+}
+
+// Goes back to ticking at full rate for a while, called on input and commands
+void wakeMainLoop()
+{
+        noteActivity();
+
+        if (tickInterval != TICK_MS)
+                setTickInterval(TICK_MS);
+}
+
 gboolean mainloop_callback(gpointer data)
 {
         (void)data;
 
         calcElapsedTime();
 
-        handleInput();
+        if (!daemonEnabled)
+                handleInput();
 
         updateCounter++;
 
+        // Show how far the library scan has come now and then
+        if (isLibraryLoading() && appState.currentView == LIBRARY_VIEW && updateCounter % 10 == 0)
+                refresh = true;
+
         // Update every other time or if searching (search needs to update often to detect keypresses)
-        if (updateCounter % 2 == 0 || appState.currentView == SEARCH_VIEW)
+        if (updateCounter % 2 == 0 || appState.currentView == SEARCH_VIEW || tickInterval == IDLE_TICK_MS)
         {
                 // Process GDBus events in the global_main_context
                 while (g_main_context_pending(global_main_context))
@@ -824,7 +957,14 @@ gboolean mainloop_callback(gpointer data)
                         g_main_context_iteration(global_main_context, FALSE);
                 }
 
-                updatePlayer();
+                drainProducedSongs();
+
+                runControlJobs();
+
+                if (daemonEnabled)
+                        refreshPlayer();
+                else
+                        updatePlayer();
 
                 if (playlist.head != NULL)
                 {
@@ -845,6 +985,10 @@ gboolean mainloop_callback(gpointer data)
                                 if (!doQuit)
                                         switchAudioImplementation();
                         }
+
+                        // With repeat on, prepareNextSong plays the current song again and that one is already cached
+                        if (!isRepeatEnabled())
+                                prefetchUpcomingSongs(currentSong, elapsedSeconds);
                 }
 
                 if (doQuit)
@@ -853,6 +997,16 @@ gboolean mainloop_callback(gpointer data)
                         return FALSE;
                 }
         }
+
+        guint interval = canTickSlowly() ? IDLE_TICK_MS : TICK_MS;
+
+        if (interval != tickInterval)
+        {
+                tickSource = 0;
+                setTickInterval(interval);
+                return FALSE;
+        }
+
         return TRUE;
 }
 
@@ -864,6 +1018,27 @@ static gboolean quitOnSignal(gpointer user_data)
         return G_SOURCE_REMOVE; // Remove the signal source
 }
 
+static gboolean dumpAudioStatsOnSignal(gpointer user_data)
+{
+        (void)user_data;
+
+        char *filepath = getAudioStatsFilePath();
+        FILE *file = fopen(filepath, "a");
+
+        if (file != NULL)
+        {
+                dumpAudioStats(file);
+                fclose(file);
+        }
+
+        free(filepath);
+
+        // The first signal turns collection on, later ones report what was gathered since
+        setAudioStatsEnabled(true);
+
+        return G_SOURCE_CONTINUE;
+}
+
 void play(Node *song)
 {
         updateLastInputTime();
@@ -906,19 +1081,32 @@ void play(Node *song)
 
         g_unix_signal_add(SIGINT, quitOnSignal, main_loop);
         g_unix_signal_add(SIGHUP, quitOnSignal, main_loop);
+        g_unix_signal_add(SIGUSR1, dumpAudioStatsOnSignal, NULL);
+
+        startControlServer(wakeMainLoop);
 
         if (song != NULL)
                 emitStartPlayingMpris();
         else
                 emitPlaybackStoppedMpris();
 
-        g_timeout_add(50, mainloop_callback, NULL);
+        noteActivity();
+        setTickInterval(TICK_MS);
         g_main_loop_run(main_loop);
         g_main_loop_unref(main_loop);
 }
 
 void cleanupOnExit()
 {
+        // A library scan still running uses the tree, the path index and switchMutex freed below
+        bool libraryWasLoading = isLibraryLoading();
+        cancelDirectoryScans();
+        waitForLibrary();
+
+        stopControlServer();
+        stopPlaylistProducer();
+        stopLoudness();
+        stopPrefetch();
         pthread_mutex_lock(&dataSourceMutex);
         resetDecoders();
         resetVorbisDecoders();
@@ -927,9 +1115,10 @@ void cleanupOnExit()
         cleanupPlaybackDevice();
         cleanupAudioContext();
         emitPlaybackStoppedMpris();
-        resetConsole();
+        if (!daemonEnabled)
+                resetConsole();
 
-        if (library == NULL || library->children == NULL)
+        if (!libraryWasLoading && (library == NULL || library->children == NULL))
         {
                 printf("No Music found.\n");
                 printf("Please make sure the path is set correctly. \n");
@@ -949,21 +1138,44 @@ void cleanupOnExit()
 
         freeSearchResults();
         cleanupMpris();
-        restoreTerminalMode();
-        enableInputBuffering();
-        setConfig(&settings);
+        if (!daemonEnabled)
+        {
+                if (throttlesIdleTicks())
+                        disableFocusReporting();
+                restoreTerminalMode();
+                enableInputBuffering();
+        }
+        if (renderNullEnabled)
+        {
+                printRenderNullReport(stdout);
+                freeRenderNull();
+        }
+        else
+        {
+                setConfig(&settings);
+        }
         saveSpecialPlaylist(settings.path);
         freeAudioBuffer();
+#ifdef DEBUG
+        printCacheStats(tempCache, stderr);
+        dumpAudioStats(stderr);
+#endif
+#ifdef TRACE
+        writeTrace(getenv("KEW_TRACE_FILE") != NULL ? getenv("KEW_TRACE_FILE") : TRACE_FILE);
+        freeTrace();
+#endif
         deleteCache(tempCache);
         deleteTempDir();
         freeMainDirectoryTree();
         deletePlaylist(&playlist);
-        deletePlaylist(originalPlaylist);
         deletePlaylist(specialPlaylist);
         free(specialPlaylist);
-        free(originalPlaylist);
-        setDefaultTextColor();
-        showCursor();
+        freePathIndex();
+        if (!daemonEnabled)
+        {
+                setDefaultTextColor();
+                showCursor();
+        }
         pthread_mutex_destroy(&(loadingdata.mutex));
         pthread_mutex_destroy(&(playlist.mutex));
         pthread_mutex_destroy(&(switchMutex));
@@ -981,13 +1193,6 @@ void cleanupOnExit()
 
 void run()
 {
-        if (originalPlaylist == NULL)
-        {
-
-                originalPlaylist = malloc(sizeof(PlayList));
-                *originalPlaylist = deepCopyPlayList(&playlist);
-        }
-
         if (playlist.head == NULL)
         {
                 appState.currentView = LIBRARY_VIEW;
@@ -995,7 +1200,7 @@ void run()
 
         initMpris();
 
-        currentSong = playlist.head;
+        currentSong = getListHead(&playlist);
         play(currentSong);
         clearScreen();
         fflush(stdout);
@@ -1003,13 +1208,26 @@ void run()
 
 void init()
 {
-        disableInputBuffering();
         srand(time(NULL));
-        initResize();
-        ioctl(STDOUT_FILENO, TIOCGWINSZ, &windowSize);
-        enableScrolling();
-        setNonblockingMode();
-        tempCache = createCache();
+        if (daemonEnabled)
+        {
+                // Nothing is drawn, so covers, colors and the visualizer's samples aren't needed
+                setAudioBufferEnabled(false);
+                setCoverDecodingEnabled(false);
+        }
+        else
+        {
+                disableInputBuffering();
+                initResize();
+                ioctl(STDOUT_FILENO, TIOCGWINSZ, &windowSize);
+                enableScrolling();
+                setNonblockingMode();
+                if (throttlesIdleTicks())
+                        enableFocusReporting();
+                initAudioBuffer();
+                initVisuals();
+        }
+        tempCache = createCache(CACHE_MAX_BYTES);
         c_strcpy(loadingdata.filePath, sizeof(loadingdata.filePath), "");
         loadingdata.songdataA = NULL;
         loadingdata.songdataB = NULL;
@@ -1018,8 +1236,14 @@ void init()
         audioData.restart = true;
         userData.songdataADeleted = true;
         userData.songdataBDeleted = true;
-        initAudioBuffer();
-        initVisuals();
+        initSystemVolume();
+        addDspStage(processEqualizer, isEqualizerActive, NULL);
+        if (!renderNullEnabled)
+        {
+                char *loudnessPath = getLoudnessFilePath();
+                initLoudness(loudnessPath);
+                free(loudnessPath);
+        }
         pthread_mutex_init(&dataSourceMutex, NULL);
         pthread_mutex_init(&switchMutex, NULL);
         pthread_mutex_init(&(loadingdata.mutex), NULL);
@@ -1039,6 +1263,7 @@ void init()
         {
                 fprintf(stdout, "Failed to redirect stderr to error.log\n");
         }
+        setAudioStatsEnabled(true);
 #else
         FILE *nullStream = freopen("/dev/null", "w", stderr);
         (void)nullStream;
@@ -1069,26 +1294,42 @@ void playSpecialPlaylist()
         run();
 }
 
+// Playback doesn't wait for the library, the music directory is walked instead while it is still being read
 void playAll()
 {
         init();
-        createPlayListFromFileSystemEntry(library, &playlist, MAX_FILES);
-        if (playlist.count == 0)
+
+        FileSystemEntry *tree = getPublishedLibrary();
+
+        if (tree != NULL)
+                startPlaylistProducer(playAllFromLibrary, tree, true);
+        else
+                startPlaylistProducer(playAllFromDisk, settings.path, true);
+
+        if (!waitForProducedSongs())
         {
                 exit(0);
         }
-        shufflePlaylist(&playlist);
+        drainProducedSongs();
         run();
 }
 
 void playAllAlbums()
 {
         init();
-        addShuffledAlbumsToPlayList(library, &playlist, MAX_FILES);
-        if (playlist.count == 0)
+
+        FileSystemEntry *tree = getPublishedLibrary();
+
+        if (tree != NULL)
+                startPlaylistProducer(playAlbumsFromLibrary, tree, false);
+        else
+                startPlaylistProducer(playAlbumsFromDisk, settings.path, false);
+
+        if (!waitForProducedSongs())
         {
                 exit(0);
         }
+        drainProducedSongs();
         run();
 }
 
@@ -1118,9 +1359,42 @@ void handleOptions(int *argc, char *argv[])
         const char *quitOnStop2 = "-q";
         const char *exactOption = "--exact";
         const char *exactOption2 = "-e";
+        const char *renderNullOption = "--render-null";
+        const char *daemonOption = "--daemon";
 
         int idx = -1;
         for (int i = 0; i < *argc; i++)
+        {
+                if (c_strcasestr(argv[i], renderNullOption))
+                {
+                        // Decode the playlist as fast as possible without a sound card, then report
+                        renderNullEnabled = true;
+                        uiEnabled = false;
+                        quitAfterStopping = true;
+                        allowNotifications = false;
+                        setVolume(100);
+                        idx = i;
+                }
+        }
+        if (idx >= 0)
+                removeArgElement(argv, idx, argc);
+
+        idx = -1;
+        for (int i = 0; i < *argc; i++)
+        {
+                if (c_strcasestr(argv[i], daemonOption))
+                {
+                        // Plays in the background, controlled through MPRIS and the control socket
+                        daemonEnabled = true;
+                        uiEnabled = false;
+                        idx = i;
+                }
+        }
+        if (idx >= 0)
+                removeArgElement(argv, idx, argc);
+
+        idx = -1;
+        for (int i = 0; i < *argc; i++)
         {
                 if (c_strcasestr(argv[i], noUiOption))
                 {
@@ -1178,6 +1452,21 @@ int isProcessRunning(pid_t pid)
         return (stat(proc_path, &statbuf) == 0);
 }
 
+void writePidFile()
+{
+        char pidfile_path[256];
+        snprintf(pidfile_path, sizeof(pidfile_path), PIDFILE_TEMPLATE, getuid());
+
+        FILE *pidfile = fopen(pidfile_path, "w");
+        if (pidfile == NULL)
+        {
+                perror("Unable to create PID file");
+                exit(EXIT_FAILURE);
+        }
+        fprintf(pidfile, "%d\n", getpid());
+        fclose(pidfile);
+}
+
 // Ensures only a single instance of kew can run at a time for the current user.
 void exitIfAlreadyRunning()
 {
@@ -1210,19 +1499,46 @@ void exitIfAlreadyRunning()
                 }
         }
 
-        // Create a new PID file
-        pidfile = fopen(pidfile_path, "w");
-        if (pidfile == NULL)
+        writePidFile();
+}
+
+// Leaves the terminal and goes on in the background, before any threads are started
+void daemonize()
+{
+        pid_t pid = fork();
+
+        if (pid < 0)
         {
-                perror("Unable to create PID file");
+                perror("Unable to start in the background");
                 exit(EXIT_FAILURE);
         }
-        fprintf(pidfile, "%d\n", getpid());
-        fclose(pidfile);
+
+        // The parent must not run the exit handlers, they would clean up for the child
+        if (pid > 0)
+                _exit(0);
+
+        setsid();
+
+        int fd = open("/dev/null", O_RDWR);
+
+        if (fd >= 0)
+        {
+                dup2(fd, STDIN_FILENO);
+                dup2(fd, STDOUT_FILENO);
+                dup2(fd, STDERR_FILENO);
+
+                if (fd > STDERR_FILENO)
+                        close(fd);
+        }
+
+        writePidFile();
 }
 
 int main(int argc, char *argv[])
 {
+        if (forwardToRunningInstance(argc, argv))
+                exit(0);
+
         exitIfAlreadyRunning();
 
         if ((argc == 2 && ((strcmp(argv[1], "--help") == 0) || (strcmp(argv[1], "-h") == 0) || (strcmp(argv[1], "-?") == 0))))
@@ -1255,6 +1571,10 @@ int main(int argc, char *argv[])
         atexit(cleanupOnExit);
 
         handleOptions(&argc, argv);
+
+        if (daemonEnabled)
+                daemonize();
+
         loadSpecialPlaylist(settings.path);
 
         if (argc == 1)
@@ -1276,7 +1596,9 @@ int main(int argc, char *argv[])
         else if (argc >= 2)
         {
                 init();
-                makePlaylist(argc, argv, exactSearch, settings.path);
+                // Until the library has been published the search walks the music directory instead
+                makePlaylist(argc, argv, exactSearch, settings.path, getPublishedLibrary());
+                drainProducedSongs();
                 if (playlist.count == 0)
                         exit(0);
                 run();
@@ -0,0 +1,209 @@
+#include "libraryrows.h"
+/*
+
+libraryrows.c
+
+ The rows the library view can show, flattened into an array of entries
+ and their depths in display order. Every directory has a row, and so do
+ the songs directly under the library root and the songs of the one
+ directory that is expanded. The array is built once per library and then
+ only the subtree of a directory is rebuilt when it is expanded or
+ collapsed, so drawing a screenful costs the same however big the library
+ is. Each entry remembers its row, so finding the row of a directory is a
+ lookup and not a scan.
+
+ Only used from the UI thread. A library update from another thread marks
+ the rows invalid and they are rebuilt on the next draw.
+
+*/
+
+#define MIN_LIBRARY_ROWS 256
+
+static LibraryRow *rows = NULL;
+static int rowCount = 0;
+static int rowCapacity = 0;
+
+static LibraryRow *scratchRows = NULL;
+static int scratchCount = 0;
+static int scratchCapacity = 0;
+
+static FileSystemEntry *rowsRoot = NULL;
+static FileSystemEntry *rowsExpandedDir = NULL;
+static _Atomic bool rowsValid = false;
+
+// Tells the entries in rows[first..end) where they now are
+void numberRows(int first, int end)
+{
+        for (int i = first; i < end; i++)
+                rows[i].entry->row = i;
+}
+
+bool reserveRows(LibraryRow **array, int *capacity, int needed)
+{
+        if (needed <= *capacity)
+                return true;
+
+        int newCapacity = (*capacity > 0) ? *capacity : MIN_LIBRARY_ROWS;
+
+        while (newCapacity < needed)
+                newCapacity *= 2;
+
+        LibraryRow *newArray = realloc(*array, newCapacity * sizeof(LibraryRow));
+
+        if (newArray == NULL)
+                return false;
+
+        *array = newArray;
+        *capacity = newCapacity;
+
+        return true;
+}
+
+// Appends the visible rows under parent to the scratch array, parent's children being at depth
+void appendChildRows(FileSystemEntry *parent, int depth)
+{
+        for (FileSystemEntry *child = parent->children; child != NULL; child = child->next)
+        {
+                if (!child->isDirectory && depth > 1 && parent != rowsExpandedDir)
+                        continue;
+
+                if (!reserveRows(&scratchRows, &scratchCapacity, scratchCount + 1))
+                        return;
+
+                scratchRows[scratchCount].entry = child;
+                scratchRows[scratchCount].depth = depth;
+                scratchCount++;
+
+                if (child->isDirectory)
+                        appendChildRows(child, depth + 1);
+        }
+}
+
+void rebuildAllRows()
+{
+        rowCount = 0;
+        scratchCount = 0;
+
+        if (rowsRoot == NULL)
+                return;
+
+        appendChildRows(rowsRoot, 1);
+
+        if (!reserveRows(&rows, &rowCapacity, scratchCount))
+                return;
+
+        memcpy(rows, scratchRows, scratchCount * sizeof(LibraryRow));
+        rowCount = scratchCount;
+        numberRows(0, rowCount);
+}
+
+// Replaces the rows below dir's own row with a fresh walk of its subtree
+void rebuildDirRows(FileSystemEntry *dir)
+{
+        if (dir == NULL)
+                return;
+
+        if (dir == rowsRoot || dir->parent == NULL)
+        {
+                rebuildAllRows();
+                return;
+        }
+
+        int index = findLibraryRow(dir);
+
+        if (index < 0)
+                return;
+
+        int depth = rows[index].depth;
+        int first = index + 1;
+        int end = first;
+
+        while (end < rowCount && rows[end].depth > depth)
+                end++;
+
+        scratchCount = 0;
+        appendChildRows(dir, depth + 1);
+
+        int newCount = rowCount - (end - first) + scratchCount;
+
+        if (!reserveRows(&rows, &rowCapacity, newCount))
+                return;
+
+        memmove(rows + first + scratchCount, rows + end, (rowCount - end) * sizeof(LibraryRow));
+        memcpy(rows + first, scratchRows, scratchCount * sizeof(LibraryRow));
+        rowCount = newCount;
+        numberRows(first, rowCount);
+}
+
+// Safe to call from any thread, the rows are rebuilt by the next syncLibraryRows
+void invalidateLibraryRows()
+{
+        atomic_store(&rowsValid, false);
+}
+
+void syncLibraryRows(FileSystemEntry *root, FileSystemEntry *expandedDir)
+{
+        if (!atomic_load(&rowsValid) || root != rowsRoot)
+        {
+                atomic_store(&rowsValid, true);
+                rowsRoot = root;
+                rowsExpandedDir = expandedDir;
+                rebuildAllRows();
+                return;
+        }
+
+        setExpandedLibraryDir(expandedDir);
+}
+
+void setExpandedLibraryDir(FileSystemEntry *dir)
+{
+        if (dir == rowsExpandedDir)
+                return;
+
+        FileSystemEntry *previous = rowsExpandedDir;
+
+        rowsExpandedDir = dir;
+
+        rebuildDirRows(previous);
+        rebuildDirRows(dir);
+}
+
+int getLibraryRowCount()
+{
+        return rowCount;
+}
+
+const LibraryRow *getLibraryRow(int index)
+{
+        if (index < 0 || index >= rowCount)
+                return NULL;
+
+        return &rows[index];
+}
+
+int findLibraryRow(const FileSystemEntry *entry)
+{
+        if (entry == NULL)
+                return -1;
+
+        // Entries that lost their row, or were never shown, keep a stale index
+        int index = entry->row;
+
+        if (index < 0 || index >= rowCount || rows[index].entry != entry)
+                return -1;
+
+        return index;
+}
+
+void freeLibraryRows()
+{
+        free(rows);
+        free(scratchRows);
+
+        rows = scratchRows = NULL;
+        rowCount = rowCapacity = 0;
+        scratchCount = scratchCapacity = 0;
+        rowsRoot = rowsExpandedDir = NULL;
+
+        atomic_store(&rowsValid, false);
+}
@@ -0,0 +1,35 @@
+#ifndef LIBRARYROWS_H
+#define LIBRARYROWS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "directorytree.h"
+
+#ifndef LIBRARY_ROW_STRUCT
+#define LIBRARY_ROW_STRUCT
+
+typedef struct
+{
+        FileSystemEntry *entry;
+        int depth; // 1 for the entries directly under the library root
+} LibraryRow;
+
+#endif
+
+void invalidateLibraryRows(void);
+
+void syncLibraryRows(FileSystemEntry *root, FileSystemEntry *expandedDir);
+
+void setExpandedLibraryDir(FileSystemEntry *dir);
+
+int getLibraryRowCount(void);
+
+const LibraryRow *getLibraryRow(int index);
+
+int findLibraryRow(const FileSystemEntry *entry);
+
+void freeLibraryRows(void);
+
+#endif
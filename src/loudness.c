@@ -0,0 +1,997 @@
+#include <dirent.h>
+#include <regex.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include "loudness.h"
+/*
+
+loudness.c
+
+ Loudness normalization. A worker thread running at idle priority decodes
+ whole album directories with the regular decoders and measures integrated
+ loudness (EBU R128, K-weighted and gated) and true peak for every track and
+ for the album as a whole. Results are appended to a cache file in the config
+ directory keyed by path, size and modification time, so each file is only
+ ever analyzed once. ReplayGain tags in the files take precedence over it.
+
+*/
+
+#define LOUDNESS_BUCKETS 4096
+#define LOUDNESS_CHUNK_FRAMES 4096
+#define LOUDNESS_ABSOLUTE_GATE -70.0
+#define LOUDNESS_RELATIVE_GATE -10.0
+
+#if defined(__linux__) && !defined(SCHED_IDLE)
+#define SCHED_IDLE 5 // Only declared by sched.h under _GNU_SOURCE
+#endif
+
+typedef struct LoudnessEntry
+{
+        char *path;
+        long long size;
+        long long mtime;
+        float trackGain;
+        float trackPeak;
+        float albumGain;
+        float albumPeak;
+        bool hasAlbum;
+        struct LoudnessEntry *next;
+} LoudnessEntry;
+
+typedef struct LoudnessJob
+{
+        char *directory;
+        struct LoudnessJob *next;
+} LoudnessJob;
+
+typedef enum
+{
+        LOUDNESS_READER_BUILTIN,
+        LOUDNESS_READER_OPUS,
+        LOUDNESS_READER_VORBIS,
+        LOUDNESS_READER_M4A
+} LoudnessReaderType;
+
+typedef struct
+{
+        LoudnessReaderType type;
+        union
+        {
+                ma_decoder decoder;
+                ma_libopus opus;
+                ma_libvorbis vorbis;
+                m4a_decoder m4a;
+        };
+} LoudnessReader;
+
+static _Atomic LoudnessMode loudnessMode = LOUDNESS_OFF;
+static _Atomic bool loudnessStopping = false;
+static _Atomic bool loudnessRunning = false;
+
+static LoudnessEntry *loudnessTable[LOUDNESS_BUCKETS];
+static size_t loudnessEntries = 0;
+static size_t loudnessLines = 0;
+static char *loudnessCachePath = NULL;
+static pthread_mutex_t loudnessMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static LoudnessJob *jobHead = NULL;
+static LoudnessJob *jobTail = NULL;
+static char *currentJob = NULL;
+static pthread_cond_t jobCond = PTHREAD_COND_INITIALIZER;
+static pthread_t loudnessThread;
+
+static float truePeakTaps[LOUDNESS_OVERSAMPLING][LOUDNESS_TAPS_PER_PHASE];
+static pthread_once_t truePeakOnce = PTHREAD_ONCE_INIT;
+
+void initBiquad(Biquad *biquad, double b0, double b1, double b2, double a0, double a1, double a2)
+{
+        memset(biquad, 0, sizeof(Biquad));
+        biquad->b0 = b0 / a0;
+        biquad->b1 = b1 / a0;
+        biquad->b2 = b2 / a0;
+        biquad->a1 = a1 / a0;
+        biquad->a2 = a2 / a0;
+}
+
+static inline double runBiquad(Biquad *biquad, int channel, double x)
+{
+        double y = biquad->b0 * x + biquad->z1[channel];
+
+        biquad->z1[channel] = biquad->b1 * x - biquad->a1 * y + biquad->z2[channel];
+        biquad->z2[channel] = biquad->b2 * x - biquad->a2 * y;
+
+        return y;
+}
+
+// Lowpass interpolation filter, split into one set of taps per output phase
+void initTruePeakTaps()
+{
+        const int taps = LOUDNESS_OVERSAMPLING * LOUDNESS_TAPS_PER_PHASE;
+        const double center = (taps - 1) / 2.0;
+
+        for (int phase = 0; phase < LOUDNESS_OVERSAMPLING; phase++)
+        {
+                double sum = 0.0;
+
+                for (int k = 0; k < LOUDNESS_TAPS_PER_PHASE; k++)
+                {
+                        int n = phase + k * LOUDNESS_OVERSAMPLING;
+                        double x = (n - center) / LOUDNESS_OVERSAMPLING;
+                        double sinc = (x == 0.0) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+                        double window = 0.5 - 0.5 * cos(2.0 * M_PI * (n + 0.5) / taps);
+
+                        truePeakTaps[phase][k] = (float)(sinc * window);
+                        sum += truePeakTaps[phase][k];
+                }
+
+                for (int k = 0; k < LOUDNESS_TAPS_PER_PHASE; k++)
+                        truePeakTaps[phase][k] /= (float)sum;
+        }
+}
+
+void initLoudnessMeter(LoudnessMeter *meter, ma_uint32 channels, ma_uint32 sampleRate)
+{
+        memset(meter, 0, sizeof(LoudnessMeter));
+        pthread_once(&truePeakOnce, initTruePeakTaps);
+
+        meter->channels = (channels < LOUDNESS_MAX_CHANNELS) ? channels : LOUDNESS_MAX_CHANNELS;
+        meter->sampleRate = sampleRate;
+        meter->stepFrames = (sampleRate >= 10) ? sampleRate / 10 : 1;
+
+        // Surround channels count a little more, LFE not at all (BS.1770 for 5.1)
+        for (ma_uint32 c = 0; c < meter->channels; c++)
+                meter->channelWeights[c] = 1.0;
+
+        if (meter->channels == 6)
+        {
+                meter->channelWeights[3] = 0.0;
+                meter->channelWeights[4] = 1.41;
+                meter->channelWeights[5] = 1.41;
+        }
+
+        // K-weighting: a high shelf for the head followed by a high-pass, designed for any sample rate
+        double f0 = 1681.974450955533;
+        double gain = 3.999843853973347;
+        double q = 0.7071752369554196;
+        double k = tan(M_PI * f0 / sampleRate);
+        double vh = pow(10.0, gain / 20.0);
+        double vb = pow(vh, 0.4996667741545416);
+
+        initBiquad(&meter->shelf, vh + vb * k / q + k * k, 2.0 * (k * k - vh), vh - vb * k / q + k * k,
+                   1.0 + k / q + k * k, 2.0 * (k * k - 1.0), 1.0 - k / q + k * k);
+
+        f0 = 38.13547087602444;
+        q = 0.5003270373238773;
+        k = tan(M_PI * f0 / sampleRate);
+
+        initBiquad(&meter->highpass, 1.0, -2.0, 1.0,
+                   1.0 + k / q + k * k, 2.0 * (k * k - 1.0), 1.0 - k / q + k * k);
+}
+
+bool addLoudnessBlock(LoudnessMeter *meter, double energy)
+{
+        if (meter->blockCount == meter->blockCapacity)
+        {
+                size_t newCapacity = (meter->blockCapacity > 0) ? meter->blockCapacity * 2 : 1024;
+                double *newBlocks = realloc(meter->blocks, newCapacity * sizeof(double));
+
+                if (newBlocks == NULL)
+                        return false;
+
+                meter->blocks = newBlocks;
+                meter->blockCapacity = newCapacity;
+        }
+
+        meter->blocks[meter->blockCount++] = energy;
+
+        return true;
+}
+
+static inline void measureTruePeak(LoudnessMeter *meter, int channel, float sample)
+{
+        float *history = meter->history[channel];
+
+        memmove(history + 1, history, (LOUDNESS_TAPS_PER_PHASE - 1) * sizeof(float));
+        history[0] = sample;
+
+        for (int phase = 0; phase < LOUDNESS_OVERSAMPLING; phase++)
+        {
+                float value = 0.0f;
+
+                for (int k = 0; k < LOUDNESS_TAPS_PER_PHASE; k++)
+                        value += truePeakTaps[phase][k] * history[k];
+
+                value = fabsf(value);
+
+                if (value > meter->peak)
+                        meter->peak = value;
+        }
+}
+
+void addLoudnessFrames(LoudnessMeter *meter, const float *frames, ma_uint64 frameCount)
+{
+        ma_uint32 stride = meter->channels;
+
+        for (ma_uint64 f = 0; f < frameCount; f++)
+        {
+                const float *frame = frames + f * stride;
+                double weighted = 0.0;
+
+                for (ma_uint32 c = 0; c < meter->channels; c++)
+                {
+                        double y = runBiquad(&meter->shelf, c, frame[c]);
+                        y = runBiquad(&meter->highpass, c, y);
+
+                        weighted += meter->channelWeights[c] * y * y;
+
+                        if (fabsf(frame[c]) > meter->peak)
+                                meter->peak = fabsf(frame[c]);
+
+                        measureTruePeak(meter, c, frame[c]);
+                }
+
+                meter->stepSum += weighted;
+
+                if (++meter->stepPosition < meter->stepFrames)
+                        continue;
+
+                // 400 ms blocks overlapping by 75%, so one new block every 100 ms
+                meter->stepEnergy[meter->stepsSeen % 4] = meter->stepSum;
+                meter->stepsSeen++;
+                meter->stepSum = 0.0;
+                meter->stepPosition = 0;
+
+                if (meter->stepsSeen >= 4)
+                {
+                        double energy = meter->stepEnergy[0] + meter->stepEnergy[1] + meter->stepEnergy[2] + meter->stepEnergy[3];
+                        addLoudnessBlock(meter, energy / (4.0 * meter->stepFrames));
+                }
+        }
+}
+
+// Gated integrated loudness in LUFS, NAN when nothing is above the absolute gate
+double getIntegratedLoudness(const double *blocks, size_t blockCount)
+{
+        double absoluteGate = pow(10.0, (LOUDNESS_ABSOLUTE_GATE + 0.691) / 10.0);
+        double sum = 0.0;
+        size_t count = 0;
+
+        for (size_t i = 0; i < blockCount; i++)
+        {
+                if (blocks[i] > absoluteGate)
+                {
+                        sum += blocks[i];
+                        count++;
+                }
+        }
+
+        if (count == 0)
+                return NAN;
+
+        double relativeGate = (sum / count) * pow(10.0, LOUDNESS_RELATIVE_GATE / 10.0);
+        double gate = (relativeGate > absoluteGate) ? relativeGate : absoluteGate;
+
+        sum = 0.0;
+        count = 0;
+
+        for (size_t i = 0; i < blockCount; i++)
+        {
+                if (blocks[i] > gate)
+                {
+                        sum += blocks[i];
+                        count++;
+                }
+        }
+
+        if (count == 0)
+                return NAN;
+
+        return -0.691 + 10.0 * log10(sum / count);
+}
+
+void freeLoudnessMeter(LoudnessMeter *meter)
+{
+        free(meter->blocks);
+        meter->blocks = NULL;
+        meter->blockCount = 0;
+        meter->blockCapacity = 0;
+}
+
+LoudnessMode parseLoudnessMode(const char *value)
+{
+        // Off unless asked for, it changes playback levels and analyzes files in the background
+        if (value == NULL)
+                return LOUDNESS_OFF;
+        else if (strcasecmp(value, "album") == 0)
+                return LOUDNESS_ALBUM;
+        else if (strcasecmp(value, "track") == 0)
+                return LOUDNESS_TRACK;
+
+        return LOUDNESS_OFF;
+}
+
+void setLoudnessMode(LoudnessMode mode)
+{
+        atomic_store(&loudnessMode, mode);
+}
+
+LoudnessEntry *findLoudnessEntry(const char *path)
+{
+        LoudnessEntry *entry = loudnessTable[hashPath(path) % LOUDNESS_BUCKETS];
+
+        while (entry != NULL && strcmp(entry->path, path) != 0)
+                entry = entry->next;
+
+        return entry;
+}
+
+void putLoudnessEntry(const LoudnessEntry *values)
+{
+        LoudnessEntry *entry = findLoudnessEntry(values->path);
+
+        loudnessLines++;
+
+        if (entry == NULL)
+        {
+                entry = malloc(sizeof(LoudnessEntry));
+
+                if (entry == NULL)
+                        return;
+
+                entry->path = strdup(values->path);
+
+                if (entry->path == NULL)
+                {
+                        free(entry);
+                        return;
+                }
+
+                unsigned int bucket = hashPath(values->path) % LOUDNESS_BUCKETS;
+                entry->next = loudnessTable[bucket];
+                loudnessTable[bucket] = entry;
+                loudnessEntries++;
+        }
+
+        entry->size = values->size;
+        entry->mtime = values->mtime;
+        entry->trackGain = values->trackGain;
+        entry->trackPeak = values->trackPeak;
+        entry->albumGain = values->albumGain;
+        entry->albumPeak = values->albumPeak;
+        entry->hasAlbum = values->hasAlbum;
+}
+
+void writeLoudnessEntry(FILE *file, const LoudnessEntry *entry)
+{
+        fprintf(file, "%lld\t%lld\t%.2f\t%.6f\t%.2f\t%.6f\t%d\t%s\n", entry->size, entry->mtime,
+                entry->trackGain, entry->trackPeak, entry->albumGain, entry->albumPeak, entry->hasAlbum ? 1 : 0, entry->path);
+}
+
+// Later lines override earlier ones, the file is compacted on exit
+void loadLoudnessCache(const char *path)
+{
+        FILE *file = fopen(path, "r");
+
+        if (file == NULL)
+                return;
+
+        char line[MAXPATHLEN + 128];
+
+        while (fgets(line, sizeof(line), file) != NULL)
+        {
+                LoudnessEntry entry;
+                int hasAlbum = 0;
+                int offset = 0;
+
+                if (sscanf(line, "%lld\t%lld\t%f\t%f\t%f\t%f\t%d\t%n", &entry.size, &entry.mtime, &entry.trackGain,
+                           &entry.trackPeak, &entry.albumGain, &entry.albumPeak, &hasAlbum, &offset) < 7 ||
+                    offset == 0)
+                        continue;
+
+                line[strcspn(line, "\n")] = '\0';
+                entry.path = line + offset;
+                entry.hasAlbum = hasAlbum != 0;
+
+                if (entry.path[0] != '\0')
+                        putLoudnessEntry(&entry);
+        }
+
+        fclose(file);
+}
+
+void saveLoudnessCache(const char *path)
+{
+        FILE *file = fopen(path, "w");
+
+        if (file == NULL)
+                return;
+
+        for (int i = 0; i < LOUDNESS_BUCKETS; i++)
+        {
+                for (LoudnessEntry *entry = loudnessTable[i]; entry != NULL; entry = entry->next)
+                        writeLoudnessEntry(file, entry);
+        }
+
+        fclose(file);
+
+        loudnessLines = loudnessEntries;
+}
+
+void freeLoudnessCache()
+{
+        for (int i = 0; i < LOUDNESS_BUCKETS; i++)
+        {
+                LoudnessEntry *entry = loudnessTable[i];
+
+                while (entry != NULL)
+                {
+                        LoudnessEntry *next = entry->next;
+                        free(entry->path);
+                        free(entry);
+                        entry = next;
+                }
+
+                loudnessTable[i] = NULL;
+        }
+
+        loudnessEntries = 0;
+        loudnessLines = 0;
+}
+
+bool isLoudnessEntryFresh(const LoudnessEntry *entry, const struct stat *fileStats)
+{
+        return entry != NULL && entry->size == (long long)fileStats->st_size && entry->mtime == (long long)fileStats->st_mtime;
+}
+
+void queueLoudnessAnalysis(const char *path)
+{
+        char directory[MAXPATHLEN];
+
+        getDirectoryFromPath(path, directory);
+
+        pthread_mutex_lock(&loudnessMutex);
+
+        bool queued = (currentJob != NULL && strcmp(currentJob, directory) == 0);
+
+        for (LoudnessJob *job = jobHead; job != NULL && !queued; job = job->next)
+                queued = strcmp(job->directory, directory) == 0;
+
+        LoudnessJob *job = queued ? NULL : malloc(sizeof(LoudnessJob));
+
+        if (job != NULL)
+        {
+                job->directory = strdup(directory);
+                job->next = NULL;
+
+                if (job->directory == NULL)
+                {
+                        free(job);
+                }
+                else
+                {
+                        if (jobTail != NULL)
+                                jobTail->next = job;
+                        else
+                                jobHead = job;
+
+                        jobTail = job;
+                        pthread_cond_signal(&jobCond);
+                }
+        }
+
+        pthread_mutex_unlock(&loudnessMutex);
+}
+
+float getLoudnessFactor(double gain, double peak)
+{
+        float factor = (float)pow(10.0, gain / 20.0);
+
+        // Never boost a track into clipping
+        if (peak > 0.0 && factor * peak > 1.0)
+                factor = (float)(1.0 / peak);
+
+        return factor;
+}
+
+// Linear gain for a track that is about to play, 1.0 until it has been analyzed
+float getSongLoudnessGain(const char *path, const TagSettings *tags)
+{
+        LoudnessMode mode = atomic_load(&loudnessMode);
+
+        if (mode == LOUDNESS_OFF || path == NULL || path[0] == '\0')
+                return 1.0f;
+
+        if (tags != NULL && mode == LOUDNESS_ALBUM && tags->hasAlbumGain)
+                return getLoudnessFactor(tags->albumGain, tags->albumPeak);
+
+        if (tags != NULL && tags->hasTrackGain)
+                return getLoudnessFactor(tags->trackGain, tags->trackPeak);
+
+        if (!loudnessRunning)
+                return 1.0f;
+
+        struct stat fileStats;
+
+        if (stat(path, &fileStats) != 0)
+                return 1.0f;
+
+        float factor = 1.0f;
+        bool found = false;
+
+        pthread_mutex_lock(&loudnessMutex);
+
+        LoudnessEntry *entry = findLoudnessEntry(path);
+
+        if (isLoudnessEntryFresh(entry, &fileStats))
+        {
+                found = true;
+
+                if (mode == LOUDNESS_ALBUM && entry->hasAlbum)
+                        factor = getLoudnessFactor(entry->albumGain, entry->albumPeak);
+                else
+                        factor = getLoudnessFactor(entry->trackGain, entry->trackPeak);
+        }
+
+        pthread_mutex_unlock(&loudnessMutex);
+
+        if (!found)
+                queueLoudnessAnalysis(path);
+
+        return factor;
+}
+
+bool openLoudnessReader(LoudnessReader *reader, const char *path, ma_uint32 *channels, ma_uint32 *sampleRate)
+{
+        ma_decoding_backend_config config = ma_decoding_backend_config_init(ma_format_f32, 0);
+        ma_format format = ma_format_unknown;
+
+        if (endsWith(path, "opus"))
+        {
+                reader->type = LOUDNESS_READER_OPUS;
+
+                if (ma_libopus_init_file(path, &config, NULL, &reader->opus) != MA_SUCCESS)
+                        return false;
+
+                ma_libopus_get_data_format(&reader->opus, &format, channels, sampleRate, NULL, 0);
+        }
+        else if (endsWith(path, "ogg"))
+        {
+                reader->type = LOUDNESS_READER_VORBIS;
+
+                if (ma_libvorbis_init_file(path, &config, NULL, &reader->vorbis) != MA_SUCCESS)
+                        return false;
+
+                ma_libvorbis_get_data_format(&reader->vorbis, &format, channels, sampleRate, NULL, 0);
+        }
+        else if (endsWith(path, "m4a") || endsWith(path, "aac") || endsWith(path, "mp4"))
+        {
+                reader->type = LOUDNESS_READER_M4A;
+
+                if (m4a_decoder_init_file(path, &config, NULL, &reader->m4a) != MA_SUCCESS)
+                        return false;
+
+                m4a_decoder_get_data_format(&reader->m4a, &format, channels, sampleRate, NULL, 0);
+        }
+        else
+        {
+                ma_decoder_config decoderConfig = ma_decoder_config_init(ma_format_f32, 0, 0);
+
+                reader->type = LOUDNESS_READER_BUILTIN;
+
+                if (ma_decoder_init_file(path, &decoderConfig, &reader->decoder) != MA_SUCCESS)
+                        return false;
+
+                format = reader->decoder.outputFormat;
+                *channels = reader->decoder.outputChannels;
+                *sampleRate = reader->decoder.outputSampleRate;
+        }
+
+        return format == ma_format_f32;
+}
+
+ma_uint64 readLoudnessReader(LoudnessReader *reader, float *buffer, ma_uint64 frameCount)
+{
+        ma_uint64 framesRead = 0;
+        ma_result result = MA_ERROR;
+
+        switch (reader->type)
+        {
+        case LOUDNESS_READER_OPUS:
+                result = ma_libopus_read_pcm_frames(&reader->opus, buffer, frameCount, &framesRead);
+                break;
+        case LOUDNESS_READER_VORBIS:
+                result = ma_libvorbis_read_pcm_frames(&reader->vorbis, buffer, frameCount, &framesRead);
+                break;
+        case LOUDNESS_READER_M4A:
+                result = m4a_decoder_read_pcm_frames(&reader->m4a, buffer, frameCount, &framesRead);
+                break;
+        case LOUDNESS_READER_BUILTIN:
+                result = ma_decoder_read_pcm_frames(&reader->decoder, buffer, frameCount, &framesRead);
+                break;
+        }
+
+        return (result == MA_SUCCESS) ? framesRead : 0;
+}
+
+void closeLoudnessReader(LoudnessReader *reader)
+{
+        switch (reader->type)
+        {
+        case LOUDNESS_READER_OPUS:
+                ma_libopus_uninit(&reader->opus, NULL);
+                break;
+        case LOUDNESS_READER_VORBIS:
+                ma_libvorbis_uninit(&reader->vorbis, NULL);
+                break;
+        case LOUDNESS_READER_M4A:
+                m4a_decoder_uninit(&reader->m4a, NULL);
+                break;
+        case LOUDNESS_READER_BUILTIN:
+                ma_decoder_uninit(&reader->decoder);
+                break;
+        }
+}
+
+// Decodes the whole file into the meter, false if it can't be read or we are shutting down
+bool analyzeLoudnessFile(const char *path, LoudnessMeter *meter)
+{
+        LoudnessReader *reader = malloc(sizeof(LoudnessReader));
+        float *buffer = malloc(LOUDNESS_CHUNK_FRAMES * LOUDNESS_MAX_CHANNELS * sizeof(float));
+        ma_uint32 channels = 0;
+        ma_uint32 sampleRate = 0;
+        bool opened = false;
+        bool result = false;
+
+        if (reader == NULL || buffer == NULL)
+                goto end;
+
+        opened = openLoudnessReader(reader, path, &channels, &sampleRate);
+
+        if (!opened || channels == 0 || channels > LOUDNESS_MAX_CHANNELS || sampleRate == 0)
+                goto end;
+
+        initLoudnessMeter(meter, channels, sampleRate);
+
+        ma_uint64 framesRead;
+
+        while ((framesRead = readLoudnessReader(reader, buffer, LOUDNESS_CHUNK_FRAMES)) > 0)
+        {
+                if (atomic_load(&loudnessStopping))
+                {
+                        freeLoudnessMeter(meter);
+                        goto end;
+                }
+
+                addLoudnessFrames(meter, buffer, framesRead);
+        }
+
+        result = true;
+
+end:
+        if (opened)
+                closeLoudnessReader(reader);
+
+        free(reader);
+        free(buffer);
+
+        return result;
+}
+
+int collectLoudnessFiles(const char *directory, char ***files)
+{
+        DIR *dir = opendir(directory);
+
+        if (dir == NULL)
+                return 0;
+
+        regex_t regex;
+        regcomp(&regex, AUDIO_EXTENSIONS, REG_EXTENDED);
+
+        struct dirent *entry;
+        int count = 0;
+        int capacity = 0;
+
+        while ((entry = readdir(dir)) != NULL)
+        {
+                if (entry->d_name[0] == '.')
+                        continue;
+
+                char exto[6];
+                extractExtension(entry->d_name, sizeof(exto) - 1, exto);
+
+                if (match_regex(&regex, exto) != 0)
+                        continue;
+
+                if (count == capacity)
+                {
+                        int newCapacity = (capacity > 0) ? capacity * 2 : 32;
+                        char **newFiles = realloc(*files, newCapacity * sizeof(char *));
+
+                        if (newFiles == NULL)
+                                break;
+
+                        *files = newFiles;
+                        capacity = newCapacity;
+                }
+
+                char filePath[MAXPATHLEN];
+                snprintf(filePath, sizeof(filePath), "%s/%s", directory, entry->d_name);
+
+                (*files)[count] = strdup(filePath);
+
+                if ((*files)[count] != NULL)
+                        count++;
+        }
+
+        regfree(&regex);
+        closedir(dir);
+
+        return count;
+}
+
+void storeLoudnessResults(LoudnessEntry *results, int count)
+{
+        pthread_mutex_lock(&loudnessMutex);
+
+        FILE *file = (loudnessCachePath != NULL) ? fopen(loudnessCachePath, "a") : NULL;
+
+        for (int i = 0; i < count; i++)
+        {
+                if (results[i].path == NULL)
+                        continue;
+
+                putLoudnessEntry(&results[i]);
+
+                if (file != NULL)
+                        writeLoudnessEntry(file, &results[i]);
+        }
+
+        if (file != NULL)
+                fclose(file);
+
+        pthread_mutex_unlock(&loudnessMutex);
+}
+
+// Analyzes every file in the directory that isn't already cached. Small
+// directories are treated as albums, which needs all of their tracks decoded
+// again whenever one of them changes.
+void analyzeLoudnessDirectory(const char *directory)
+{
+        char **files = NULL;
+        int count = collectLoudnessFiles(directory, &files);
+        bool asAlbum = count <= LOUDNESS_MAX_ALBUM_TRACKS;
+        LoudnessEntry *results = calloc(count > 0 ? count : 1, sizeof(LoudnessEntry));
+        bool stale = false;
+
+        if (results == NULL)
+                goto end;
+
+        pthread_mutex_lock(&loudnessMutex);
+
+        for (int i = 0; i < count; i++)
+        {
+                struct stat fileStats;
+
+                if (stat(files[i], &fileStats) != 0)
+                        continue;
+
+                LoudnessEntry *entry = findLoudnessEntry(files[i]);
+
+                if (isLoudnessEntryFresh(entry, &fileStats) && (!asAlbum || entry->hasAlbum))
+                        continue;
+
+                results[i].path = files[i];
+                results[i].size = (long long)fileStats.st_size;
+                results[i].mtime = (long long)fileStats.st_mtime;
+                stale = true;
+        }
+
+        pthread_mutex_unlock(&loudnessMutex);
+
+        if (!stale)
+                goto end;
+
+        double *albumBlocks = NULL;
+        size_t albumCount = 0;
+        double albumPeak = 0.0;
+
+        for (int i = 0; i < count; i++)
+        {
+                if (!asAlbum && results[i].path == NULL)
+                        continue;
+
+                if (results[i].path == NULL)
+                {
+                        // Already measured, but the album value needs its blocks too
+                        struct stat fileStats;
+
+                        if (stat(files[i], &fileStats) != 0)
+                                continue;
+
+                        results[i].path = files[i];
+                        results[i].size = (long long)fileStats.st_size;
+                        results[i].mtime = (long long)fileStats.st_mtime;
+                }
+
+                LoudnessMeter meter;
+
+                if (!analyzeLoudnessFile(files[i], &meter))
+                {
+                        results[i].path = NULL;
+
+                        if (atomic_load(&loudnessStopping))
+                        {
+                                free(albumBlocks);
+                                goto end;
+                        }
+
+                        continue;
+                }
+
+                double loudness = getIntegratedLoudness(meter.blocks, meter.blockCount);
+
+                results[i].trackGain = isnan(loudness) ? 0.0f : (float)(LOUDNESS_REFERENCE_LUFS - loudness);
+                results[i].trackPeak = (float)meter.peak;
+                albumPeak = (meter.peak > albumPeak) ? meter.peak : albumPeak;
+
+                if (asAlbum && meter.blockCount > 0)
+                {
+                        double *newBlocks = realloc(albumBlocks, (albumCount + meter.blockCount) * sizeof(double));
+
+                        if (newBlocks != NULL)
+                        {
+                                memcpy(newBlocks + albumCount, meter.blocks, meter.blockCount * sizeof(double));
+                                albumBlocks = newBlocks;
+                                albumCount += meter.blockCount;
+                        }
+                }
+
+                freeLoudnessMeter(&meter);
+        }
+
+        if (asAlbum)
+        {
+                // Album loudness gates the blocks of all tracks together, not an average of the tracks
+                double loudness = getIntegratedLoudness(albumBlocks, albumCount);
+
+                for (int i = 0; i < count; i++)
+                {
+                        results[i].albumGain = isnan(loudness) ? 0.0f : (float)(LOUDNESS_REFERENCE_LUFS - loudness);
+                        results[i].albumPeak = (float)albumPeak;
+                        results[i].hasAlbum = true;
+                }
+        }
+
+        free(albumBlocks);
+
+        storeLoudnessResults(results, count);
+
+end:
+        for (int i = 0; i < count; i++)
+                free(files[i]);
+
+        free(files);
+        free(results);
+}
+
+// Only runs when nothing else wants the CPU, so playback never waits on it
+void lowerLoudnessPriority()
+{
+#ifdef SCHED_IDLE
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+#ifdef __linux__
+        setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+#endif
+#ifdef __APPLE__
+        pthread_set_qos_class_self_np(QOS_CLASS_BACKGROUND, 0);
+#endif
+}
+
+void *loudnessWorker(void *arg)
+{
+        (void)arg;
+
+        lowerLoudnessPriority();
+
+        while (true)
+        {
+                pthread_mutex_lock(&loudnessMutex);
+
+                while (jobHead == NULL && !atomic_load(&loudnessStopping))
+                        pthread_cond_wait(&jobCond, &loudnessMutex);
+
+                if (atomic_load(&loudnessStopping))
+                {
+                        pthread_mutex_unlock(&loudnessMutex);
+                        break;
+                }
+
+                LoudnessJob *job = jobHead;
+                jobHead = job->next;
+
+                if (jobHead == NULL)
+                        jobTail = NULL;
+
+                currentJob = job->directory;
+
+                pthread_mutex_unlock(&loudnessMutex);
+
+                analyzeLoudnessDirectory(job->directory);
+
+                pthread_mutex_lock(&loudnessMutex);
+                currentJob = NULL;
+                pthread_mutex_unlock(&loudnessMutex);
+
+                free(job->directory);
+                free(job);
+        }
+
+        return NULL;
+}
+
+void initLoudness(const char *cachePath)
+{
+        if (loudnessRunning || atomic_load(&loudnessMode) == LOUDNESS_OFF)
+                return;
+
+        pthread_mutex_lock(&loudnessMutex);
+
+        loudnessCachePath = (cachePath != NULL) ? strdup(cachePath) : NULL;
+
+        if (loudnessCachePath != NULL)
+                loadLoudnessCache(loudnessCachePath);
+
+        pthread_mutex_unlock(&loudnessMutex);
+
+        atomic_store(&loudnessStopping, false);
+
+        if (pthread_create(&loudnessThread, NULL, loudnessWorker, NULL) != 0)
+        {
+                perror("Failed to start loudness analysis");
+                return;
+        }
+
+        loudnessRunning = true;
+}
+
+void stopLoudness()
+{
+        if (!loudnessRunning)
+                return;
+
+        pthread_mutex_lock(&loudnessMutex);
+        atomic_store(&loudnessStopping, true);
+        pthread_cond_signal(&jobCond);
+        pthread_mutex_unlock(&loudnessMutex);
+
+        pthread_join(loudnessThread, NULL);
+        loudnessRunning = false;
+
+        pthread_mutex_lock(&loudnessMutex);
+
+        while (jobHead != NULL)
+        {
+                LoudnessJob *next = jobHead->next;
+                free(jobHead->directory);
+                free(jobHead);
+                jobHead = next;
+        }
+
+        jobTail = NULL;
+
+        if (loudnessCachePath != NULL && loudnessLines > loudnessEntries)
+                saveLoudnessCache(loudnessCachePath);
+
+        freeLoudnessCache();
+        free(loudnessCachePath);
+        loudnessCachePath = NULL;
+
+        pthread_mutex_unlock(&loudnessMutex);
+}
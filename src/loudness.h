@@ -0,0 +1,96 @@
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "soundcommon.h"
+
+#ifndef LOUDNESS_REFERENCE_LUFS
+#define LOUDNESS_REFERENCE_LUFS -18.0 // ReplayGain 2.0 reference level
+#endif
+
+#ifndef LOUDNESS_MAX_CHANNELS
+#define LOUDNESS_MAX_CHANNELS 8
+#endif
+
+#ifndef LOUDNESS_OVERSAMPLING
+#define LOUDNESS_OVERSAMPLING 4 // True peak is measured at four times the sample rate
+#endif
+
+#ifndef LOUDNESS_TAPS_PER_PHASE
+#define LOUDNESS_TAPS_PER_PHASE 12
+#endif
+
+#ifndef LOUDNESS_MAX_ALBUM_TRACKS
+#define LOUDNESS_MAX_ALBUM_TRACKS 100 // Bigger directories are not treated as albums
+#endif
+
+typedef enum
+{
+        LOUDNESS_OFF,
+        LOUDNESS_TRACK,
+        LOUDNESS_ALBUM
+} LoudnessMode;
+
+#ifndef BIQUAD_STRUCT
+#define BIQUAD_STRUCT
+
+typedef struct
+{
+        double b0, b1, b2, a1, a2;
+        double z1[LOUDNESS_MAX_CHANNELS];
+        double z2[LOUDNESS_MAX_CHANNELS];
+} Biquad;
+
+#endif
+
+#ifndef LOUDNESSMETER_STRUCT
+#define LOUDNESSMETER_STRUCT
+
+// EBU R128 / ITU-R BS.1770 meter for one track
+typedef struct
+{
+        ma_uint32 channels;
+        ma_uint32 sampleRate;
+        double channelWeights[LOUDNESS_MAX_CHANNELS];
+        Biquad shelf;
+        Biquad highpass;
+        double stepEnergy[4]; // The last four 100 ms steps make one 400 ms block
+        int stepsSeen;
+        double stepSum;
+        ma_uint32 stepFrames;
+        ma_uint32 stepPosition;
+        double *blocks; // Mean square energy of every 400 ms block
+        size_t blockCount;
+        size_t blockCapacity;
+        float history[LOUDNESS_MAX_CHANNELS][LOUDNESS_TAPS_PER_PHASE];
+        double peak;
+} LoudnessMeter;
+
+#endif
+
+void initLoudnessMeter(LoudnessMeter *meter, ma_uint32 channels, ma_uint32 sampleRate);
+
+void addLoudnessFrames(LoudnessMeter *meter, const float *frames, ma_uint64 frameCount);
+
+double getIntegratedLoudness(const double *blocks, size_t blockCount);
+
+void freeLoudnessMeter(LoudnessMeter *meter);
+
+LoudnessMode parseLoudnessMode(const char *value);
+
+void setLoudnessMode(LoudnessMode mode);
+
+float getSongLoudnessGain(const char *path, const TagSettings *tags);
+
+void initLoudness(const char *cachePath);
+
+void stopLoudness();
+
+#endif
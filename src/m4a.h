@@ -25,6 +25,11 @@ extern "C"
 #include <miniaudio.h>
 #include <stdint.h>
 #include <string.h>
+#include "mappedio.h"
+
+#ifndef M4A_LEFTOVER_SIZE
+#define M4A_LEFTOVER_SIZE (4800 * 2 * 4) // MAX_SAMPLES * MAX_CHANNELS * MAX_SAMPLE_SIZE
+#endif
 
         typedef struct
         {
@@ -35,6 +40,7 @@ extern "C"
                 void *pReadSeekTellUserData;
                 ma_format format;
                 FILE *mf;
+                bool mappedInput; // format_context reads through mappedio.c
                 // FFmpeg related fields...
                 AVCodecContext *codec_context;
                 SwrContext *swr_ctx;
@@ -42,6 +48,9 @@ extern "C"
                 ma_uint64 cursor;
                 ma_uint32 sampleSize;
                 int bitDepth;
+                ma_uint64 validFrames; // Length without the iTunSMPB end padding, 0 when unknown
+                uint8_t leftoverBuffer[M4A_LEFTOVER_SIZE]; // Decoded samples that didn't fit in the last read
+                ma_uint64 leftoverSampleCount;
         } m4a_decoder;
 
         MA_API ma_result m4a_decoder_init(ma_read_proc onRead, ma_seek_proc onSeek, ma_tell_proc onTell, void *pReadSeekTellUserData, const ma_decoding_backend_config *pConfig, const ma_allocation_callbacks *pAllocationCallbacks, m4a_decoder *pM4a);
@@ -62,9 +71,6 @@ extern "C"
 #define MAX_CHANNELS 2
 #define MAX_SAMPLES 4800 // Maximum expected frame size
 #define MAX_SAMPLE_SIZE 4
-static uint8_t leftoverBuffer[MAX_SAMPLES * MAX_CHANNELS * MAX_SAMPLE_SIZE];
-
-static ma_uint64 leftoverSampleCount = 0;
 
 extern ma_result m4a_decoder_ds_get_data_format(ma_data_source *pDataSource, ma_format *pFormat, ma_uint32 *pChannels, ma_uint32 *pSampleRate, ma_channel *pChannelMap, size_t channelMapCap);
 
@@ -310,14 +316,14 @@ MA_API ma_result m4a_decoder_init_file(const char *pFilePath, const ma_decoding_
 
         // Initialize libavformat and libavcodec
         AVFormatContext *format_context = NULL;
-        if (avformat_open_input(&format_context, pFilePath, NULL, NULL) != 0)
+        if (openMappedInput(&format_context, pFilePath, true) != 0)
         {
                 return MA_INVALID_FILE;
         }
 
         if (avformat_find_stream_info(format_context, NULL) < 0)
         {
-                avformat_close_input(&format_context);
+                closeMappedInput(&format_context);
                 return MA_ERROR;
         }
 
@@ -334,7 +340,7 @@ MA_API ma_result m4a_decoder_init_file(const char *pFilePath, const ma_decoding_
 
         if (stream_index < 0)
         {
-                avformat_close_input(&format_context);
+                closeMappedInput(&format_context);
                 return MA_ERROR;
         }
 
@@ -343,21 +349,21 @@ MA_API ma_result m4a_decoder_init_file(const char *pFilePath, const ma_decoding_
         AVCodecContext *codec_context = avcodec_alloc_context3(decoder);
         if (!codec_context)
         {
-                avformat_close_input(&format_context);
+                closeMappedInput(&format_context);
                 return MA_OUT_OF_MEMORY;
         }
 
         if (avcodec_parameters_to_context(codec_context, audio_stream->codecpar) < 0)
         {
                 avcodec_free_context(&codec_context);
-                avformat_close_input(&format_context);
+                closeMappedInput(&format_context);
                 return MA_ERROR;
         }
 
         if (avcodec_open2(codec_context, decoder, NULL) < 0)
         {
                 avcodec_free_context(&codec_context);
-                avformat_close_input(&format_context);
+                closeMappedInput(&format_context);
                 return MA_ERROR;
         }
 
@@ -380,6 +386,7 @@ MA_API ma_result m4a_decoder_init_file(const char *pFilePath, const ma_decoding_
 
         pM4a->format_context = format_context;
         pM4a->mf = NULL;
+        pM4a->mappedInput = true;
         pM4a->format = ffmpeg_to_mini_al_format(pM4a->codec_context->sample_fmt);
 
         return MA_SUCCESS;
@@ -406,7 +413,10 @@ MA_API void m4a_decoder_uninit(m4a_decoder *pM4a, const ma_allocation_callbacks
 
         if (pM4a->format_context != NULL)
         {
-                avformat_close_input(&pM4a->format_context);
+                if (pM4a->mappedInput)
+                        closeMappedInput(&pM4a->format_context);
+                else
+                        avformat_close_input(&pM4a->format_context);
         }
 
         if (pM4a->mf != NULL)
@@ -430,6 +440,24 @@ ma_result m4a_decoder_read_pcm_frames(m4a_decoder *pM4a, void *pFramesOut, ma_ui
         ma_uint32 channels;
         ma_uint32 sampleRate;
 
+        // Stop at the end of the real audio, as if the file ended there
+        if (pM4a->validFrames > 0)
+        {
+                if (pM4a->cursor >= pM4a->validFrames)
+                {
+                        if (pFramesRead != NULL)
+                                *pFramesRead = 0;
+
+                        return MA_AT_END;
+                }
+
+                if (frameCount > pM4a->validFrames - pM4a->cursor)
+                {
+                        frameCount = pM4a->validFrames - pM4a->cursor;
+                        result = MA_AT_END;
+                }
+        }
+
         m4a_decoder_get_data_format(pM4a, &format, &channels, &sampleRate, NULL, 0);
 
         // only two channels supported for now
@@ -453,18 +481,18 @@ ma_result m4a_decoder_read_pcm_frames(m4a_decoder *pM4a, void *pFramesOut, ma_ui
         AVPacket packet;
         ma_uint64 totalFramesProcessed = 0;
 
-        if (leftoverSampleCount > 0)
+        if (pM4a->leftoverSampleCount > 0)
         {
-                int leftoverToProcess = (leftoverSampleCount < frameCount) ? leftoverSampleCount : frameCount;
+                int leftoverToProcess = (pM4a->leftoverSampleCount < frameCount) ? pM4a->leftoverSampleCount : frameCount;
 
                 int leftoverBytes = leftoverToProcess * channels * pM4a->sampleSize;
-                memcpy(pFramesOut, leftoverBuffer, leftoverBytes);
+                memcpy(pFramesOut, pM4a->leftoverBuffer, leftoverBytes);
                 totalFramesProcessed += leftoverToProcess;
 
-                int bytesToShift = (leftoverSampleCount - leftoverToProcess) * channels * pM4a->sampleSize;
-                uint8_t *shiftSource = leftoverBuffer + leftoverToProcess * channels * pM4a->sampleSize;
-                memmove(leftoverBuffer, shiftSource, bytesToShift);
-                leftoverSampleCount -= leftoverToProcess;
+                int bytesToShift = (pM4a->leftoverSampleCount - leftoverToProcess) * channels * pM4a->sampleSize;
+                uint8_t *shiftSource = pM4a->leftoverBuffer + leftoverToProcess * channels * pM4a->sampleSize;
+                memmove(pM4a->leftoverBuffer, shiftSource, bytesToShift);
+                pM4a->leftoverSampleCount -= leftoverToProcess;
         }
 
         while (totalFramesProcessed < frameCount)
@@ -543,10 +571,10 @@ ma_result m4a_decoder_read_pcm_frames(m4a_decoder *pM4a, void *pFramesOut, ma_ui
                                                                         return MA_ERROR;
                                                                 }
 
-                                                                memcpy(leftoverBuffer + byteOffset, (uint8_t *)frame->extended_data[c] + i * pM4a->sampleSize, pM4a->sampleSize);
+                                                                memcpy(pM4a->leftoverBuffer + byteOffset, (uint8_t *)frame->extended_data[c] + i * pM4a->sampleSize, pM4a->sampleSize);
                                                         }
                                                 }
-                                                leftoverSampleCount = remainingSamples;
+                                                pM4a->leftoverSampleCount = remainingSamples;
                                         }
 
                                         free(output_buffer);
@@ -603,6 +631,8 @@ MA_API ma_result m4a_decoder_seek_to_pcm_frame(m4a_decoder *pM4a, ma_uint64 fram
 
         // After seeking, we must clear the codec's internal buffer.
         avcodec_flush_buffers(pM4a->codec_context);
+        pM4a->leftoverSampleCount = 0;
+        pM4a->cursor = frameIndex;
 
         return MA_SUCCESS;
 }
@@ -721,6 +751,12 @@ MA_API ma_result m4a_decoder_get_length_in_pcm_frames(m4a_decoder *pM4a, ma_uint
                 return MA_ERROR;
         }
 
+        if (pM4a->validFrames > 0)
+        {
+                *pLength = pM4a->validFrames;
+                return MA_SUCCESS;
+        }
+
         // Use duration and time base to calculate total number of frames
         if (audio_stream->duration != AV_NOPTS_VALUE)
         {
@@ -0,0 +1,206 @@
+#include "mappedio.h"
+/*
+
+mappedio.c
+
+ File input for FFmpeg. The file is mapped into memory and the demuxer
+ reads it through a custom AVIOContext, so every read is a single copy out
+ of the page cache with no system call and no stdio buffer in between.
+ Reads larger than MAPPED_IO_BUFFER_SIZE, which most audio packets are, go
+ straight into the packet. Files that can't be mapped, empty ones or ones
+ on file systems without mmap support, are read with pread instead.
+
+ Used for playing m4a files and for reading tags.
+
+*/
+
+typedef struct
+{
+        int fd;
+        const uint8_t *data; // NULL when reading with pread
+        int64_t size;        // -1 when unknown
+        int64_t position;
+} MappedFile;
+
+int readMapped(void *opaque, uint8_t *buf, int bufSize)
+{
+        MappedFile *file = (MappedFile *)opaque;
+
+        if (file->data == NULL)
+        {
+                ssize_t bytesRead = pread(file->fd, buf, bufSize, file->position);
+
+                if (bytesRead < 0)
+                        return AVERROR(errno);
+
+                if (bytesRead == 0)
+                        return AVERROR_EOF;
+
+                file->position += bytesRead;
+
+                return (int)bytesRead;
+        }
+
+        if (file->position >= file->size)
+                return AVERROR_EOF;
+
+        int64_t available = file->size - file->position;
+        int count = (available < bufSize) ? (int)available : bufSize;
+
+        memcpy(buf, file->data + file->position, count);
+        file->position += count;
+
+        return count;
+}
+
+int64_t seekMapped(void *opaque, int64_t offset, int whence)
+{
+        MappedFile *file = (MappedFile *)opaque;
+        int64_t position;
+
+        switch (whence & ~AVSEEK_FORCE)
+        {
+        case AVSEEK_SIZE:
+                return (file->size >= 0) ? file->size : AVERROR(ENOSYS);
+        case SEEK_SET:
+                position = offset;
+                break;
+        case SEEK_CUR:
+                position = file->position + offset;
+                break;
+        case SEEK_END:
+                if (file->size < 0)
+                        return AVERROR(ENOSYS);
+
+                position = file->size + offset;
+                break;
+        default:
+                return AVERROR(EINVAL);
+        }
+
+        if (position < 0)
+                return AVERROR(EINVAL);
+
+        file->position = position;
+
+        return position;
+}
+
+void closeMappedFile(MappedFile *file)
+{
+        if (file == NULL)
+                return;
+
+        if (file->data != NULL)
+                munmap((void *)file->data, (size_t)file->size);
+
+        if (file->fd >= 0)
+                close(file->fd);
+
+        free(file);
+}
+
+MappedFile *openMappedFile(const char *path, bool sequential)
+{
+        MappedFile *file = calloc(1, sizeof(MappedFile));
+
+        if (file == NULL)
+                return NULL;
+
+        file->size = -1;
+        file->fd = open(path, O_RDONLY | O_CLOEXEC);
+
+        if (file->fd < 0)
+        {
+                free(file);
+                return NULL;
+        }
+
+        struct stat st;
+
+        if (fstat(file->fd, &st) != 0 || !S_ISREG(st.st_mode))
+                return file;
+
+        file->size = st.st_size;
+
+        if (st.st_size <= 0 || (uint64_t)st.st_size > SIZE_MAX)
+                return file;
+
+        void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, file->fd, 0);
+
+        if (data == MAP_FAILED)
+                return file;
+
+#ifdef MADV_SEQUENTIAL
+        if (sequential)
+                madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+#else
+        (void)sequential;
+#endif
+
+        file->data = data;
+
+        return file;
+}
+
+void freeMappedIO(AVIOContext **pb)
+{
+        if (pb == NULL || *pb == NULL)
+                return;
+
+        closeMappedFile((MappedFile *)(*pb)->opaque);
+        av_freep(&(*pb)->buffer);
+        avio_context_free(pb);
+}
+
+// Like avformat_open_input, sequential is for files that will be read from start to end
+int openMappedInput(AVFormatContext **formatContext, const char *path, bool sequential)
+{
+        MappedFile *file = openMappedFile(path, sequential);
+
+        if (file == NULL)
+                return AVERROR(errno ? errno : EIO);
+
+        unsigned char *buffer = av_malloc(MAPPED_IO_BUFFER_SIZE);
+        AVIOContext *pb = (buffer != NULL) ? avio_alloc_context(buffer, MAPPED_IO_BUFFER_SIZE, 0, file, readMapped, NULL, seekMapped) : NULL;
+        AVFormatContext *context = (pb != NULL) ? avformat_alloc_context() : NULL;
+
+        if (context == NULL)
+        {
+                if (pb != NULL)
+                        freeMappedIO(&pb);
+                else
+                {
+                        av_free(buffer);
+                        closeMappedFile(file);
+                }
+
+                return AVERROR(ENOMEM);
+        }
+
+        context->pb = pb;
+
+        // Frees the context on failure, but not a custom AVIOContext
+        int ret = avformat_open_input(&context, path, NULL, NULL);
+
+        if (ret < 0)
+        {
+                freeMappedIO(&pb);
+                return ret;
+        }
+
+        *formatContext = context;
+
+        return 0;
+}
+
+void closeMappedInput(AVFormatContext **formatContext)
+{
+        if (formatContext == NULL || *formatContext == NULL)
+                return;
+
+        AVIOContext *pb = (*formatContext)->pb;
+
+        avformat_close_input(formatContext);
+        freeMappedIO(&pb);
+}
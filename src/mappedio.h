@@ -0,0 +1,27 @@
+#ifndef MAPPEDIO_H
+#define MAPPEDIO_H
+
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libavformat/avformat.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef MAPPED_IO_BUFFER_SIZE
+#define MAPPED_IO_BUFFER_SIZE 32768 // Larger reads go straight from the file to the caller
+#endif
+
+int openMappedInput(AVFormatContext **formatContext, const char *path, bool sequential);
+
+void closeMappedInput(AVFormatContext **formatContext);
+
+#endif
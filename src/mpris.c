@@ -14,10 +14,9 @@ guint player_registration_id;
 guint bus_name_id;
 
 static const gchar *LoopStatus = "None";
-static gdouble Rate = 1.0;
 static gdouble Volume = 0.5;
-static gdouble MinimumRate = 1.0;
-static gdouble MaximumRate = 1.0;
+static gdouble MinimumRate = STRETCH_MIN_RATE;
+static gdouble MaximumRate = STRETCH_MAX_RATE;
 static gboolean CanGoNext = TRUE;
 static gboolean CanGoPrevious = TRUE;
 static gboolean CanPlay = TRUE;
@@ -489,7 +488,7 @@ static gboolean get_rate(GDBusConnection *connection, const gchar *sender,
         (void)error;
         (void)user_data;
 
-        *value = g_variant_new_double(Rate);
+        *value = g_variant_new_double(getPlaybackRate());
         return TRUE;
 }
 
@@ -666,7 +665,7 @@ static gboolean get_can_go_next(GDBusConnection *connection, const gchar *sender
         (void)error;
         (void)user_data;
 
-        CanGoNext = (currentSong == NULL || currentSong->next != NULL) ? TRUE : FALSE;
+        CanGoNext = (currentSong == NULL || getListNext(currentSong) != NULL) ? TRUE : FALSE;
 
         *value = g_variant_new_boolean(CanGoNext);
         return TRUE;
@@ -685,7 +684,7 @@ static gboolean get_can_go_previous(GDBusConnection *connection, const gchar *se
         (void)error;
         (void)user_data;
 
-        CanGoPrevious = (currentSong == NULL || currentSong->prev != NULL) ? TRUE : FALSE;
+        CanGoPrevious = (currentSong == NULL || getListPrev(currentSong) != NULL) ? TRUE : FALSE;
 
         *value = g_variant_new_boolean(CanGoPrevious);
         return TRUE;
@@ -897,6 +896,22 @@ static gboolean set_property_callback(GDBusConnection *connection, const gchar *
                         setVolume((int)new_volume);
                         return TRUE;
                 }
+                else if (g_strcmp0(property_name, "Rate") == 0)
+                {
+                        double new_rate;
+                        g_variant_get(value, "d", &new_rate);
+
+                        // A rate of zero means pause according to the spec
+                        if (new_rate <= 0.0)
+                        {
+                                playbackPause(&pause_time);
+                                return TRUE;
+                        }
+
+                        setPlaybackRate(new_rate);
+                        emitRateChanged();
+                        return TRUE;
+                }
                 else if (g_strcmp0(property_name, "LoopStatus") == 0)
                 {
                         toggleRepeat();
@@ -1145,6 +1160,12 @@ void emitVolumeChanged()
         emit_properties_changed(connection, "Volume", volume_variant);
 }
 
+void emitRateChanged()
+{
+        GVariant *rate_variant = g_variant_new_double(getPlaybackRate());
+        emit_properties_changed(connection, "Rate", rate_variant);
+}
+
 void emitShuffleChanged()
 {
         gboolean shuffleEnabled = isShuffleEnabled();
@@ -1219,11 +1240,11 @@ void emitMetadataChanged(const gchar *title, const gchar *artist, const gchar *a
         GVariantBuilder changed_properties_builder;
         g_variant_builder_init(&changed_properties_builder, G_VARIANT_TYPE("a{sv}"));
         g_variant_builder_add(&changed_properties_builder, "{sv}", "Metadata", metadata_variant);
-        g_variant_builder_add(&changed_properties_builder, "{sv}", "CanGoPrevious", g_variant_new_boolean((currentSong != NULL && currentSong->prev != NULL)));
-        g_variant_builder_add(&changed_properties_builder, "{sv}", "CanGoNext", g_variant_new_boolean((currentSong != NULL && currentSong->next != NULL)));
+        g_variant_builder_add(&changed_properties_builder, "{sv}", "CanGoPrevious", g_variant_new_boolean((currentSong != NULL && getListPrev(currentSong) != NULL)));
+        g_variant_builder_add(&changed_properties_builder, "{sv}", "CanGoNext", g_variant_new_boolean((currentSong != NULL && getListNext(currentSong) != NULL)));
 
         CanSeek = true;
-        if (currentSong != NULL && endsWith(currentSong->song.filePath, "ogg"))
+        if (currentSong != NULL && endsWith(currentSong->track->path, "ogg"))
         {
                 CanSeek = false;
         }
@@ -22,6 +22,8 @@ void emitVolumeChanged();
 
 void emitShuffleChanged();
 
+void emitRateChanged();
+
 void emitMetadataChanged(const gchar *title, const gchar *artist, const gchar *album, const gchar *coverArtPath, const gchar *trackId, Node *currentSong, gint64 length);
 
 void emitStartPlayingMpris(void);
@@ -0,0 +1,364 @@
+#include "pathindex.h"
+
+/*
+
+pathindex.c
+
+ Interned paths. Every path is hashed once into a stable id, which playlist
+ nodes and library entries then share, so that looking up a track by path
+ doesn't require comparing strings across whole lists or trees. Each path
+ can also have a reference counted Track that playlists and loaded songs
+ point to instead of keeping copies of the path.
+
+*/
+
+#define MIN_PATH_BUCKETS 1024
+
+typedef struct
+{
+        char *path;
+        unsigned int hash;
+        int nextInBucket;
+        FileSystemEntry *entry; // The library entry for this path, if any
+        Track *track;           // The shared track for this path, if referenced
+} InternedPath;
+
+static InternedPath *paths = NULL;
+static int numPaths = 0;
+static int pathsCapacity = 0;
+
+static int *buckets = NULL;
+static int bucketCount = 0;
+
+static pthread_mutex_t pathIndexMutex = PTHREAD_MUTEX_INITIALIZER;
+
+unsigned int hashPath(const char *path)
+{
+        // FNV-1a
+        unsigned int hash = 2166136261u;
+
+        for (const unsigned char *c = (const unsigned char *)path; *c != '\0'; c++)
+        {
+                hash ^= *c;
+                hash *= 16777619u;
+        }
+
+        return hash;
+}
+
+int lookupPath(const char *path, unsigned int hash)
+{
+        if (bucketCount == 0)
+                return -1;
+
+        int pathId = buckets[hash & (bucketCount - 1)];
+
+        while (pathId >= 0)
+        {
+                if (paths[pathId].hash == hash && strcmp(paths[pathId].path, path) == 0)
+                        return pathId;
+
+                pathId = paths[pathId].nextInBucket;
+        }
+
+        return -1;
+}
+
+int growBuckets(void)
+{
+        int newBucketCount = (bucketCount > 0) ? bucketCount * 2 : MIN_PATH_BUCKETS;
+
+        int *newBuckets = malloc(newBucketCount * sizeof(int));
+        if (newBuckets == NULL)
+                return -1;
+
+        for (int i = 0; i < newBucketCount; i++)
+                newBuckets[i] = -1;
+
+        for (int i = 0; i < numPaths; i++)
+        {
+                unsigned int bucket = paths[i].hash & (newBucketCount - 1);
+                paths[i].nextInBucket = newBuckets[bucket];
+                newBuckets[bucket] = i;
+        }
+
+        free(buckets);
+        buckets = newBuckets;
+        bucketCount = newBucketCount;
+
+        return 0;
+}
+
+int internPath(const char *path)
+{
+        if (path == NULL)
+                return -1;
+
+        unsigned int hash = hashPath(path);
+
+        pthread_mutex_lock(&pathIndexMutex);
+
+        int pathId = lookupPath(path, hash);
+
+        if (pathId >= 0)
+        {
+                pthread_mutex_unlock(&pathIndexMutex);
+                return pathId;
+        }
+
+        if (numPaths >= bucketCount && growBuckets() < 0)
+        {
+                pthread_mutex_unlock(&pathIndexMutex);
+                return -1;
+        }
+
+        if (numPaths >= pathsCapacity)
+        {
+                int newCapacity = (pathsCapacity > 0) ? pathsCapacity * 2 : MIN_PATH_BUCKETS;
+                InternedPath *newPaths = realloc(paths, newCapacity * sizeof(InternedPath));
+
+                if (newPaths == NULL)
+                {
+                        pthread_mutex_unlock(&pathIndexMutex);
+                        return -1;
+                }
+
+                paths = newPaths;
+                pathsCapacity = newCapacity;
+        }
+
+        char *copy = strdup(path);
+        if (copy == NULL)
+        {
+                pthread_mutex_unlock(&pathIndexMutex);
+                return -1;
+        }
+
+        pathId = numPaths++;
+
+        unsigned int bucket = hash & (bucketCount - 1);
+        paths[pathId].path = copy;
+        paths[pathId].hash = hash;
+        paths[pathId].entry = NULL;
+        paths[pathId].track = NULL;
+        paths[pathId].nextInBucket = buckets[bucket];
+        buckets[bucket] = pathId;
+
+        pthread_mutex_unlock(&pathIndexMutex);
+
+        return pathId;
+}
+
+int findPathId(const char *path)
+{
+        if (path == NULL)
+                return -1;
+
+        unsigned int hash = hashPath(path);
+
+        pthread_mutex_lock(&pathIndexMutex);
+
+        int pathId = lookupPath(path, hash);
+
+        pthread_mutex_unlock(&pathIndexMutex);
+
+        return pathId;
+}
+
+const char *getInternedPath(int pathId)
+{
+        const char *path = NULL;
+
+        pthread_mutex_lock(&pathIndexMutex);
+
+        if (pathId >= 0 && pathId < numPaths)
+                path = paths[pathId].path;
+
+        pthread_mutex_unlock(&pathIndexMutex);
+
+        return path;
+}
+
+void indexLibraryRecursive(FileSystemEntry *entry)
+{
+        while (entry != NULL)
+        {
+                if (entry->isDirectory)
+                {
+                        indexLibraryRecursive(entry->children);
+                }
+                else
+                {
+                        entry->pathId = internPath(entry->fullPath);
+
+                        if (entry->pathId >= 0)
+                        {
+                                pthread_mutex_lock(&pathIndexMutex);
+                                paths[entry->pathId].entry = entry;
+                                pthread_mutex_unlock(&pathIndexMutex);
+                        }
+                }
+
+                entry = entry->next;
+        }
+}
+
+void indexLibrary(FileSystemEntry *root)
+{
+        if (root == NULL)
+                return;
+
+        indexLibraryRecursive(root->children);
+}
+
+void clearLibraryIndex(void)
+{
+        pthread_mutex_lock(&pathIndexMutex);
+
+        for (int i = 0; i < numPaths; i++)
+                paths[i].entry = NULL;
+
+        pthread_mutex_unlock(&pathIndexMutex);
+}
+
+FileSystemEntry *findLibraryEntry(int pathId)
+{
+        FileSystemEntry *entry = NULL;
+
+        pthread_mutex_lock(&pathIndexMutex);
+
+        if (pathId >= 0 && pathId < numPaths)
+                entry = paths[pathId].entry;
+
+        pthread_mutex_unlock(&pathIndexMutex);
+
+        return entry;
+}
+
+Track *acquireTrack(const char *path)
+{
+        int pathId = internPath(path);
+
+        if (pathId < 0)
+                return NULL;
+
+        pthread_mutex_lock(&pathIndexMutex);
+
+        Track *track = paths[pathId].track;
+
+        if (track != NULL)
+        {
+                track->refCount++;
+        }
+        else
+        {
+                track = malloc(sizeof(Track));
+
+                if (track != NULL)
+                {
+                        track->path = paths[pathId].path;
+                        track->pathId = pathId;
+                        track->duration = 0.0;
+                        track->refCount = 1;
+                        atomic_init(&track->tagName, NULL);
+                        track->fileName = NULL;
+                        track->displayName = NULL;
+                        track->displayWidth = 0;
+                        paths[pathId].track = track;
+                }
+        }
+
+        pthread_mutex_unlock(&pathIndexMutex);
+
+        return track;
+}
+
+void freeTrack(Track *track)
+{
+        free(atomic_load(&track->tagName));
+        free(track->fileName);
+        free(track);
+}
+
+Track *retainTrack(Track *track)
+{
+        if (track == NULL)
+                return NULL;
+
+        pthread_mutex_lock(&pathIndexMutex);
+        track->refCount++;
+        pthread_mutex_unlock(&pathIndexMutex);
+
+        return track;
+}
+
+void releaseTrack(Track *track)
+{
+        if (track == NULL)
+                return;
+
+        pthread_mutex_lock(&pathIndexMutex);
+
+        if (--track->refCount <= 0)
+        {
+                if (track->pathId < numPaths && paths[track->pathId].track == track)
+                        paths[track->pathId].track = NULL;
+
+                freeTrack(track);
+        }
+
+        pthread_mutex_unlock(&pathIndexMutex);
+}
+
+void freePathIndex(void)
+{
+        pthread_mutex_lock(&pathIndexMutex);
+
+        for (int i = 0; i < numPaths; i++)
+        {
+                if (paths[i].track != NULL)
+                        freeTrack(paths[i].track);
+                free(paths[i].path);
+        }
+
+        free(paths);
+        free(buckets);
+        paths = NULL;
+        buckets = NULL;
+        numPaths = 0;
+        pathsCapacity = 0;
+        bucketCount = 0;
+
+        pthread_mutex_unlock(&pathIndexMutex);
+}
+
+// Used in place of the file name in the playlist from then on. Needs an artist, as
+// without a title tag the title is just the file name again.
+void setTrackTagName(Track *track, const char *artist, const char *title)
+{
+        if (track == NULL || artist == NULL || title == NULL || artist[0] == '\0' || title[0] == '\0')
+                return;
+
+        if (atomic_load(&track->tagName) != NULL)
+                return;
+
+        size_t length = strlen(artist) + strlen(" - ") + strlen(title) + 1;
+        char *name = malloc(length);
+
+        if (name == NULL)
+                return;
+
+        snprintf(name, length, "%s - %s", artist, title);
+
+        // Tags can hold line breaks and tabs, which would break the rows
+        for (char *c = name; *c != '\0'; c++)
+        {
+                if ((unsigned char)*c < 0x20)
+                        *c = ' ';
+        }
+
+        char *expected = NULL;
+
+        if (!atomic_compare_exchange_strong(&track->tagName, &expected, name))
+                free(name);
+}
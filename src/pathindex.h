@@ -0,0 +1,55 @@
+#ifndef PATHINDEX_H
+#define PATHINDEX_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "directorytree.h"
+
+#ifndef TRACK_STRUCT
+#define TRACK_STRUCT
+
+// One record per file, shared by every playlist node and loaded song that
+// refers to it
+typedef struct
+{
+        const char *path; // Interned, stays valid until freePathIndex
+        int pathId;
+        double duration;
+        int refCount;
+        char *_Atomic tagName;   // "Artist - Title" once the tags have been read, set only once
+        char *fileName;          // Shown until then, made from the path by the UI on first display
+        const char *displayName; // Whichever of the two the UI measured last, UI thread only
+        int displayWidth;        // In terminal columns
+} Track;
+
+#endif
+
+unsigned int hashPath(const char *path);
+
+int internPath(const char *path);
+
+int findPathId(const char *path);
+
+const char *getInternedPath(int pathId);
+
+void indexLibrary(FileSystemEntry *root);
+
+void clearLibraryIndex(void);
+
+FileSystemEntry *findLibraryEntry(int pathId);
+
+Track *acquireTrack(const char *path);
+
+Track *retainTrack(Track *track);
+
+void releaseTrack(Track *track);
+
+void setTrackTagName(Track *track, const char *artist, const char *title);
+
+void freePathIndex(void);
+
+#endif
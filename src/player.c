@@ -38,6 +38,7 @@ bool showList = true;
 bool resetPlaylistDisplay = true;
 bool fastForwarding = false;
 bool rewinding = false;
+bool showAudioStats = false;
 bool nerdFontsEnabled = true;
 int numProgressBars = 35;
 int elapsedBars = 0;
@@ -66,7 +67,6 @@ int maxListSize = 0;
 int maxSearchListSize = 0;
 
 int numDirectoryTreeEntries = 0;
-int numTopLevelSongs = 0;
 int startLibIter = 0;
 int startSearchIter = 0;
 int maxLibListSize = 0;
@@ -75,15 +75,16 @@ int chosenSearchResultRow = 0;
 bool allowChooseSongs = false;
 FileSystemEntry *currentEntry = NULL;
 FileSystemEntry *chosenDir = NULL;
-int libIter = 0;
-int libSongIter = 0;
-int libTopLevelSongIter = 0;
 int chosenNodeId = 0;
 int cacheLibrary = -1;
 
 const char LIBRARY_FILE[] = "kewlibrary";
+const char AUDIO_STATS_FILE[] = "kewaudiostats.log";
+const char LOUDNESS_FILE[] = "kewloudness";
 
 FileSystemEntry *library = NULL;
+static _Atomic bool libraryLoading = false;
+static _Atomic bool libraryCacheOffered = false;
 
 bool hasNerdFonts()
 {
@@ -147,7 +148,7 @@ void printHelp()
         printf(" \033[1;4mUsage:\033[0m   kew path \"path to music library\"\n");
         printf("          (Saves the music library path. Use this the first time. Ie: kew path \"/home/joe/Music/\")\n");
         printf("          kew (no argument, opens library)\n");
-        printf("          kew all (loads all your songs up to 10 000)\n");
+        printf("          kew all (loads all your songs)\n");
         printf("          kew albums (plays all albums up to 2000 randomly one after the other)");
         printf("          kew <song name,directory or playlist words>\n");
         printf("          kew --help, -? or -h\n");
@@ -158,6 +159,7 @@ void printHelp()
         printf("          kew shuffle <dir name> (random and rand works too)\n");
         printf("          kew artistA:artistB (plays artistA and artistB shuffled)\n");
         printf("          kew . (plays kew.m3u file)\n");
+        printf("          kew --render-null <song> (decodes without a sound card as fast as possible and prints a report)\n");
         printf("\n");
         printf(" \033[1;4mExample:\033[0m kew moon\n");
         printf(" (Plays the first song or directory it finds that has the word moon, ie moonlight sonata)\n");
@@ -414,6 +416,11 @@ void printProgress(double elapsed_seconds, double total_seconds)
                total_hours, total_minutes, total_seconds_remainder,
                progress_percentage, vol);
 
+        double rate = getPlaybackRate();
+
+        if (rate != 1.0)
+                printf(" Speed:%.2fx", rate);
+
         // Restore the cursor position
         printf("\033[u");
 }
@@ -548,6 +555,20 @@ void printLastRow()
 
         printf("\033[K"); // clear the line
 
+        if (showAudioStats)
+        {
+                char statsText[200];
+                formatAudioStatsSummary(statsText, sizeof(statsText));
+
+                int maxWidth = term_w - indent - 1;
+                if (maxWidth > 0 && (int)strlen(statsText) > maxWidth)
+                        statsText[maxWidth] = '\0';
+
+                printBlankSpaces(indent);
+                printf("%s", statsText);
+                return;
+        }
+
         int randomNumber = getRandomNumber(1, 808);
         if (randomNumber == 808)
                 printGlimmeringText(text, nerdFontText, lastRowColor);
@@ -608,6 +629,8 @@ int showKeyBindings(SongData *songdata, AppSettings *settings)
         printBlankSpaces(indent);
         printf(" - %s to seek forward.\n", settings->seekForward);
         printBlankSpaces(indent);
+        printf(" - %s and %s to change playback speed.\n", settings->decreaseSpeed, settings->increaseSpeed);
+        printBlankSpaces(indent);
         printf(" - %s to save the playlist to your music folder.\n", settings->savePlaylist);
         printBlankSpaces(indent);
         printf(" - %s to add current song to kew.m3u (run with \"kew .\").\n", settings->addToMainPlaylist);
@@ -616,7 +639,7 @@ int showKeyBindings(SongData *songdata, AppSettings *settings)
         printf("\n");
         printLastRow();
 
-        numPrintedRows += 17;
+        numPrintedRows += 18;
 
         return numPrintedRows;
 }
@@ -681,6 +704,17 @@ void toggleShowKeyBindings()
         }
 }
 
+void toggleAudioStatsOverlay()
+{
+        showAudioStats = !showAudioStats;
+
+        // Collection stays on once the overlay has been opened, so that a later dump has something to show
+        if (showAudioStats)
+                setAudioStatsEnabled(true);
+
+        refresh = true;
+}
+
 void flipNextPage()
 {
         if (appState.currentView == LIBRARY_VIEW)
@@ -692,7 +726,7 @@ void flipNextPage()
         else if (appState.currentView == PLAYLIST_VIEW)
         {
                 chosenRow += maxListSize - 1;
-                chosenRow = (chosenRow >= originalPlaylist->count) ? originalPlaylist->count - 1 : chosenRow;
+                chosenRow = (chosenRow >= playlist.count) ? playlist.count - 1 : chosenRow;
                 refresh = true;
         }
         else if (appState.currentView == SEARCH_VIEW)
@@ -732,7 +766,7 @@ void scrollNext()
         if (appState.currentView == PLAYLIST_VIEW)
         {
                 chosenRow++;
-                chosenRow = (chosenRow >= originalPlaylist->count) ? originalPlaylist->count - 1 : chosenRow;
+                chosenRow = (chosenRow >= playlist.count) ? playlist.count - 1 : chosenRow;
                 refresh = true;
         }
         else if (appState.currentView == LIBRARY_VIEW)
@@ -770,9 +804,9 @@ void scrollPrev()
 
 int getRowWithinBounds(int row)
 {
-        if (row >= originalPlaylist->count)
+        if (row >= playlist.count)
         {
-                row = originalPlaylist->count - 1;
+                row = playlist.count - 1;
         }
 
         if (row < 0)
@@ -919,6 +953,34 @@ FileSystemEntry *getLibrary()
         return library;
 }
 
+void setLibraryLoading(bool loading)
+{
+        atomic_store(&libraryLoading, loading);
+}
+
+bool isLibraryLoading()
+{
+        return atomic_load(&libraryLoading);
+}
+
+// The scan was slow and cacheLibrary isn't set, the library view asks the user instead of deciding for them
+void offerLibraryCache()
+{
+        atomic_store(&libraryCacheOffered, true);
+}
+
+bool isLibraryCacheOffered()
+{
+        return atomic_load(&libraryCacheOffered);
+}
+
+void acceptLibraryCache()
+{
+        cacheLibrary = 1;
+        atomic_store(&libraryCacheOffered, false);
+        refresh = true;
+}
+
 FileSystemEntry *getChosenDir()
 {
         return chosenDir;
@@ -965,161 +1027,128 @@ void resetChosenDir()
         chosenDir = NULL;
 }
 
-int displayTree(FileSystemEntry *root, int depth, int maxListSize, int maxNameWidth)
+void printLibraryRow(const LibraryRow *row, bool isChosen, int maxNameWidth)
 {
         char dirName[maxNameWidth + 1];
         char filename[maxNameWidth + 1];
+        FileSystemEntry *entry = row->entry;
 
-        if (libIter >= startLibIter + maxListSize)
+        if (row->depth == 1)
         {
-                return 0;
+                if (useProfileColors)
+                        setTextColor(artistColor);
+                else
+                        setColor();
         }
-
-        FileSystemEntry *tmp = root->parent == NULL ? NULL : root->parent->children;
-        int numAudioChildren = 0;
-
-        while (tmp != NULL)
+        else
         {
-                if (!tmp->isDirectory)
-                        numAudioChildren++;
-
-                tmp = tmp->next;
+                setDefaultTextColor();
         }
 
-        if (chosenLibRow > startLibIter + maxListSize - round(maxListSize / 2))
-        {
-                startLibIter = chosenLibRow - maxListSize + round(maxListSize / 2) + 1;
-        }
+        if (row->depth >= 2)
+                printf("  ");
+
+        printBlankSpaces(indent);
 
-        if (allowChooseSongs)
+        if (isChosen)
         {
-                if (chosenLibRow >= libIter + libSongIter && libSongIter != 0)
+                if (entry->isEnqueued)
                 {
-                        if (chosenLibRow >= numDirectoryTreeEntries + numTopLevelSongs + numAudioChildren)
-                        {
-                                startLibIter = numDirectoryTreeEntries + numTopLevelSongs + numAudioChildren - maxListSize;
-                                chosenLibRow = numDirectoryTreeEntries + numTopLevelSongs + numAudioChildren - 1;
-                        }
+                        if (useProfileColors)
+                                setTextColor(enqueuedColor);
+                        else
+                                setColor();
+                        printf("\x1b[7m * ");
+                }
+                else
+                {
+                        printf("  \x1b[7m ");
                 }
         }
         else
         {
-                if (chosenLibRow >= numDirectoryTreeEntries + numTopLevelSongs)
+                if (entry->isEnqueued)
                 {
-                        startLibIter = numDirectoryTreeEntries + numTopLevelSongs - maxListSize;
-                        chosenLibRow = numDirectoryTreeEntries + numTopLevelSongs - 1;
+                        if (useProfileColors)
+                                setTextColor(enqueuedColor);
+                        else
+                                setColor();
+                        printf(" * ");
                 }
+                else
+                        printf("   ");
         }
 
-        if (chosenLibRow < 0)
-                startLibIter = chosenLibRow = libIter = 0;
+        if (entry->isDirectory)
+        {
+                dirName[0] = '\0';
 
-        if (root == NULL)
-                return 0;
+                snprintf(dirName, maxNameWidth + 1, "%s", entry->name);
 
-        if (root->isDirectory ||
-            (!root->isDirectory && depth == 1) ||
-            (chosenDir != NULL && allowChooseSongs && root->parent != NULL && (strcmp(root->parent->fullPath, chosenDir->fullPath) == 0 || strcmp(root->fullPath, chosenDir->fullPath) == 0)))
+                if (row->depth == 1)
+                        printf("%s \n", stringToUpper(dirName));
+                else
+                        printf("%s \n", dirName);
+        }
+        else
         {
-                if (depth > 0)
-                {
-                        if (libIter >= startLibIter)
-                        {
+                filename[0] = '\0';
+                processName(entry->name, filename, maxNameWidth);
+                printf(" └─%s \n", filename);
+        }
 
-                                if (depth == 1)
-                                {
-                                        if (useProfileColors)
-                                                setTextColor(artistColor);
-                                        else
-                                                setColor();
-                                }
-                                else
-                                {
-                                        setDefaultTextColor();
-                                }
-
-                                if (depth >= 2)
-                                        printf("  ");
-
-                                printBlankSpaces(indent);
-
-                                if (chosenLibRow == libIter)
-                                {
-                                        if (root->isEnqueued)
-                                        {
-                                                if (useProfileColors)
-                                                        setTextColor(enqueuedColor);
-                                                else
-                                                        setColor();
-                                                printf("\x1b[7m * ");
-                                        }
-                                        else
-                                        {
-                                                printf("  \x1b[7m ");
-                                        }
-
-                                        currentEntry = root;
-
-                                        if (allowChooseSongs == true && (chosenDir == NULL ||
-                                                                         (currentEntry != NULL && currentEntry->parent != NULL && chosenDir != NULL && (strcmp(currentEntry->parent->fullPath, chosenDir->fullPath) != 0) &&
-                                                                          strcmp(root->fullPath, chosenDir->fullPath) != 0)))
-                                        {
-                                                chosenLibRow -= libSongIter;
-                                                allowChooseSongs = false;
-                                                chosenDir = NULL;
-                                                refresh = true;
-                                        }
-                                }
-                                else
-                                {
-                                        if (root->isEnqueued)
-                                        {
-                                                if (useProfileColors)
-                                                        setTextColor(enqueuedColor);
-                                                else
-                                                        setColor();
-                                                printf(" * ");
-                                        }
-                                        else
-                                                printf("   ");
-                                }
-
-                                if (root->isDirectory)
-                                {
-                                        dirName[0] = '\0';
-
-                                        snprintf(dirName, maxNameWidth + 1, "%s", root->name);
-
-                                        if (depth == 1)
-                                                printf("%s \n", stringToUpper(dirName));
-                                        else
-                                                printf("%s \n", dirName);
-                                }
-                                else
-                                {
-                                        filename[0] = '\0';
-                                        processName(root->name, filename, maxNameWidth);
-                                        printf(" └─%s \n", filename);
-
-                                        libSongIter++;
-                                }
+        setColor();
+}
 
-                                setColor();
-                        }
+void displayTree(int maxListSize, int maxNameWidth)
+{
+        syncLibraryRows(library, allowChooseSongs ? chosenDir : NULL);
 
-                        libIter++;
-                }
+        int rowCount = getLibraryRowCount();
 
-                FileSystemEntry *child = root->children;
-                while (child != NULL)
-                {
-                        if (displayTree(child, depth + 1, maxListSize, maxNameWidth) == -1)
-                                return -1;
-                        child = child->next;
-                }
+        if (rowCount == 0)
+        {
+                startLibIter = chosenLibRow = 0;
+                return;
         }
 
-        return 0;
+        if (chosenLibRow >= rowCount)
+                chosenLibRow = rowCount - 1;
+
+        if (chosenLibRow < 0)
+                chosenLibRow = 0;
+
+        FileSystemEntry *entry = getLibraryRow(chosenLibRow)->entry;
+
+        // Moving out of the expanded directory collapses it again
+        if (allowChooseSongs && chosenDir != NULL && entry != chosenDir && entry->parent != chosenDir)
+        {
+                allowChooseSongs = false;
+                chosenDir = NULL;
+                setExpandedLibraryDir(NULL);
+
+                rowCount = getLibraryRowCount();
+                chosenLibRow = findLibraryRow(entry);
+
+                if (chosenLibRow < 0)
+                        chosenLibRow = 0;
+        }
+
+        currentEntry = getLibraryRow(chosenLibRow)->entry;
+
+        // Keep the chosen row around the middle of the list
+        startLibIter = 0;
+
+        if (chosenLibRow > maxListSize - round(maxListSize / 2))
+                startLibIter = chosenLibRow - maxListSize + round(maxListSize / 2) + 1;
+
+        int end = startLibIter + maxListSize;
+
+        if (end > rowCount)
+                end = rowCount;
+
+        for (int i = startLibIter; i < end; i++)
+                printLibraryRow(getLibraryRow(i), i == chosenLibRow, maxNameWidth);
 }
 
 char *getLibraryFilePath()
@@ -1136,12 +1165,36 @@ char *getLibraryFilePath()
         return filepath;
 }
 
-void showLibrary(SongData *songData)
+char *getAudioStatsFilePath()
 {
-        libIter = 0;
-        libSongIter = 0;
-        startLibIter = 0;
+        char *configdir = getConfigPath();
+        char *filepath = NULL;
+
+        size_t filepath_length = strlen(configdir) + strlen("/") + strlen(AUDIO_STATS_FILE) + 1;
+        filepath = (char *)malloc(filepath_length);
+        strcpy(filepath, configdir);
+        strcat(filepath, "/");
+        strcat(filepath, AUDIO_STATS_FILE);
+        free(configdir);
+        return filepath;
+}
+
+char *getLoudnessFilePath()
+{
+        char *configdir = getConfigPath();
+        char *filepath = NULL;
 
+        size_t filepath_length = strlen(configdir) + strlen("/") + strlen(LOUDNESS_FILE) + 1;
+        filepath = (char *)malloc(filepath_length);
+        strcpy(filepath, configdir);
+        strcat(filepath, "/");
+        strcat(filepath, LOUDNESS_FILE);
+        free(configdir);
+        return filepath;
+}
+
+void showLibrary(SongData *songData)
+{
         refresh = false;
 
         int term_w, term_h;
@@ -1164,34 +1217,45 @@ void showLibrary(SongData *songData)
                 printf(" Pg Up and Pg Dn to scroll. Press u to update the library.\n\n");
         }
 
-        numTopLevelSongs = 0;
-
-        FileSystemEntry *tmp = library->children;
-
-        while (tmp != NULL)
+        if (isLibraryLoading())
         {
-                if (!tmp->isDirectory)
-                        numTopLevelSongs++;
-
-                tmp = tmp->next;
+                maxLibListSize -= 2;
+                printBlankSpaces(indent);
+                printf(" Scanning the library, %d directories so far.\n\n", getScannedDirectoryCount());
+        }
+        else if (isLibraryCacheOffered())
+        {
+                maxLibListSize -= 2;
+                printBlankSpaces(indent);
+                printf(" Scanning took a while. Press u here to keep a library cache for quicker startups.\n\n");
+        }
+        else if (library == NULL || library->children == NULL)
+        {
+                maxLibListSize -= 2;
+                printBlankSpaces(indent);
+                printf(" No music found. To set the path type: kew path \"/path/to/Music\".\n\n");
         }
 
-        displayTree(library, 0, maxLibListSize, maxNameWidth);
+        displayTree(maxLibListSize, maxNameWidth);
 
         printf("\n");
 
         printLastRow();
-
-        if (refresh)
-        {
-                printf("\033[1;1H");
-                clearScreen();
-                showLibrary(songData);
-        }
 }
 
 int printPlayer(SongData *songdata, double elapsedSeconds, AppSettings *settings)
 {
+        TRACE_SCOPE("printPlayer");
+
+        bool hasMetadata = (songdata != NULL && songdata->metadata != NULL && !songdata->hasErrors && (songdata->hasErrors < 1));
+
+        // Seeking needs the duration even when nothing is shown
+        if (hasMetadata)
+        {
+                metadata = *songdata->metadata;
+                duration = songdata->duration;
+        }
+
         if (!uiEnabled)
         {
                 return 0;
@@ -1201,11 +1265,8 @@ int printPlayer(SongData *songdata, double elapsedSeconds, AppSettings *settings
 
         setColor();
 
-        if (songdata != NULL && songdata->metadata != NULL && !songdata->hasErrors && (songdata->hasErrors < 1))
+        if (hasMetadata)
         {
-                metadata = *songdata->metadata;
-                duration = songdata->duration;
-
                 if (songdata->cover != NULL && coverEnabled)
                 {
                         color.r = songdata->red;
@@ -1247,7 +1308,7 @@ int printPlayer(SongData *songdata, double elapsedSeconds, AppSettings *settings
         else if (appState.currentView == PLAYLIST_VIEW && refresh)
         {
                 clearScreen();
-                showPlaylist(songdata, originalPlaylist, &chosenRow, &chosenNodeId);
+                showPlaylist(songdata, &playlist, &chosenRow, &chosenNodeId);
                 resetPlaylistDisplay = false;                
                 refresh = false;
         }
@@ -1295,6 +1356,9 @@ void freeMainDirectoryTree()
 
         char *filepath = getLibraryFilePath();
 
+        clearLibraryIndex();
+        freeLibraryRows();
+
         if (cacheLibrary)
                 freeAndWriteTree(library, filepath);
         else
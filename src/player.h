@@ -1,6 +1,7 @@
 #ifndef PLAYER_H
 #define PLAYER_H
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,6 +10,7 @@
 #include "../include/imgtotxt/options.h"
 #include "chafafunc.h"
 #include "directorytree.h"
+#include "libraryrows.h"
 #include "playlist.h"
 #include "playlist_ui.h"
 #include "search_ui.h"
@@ -37,6 +39,7 @@ extern int visualizerHeight;
 extern TagSettings metadata;
 extern bool fastForwarding;
 extern bool rewinding;
+extern bool showAudioStats;
 extern double elapsedSeconds;
 extern double pauseSeconds;
 extern double totalPauseSeconds;
@@ -72,6 +75,16 @@ FileSystemEntry *getChosenDir();
 
 FileSystemEntry *getLibrary();
 
+void setLibraryLoading(bool loading);
+
+bool isLibraryLoading();
+
+void offerLibraryCache(void);
+
+bool isLibraryCacheOffered(void);
+
+void acceptLibraryCache(void);
+
 void scrollNext(void);
 
 void scrollPrev(void);
@@ -88,12 +101,18 @@ void toggleShowSearch(void);
 
 void showTrack();
 
+void toggleAudioStatsOverlay();
+
 void setTextColorRGB2(int r, int g, int b);
 
 void freeMainDirectoryTree();
 
 char *getLibraryFilePath();
 
+char *getAudioStatsFilePath();
+
+char *getLoudnessFilePath();
+
 void resetChosenDir();
 
 #endif
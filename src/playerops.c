@@ -11,10 +11,13 @@ playerops.c
 #define MAXPATHLEN 4096
 #endif
 
-#ifndef ASK_IF_USE_CACHE_LIMIT_SECONDS
-#define ASK_IF_USE_CACHE_LIMIT_SECONDS 4
+#ifndef CACHE_LIBRARY_LIMIT_SECONDS
+#define CACHE_LIBRARY_LIMIT_SECONDS 4 // Turn on the library cache if a scan takes longer than this
 #endif
 
+static pthread_t libraryThread;
+static bool libraryThreadStarted = false;
+
 struct timespec current_time;
 struct timespec start_time;
 struct timespec pause_time;
@@ -54,10 +57,7 @@ void updatePlaylist()
 
         if (isShuffleEnabled())
         {
-                if (currentSong != NULL)
-                        shufflePlaylistStartingFromSong(&playlist, currentSong);
-                else
-                        shufflePlaylist(&playlist);
+                shufflePlayOrder(&playlist, currentSong);
 
                 nextSongNeedsRebuilding = true;
         }
@@ -220,8 +220,8 @@ void skipToSong(int id, bool startPlaying)
         {
                 songHasErrors = false;
                 forceSkip = true;
-                if (currentSong->next != NULL)
-                        skipToSong(currentSong->next->id, true);
+                if (getListNext(currentSong) != NULL)
+                        skipToSong(getListNext(currentSong)->id, true);
         }
 
         updateLastSongSwitchTime();
@@ -339,7 +339,7 @@ void addToSpecialPlaylist()
         if (findSelectedEntryById(specialPlaylist, id) != NULL) // song is already in list
                 return;
 
-        createNode(&node, currentSong->song.filePath, id);
+        createNode(&node, currentSong->track->path, id);
         addToList(specialPlaylist, node);
 }
 
@@ -348,39 +348,13 @@ void toggleShuffle()
         bool shuffleEnabled = !isShuffleEnabled();
         setShuffleEnabled(shuffleEnabled);
 
-        if (shuffleEnabled)
-        {
-                pthread_mutex_lock(&(playlist.mutex));
-
-                shufflePlaylistStartingFromSong(&playlist, currentSong);
-
-                pthread_mutex_unlock(&(playlist.mutex));
-
-                emitBooleanPropertyChanged("Shuffle", TRUE);
-        }
-        else
-        {
-                char *path = NULL;
-                if (currentSong != NULL)
-                {
-                        path = strdup(currentSong->song.filePath);
-                }
-
-                pthread_mutex_lock(&(playlist.mutex));
-
-                deletePlaylist(&playlist); // Doesn't destroy the mutex
-                deepCopyPlayListOntoList(originalPlaylist, &playlist);
+        pthread_mutex_lock(&(playlist.mutex));
 
-                if (path != NULL)
-                {
-                        currentSong = findPathInPlaylist(path, &playlist);
-                        free(path);
-                }
+        setShuffled(&playlist, shuffleEnabled, currentSong);
 
-                pthread_mutex_unlock(&(playlist.mutex));
+        pthread_mutex_unlock(&(playlist.mutex));
 
-                emitBooleanPropertyChanged("Shuffle", FALSE);
-        }
+        emitBooleanPropertyChanged("Shuffle", shuffleEnabled ? TRUE : FALSE);
 
         loadedNextSong = false;
         nextSong = NULL;
@@ -455,6 +429,29 @@ SongData *getCurrentSongData(void)
         return songData;
 }
 
+// Time played beyond wall clock time because of the playback rate, reset whenever start_time is
+static struct timespec rateStartTime = {0, 0};
+static struct timespec rateLastTime = {0, 0};
+static double rateExtraSeconds = 0.0;
+
+void updateRateExtraSeconds(bool playing)
+{
+        if (rateStartTime.tv_sec != start_time.tv_sec || rateStartTime.tv_nsec != start_time.tv_nsec)
+        {
+                rateStartTime = start_time;
+                rateLastTime = start_time;
+                rateExtraSeconds = 0.0;
+        }
+
+        double sinceLast = (double)(current_time.tv_sec - rateLastTime.tv_sec) +
+                           (double)(current_time.tv_nsec - rateLastTime.tv_nsec) / 1e9;
+
+        if (playing && sinceLast > 0.0)
+                rateExtraSeconds += sinceLast * (getPlaybackRate() - 1.0);
+
+        rateLastTime = current_time;
+}
+
 void calcElapsedTime()
 {
         if (isStopped())
@@ -465,10 +462,12 @@ void calcElapsedTime()
         double timeSinceLastUpdate = (double)(current_time.tv_sec - lastUpdateTime.tv_sec) +
                                      (double)(current_time.tv_nsec - lastUpdateTime.tv_nsec) / 1e9;
 
+        updateRateExtraSeconds(!isPaused());
+
         if (!isPaused())
         {
                 elapsedSeconds = (double)(current_time.tv_sec - start_time.tv_sec) +
-                                 (double)(current_time.tv_nsec - start_time.tv_nsec) / 1e9;
+                                 (double)(current_time.tv_nsec - start_time.tv_nsec) / 1e9 + rateExtraSeconds;
                 double seekElapsed = getSeekElapsed();
                 double diff = elapsedSeconds + (seekElapsed + seekAccumulatedSeconds - totalPauseSeconds);
 
@@ -504,7 +503,7 @@ void flushSeek()
         {
                 if (currentSong != NULL)
                 {
-                        if (endsWith(currentSong->song.filePath, "ogg"))
+                        if (endsWith(currentSong->track->path, "ogg"))
                         {
                                 return;
                         }
@@ -563,7 +562,7 @@ void seekForward()
 {
         if (currentSong != NULL)
         {
-                if (endsWith(currentSong->song.filePath, "ogg"))
+                if (endsWith(currentSong->track->path, "ogg"))
                 {
                         return;
                 }
@@ -581,7 +580,7 @@ void seekBack()
 {
         if (currentSong != NULL)
         {
-                if (endsWith(currentSong->song.filePath, "ogg"))
+                if (endsWith(currentSong->track->path, "ogg"))
                 {
                         return;
                 }
@@ -597,119 +596,51 @@ void seekBack()
 
 Node *findSelectedEntryById(PlayList *playlist, int id)
 {
-        Node *node = playlist->head;
-
-        if (node == NULL || id < 0)
+        if (playlist == NULL || id < 0)
                 return NULL;
 
-        bool found = false;
-
-        for (int i = 0; i < playlist->count; i++)
-        {
-                if (node != NULL && node->id == id)
-                {
-                        found = true;
-                        break;
-                }
-                else if (node == NULL)
-                {
-                        return NULL;
-                }
-                node = node->next;
-        }
-
-        if (found)
-        {
-                return node;
-        }
-
-        return NULL;
+        return findNodeById(playlist, id);
 }
 
 Node *findSelectedEntry(PlayList *playlist, int row)
 {
-        Node *node = playlist->head;
-
-        if (node == NULL)
+        if (playlist == NULL)
                 return NULL;
 
-        bool found = false;
-
-        for (int i = 0; i < playlist->count; i++)
-        {
-                if (i == row)
-                {
-                        found = true;
-                        break;
-                }
-                node = node->next;
-        }
-
-        if (found)
-        {
-                return node;
-        }
-
-        return NULL;
+        return getNodeAtPosition(playlist, row);
 }
 
-bool markAsDequeued(FileSystemEntry *root, char *path)
+bool markAsDequeued(int pathId)
 {
-        int numChildrenEnqueued = 0;
+        FileSystemEntry *entry = findLibraryEntry(pathId);
 
-        if (root == NULL)
+        if (entry == NULL)
                 return false;
 
-        if (!root->isDirectory)
-        {
-                if (strcmp(root->fullPath, path) == 0)
-                {
-                        root->isEnqueued = false;
-                        return true;
-                }
-        }
-        else
-        {
-                FileSystemEntry *child = root->children;
-                bool found = false;
-                while (child != NULL)
-                {
-                        found = markAsDequeued(child, path);
-                        child = child->next;
-
-                        if (found)
-                                break;
-                }
-
-                if (found)
-                {
-                        child = root->children;
-
-                        while (child != NULL)
-                        {
-                                if (child->isEnqueued)
-                                        numChildrenEnqueued++;
+        entry->isEnqueued = false;
 
-                                child = child->next;
-                        }
+        // Directories stay enqueued only while some child still is
+        for (FileSystemEntry *dir = entry->parent; dir != NULL; dir = dir->parent)
+        {
+                FileSystemEntry *child = dir->children;
 
-                        if (numChildrenEnqueued == 0)
-                                root->isEnqueued = false;
+                while (child != NULL && !child->isEnqueued)
+                        child = child->next;
 
-                        return true;
-                }
+                if (child == NULL)
+                        dir->isEnqueued = false;
         }
 
-        return false;
+        return true;
 }
 
 Node *getNextSong()
 {
         if (nextSong != NULL)
                 return nextSong;
-        else if (currentSong != NULL && currentSong->next != NULL)
+        else if (currentSong != NULL && getListNext(currentSong) != NULL)
         {
-                return currentSong->next;
+                return getListNext(currentSong);
         }
         else
         {
@@ -723,11 +654,7 @@ void enqueueSong(FileSystemEntry *child)
 
         Node *node = NULL;
         createNode(&node, child->fullPath, id);
-        addToList(originalPlaylist, node);
-
-        Node *node2 = NULL;
-        createNode(&node2, child->fullPath, id);
-        addToList(&playlist, node2);
+        addToList(&playlist, node);
 
         child->isEnqueued = 1;
         child->parent->isEnqueued = 1;
@@ -735,23 +662,16 @@ void enqueueSong(FileSystemEntry *child)
 
 void dequeueSong(FileSystemEntry *child)
 {
-        Node *node1 = findLastPathInPlaylist(child->fullPath, originalPlaylist);
+        Node *node = (child->pathId >= 0) ? findLastPathIdInPlaylist(child->pathId, &playlist)
+                                          : findLastPathInPlaylist(child->fullPath, &playlist);
 
-        if (node1 == NULL)
+        if (node == NULL)
                 return;
 
-        if (currentSong != NULL && currentSong->id == node1->id)
+        if (currentSong != NULL && currentSong->id == node->id)
                 return;
 
-        int id = node1->id;
-
-        Node *node2 = findSelectedEntryById(&playlist, id);
-
-        if (node1 != NULL)
-                deleteFromList(originalPlaylist, node1);
-
-        if (node2 != NULL)
-                deleteFromList(&playlist, node2);
+        deleteFromList(&playlist, node);
 
         child->isEnqueued = 0;
 
@@ -866,7 +786,7 @@ void enqueueSongs(FileSystemEntry *entry)
         {
                 if (entry->isDirectory)
                 {
-                        if (!hasSongChildren(entry) || (chosenDir != NULL && strcmp(entry->fullPath, chosenDir->fullPath) == 0))
+                        if (!hasSongChildren(entry) || entry == chosenDir)
                         {
                                 if (hasDequeuedChildren(entry))
                                 {
@@ -925,6 +845,58 @@ void enqueueSongs(FileSystemEntry *entry)
         updateLastPlaylistChangeTime();
 }
 
+// Joins a batch of songs that already have ids onto the end of the queue
+void appendSongsToPlaylist(PlayList *batch, bool reshuffle)
+{
+        pthread_mutex_lock(&(playlist.mutex));
+
+        bool wasLast = (currentSong != NULL && getListNext(currentSong) == NULL);
+
+        joinPlaylist(&playlist, batch);
+
+        // Reshuffles the stored play order from the current song on, the list as shown stays as it was found
+        if (reshuffle)
+        {
+                shufflePlayOrder(&playlist, currentSong);
+                setShuffled(&playlist, true, currentSong);
+        }
+
+        pthread_mutex_unlock(&(playlist.mutex));
+
+        if (reshuffle && !isShuffleEnabled())
+        {
+                setShuffleEnabled(true);
+                emitBooleanPropertyChanged("Shuffle", TRUE);
+        }
+
+        if (currentSong != NULL && (wasLast || reshuffle))
+        {
+                nextSong = NULL;
+                nextSongNeedsRebuilding = true;
+        }
+
+        if (currentSong != NULL && audioData.endOfListReached)
+        {
+                waitingForNext = true;
+                audioData.endOfListReached = false;
+        }
+
+        if (appState.currentView == PLAYLIST_VIEW)
+                refresh = true;
+}
+
+// Appends songs found by the playlist producer to the queue
+void drainProducedSongs()
+{
+        PlayList batch = {NULL, NULL, 0, PTHREAD_MUTEX_INITIALIZER, {0}, {0}};
+        bool reshuffle = false;
+
+        if (takeProducedSongs(&batch, &reshuffle) == 0 && !reshuffle)
+                return;
+
+        appendSongsToPlaylist(&batch, reshuffle);
+}
+
 void handleRemove()
 {
         if (refresh)
@@ -937,7 +909,7 @@ void handleRemove()
 
         bool rebuild = false;
 
-        Node *node = findSelectedEntry(originalPlaylist, chosenRow);
+        Node *node = findSelectedEntry(&playlist, chosenRow);
 
         if (node == NULL)
         {
@@ -963,20 +935,14 @@ void handleRemove()
 
         if (node != NULL && song != NULL)
         {
-                if (strcmp(song->song.filePath, node->song.filePath) == 0 || (currentSong != NULL && currentSong->next != NULL && id == currentSong->next->id))
+                if (song->track == node->track || (currentSong != NULL && getListNext(currentSong) != NULL && id == getListNext(currentSong)->id))
                         rebuild = true;
         }
 
         if (node != NULL)
-                markAsDequeued(getLibrary(), node->song.filePath);
-
-        Node *node2 = findSelectedEntryById(&playlist, id);
-
-        if (node != NULL)
-                deleteFromList(originalPlaylist, node);
+                markAsDequeued(node->track->pathId);
 
-        if (node2 != NULL)
-                deleteFromList(&playlist, node2);
+        deleteFromList(&playlist, node);
 
         updateLastPlaylistChangeTime();
 
@@ -991,7 +957,7 @@ void handleRemove()
                 nextSong = NULL;
                 updatePlaylist();
 
-                tryNextSong = currentSong->next;
+                tryNextSong = getListNext(currentSong);
                 nextSongNeedsRebuilding = false;
                 nextSong = NULL;
                 nextSong = getListNext(currentSong);
@@ -1016,15 +982,14 @@ Node *getSongByNumber(PlayList *playlist, int songNumber)
                 return song;
         }
 
-        int count = 1;
-
-        while (song->next != NULL && count != songNumber)
+        if (songNumber > playlist->count)
         {
-                song = getListNext(song);
-                count++;
+                return playlist->tail;
         }
 
-        return song;
+        song = getNodeAtPosition(playlist, songNumber - 1);
+
+        return (song != NULL) ? song : playlist->tail;
 }
 
 int loadDecoder(SongData *songData, bool *songDataDeleted)
@@ -1037,14 +1002,20 @@ int loadDecoder(SongData *songData, bool *songDataDeleted)
                 // this should only be done for the second song, as switchAudioImplementation() handles the first one
                 if (!loadingdata.loadingFirstDecoder)
                 {
+                        const GaplessInfo *gapless = (songData->metadata != NULL) ? &songData->metadata->gapless : NULL;
+
+                        beginNextDecoderChange();
+
                         if (hasBuiltinDecoder(songData->filePath))
-                                result = prepareNextDecoder(songData->filePath);
+                                result = prepareNextDecoder(songData->filePath, gapless);
                         else if (endsWith(songData->filePath, "opus"))
                                 result = prepareNextOpusDecoder(songData->filePath);
                         else if (endsWith(songData->filePath, "ogg"))
                                 result = prepareNextVorbisDecoder(songData->filePath);
                         else if (endsWith(songData->filePath, "m4a") || endsWith(songData->filePath, "aac") || endsWith(songData->filePath, "mp4"))
-                                result = prepareNextM4aDecoder(songData->filePath);
+                                result = prepareNextM4aDecoder(songData->filePath, gapless);
+
+                        endNextDecoderChange();
                 }
         }
         return result;
@@ -1152,7 +1123,7 @@ void loadSong(Node *song, LoadingThreadData *loadingdata)
                 return;
         }
 
-        c_strcpy(loadingdata->filePath, sizeof(loadingdata->filePath), song->song.filePath);
+        c_strcpy(loadingdata->filePath, sizeof(loadingdata->filePath), song->track->path);
 
         pthread_t loadingThread;
         pthread_create(&loadingThread, NULL, songDataReaderThread, (void *)loadingdata);
@@ -1168,7 +1139,7 @@ void loadNext(LoadingThreadData *loadingdata)
         }
         else
         {
-                c_strcpy(loadingdata->filePath, sizeof(loadingdata->filePath), nextSong->song.filePath);
+                c_strcpy(loadingdata->filePath, sizeof(loadingdata->filePath), nextSong->track->path);
         }
 
         pthread_t loadingThread;
@@ -1212,7 +1183,7 @@ void loadNextSong()
 {
         songLoading = true;
         nextSongNeedsRebuilding = false;
-        tryNextSong = currentSong->next;
+        tryNextSong = getListNext(currentSong);
         loadingdata.loadA = !usingSongDataA;
         nextSong = getListNext(currentSong);
         loadingdata.loadingFirstDecoder = false;
@@ -1276,7 +1247,7 @@ void goPlaylistNext()
 void skipToNextSong()
 {
         // Stop if there is no song or no next song
-        if (currentSong == NULL || currentSong->next == NULL)
+        if (currentSong == NULL || getListNext(currentSong) == NULL)
         {
                 if (!isStopped() && !isPaused())
                         stop();
@@ -1303,15 +1274,15 @@ void skipToNextSong()
 
 void setCurrentSongToPrev()
 {
-        if (isShuffleEnabled() && currentSong != NULL && currentSong->prev == NULL)
+        if (isShuffleEnabled() && currentSong != NULL && getListPrev(currentSong) == NULL)
         {
-                if (currentSong->prev == NULL && currentSong->next != NULL)
-                        currentSong = currentSong->next;
+                if (getListNext(currentSong) != NULL)
+                        currentSong = getListNext(currentSong);
                 else
                         return;
         }
         else
-                currentSong = currentSong->prev;
+                currentSong = getListPrev(currentSong);
 }
 
 void goPlaylistPrev()
@@ -1345,7 +1316,7 @@ void goPlaylistPrev()
 void skipToPrevSong()
 {
         // Stop if there is no song or no previous song
-        if ((currentSong == NULL || currentSong->prev == NULL) && !isShuffleEnabled())
+        if ((currentSong == NULL || getListPrev(currentSong) == NULL) && !isShuffleEnabled())
         {
                 if (!isStopped() && !isPaused())
                         stop();
@@ -1409,7 +1380,7 @@ void skipToNumberedSong(int songNumber)
         songLoading = true;
         forceSkip = false;
 
-        currentSong = getSongByNumber(originalPlaylist, songNumber);
+        currentSong = getSongByNumber(&playlist, songNumber);
 
         loadingdata.loadA = !usingSongDataA;
         loadingdata.loadingFirstDecoder = true;
@@ -1437,18 +1408,10 @@ void skipToNumberedSong(int songNumber)
 
 void skipToLastSong()
 {
-        Node *song = playlist.head;
-
-        if (!song)
+        if (playlist.head == NULL)
                 return;
 
-        int count = 1;
-        while (song->next != NULL)
-        {
-                song = getListNext(song);
-                count++;
-        }
-        skipToNumberedSong(count);
+        skipToNumberedSong(playlist.count);
 }
 
 void loadFirstSong(Node *song)
@@ -1503,11 +1466,11 @@ int loadFirst(Node *song)
 
         usingSongDataA = true;
 
-        while (songHasErrors && currentSong->next != NULL)
+        while (songHasErrors && getListNext(currentSong) != NULL)
         {
                 songHasErrors = false;
                 loadedNextSong = false;
-                currentSong = currentSong->next;
+                currentSong = getListNext(currentSong);
                 loadFirstSong(currentSong);
         }
 
@@ -1526,111 +1489,147 @@ int loadFirst(Node *song)
         return 0;
 }
 
-void *updateLibraryThread(void *arg)
+// Swaps in a newly built tree, the old one is freed
+void publishLibrary(FileSystemEntry *tree, int numEntries)
 {
-        char *path = (char *)arg;
-        int tmpDirectoryTreeEntries = 0;
-
-        FileSystemEntry *temp = createDirectoryTree(path, &tmpDirectoryTreeEntries);
-
         pthread_mutex_lock(&switchMutex);
 
+        clearLibraryIndex();
         freeTree(library);
-        library = temp;
-        numDirectoryTreeEntries = tmpDirectoryTreeEntries;
+        library = tree;
+        indexLibrary(library);
+        invalidateLibraryRows();
+        numDirectoryTreeEntries = numEntries;
         resetChosenDir();
 
         pthread_mutex_unlock(&switchMutex);
 
         refresh = true;
-
-        return NULL;
 }
 
-void updateLibrary(char *path)
+// NULL until the first scan has been published, safe to call from any thread
+FileSystemEntry *getPublishedLibrary()
 {
-        pthread_t threadId;
+        pthread_mutex_lock(&switchMutex);
 
-        freeSearchResults();
+        FileSystemEntry *tree = library;
 
-        if (pthread_create(&threadId, NULL, updateLibraryThread, path) != 0)
-        {
-                perror("Failed to create thread");
-                return;
-        }
+        pthread_mutex_unlock(&switchMutex);
+
+        return tree;
 }
 
-void askIfCacheLibrary()
+void *updateLibraryThread(void *arg)
 {
-        if (cacheLibrary > -1) // Only use this function if cacheLibrary isn't set
-                return;
+        char *path = (char *)arg;
+        int tmpDirectoryTreeEntries = 0;
 
-        char input = '\0';
+        FileSystemEntry *temp = createDirectoryTree(path, &tmpDirectoryTreeEntries);
 
-        restoreTerminalMode();
-        enableInputBuffering();
-        showCursor();
+        // Exiting, the tree may be incomplete and the old one is about to be freed anyway
+        if (isDirectoryScanCancelled())
+                freeTree(temp);
+        else
+                publishLibrary(temp, tmpDirectoryTreeEntries);
 
-        printf("Would you like to enable a (local) library cache for quicker startup times?\nYou can update the cache at any time by pressing 'u'. (y/n): ");
+        setLibraryLoading(false);
 
-        fflush(stdout);
+        return NULL;
+}
 
-        do
-        {
-                int res = scanf(" %c", &input);
+void updateLibrary(char *path)
+{
+        // A search started from the command line may still be reading the library
+        if (isPlaylistProducerRunning() || isLibraryLoading())
+                return;
 
-                if (res < 0)
-                        break;
+        freeSearchResults();
 
-        } while (input != 'Y' && input != 'y' && input != 'N' && input != 'n');
+        // The previous load or update has finished, it only needs joining
+        waitForLibrary();
 
-        if (input == 'Y' || input == 'y')
-        {
-                printf("Y\n");
-                cacheLibrary = 1;
-        }
-        else
+        setLibraryLoading(true);
+
+        if (pthread_create(&libraryThread, NULL, updateLibraryThread, path) != 0)
         {
-                printf("N\n");
-                cacheLibrary = 0;
+                perror("Failed to create thread");
+                setLibraryLoading(false);
+                return;
         }
 
-        setNonblockingMode();
-        disableInputBuffering();
-        hideCursor();
+        libraryThreadStarted = true;
+        refresh = true;
 }
 
-void createLibrary(AppSettings *settings)
+void *loadLibraryThread(void *arg)
 {
+        const char *path = (const char *)arg;
+        FileSystemEntry *tree = NULL;
+        int numEntries = 0;
+
         if (cacheLibrary > 0)
         {
                 char *libFilepath = getLibraryFilePath();
-                library = reconstructTreeFromFile(libFilepath, settings->path, &numDirectoryTreeEntries);
+                tree = reconstructTreeFromFile(libFilepath, path, &numEntries);
                 free(libFilepath);
+
+                if (tree != NULL && tree->children == NULL)
+                {
+                        freeTree(tree);
+                        tree = NULL;
+                        numEntries = 0;
+                }
         }
 
-        if (library == NULL || library->children == NULL)
+        if (tree == NULL)
         {
                 struct timeval start, end;
 
                 gettimeofday(&start, NULL);
 
-                library = createDirectoryTree(settings->path, &numDirectoryTreeEntries);
+                tree = createDirectoryTree(path, &numEntries);
 
                 gettimeofday(&end, NULL);
                 long seconds = end.tv_sec - start.tv_sec;
                 long microseconds = end.tv_usec - start.tv_usec;
                 double elapsed = seconds + microseconds * 1e-6;
 
-                // If time to load the library was significant, ask to use cache instead
-                if (elapsed > ASK_IF_USE_CACHE_LIMIT_SECONDS)
-                {
-                        askIfCacheLibrary();
-                }
+                // Scanning is slow enough that reading the tree back from a file would pay off
+                if (elapsed > CACHE_LIBRARY_LIMIT_SECONDS && cacheLibrary < 0 && !isDirectoryScanCancelled())
+                        offerLibraryCache();
         }
 
-        if (library == NULL || library->children == NULL)
+        if (isDirectoryScanCancelled())
+                freeTree(tree);
+        else
+                publishLibrary(tree, numEntries);
+
+        setLibraryLoading(false);
+
+        return NULL;
+}
+
+// Starts reading the library in the background, the library view shows progress until it is published
+void createLibrary(AppSettings *settings)
+{
+        setLibraryLoading(true);
+
+        if (pthread_create(&libraryThread, NULL, loadLibraryThread, settings->path) != 0)
         {
-                exit(0);
+                perror("Failed to create thread");
+                loadLibraryThread(settings->path);
+                return;
         }
+
+        libraryThreadStarted = true;
+}
+
+// Joins the load or update thread, before another one starts and before exiting
+void waitForLibrary()
+{
+        if (!libraryThreadStarted)
+                return;
+
+        pthread_join(libraryThread, NULL);
+        libraryThreadStarted = false;
 }
@@ -68,6 +68,10 @@ void handleRemove();
 
 void enqueueSongs(FileSystemEntry *entry);
 
+void appendSongsToPlaylist(PlayList *batch, bool reshuffle);
+
+void drainProducedSongs();
+
 void updateLastSongSwitchTime(void);
 
 void updateLastInputTime(void);
@@ -130,12 +134,14 @@ void rebuildNextSong(Node *song);
 
 void updateLibrary(char *path);
 
-void askIfCacheLibrary();
-
 void unloadPreviousSong();
 
 void createLibrary(AppSettings *settings);
 
+FileSystemEntry *getPublishedLibrary(void);
+
+void waitForLibrary(void);
+
 void loadNextSong();
 
 void setCurrentSongToNext();
@@ -11,6 +11,7 @@ Playlist related functions.
 
 */
 #define MAX_SEARCH_SIZE 256
+#define MIN_INDEX_SIZE 1024
 
 #ifndef MAXPATHLEN
 #define MAXPATHLEN 4096
@@ -19,11 +20,9 @@ Playlist related functions.
 const char PLAYLIST_EXTENSIONS[] = "\\.(m3u)$";
 const char mainPlaylistName[] = "kew.m3u";
 
-// The playlist unshuffled as it appears in playlist view
-PlayList *originalPlaylist = NULL;
-
-// The (sometimes shuffled) sequence of songs that will be played
-PlayList playlist = {NULL, NULL, 0, PTHREAD_MUTEX_INITIALIZER};
+// The songs in the order they appear in playlist view. When shuffle is on
+// they are played in the order kept in playlist.order instead.
+PlayList playlist = {NULL, NULL, 0, PTHREAD_MUTEX_INITIALIZER, {0}, {0}};
 
 // The playlist from kew.m3u
 PlayList *specialPlaylist = NULL;
@@ -36,21 +35,449 @@ volatile int stopPlaylistDurationThread = 0;
 Node *currentSong = NULL;
 int nodeIdCounter = 0;
 
+// Next and previous song in the play order of the main playlist
 Node *getListNext(Node *node)
 {
-        return (node == NULL) ? NULL : node->next;
+        if (node == NULL)
+                return NULL;
+
+        return playlist.order.active ? node->shuffleNext : node->next;
 }
 
 Node *getListPrev(Node *node)
 {
-        return (node == NULL) ? NULL : node->prev;
+        if (node == NULL)
+                return NULL;
+
+        return playlist.order.active ? node->shufflePrev : node->prev;
 }
 
-void addToList(PlayList *list, Node *newNode)
+Node *getListHead(PlayList *list)
+{
+        return list->order.active ? list->order.head : list->head;
+}
+
+Node *getListTail(PlayList *list)
+{
+        return list->order.active ? list->order.tail : list->tail;
+}
+
+void appendToPlayOrder(PlayList *list, Node *node)
 {
-        if (list->count >= MAX_FILES)
+        node->shuffleNext = NULL;
+        node->shufflePrev = list->order.tail;
+
+        if (list->order.tail != NULL)
+                list->order.tail->shuffleNext = node;
+        else
+                list->order.head = node;
+
+        list->order.tail = node;
+}
+
+void removeFromPlayOrder(PlayList *list, Node *node)
+{
+        if (node->shufflePrev != NULL)
+                node->shufflePrev->shuffleNext = node->shuffleNext;
+        else if (list->order.head == node)
+                list->order.head = node->shuffleNext;
+
+        if (node->shuffleNext != NULL)
+                node->shuffleNext->shufflePrev = node->shufflePrev;
+        else if (list->order.tail == node)
+                list->order.tail = node->shufflePrev;
+
+        node->shuffleNext = NULL;
+        node->shufflePrev = NULL;
+}
+
+void prependToPlayOrder(PlayList *list, Node *node)
+{
+        node->shufflePrev = NULL;
+        node->shuffleNext = list->order.head;
+
+        if (list->order.head != NULL)
+                list->order.head->shufflePrev = node;
+        else
+                list->order.tail = node;
+
+        list->order.head = node;
+}
+
+// Stores a new random play order, starting with first if it is given
+void shufflePlayOrder(PlayList *list, Node *first)
+{
+        list->order.head = NULL;
+        list->order.tail = NULL;
+        list->order.stored = true;
+
+        if (list->count == 0)
                 return;
 
+        Node **nodes = (Node **)malloc(list->count * sizeof(Node *));
+        if (nodes == NULL)
+        {
+                printf("Memory allocation error.\n");
+                exit(0);
+        }
+
+        int i = 0;
+        for (Node *node = list->head; node != NULL; node = node->next)
+                nodes[i++] = node;
+
+        for (int j = list->count - 1; j >= 1; --j)
+        {
+                int k = rand() % (j + 1);
+                Node *temp = nodes[j];
+                nodes[j] = nodes[k];
+                nodes[k] = temp;
+        }
+
+        for (int j = 0; j < list->count; ++j)
+        {
+                if (nodes[j] != first)
+                        appendToPlayOrder(list, nodes[j]);
+        }
+
+        if (first != NULL)
+                prependToPlayOrder(list, first);
+
+        free(nodes);
+}
+
+// Switches between playing in list order and the stored shuffled order.
+// Only the first switch to shuffle has to build the order; after that it
+// is enough to move the song given as first to the front of it.
+void setShuffled(PlayList *list, bool shuffled, Node *first)
+{
+        if (shuffled)
+        {
+                if (!list->order.stored)
+                {
+                        shufflePlayOrder(list, first);
+                }
+                else if (first != NULL && first != list->order.head)
+                {
+                        removeFromPlayOrder(list, first);
+                        prependToPlayOrder(list, first);
+                }
+        }
+
+        list->order.active = shuffled;
+}
+
+void freePlaylistIndex(PlayList *list)
+{
+        free(list->index.positions);
+        free(list->index.slotCounts);
+        free(list->index.buckets);
+        free(list->index.pathBuckets);
+        list->index.positions = NULL;
+        list->index.slotCounts = NULL;
+        list->index.positionsCapacity = 0;
+        list->index.slotCount = 0;
+        list->index.positionsValid = false;
+        list->index.buckets = NULL;
+        list->index.pathBuckets = NULL;
+        list->index.bucketCount = 0;
+        list->index.bucketsValid = false;
+}
+
+void invalidatePlaylistIndex(PlayList *list)
+{
+        list->index.positionsValid = false;
+        list->index.bucketsValid = false;
+}
+
+unsigned int idToBucket(int id, int bucketCount)
+{
+        // bucketCount is always a power of two
+        return ((unsigned int)id * 2654435761u) & (unsigned int)(bucketCount - 1);
+}
+
+void addToBuckets(PlayList *list, Node *node)
+{
+        unsigned int bucket = idToBucket(node->id, list->index.bucketCount);
+
+        node->nextInBucket = list->index.buckets[bucket];
+        list->index.buckets[bucket] = node;
+
+        bucket = idToBucket(node->track->pathId, list->index.bucketCount);
+
+        node->nextWithPath = list->index.pathBuckets[bucket];
+        list->index.pathBuckets[bucket] = node;
+}
+
+void removeFromBuckets(PlayList *list, Node *node)
+{
+        Node **link = &list->index.buckets[idToBucket(node->id, list->index.bucketCount)];
+
+        while (*link != NULL)
+        {
+                if (*link == node)
+                {
+                        *link = node->nextInBucket;
+                        break;
+                }
+                link = &(*link)->nextInBucket;
+        }
+        node->nextInBucket = NULL;
+
+        link = &list->index.pathBuckets[idToBucket(node->track->pathId, list->index.bucketCount)];
+
+        while (*link != NULL)
+        {
+                if (*link == node)
+                {
+                        *link = node->nextWithPath;
+                        break;
+                }
+                link = &(*link)->nextWithPath;
+        }
+        node->nextWithPath = NULL;
+}
+
+int rebuildBuckets(PlayList *list)
+{
+        int bucketCount = MIN_INDEX_SIZE;
+
+        while (bucketCount < list->count)
+                bucketCount *= 2;
+
+        if (bucketCount != list->index.bucketCount)
+        {
+                Node **buckets = calloc(bucketCount, sizeof(Node *));
+                Node **pathBuckets = calloc(bucketCount, sizeof(Node *));
+                if (buckets == NULL || pathBuckets == NULL)
+                {
+                        free(buckets);
+                        free(pathBuckets);
+                        return -1;
+                }
+
+                free(list->index.buckets);
+                free(list->index.pathBuckets);
+                list->index.buckets = buckets;
+                list->index.pathBuckets = pathBuckets;
+                list->index.bucketCount = bucketCount;
+        }
+        else
+        {
+                memset(list->index.buckets, 0, bucketCount * sizeof(Node *));
+                memset(list->index.pathBuckets, 0, bucketCount * sizeof(Node *));
+        }
+
+        // Chains run from the tail towards the head, the same order appends leave them in
+        for (Node *node = list->head; node != NULL; node = node->next)
+        {
+                addToBuckets(list, node);
+        }
+
+        list->index.bucketsValid = true;
+
+        return 0;
+}
+
+int reservePositions(PlayList *list, int capacity)
+{
+        if (capacity <= list->index.positionsCapacity)
+                return 0;
+
+        int newCapacity = (list->index.positionsCapacity > 0) ? list->index.positionsCapacity : MIN_INDEX_SIZE;
+
+        while (newCapacity < capacity)
+                newCapacity *= 2;
+
+        Node **positions = realloc(list->index.positions, newCapacity * sizeof(Node *));
+        if (positions == NULL)
+                return -1;
+
+        list->index.positions = positions;
+
+        int *slotCounts = realloc(list->index.slotCounts, (newCapacity + 1) * sizeof(int));
+        if (slotCounts == NULL)
+                return -1;
+
+        list->index.slotCounts = slotCounts;
+        list->index.positionsCapacity = newCapacity;
+
+        return 0;
+}
+
+void addToSlotCount(PlayListIndex *index, int slot, int delta)
+{
+        for (int i = slot + 1; i <= index->positionsCapacity; i += i & -i)
+                index->slotCounts[i] += delta;
+}
+
+// Number of slots in use before slot, which is the row of the node in it
+int countSlotsBefore(const PlayListIndex *index, int slot)
+{
+        int count = 0;
+
+        for (int i = slot; i > 0; i -= i & -i)
+                count += index->slotCounts[i];
+
+        return count;
+}
+
+// The slot holding the node at row, row has to be less than the list's count
+int findSlot(const PlayListIndex *index, int row)
+{
+        int slot = 0;
+
+        for (int step = index->positionsCapacity; step > 0; step >>= 1)
+        {
+                if (slot + step <= index->positionsCapacity && index->slotCounts[slot + step] <= row)
+                {
+                        slot += step;
+                        row -= index->slotCounts[slot];
+                }
+        }
+
+        return slot;
+}
+
+int rebuildPositions(PlayList *list)
+{
+        // Room to append as many again before the next rebuild
+        if (reservePositions(list, list->count * 2 + 1) < 0)
+                return -1;
+
+        int capacity = list->index.positionsCapacity;
+        int *slotCounts = list->index.slotCounts;
+
+        memset(slotCounts, 0, (capacity + 1) * sizeof(int));
+
+        int i = 0;
+        for (Node *node = list->head; node != NULL && i < list->count; node = node->next)
+        {
+                list->index.positions[i] = node;
+                node->slot = i;
+                slotCounts[i + 1] = 1;
+                i++;
+        }
+
+        for (int j = 1; j <= capacity; j++)
+        {
+                int parent = j + (j & -j);
+
+                if (parent <= capacity)
+                        slotCounts[parent] += slotCounts[j];
+        }
+
+        list->index.slotCount = i;
+        list->index.positionsValid = true;
+
+        return 0;
+}
+
+// Gives a node just added at the end of the list the next slot
+void appendPosition(PlayList *list, Node *node)
+{
+        if (!list->index.positionsValid)
+                return;
+
+        if (list->index.slotCount >= list->index.positionsCapacity)
+        {
+                list->index.positionsValid = false;
+                return;
+        }
+
+        int slot = list->index.slotCount++;
+
+        list->index.positions[slot] = node;
+        node->slot = slot;
+        addToSlotCount(&list->index, slot, 1);
+}
+
+// Empties the slot of a node about to be removed, the list's count not yet lowered
+void removePosition(PlayList *list, Node *node)
+{
+        if (!list->index.positionsValid)
+                return;
+
+        int slot = node->slot;
+
+        if (slot < 0 || slot >= list->index.slotCount || list->index.positions[slot] != node)
+                return;
+
+        list->index.positions[slot] = NULL;
+        addToSlotCount(&list->index, slot, -1);
+
+        if (slot == list->index.slotCount - 1)
+                list->index.slotCount--;
+
+        if ((list->count - 1) * 2 < list->index.slotCount)
+                list->index.positionsValid = false;
+}
+
+Node *findNodeById(PlayList *list, int id)
+{
+        if (list == NULL || list->head == NULL)
+                return NULL;
+
+        if (!list->index.bucketsValid && rebuildBuckets(list) < 0)
+        {
+                // Out of memory, fall back to walking the list
+                for (Node *node = list->head; node != NULL; node = node->next)
+                {
+                        if (node->id == id)
+                                return node;
+                }
+                return NULL;
+        }
+
+        Node *node = list->index.buckets[idToBucket(id, list->index.bucketCount)];
+
+        while (node != NULL && node->id != id)
+                node = node->nextInBucket;
+
+        return node;
+}
+
+Node *getNodeAtPosition(PlayList *list, int position)
+{
+        if (list == NULL || position < 0 || position >= list->count)
+                return NULL;
+
+        if (!list->index.positionsValid && rebuildPositions(list) < 0)
+        {
+                Node *node = list->head;
+                for (int i = 0; node != NULL && i < position; i++)
+                        node = node->next;
+                return node;
+        }
+
+        return list->index.positions[findSlot(&list->index, position)];
+}
+
+int getNodePosition(PlayList *list, Node *node)
+{
+        if (list == NULL || node == NULL)
+                return -1;
+
+        if (!list->index.positionsValid && rebuildPositions(list) < 0)
+        {
+                int row = 0;
+                for (Node *current = list->head; current != NULL; current = current->next)
+                {
+                        if (current == node)
+                                return row;
+                        row++;
+                }
+                return -1;
+        }
+
+        // The node might belong to another list
+        if (node->slot < 0 || node->slot >= list->index.slotCount || list->index.positions[node->slot] != node)
+                return -1;
+
+        return countSlotsBefore(&list->index, node->slot);
+}
+
+void addToList(PlayList *list, Node *newNode)
+{
         list->count++;
 
         if (list->head == NULL)
@@ -65,6 +492,19 @@ void addToList(PlayList *list, Node *newNode)
                 list->tail->next = newNode;
                 list->tail = newNode;
         }
+
+        if (list->order.stored)
+                appendToPlayOrder(list, newNode);
+
+        appendPosition(list, newNode);
+
+        if (list->index.bucketsValid)
+        {
+                if (list->count > list->index.bucketCount * 2)
+                        list->index.bucketsValid = false;
+                else
+                        addToBuckets(list, newNode);
+        }
 }
 
 Node *deleteFromList(PlayList *list, Node *node)
@@ -89,8 +529,15 @@ Node *deleteFromList(PlayList *list, Node *node)
         if (node->next != NULL)
                 node->next->prev = node->prev;
 
-        if (node->song.filePath != NULL)
-                free(node->song.filePath);
+        if (list->index.bucketsValid)
+                removeFromBuckets(list, node);
+
+        if (list->order.stored)
+                removeFromPlayOrder(list, node);
+
+        removePosition(list, node);
+
+        releaseTrack(node->track);
 
         Node *nextNode = node->next;
 
@@ -108,7 +555,7 @@ void deletePlaylist(PlayList *list)
         while (current != NULL)
         {
                 Node *next = current->next;
-                free(current->song.filePath);
+                releaseTrack(current->track);
                 free(current);
                 current = next;
         }
@@ -117,6 +564,11 @@ void deletePlaylist(PlayList *list)
         list->head = NULL;
         list->tail = NULL;
         list->count = 0;
+        list->order.head = NULL;
+        list->order.tail = NULL;
+        list->order.stored = list->order.active;
+
+        freePlaylistIndex(list);
 }
 
 void shufflePlaylist(PlayList *playlist)
@@ -158,6 +610,8 @@ void shufflePlaylist(PlayList *playlist)
                 nodes[j]->prev = (j > 0) ? nodes[j - 1] : NULL;
         }
         free(nodes);
+
+        playlist->index.positionsValid = false;
 }
 
 void insertAsFirst(Node *currentSong, PlayList *playlist)
@@ -199,6 +653,8 @@ void insertAsFirst(Node *currentSong, PlayList *playlist)
                         playlist->head = currentSong;
                 }
         }
+
+        playlist->index.positionsValid = false;
 }
 
 void shufflePlaylistStartingFromSong(PlayList *playlist, Node *song)
@@ -229,40 +685,47 @@ int compare(const struct dirent **a, const struct dirent **b)
 
 void createNode(Node **node, const char *directoryPath, int id)
 {
-        SongInfo song;
-        song.filePath = strdup(directoryPath);
-        song.duration = 0.0;
+        Track *track = acquireTrack(directoryPath);
 
         *node = (Node *)malloc(sizeof(Node));
-        if (*node == NULL)
+        if (*node == NULL || track == NULL)
         {
                 printf("Failed to allocate memory.");
                 exit(0);
                 return;
         }
 
-        (*node)->song = song;
+        (*node)->track = track;
         (*node)->next = NULL;
         (*node)->prev = NULL;
         (*node)->id = id;
+        (*node)->slot = -1;
+        (*node)->nextInBucket = NULL;
+        (*node)->nextWithPath = NULL;
+        (*node)->shuffleNext = NULL;
+        (*node)->shufflePrev = NULL;
 }
 
-void buildPlaylistRecursive(const char *directoryPath, const char *allowedExtensions, PlayList *playlist)
+// Songs are handed over to the playlist producer as soon as they are found.
+// Returns the number of songs found.
+int buildPlaylistRecursive(const char *directoryPath, const char *allowedExtensions, PlayList *playlist)
 {
+        int numSongs = 0;
         int res = isDirectory(directoryPath);
         if (res != 1 && res != -1 && directoryPath != NULL)
         {
                 Node *node = NULL;
-                createNode(&node, directoryPath, nodeIdCounter++);
+                createNode(&node, directoryPath, -1);
                 addToList(playlist, node);
-                return;
+                offerProducedSongs(playlist);
+                return 1;
         }
 
         DIR *dir = opendir(directoryPath);
         if (dir == NULL)
         {
                 printf("Failed to open directory: %s\n", directoryPath);
-                return;
+                return 0;
         }
 
         regex_t regex;
@@ -271,7 +734,7 @@ void buildPlaylistRecursive(const char *directoryPath, const char *allowedExtens
         {
                 printf("Failed to compile regular expression\n");
                 closedir(dir);
-                return;
+                return 0;
         }
 
         char exto[6];
@@ -281,10 +744,12 @@ void buildPlaylistRecursive(const char *directoryPath, const char *allowedExtens
         if (numEntries < 0)
         {
                 printf("Failed to scan directory: %s\n", directoryPath);
-                return;
+                closedir(dir);
+                regfree(&regex);
+                return 0;
         }
 
-        for (int i = 0; i < numEntries && playlist->count < MAX_FILES; i++)
+        for (int i = 0; i < numEntries && !producerStopRequested(); i++)
         {
                 struct dirent *entry = entries[i];
 
@@ -298,10 +763,15 @@ void buildPlaylistRecursive(const char *directoryPath, const char *allowedExtens
 
                 if (isDirectory(filePath))
                 {
-                        int songCount = playlist->count;
-                        buildPlaylistRecursive(filePath, allowedExtensions, playlist);
-                        if (playlist->count > songCount)
-                                numDirs++;
+                        int dirSongs = buildPlaylistRecursive(filePath, allowedExtensions, playlist);
+                        if (dirSongs > 0)
+                        {
+                                numSongs += dirSongs;
+
+                                // Songs from more than one directory get shuffled
+                                if (++numDirs > 1)
+                                        shuffleProducedSongs();
+                        }
                 }
                 else
                 {
@@ -311,8 +781,10 @@ void buildPlaylistRecursive(const char *directoryPath, const char *allowedExtens
                                 snprintf(filePath, sizeof(filePath), "%s/%s", directoryPath, entry->d_name);
 
                                 Node *node = NULL;
-                                createNode(&node, filePath, nodeIdCounter++);
+                                createNode(&node, filePath, -1);
                                 addToList(playlist, node);
+                                offerProducedSongs(playlist);
+                                numSongs++;
                         }
                 }
         }
@@ -325,6 +797,8 @@ void buildPlaylistRecursive(const char *directoryPath, const char *allowedExtens
 
         closedir(dir);
         regfree(&regex);
+
+        return numSongs;
 }
 
 int playDirectory(const char *directoryPath, const char *allowedExtensions, PlayList *playlist)
@@ -359,34 +833,325 @@ int playDirectory(const char *directoryPath, const char *allowedExtensions, Play
         }
         closedir(dir);
 
-        return 0;
+        return 0;
+}
+
+int joinPlaylist(PlayList *dest, PlayList *src)
+{
+        if (src->count == 0)
+        {
+                return 0;
+        }
+
+        if (dest->count == 0)
+        {
+                dest->head = src->head;
+                dest->tail = src->tail;
+        }
+        else
+        {
+                dest->tail->next = src->head;
+                src->head->prev = dest->tail;
+                dest->tail = src->tail;
+        }
+        dest->count += src->count;
+
+        if (dest->index.bucketsValid && dest->count > dest->index.bucketCount * 2)
+                dest->index.bucketsValid = false;
+
+        for (Node *node = src->head; node != NULL; node = node->next)
+        {
+                if (dest->order.stored)
+                        appendToPlayOrder(dest, node);
+
+                appendPosition(dest, node);
+
+                if (dest->index.bucketsValid)
+                        addToBuckets(dest, node);
+        }
+
+        src->head = NULL;
+        src->tail = NULL;
+        src->count = 0;
+        src->order.head = NULL;
+        src->order.tail = NULL;
+
+        invalidatePlaylistIndex(src);
+
+        return 1;
+}
+
+void assignNodeIds(PlayList *list)
+{
+        for (Node *node = list->head; node != NULL; node = node->next)
+                node->id = nodeIdCounter++;
+
+        // The rows stay the same
+        list->index.bucketsValid = false;
+}
+
+typedef struct
+{
+        pthread_t thread;
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        PlaylistFillFunc fill;
+        void *arg;
+        PlayList produced; // Songs in play order, waiting to be taken by the main thread
+        Node **pool;       // Shuffle mode: songs found but not yet given a place in the play order
+        int poolSize;
+        int poolCapacity;
+        int numFound;
+        int numOrdered;
+        bool shuffle;
+        bool reshuffle; // Switched to shuffle mode after songs had already been taken
+        bool appending; // The songs go after others already in the playlist
+        int batchSize;  // Songs offerProducedSongs collects before handing them over, producer thread only
+        bool running;
+        bool started;
+        volatile bool stop;
+} PlaylistProducer;
+
+PlaylistProducer producer = {.mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+
+// Caller holds producer.mutex
+void orderRandomPoolSong(void)
+{
+        int i = rand() % producer.poolSize;
+        Node *node = producer.pool[i];
+
+        producer.pool[i] = producer.pool[--producer.poolSize];
+        node->next = NULL;
+        node->prev = NULL;
+        addToList(&producer.produced, node);
+        producer.numOrdered++;
+}
+
+// Caller holds producer.mutex
+int addToPool(PlayList *pending)
+{
+        int needed = producer.poolSize + pending->count;
+
+        if (needed > producer.poolCapacity)
+        {
+                int newCapacity = (producer.poolCapacity > 0) ? producer.poolCapacity : 256;
+
+                while (newCapacity < needed)
+                        newCapacity *= 2;
+
+                Node **pool = realloc(producer.pool, newCapacity * sizeof(Node *));
+                if (pool == NULL)
+                        return -1;
+
+                producer.pool = pool;
+                producer.poolCapacity = newCapacity;
+        }
+
+        Node *node = pending->head;
+        while (node != NULL)
+        {
+                Node *next = node->next;
+                producer.pool[producer.poolSize++] = node;
+                node = next;
+        }
+
+        producer.numFound += pending->count;
+        pending->head = NULL;
+        pending->tail = NULL;
+        pending->count = 0;
+
+        return 0;
+}
+
+void flushProducedSongs(PlayList *pending)
+{
+        if (pending == NULL || pending->count == 0)
+                return;
+
+        pthread_mutex_lock(&producer.mutex);
+
+        if (producer.shuffle && addToPool(pending) == 0)
+        {
+                // Each song placed in the play order is drawn at random from everything
+                // found so far, while about half of what has been found is held back
+                while (producer.poolSize > 0 && producer.numOrdered * 2 < producer.numFound)
+                        orderRandomPoolSong();
+        }
+        else
+        {
+                producer.numFound += pending->count;
+                producer.numOrdered += pending->count;
+                joinPlaylist(&producer.produced, pending);
+        }
+
+        pthread_cond_signal(&producer.cond);
+
+        pthread_mutex_unlock(&producer.mutex);
+}
+
+// Hands pending over once it holds batchSize songs. The first song goes right away so playback can start,
+// after that the batches double up to PRODUCER_BATCH_SONGS and the lock is taken once per batch.
+void offerProducedSongs(PlayList *pending)
+{
+        if (pending == NULL || pending->count < producer.batchSize)
+                return;
+
+        flushProducedSongs(pending);
+
+        if (producer.batchSize < PRODUCER_BATCH_SONGS)
+                producer.batchSize *= 2;
+}
+
+void shuffleProducedSongs(void)
+{
+        pthread_mutex_lock(&producer.mutex);
+
+        if (!producer.shuffle)
+        {
+                int numTaken = producer.numOrdered - producer.produced.count;
+
+                producer.shuffle = true;
+                producer.numFound -= producer.produced.count;
+                producer.numOrdered = numTaken;
+
+                if (addToPool(&producer.produced) < 0)
+                {
+                        producer.shuffle = false;
+                        producer.numFound += producer.produced.count;
+                        producer.numOrdered += producer.produced.count;
+                }
+                else
+                {
+                        // Songs the main thread already has get shuffled there instead, unless
+                        // they were added to a queue that was there before and has to stay as it is
+                        producer.reshuffle = (numTaken > 0 && !producer.appending);
+                }
+        }
+
+        pthread_mutex_unlock(&producer.mutex);
+}
+
+bool producerStopRequested(void)
+{
+        return producer.stop;
+}
+
+void *playlistProducerThread(void *arg)
+{
+        (void)arg;
+
+        PlayList pending = {NULL, NULL, 0, PTHREAD_MUTEX_INITIALIZER, {0}, {0}};
+
+        producer.fill(&pending, producer.arg);
+
+        flushProducedSongs(&pending);
+
+        pthread_mutex_lock(&producer.mutex);
+
+        while (producer.poolSize > 0)
+                orderRandomPoolSong();
+
+        producer.running = false;
+        pthread_cond_broadcast(&producer.cond);
+
+        pthread_mutex_unlock(&producer.mutex);
+
+        deletePlaylist(&pending);
+
+        return NULL;
+}
+
+void startPlaylistProducer(PlaylistFillFunc fill, void *arg, bool shuffle)
+{
+        if (producer.started)
+                stopPlaylistProducer();
+
+        producer.fill = fill;
+        producer.arg = arg;
+        producer.shuffle = shuffle;
+        producer.reshuffle = false;
+        producer.appending = (playlist.count > 0);
+        producer.batchSize = 1;
+        producer.numFound = 0;
+        producer.numOrdered = 0;
+        producer.stop = false;
+        producer.running = true;
+        numDirs = 0;
+        producer.started = true;
+
+        if (pthread_create(&producer.thread, NULL, playlistProducerThread, NULL) != 0)
+        {
+                perror("Failed to create thread");
+                producer.started = false;
+                playlistProducerThread(NULL);
+        }
+}
+
+bool waitForProducedSongs(void)
+{
+        pthread_mutex_lock(&producer.mutex);
+
+        while (producer.produced.count == 0 && producer.running)
+                pthread_cond_wait(&producer.cond, &producer.mutex);
+
+        bool hasSongs = producer.produced.count > 0;
+
+        pthread_mutex_unlock(&producer.mutex);
+
+        return hasSongs;
+}
+
+int takeProducedSongs(PlayList *dest, bool *reshuffle)
+{
+        pthread_mutex_lock(&producer.mutex);
+
+        int count = producer.produced.count;
+
+        // Ids are only handed out on the main thread
+        assignNodeIds(&producer.produced);
+        joinPlaylist(dest, &producer.produced);
+
+        if (reshuffle != NULL)
+                *reshuffle = producer.reshuffle;
+        producer.reshuffle = false;
+
+        pthread_mutex_unlock(&producer.mutex);
+
+        return count;
+}
+
+bool isPlaylistProducerRunning(void)
+{
+        pthread_mutex_lock(&producer.mutex);
+
+        bool running = producer.running;
+
+        pthread_mutex_unlock(&producer.mutex);
+
+        return running;
 }
 
-int joinPlaylist(PlayList *dest, PlayList *src)
+void stopPlaylistProducer(void)
 {
-        if (src->count == 0)
-        {
-                return 0;
-        }
+        if (!producer.started)
+                return;
 
-        if (dest->count == 0)
-        {
-                dest->head = src->head;
-                dest->tail = src->tail;
-        }
-        else
+        producer.stop = true;
+        pthread_join(producer.thread, NULL);
+        producer.started = false;
+
+        deletePlaylist(&producer.produced);
+
+        for (int i = 0; i < producer.poolSize; i++)
         {
-                dest->tail->next = src->head;
-                src->head->prev = dest->tail;
-                dest->tail = src->tail;
+                releaseTrack(producer.pool[i]->track);
+                free(producer.pool[i]);
         }
-        dest->count += src->count;
-
-        src->head = NULL;
-        src->tail = NULL;
-        src->count = 0;
 
-        return 1;
+        free(producer.pool);
+        producer.pool = NULL;
+        producer.poolSize = 0;
+        producer.poolCapacity = 0;
 }
 
 void makePlaylistName(const char *search)
@@ -446,40 +1211,90 @@ void readM3UFile(const char *filename, PlayList *playlist)
                         strcat(songPath, line);
 
                         Node *newNode = NULL;
-                        createNode(&newNode, songPath, nodeIdCounter++);
+                        createNode(&newNode, songPath, -1);
+                        addToList(playlist, newNode);
+                }
+        }
+        fclose(file);
+}
+
+typedef struct
+{
+        char search[MAX_SEARCH_SIZE];
+        char path[MAXPATHLEN];
+        const char *allowedExtensions;
+        enum SearchType searchType;
+        bool exactSearch;
+        bool readPlaylists;
+        FileSystemEntry *library;
+} SearchFillArgs;
+
+SearchFillArgs searchFillArgs;
+
+void fillFromSearch(PlayList *pending, void *arg)
+{
+        SearchFillArgs *args = (SearchFillArgs *)arg;
+
+        if (args->searchType == ReturnAllSongs)
+        {
+                buildPlaylistRecursive(args->path, args->allowedExtensions, pending);
+                return;
+        }
+
+        const char *delimiter = ":";
+        char *savePtr = NULL;
+        char *token = strtok_r(args->search, delimiter, &savePtr);
 
-                        if (playlist->head == NULL)
+        while (token != NULL && !producerStopRequested())
+        {
+                char buf[MAXPATHLEN] = {0};
+                if (strncmp(token, "song", 4) == 0)
+                {
+                        memmove(token, token + 4, strlen(token + 4) + 1);
+                        args->searchType = FileOnly;
+                }
+                trim(token);
+
+                // The library only holds audio files, so playlists are always searched for on disk
+                bool found = (args->library != NULL && !args->readPlaylists &&
+                              findInDirectoryTree(args->library->children, token, buf, args->searchType, args->exactSearch) == 0);
+
+                if (!found)
+                        found = (walker(args->path, token, buf, args->allowedExtensions, args->searchType, args->exactSearch) == 0);
+
+                if (found)
+                {
+                        if (args->readPlaylists)
                         {
-                                playlist->head = newNode;
-                                playlist->tail = newNode;
+                                readM3UFile(buf, pending);
+                                flushProducedSongs(pending);
                         }
                         else
                         {
-                                playlist->tail->next = newNode;
-                                newNode->prev = playlist->tail;
-                                playlist->tail = newNode;
+                                buildPlaylistRecursive(buf, args->allowedExtensions, pending);
+                                flushProducedSongs(pending);
                         }
-
-                        playlist->count++;
                 }
+
+                token = strtok_r(NULL, delimiter, &savePtr);
         }
-        fclose(file);
 }
 
-int makePlaylist(int argc, char *argv[], bool exactSearch, const char *path)
+// Turns a search from the command line into arguments for fillFromSearch, returns true if the results should be shuffled
+bool parseSearch(int argc, char *argv[], bool exactSearch, const char *path, FileSystemEntry *library, SearchFillArgs *args)
 {
         enum SearchType searchType = SearchAny;
         int searchTypeIndex = 1;
+        bool mix = false;
 
         const char *delimiter = ":";
-        PlayList partialPlaylist = {NULL, NULL, 0, PTHREAD_MUTEX_INITIALIZER};
 
         const char *allowedExtensions = AUDIO_EXTENSIONS;
 
         if (strcmp(argv[1], "all") == 0)
         {
                 searchType = ReturnAllSongs;
-                shuffle = true;
+                mix = true;
         }
 
         if (argc > 1)
@@ -500,7 +1315,7 @@ int makePlaylist(int argc, char *argv[], bool exactSearch, const char *path)
                         if (count > 2)
                         {
                                 searchTypeIndex = 2;
-                                shuffle = true;
+                                mix = true;
                         }
                 }
 
@@ -514,72 +1329,71 @@ int makePlaylist(int argc, char *argv[], bool exactSearch, const char *path)
         if (searchType == FileOnly || searchType == DirOnly || searchType == SearchPlayList)
                 start = searchTypeIndex + 2;
 
-        search[0] = '\0';
+        args->search[0] = '\0';
 
         for (int i = start - 1; i < argc; i++)
         {
-                strcat(search, " ");
-                strcat(search, argv[i]);
+                size_t length = strlen(args->search);
+                snprintf(args->search + length, sizeof(args->search) - length, " %s", argv[i]);
         }
-        makePlaylistName(search);
 
-        if (strstr(search, delimiter))
+        if (strstr(args->search, delimiter))
         {
-                shuffle = true;
+                mix = true;
         }
 
-        if (searchType == ReturnAllSongs)
-        {
-                pthread_mutex_lock(&(playlist.mutex));
+        c_strcpy(args->path, sizeof(args->path), path);
+        args->allowedExtensions = allowedExtensions;
+        args->searchType = searchType;
+        args->exactSearch = exactSearch;
+        args->readPlaylists = (strcmp(argv[1], "list") == 0);
+        args->library = library;
 
-                buildPlaylistRecursive(path, allowedExtensions, &playlist);
+        return mix;
+}
 
-                pthread_mutex_unlock(&(playlist.mutex));
-        }
-        else
-        {
-                char *token = strtok(search, delimiter);
+int makePlaylist(int argc, char *argv[], bool exactSearch, const char *path, FileSystemEntry *library)
+{
+        if (parseSearch(argc, argv, exactSearch, path, library, &searchFillArgs))
+                shuffle = true;
 
-                while (token != NULL)
-                {
-                        char buf[MAXPATHLEN] = {0};
-                        if (strncmp(token, "song", 4) == 0)
-                        {
-                                memmove(token, token + 4, strlen(token + 4) + 1);
-                                searchType = FileOnly;
-                        }
-                        trim(token);
-                        if (walker(path, token, buf, allowedExtensions, searchType, exactSearch) == 0)
-                        {
-                                if (strcmp(argv[1], "list") == 0)
-                                {
-                                        readM3UFile(buf, &playlist);
-                                }
-                                else
-                                {
-                                        pthread_mutex_lock(&(playlist.mutex));
-
-                                        buildPlaylistRecursive(buf, allowedExtensions, &partialPlaylist);
-                                        joinPlaylist(&playlist, &partialPlaylist);
-
-                                        pthread_mutex_unlock(&(playlist.mutex));
-                                }
-                        }
+        c_strcpy(search, sizeof(search), searchFillArgs.search);
+        makePlaylistName(search);
 
-                        token = strtok(NULL, delimiter);
-                }
-        }
-        if (numDirs > 1)
-                shuffle = true;
-        if (shuffle)
-                shufflePlaylist(&playlist);
+        // The search and directory walk run on the producer thread, playback
+        // starts as soon as the first song has been found
+        startPlaylistProducer(fillFromSearch, &searchFillArgs, shuffle);
 
-        if (playlist.head == NULL)
+        if (!waitForProducedSongs())
                 printf("Music not found\n");
 
         return 0;
 }
 
+SearchFillArgs enqueueFillArgs;
+
+// Adds what a command line search finds to the end of the playlist. The
+// producer must be idle and everything it found already taken.
+void enqueueSearch(int argc, char *argv[], bool exactSearch, const char *path, FileSystemEntry *library)
+{
+        bool mix = parseSearch(argc, argv, exactSearch, path, library, &enqueueFillArgs);
+
+        startPlaylistProducer(fillFromSearch, &enqueueFillArgs, mix);
+}
+
+// Adds every song under a directory to the end of the playlist, same conditions as enqueueSearch
+void enqueueDirectory(const char *path)
+{
+        enqueueFillArgs.search[0] = '\0';
+        c_strcpy(enqueueFillArgs.path, sizeof(enqueueFillArgs.path), path);
+        enqueueFillArgs.allowedExtensions = AUDIO_EXTENSIONS;
+        enqueueFillArgs.searchType = ReturnAllSongs;
+        enqueueFillArgs.exactSearch = false;
+        enqueueFillArgs.readPlaylists = false;
+        enqueueFillArgs.library = NULL;
+
+        startPlaylistProducer(fillFromSearch, &enqueueFillArgs, false);
+}
 
 void generateM3UFilename(const char *basePath, const char *filePath, char *m3uFilename, size_t size) {
 
@@ -619,7 +1433,7 @@ void writeM3UFile(const char *filename, PlayList *playlist)
         Node *currentNode = playlist->head;
         while (currentNode != NULL)
         {
-                fprintf(file, "%s\n", currentNode->song.filePath);
+                fprintf(file, "%s\n", currentNode->track->path);
                 currentNode = currentNode->next;
         }
         fclose(file);
@@ -641,7 +1455,9 @@ void loadSpecialPlaylist(const char *directory)
         specialPlaylist->count = 0;
         specialPlaylist->head = NULL;
         specialPlaylist->tail = NULL;
+        memset(&specialPlaylist->index, 0, sizeof(PlayListIndex));
         readM3UFile(playlistPath, specialPlaylist);
+        assignNodeIds(specialPlaylist);
 }
 
 void saveSpecialPlaylist(const char *directory)
@@ -677,12 +1493,12 @@ void savePlaylist(const char *path)
                 return;
         }
 
-        if (playlist.head == NULL || playlist.head->song.filePath == NULL)
+        if (playlist.head == NULL || playlist.head->track->path == NULL)
                 return;
         
         char m3uFilename[MAXPATHLEN];
 
-        generateM3UFilename(path, playlist.head->song.filePath, m3uFilename, sizeof(m3uFilename));
+        generateM3UFilename(path, playlist.head->track->path, m3uFilename, sizeof(m3uFilename));
 
         writeM3UFile(m3uFilename, &playlist);
 }
@@ -701,10 +1517,14 @@ Node *deepCopyNode(Node *originalNode)
                 return NULL;
         }
 
-        newNode->song.filePath = strdup(originalNode->song.filePath);
-        newNode->song.duration = originalNode->song.duration;
+        newNode->track = retainTrack(originalNode->track);
         newNode->prev = NULL;
         newNode->id = originalNode->id;
+        newNode->slot = -1;
+        newNode->nextInBucket = NULL;
+        newNode->nextWithPath = NULL;
+        newNode->shuffleNext = NULL;
+        newNode->shufflePrev = NULL;
         newNode->next = deepCopyNode(originalNode->next);
 
         if (newNode->next != NULL)
@@ -729,14 +1549,6 @@ Node *findTail(Node *head)
         return current;
 }
 
-PlayList deepCopyPlayList(PlayList *originalList)
-{
-        PlayList newList = {NULL, NULL, 0, PTHREAD_MUTEX_INITIALIZER};
-
-        deepCopyPlayListOntoList(originalList, &newList);
-        return newList;
-}
-
 void deepCopyPlayListOntoList(PlayList *originalList, PlayList *newList)
 {
         if (originalList == NULL)
@@ -747,96 +1559,144 @@ void deepCopyPlayListOntoList(PlayList *originalList, PlayList *newList)
         newList->head = deepCopyNode(originalList->head);
         newList->tail = findTail(newList->head);
         newList->count = originalList->count;
+
+        if (newList->order.stored)
+        {
+                newList->order.head = NULL;
+                newList->order.tail = NULL;
+                for (Node *node = newList->head; node != NULL; node = node->next)
+                        appendToPlayOrder(newList, node);
+        }
+
+        invalidatePlaylistIndex(newList);
 }
 
-Node *findPathInPlaylist(char *path, PlayList *playlist)
+Node *findPathIdInPlaylist(int pathId, PlayList *playlist)
 {
-        Node *currentNode = playlist->head;
+        if (playlist == NULL || playlist->head == NULL || pathId < 0)
+                return NULL;
 
-        while (currentNode != NULL)
+        if (!playlist->index.bucketsValid && rebuildBuckets(playlist) < 0)
         {
-                if (strcmp(currentNode->song.filePath, path) == 0)
+                for (Node *node = playlist->head; node != NULL; node = node->next)
                 {
-                        return currentNode;
+                        if (node->track->pathId == pathId)
+                                return node;
                 }
+                return NULL;
+        }
 
-                currentNode = currentNode->next;
+        // The chain is ordered from the tail, so the first occurrence is the last match
+        Node *found = NULL;
+        Node *node = playlist->index.pathBuckets[idToBucket(pathId, playlist->index.bucketCount)];
+
+        for (; node != NULL; node = node->nextWithPath)
+        {
+                if (node->track->pathId == pathId)
+                        found = node;
         }
-        return NULL;
+
+        return found;
 }
 
-Node *findLastPathInPlaylist(char *path, PlayList *playlist)
+Node *findLastPathIdInPlaylist(int pathId, PlayList *playlist)
 {
-        Node *currentNode = playlist->tail;
+        if (playlist == NULL || playlist->head == NULL || pathId < 0)
+                return NULL;
 
-        while (currentNode != NULL)
+        if (!playlist->index.bucketsValid && rebuildBuckets(playlist) < 0)
         {
-                if (strcmp(currentNode->song.filePath, path) == 0)
+                for (Node *node = playlist->tail; node != NULL; node = node->prev)
                 {
-                        return currentNode;
+                        if (node->track->pathId == pathId)
+                                return node;
                 }
-
-                currentNode = currentNode->prev;
+                return NULL;
         }
-        return NULL;
+
+        Node *node = playlist->index.pathBuckets[idToBucket(pathId, playlist->index.bucketCount)];
+
+        while (node != NULL && node->track->pathId != pathId)
+                node = node->nextWithPath;
+
+        return node;
 }
 
-int findNodeInList(PlayList *list, int id, Node **foundNode)
+Node *findPathInPlaylist(char *path, PlayList *playlist)
 {
-        Node *node = list->head;
-        int row = 0;
+        return findPathIdInPlaylist(findPathId(path), playlist);
+}
 
-        while (node != NULL)
-        {
-                if (id == node->id)
-                {
-                        *foundNode = node;
-                        return row;
-                }
+Node *findLastPathInPlaylist(char *path, PlayList *playlist)
+{
+        return findLastPathIdInPlaylist(findPathId(path), playlist);
+}
 
-                node = node->next;
-                row++;
-        }
+int findNodeInList(PlayList *list, int id, Node **foundNode)
+{
+        *foundNode = findNodeById(list, id);
 
-        *foundNode = NULL;
+        if (*foundNode == NULL)
+                return -1;
 
-        return -1;
+        return getNodePosition(list, *foundNode);
 }
 
-void addSongToPlayList(PlayList *list, const char *filePath, int playlistMax)
+void addSongToPlayList(PlayList *list, const char *filePath)
 {
-        if (list->count >= playlistMax)
-                return;
-
         Node *newNode = NULL;
-        createNode(&newNode, filePath, list->count);
+        createNode(&newNode, filePath, -1);
         addToList(list, newNode);
 }
 
-void traverseFileSystemEntry(FileSystemEntry *entry, PlayList *list, int playlistMax)
+void traverseFileSystemEntry(FileSystemEntry *entry, PlayList *list)
 {
-        if (entry == NULL || list->count >= playlistMax)
+        if (entry == NULL)
                 return;
 
         if (entry->isDirectory == 0)
         {
-                addSongToPlayList(list, entry->fullPath, playlistMax);
+                addSongToPlayList(list, entry->fullPath);
         }
 
         if (entry->isDirectory == 1 && entry->children != NULL)
         {
-                traverseFileSystemEntry(entry->children, list, playlistMax);
+                traverseFileSystemEntry(entry->children, list);
         }
 
         if (entry->next != NULL)
         {
-                traverseFileSystemEntry(entry->next, list, playlistMax);
+                traverseFileSystemEntry(entry->next, list);
         }
 }
 
-void createPlayListFromFileSystemEntry(FileSystemEntry *root, PlayList *list, int playlistMax)
+void createPlayListFromFileSystemEntry(FileSystemEntry *root, PlayList *list)
+{
+        Node *last = list->tail;
+
+        traverseFileSystemEntry(root, list);
+
+        for (Node *node = (last != NULL) ? last->next : list->head; node != NULL; node = node->next)
+                node->id = nodeIdCounter++;
+}
+
+void playAllFromLibrary(PlayList *pending, void *arg)
 {
-        traverseFileSystemEntry(root, list, playlistMax);
+        FileSystemEntry *root = (FileSystemEntry *)arg;
+
+        if (root == NULL)
+                return;
+
+        // Hand over one top level directory at a time
+        for (FileSystemEntry *entry = root->children; entry != NULL && !producerStopRequested(); entry = entry->next)
+        {
+                if (entry->isDirectory == 0)
+                        addSongToPlayList(pending, entry->fullPath);
+                else if (entry->children != NULL)
+                        traverseFileSystemEntry(entry->children, pending);
+
+                flushProducedSongs(pending);
+        }
 }
 
 int isMusicFile(const char *filename)
@@ -875,41 +1735,20 @@ int containsMusicFiles(FileSystemEntry *entry)
     return 0;
 }
 
-void addAlbumToPlayList(PlayList *list, FileSystemEntry *album, int playlistMax)
+void addAlbumToPlayList(PlayList *list, FileSystemEntry *album)
 {
     FileSystemEntry *entry = album->children;
 
-    while (entry != NULL && list->count < playlistMax)
+    while (entry != NULL)
     {
         if (!entry->isDirectory && isMusicFile(entry->name))
         {
-            addSongToPlayList(list, entry->fullPath, playlistMax);
+            addSongToPlayList(list, entry->fullPath);
         }
         entry = entry->next;
     }
 }
 
-void addAlbumsToPlayList(FileSystemEntry *entry, PlayList *list, int playlistMax)
-{
-    if (entry == NULL || list->count >= playlistMax)
-        return;
-
-    if (entry->isDirectory && containsMusicFiles(entry))
-    {
-        addAlbumToPlayList(list, entry, playlistMax);
-    }
-
-    if (entry->isDirectory && entry->children != NULL)
-    {
-        addAlbumsToPlayList(entry->children, list, playlistMax);
-    }
-
-    if (entry->next != NULL)
-    {
-        addAlbumsToPlayList(entry->next, list, playlistMax);
-    }
-}
-
 void shuffleEntries(FileSystemEntry **array, size_t n)
 {
     if (n > 1)
@@ -925,41 +1764,280 @@ void shuffleEntries(FileSystemEntry **array, size_t n)
     }
 }
 
-void collectAlbums(FileSystemEntry *entry, FileSystemEntry **albums, size_t *count)
+void collectAlbums(FileSystemEntry *entry, FileSystemEntry ***albums, size_t *count, size_t *capacity)
 {
     if (entry == NULL)
         return;
 
     if (entry->isDirectory && containsMusicFiles(entry))
     {
-        albums[*count] = entry;
+        if (*count >= *capacity)
+        {
+            size_t newCapacity = (*capacity > 0) ? *capacity * 2 : 256;
+            FileSystemEntry **newAlbums = realloc(*albums, newCapacity * sizeof(FileSystemEntry *));
+
+            if (newAlbums == NULL)
+                return;
+
+            *albums = newAlbums;
+            *capacity = newCapacity;
+        }
+
+        (*albums)[*count] = entry;
         (*count)++;
     }
 
     if (entry->isDirectory && entry->children != NULL)
     {
-        collectAlbums(entry->children, albums, count);
+        collectAlbums(entry->children, albums, count, capacity);
     }
 
     if (entry->next != NULL)
     {
-        collectAlbums(entry->next, albums, count);
+        collectAlbums(entry->next, albums, count, capacity);
     }
 }
 
-void addShuffledAlbumsToPlayList(FileSystemEntry *root, PlayList *list, int playlistMax)
+void addAlbumsInRandomOrder(FileSystemEntry *root, PlayList *list, bool handOver)
 {
-    size_t maxAlbums = 2000; 
-    FileSystemEntry *albums[maxAlbums];
+    FileSystemEntry **albums = NULL;
     size_t albumCount = 0;
+    size_t capacity = 0;
 
-    collectAlbums(root, albums, &albumCount);
+    collectAlbums(root, &albums, &albumCount, &capacity);
 
     srand(time(NULL));
     shuffleEntries(albums, albumCount);
 
-    for (size_t i = 0; i < albumCount && list->count < playlistMax; i++)
+    for (size_t i = 0; i < albumCount && !producerStopRequested(); i++)
+    {
+        addAlbumToPlayList(list, albums[i]);
+
+        if (handOver)
+            flushProducedSongs(list);
+    }
+
+    free(albums);
+}
+
+void playAlbumsFromLibrary(PlayList *pending, void *arg)
+{
+    addAlbumsInRandomOrder((FileSystemEntry *)arg, pending, true);
+}
+
+// For when the library hasn't been published yet, arg is the music directory
+void playAllFromDisk(PlayList *pending, void *arg)
+{
+    buildPlaylistRecursive((const char *)arg, AUDIO_EXTENSIONS, pending);
+}
+
+typedef struct
+{
+    char **paths;
+    size_t count;
+    size_t capacity;
+} AlbumPaths;
+
+void appendAlbumPath(AlbumPaths *albums, const char *path)
+{
+    if (albums->count >= albums->capacity)
+    {
+        size_t newCapacity = (albums->capacity > 0) ? albums->capacity * 2 : 256;
+        char **newPaths = realloc(albums->paths, newCapacity * sizeof(char *));
+
+        if (newPaths == NULL)
+            return;
+
+        albums->paths = newPaths;
+        albums->capacity = newCapacity;
+    }
+
+    char *copy = strdup(path);
+
+    if (copy != NULL)
+        albums->paths[albums->count++] = copy;
+}
+
+// Returns the number of visible entries in the directory sorted like the library, or -1
+int scanVisibleEntries(const char *directoryPath, struct dirent ***entries)
+{
+    int numEntries = scandir(directoryPath, entries, NULL, compare);
+
+    if (numEntries < 0)
+        return -1;
+
+    int kept = 0;
+
+    for (int i = 0; i < numEntries; i++)
+    {
+        if ((*entries)[i]->d_name[0] == '.')
+            free((*entries)[i]);
+        else
+            (*entries)[kept++] = (*entries)[i];
+    }
+
+    return kept;
+}
+
+void freeEntries(struct dirent **entries, int numEntries)
+{
+    for (int i = 0; i < numEntries; i++)
+        free(entries[i]);
+
+    free(entries);
+}
+
+// Directories with music files directly in them, the same ones collectAlbums finds in the library
+void collectAlbumPaths(const char *directoryPath, AlbumPaths *albums)
+{
+    struct dirent **entries;
+    int numEntries = scanVisibleEntries(directoryPath, &entries);
+
+    if (numEntries < 0)
+        return;
+
+    bool hasMusic = false;
+
+    for (int i = 0; i < numEntries && !producerStopRequested(); i++)
+    {
+        char filePath[FILENAME_MAX];
+        snprintf(filePath, sizeof(filePath), "%s/%s", directoryPath, entries[i]->d_name);
+
+        if (isDirectory(filePath) == 1)
+            collectAlbumPaths(filePath, albums);
+        else if (isMusicFile(entries[i]->d_name))
+            hasMusic = true;
+    }
+
+    freeEntries(entries, numEntries);
+
+    if (hasMusic)
+        appendAlbumPath(albums, directoryPath);
+}
+
+// Descends into random subdirectories until one has music files in it, so playback can start before the walk is done
+bool findRandomAlbumPath(const char *directoryPath, char *albumPath, size_t size)
+{
+    struct dirent **entries;
+    int numEntries = scanVisibleEntries(directoryPath, &entries);
+
+    if (numEntries < 0)
+        return false;
+
+    bool found = false;
+    int numDirs = 0;
+    int i = 0;
+
+    for (; i < numEntries && !found; i++)
+    {
+        char filePath[FILENAME_MAX];
+        snprintf(filePath, sizeof(filePath), "%s/%s", directoryPath, entries[i]->d_name);
+
+        if (isDirectory(filePath) == 1)
+            entries[numDirs++] = entries[i]; // Only earlier slots are reused, those are already looked at
+        else if (isMusicFile(entries[i]->d_name))
+            found = true;
+        else
+            free(entries[i]);
+    }
+
+    if (found)
+    {
+        c_strcpy(albumPath, size, directoryPath);
+
+        // The music file that was found and everything after it
+        for (int j = i - 1; j < numEntries; j++)
+            free(entries[j]);
+
+        freeEntries(entries, numDirs);
+        return true;
+    }
+
+    for (int left = numDirs; left > 0 && !found && !producerStopRequested(); left--)
+    {
+        int pick = rand() % left;
+        struct dirent *entry = entries[pick];
+
+        entries[pick] = entries[left - 1];
+        entries[left - 1] = entry;
+
+        char filePath[FILENAME_MAX];
+        snprintf(filePath, sizeof(filePath), "%s/%s", directoryPath, entry->d_name);
+
+        found = findRandomAlbumPath(filePath, albumPath, size);
+    }
+
+    freeEntries(entries, numDirs);
+
+    return found;
+}
+
+void addAlbumPathToPlayList(PlayList *list, const char *albumPath)
+{
+    struct dirent **entries;
+    int numEntries = scanVisibleEntries(albumPath, &entries);
+
+    if (numEntries < 0)
+        return;
+
+    for (int i = 0; i < numEntries; i++)
+    {
+        char filePath[FILENAME_MAX];
+        snprintf(filePath, sizeof(filePath), "%s/%s", albumPath, entries[i]->d_name);
+
+        if (isMusicFile(entries[i]->d_name) && isDirectory(filePath) != 1)
+            addSongToPlayList(list, filePath);
+    }
+
+    freeEntries(entries, numEntries);
+}
+
+// Like playAlbumsFromLibrary but walks the music directory, arg. A random album is
+// handed over first, the rest follow in random order once the whole walk is done.
+void playAlbumsFromDisk(PlayList *pending, void *arg)
+{
+    const char *path = (const char *)arg;
+    char first[FILENAME_MAX] = {0};
+
+    srand(time(NULL));
+
+    if (findRandomAlbumPath(path, first, sizeof(first)))
+    {
+        addAlbumPathToPlayList(pending, first);
+        flushProducedSongs(pending);
+    }
+
+    AlbumPaths albums = {NULL, 0, 0};
+
+    collectAlbumPaths(path, &albums);
+
+    for (size_t left = albums.count; left > 0 && !producerStopRequested(); left--)
     {
-        addAlbumToPlayList(list, albums[i], playlistMax);
+        size_t pick = rand() / (RAND_MAX / left + 1);
+        char *album = albums.paths[pick];
+
+        albums.paths[pick] = albums.paths[left - 1];
+        albums.paths[left - 1] = album;
+
+        if (strcmp(album, first) == 0)
+            continue;
+
+        addAlbumPathToPlayList(pending, album);
+        flushProducedSongs(pending);
     }
+
+    for (size_t i = 0; i < albums.count; i++)
+        free(albums.paths[i]);
+
+    free(albums.paths);
+}
+
+void addShuffledAlbumsToPlayList(FileSystemEntry *root, PlayList *list)
+{
+    Node *last = list->tail;
+
+    addAlbumsInRandomOrder(root, list, false);
+
+    for (Node *node = (last != NULL) ? last->next : list->head; node != NULL; node = node->next)
+        node->id = nodeIdCounter++;
 }
@@ -12,48 +12,94 @@
 #include <string.h>
 #include "directorytree.h"
 #include "file.h"
+#include "pathindex.h"
 
-#define MAX_FILES 10000
+#ifndef PRODUCER_BATCH_SONGS
+#define PRODUCER_BATCH_SONGS 64 // Most songs the playlist producer collects before taking the lock
+#endif
 
 #ifndef PLAYLIST_STRUCT
 #define PLAYLIST_STRUCT
 
-typedef struct
-{
-        char *filePath;
-        double duration;
-} SongInfo;
-
 typedef struct Node
 {
         int id;
-        SongInfo song;
+        Track *track;
         struct Node *next;
         struct Node *prev;
+        int slot;                  // In the list's position index, valid while the list's positions are valid
+        struct Node *nextInBucket; // Chain in the list's id table
+        struct Node *nextWithPath; // Chain in the list's path id table
+        struct Node *shuffleNext;  // Links in the list's shuffled play order
+        struct Node *shufflePrev;
 } Node;
 
+// Lookup tables kept alongside the linked list so that positional and id
+// lookups don't have to walk the list. Both are kept up to date on appends
+// and joins, the positions also on removals. They are rebuilt lazily after
+// reordering (shuffle, copy).
+//
+// Nodes get slots in list order. A Fenwick tree counts the slots in use, so
+// the row of a node and the node at a row are both found in O(log n). A
+// removal only empties its slot. The slots are compacted by a rebuild once
+// half of them are empty or all of them are taken, which is O(1) amortized.
+typedef struct
+{
+        Node **positions;      // Node in each slot, NULL once removed
+        int *slotCounts;       // Fenwick tree over the slots in use, 1-based
+        int positionsCapacity; // A power of two
+        int slotCount;         // Slots handed out so far
+        bool positionsValid;
+        Node **buckets;
+        Node **pathBuckets;
+        int bucketCount;
+        bool bucketsValid;
+} PlayListIndex;
+
+// A shuffled play order over the same nodes. Once stored it is kept up to
+// date on appends and removals, so shuffle can be switched on and off
+// without copying or relinking the list itself.
+typedef struct
+{
+        Node *head;
+        Node *tail;
+        bool stored;
+        bool active;
+} PlayOrder;
+
 typedef struct
 {
         Node *head;
         Node *tail;
         int count; 
         pthread_mutex_t mutex;
+        PlayListIndex index;
+        PlayOrder order;
 } PlayList;
 
 extern Node *currentSong;
 
 #endif
 
+#ifndef PLAYLIST_FILL_FUNC
+#define PLAYLIST_FILL_FUNC
+// Runs on the producer thread, adding songs to pending and handing them over with offerProducedSongs or flushProducedSongs
+typedef void (*PlaylistFillFunc)(PlayList *pending, void *arg);
+#endif
+
 extern PlayList playlist;
 
 extern PlayList *specialPlaylist;
-extern PlayList *originalPlaylist;
 extern int nodeIdCounter;
 
 Node *getListNext(Node *node);
 
 Node *getListPrev(Node *node);
 
+Node *getListHead(PlayList *list);
+
+Node *getListTail(PlayList *list);
+
 void createNode(Node **node, const char *directoryPath, int id);
 
 void addToList(PlayList *list, Node *newNode);
@@ -66,7 +112,15 @@ void shufflePlaylist(PlayList *playlist);
 
 void shufflePlaylistStartingFromSong(PlayList *playlist, Node *song);
 
-int makePlaylist(int argc, char *argv[], bool exactSearch, const char *path);
+void shufflePlayOrder(PlayList *list, Node *first);
+
+void setShuffled(PlayList *list, bool shuffled, Node *first);
+
+int makePlaylist(int argc, char *argv[], bool exactSearch, const char *path, FileSystemEntry *library);
+
+void enqueueSearch(int argc, char *argv[], bool exactSearch, const char *path, FileSystemEntry *library);
+
+void enqueueDirectory(const char *path);
 
 void writeCurrentPlaylistToM3UFile(PlayList *playlist);
 
@@ -78,16 +132,56 @@ void saveSpecialPlaylist(const char *directory);
 
 void savePlaylist(const char *path);
 
-PlayList deepCopyPlayList(PlayList *originalList);
-
 void deepCopyPlayListOntoList(PlayList *originalList, PlayList *newList);
 
 Node *findPathInPlaylist(char *path, PlayList *playlist);
 
 Node *findLastPathInPlaylist(char *path, PlayList *playlist);
 
+Node *findPathIdInPlaylist(int pathId, PlayList *playlist);
+
+Node *findLastPathIdInPlaylist(int pathId, PlayList *playlist);
+
 int findNodeInList(PlayList *list, int id, Node **foundNode);
 
-void createPlayListFromFileSystemEntry(FileSystemEntry *root, PlayList *list, int playlistMax);
+Node *findNodeById(PlayList *list, int id);
+
+Node *getNodeAtPosition(PlayList *list, int position);
+
+int getNodePosition(PlayList *list, Node *node);
+
+void invalidatePlaylistIndex(PlayList *list);
+
+void assignNodeIds(PlayList *list);
+
+void freePlaylistIndex(PlayList *list);
+
+void createPlayListFromFileSystemEntry(FileSystemEntry *root, PlayList *list);
+
+void addShuffledAlbumsToPlayList(FileSystemEntry *root, PlayList *list);
+
+void startPlaylistProducer(PlaylistFillFunc fill, void *arg, bool shuffle);
+
+void flushProducedSongs(PlayList *pending);
+
+void offerProducedSongs(PlayList *pending);
+
+void shuffleProducedSongs(void);
+
+bool producerStopRequested(void);
+
+bool waitForProducedSongs(void);
+
+int takeProducedSongs(PlayList *dest, bool *reshuffle);
+
+bool isPlaylistProducerRunning(void);
+
+void stopPlaylistProducer(void);
+
+void playAllFromLibrary(PlayList *pending, void *arg);
+
+void playAlbumsFromLibrary(PlayList *pending, void *arg);
+
+void playAllFromDisk(PlayList *pending, void *arg);
 
-void addShuffledAlbumsToPlayList(FileSystemEntry *root, PlayList *list, int playlistMax);
+void playAlbumsFromDisk(PlayList *pending, void *arg);
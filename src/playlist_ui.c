@@ -1,4 +1,7 @@
+#define _XOPEN_SOURCE 700
 #include "playlist_ui.h"
+#include <limits.h>
+#include <wchar.h>
 
 int startIter = 0;
 
@@ -7,103 +10,148 @@ void getTerminalSize(int *width, int *height)
         getTermSize(width, height);
 }
 
-Node *determineStartNode(Node *head, int *foundAt, bool *startFromCurrent, int listSize)
+Node *determineStartNode(PlayList *list, int *foundAt, bool *startFromCurrent)
 {
-        Node *node = head;
         Node *foundNode = NULL;
-        int numSongs = 0;
         *foundAt = -1;
 
-        while (node != NULL && numSongs <= listSize)
+        if (currentSong != NULL)
+                *foundAt = findNodeInList(list, currentSong->id, &foundNode);
+
+        *startFromCurrent = (*foundAt > -1) ? true : false;
+        return foundNode ? foundNode : list->head;
+}
+
+// Bytes of str that fit in maxWidth terminal columns, with the columns they take in width
+size_t fitToWidth(const char *str, int maxWidth, int *width)
+{
+        mbstate_t state;
+        size_t remaining = strlen(str);
+        size_t bytes = 0;
+        int columns = 0;
+
+        memset(&state, 0, sizeof(state));
+
+        while (remaining > 0)
         {
-                if (currentSong != NULL && currentSong->id == node->id)
+                wchar_t wc;
+                size_t length = mbrtowc(&wc, str + bytes, remaining, &state);
+                int charWidth = 1;
+
+                if (length == (size_t)-1 || length == (size_t)-2)
+                {
+                        // Not valid in this locale, count the byte as one column
+                        memset(&state, 0, sizeof(state));
+                        length = 1;
+                }
+                else if (length == 0)
                 {
-                        *foundAt = numSongs;
-                        foundNode = node;
                         break;
                 }
-                node = node->next;
-                numSongs++;
+                else
+                {
+                        charWidth = wcwidth(wc);
+
+                        if (charWidth < 0)
+                                charWidth = 0;
+                }
+
+                if (columns + charWidth > maxWidth)
+                        break;
+
+                columns += charWidth;
+                bytes += length;
+                remaining -= length;
         }
 
-        *startFromCurrent = (*foundAt > -1) ? true : false;
-        return foundNode ? foundNode : head;
+        if (width != NULL)
+                *width = columns;
+
+        return bytes;
 }
 
-void preparePlaylistString(Node *node, char *buffer, int bufferSize, int shortenAmount)
+char *makeFileDisplayName(const char *path)
 {
-        if (node == NULL || buffer == NULL)
-        {
-                buffer[0] = '\0';
-                return;
-        }
+        const char *lastSlash = strrchr(path, '/');
+        const char *name = (lastSlash != NULL) ? lastSlash + 1 : path;
+        const char *lastDot = strrchr(name, '.');
+        size_t nameLength = (lastDot != NULL) ? (size_t)(lastDot - name) : strlen(name);
+        char *displayName = malloc(nameLength + 1);
 
-        char filePath[MAXPATHLEN];
-        c_strcpy(filePath, sizeof(filePath), node->song.filePath);
-        char *lastSlash = strrchr(filePath, '/');
-        char *lastDot = strrchr(filePath, '.');
+        if (displayName == NULL)
+                return NULL;
+
+        memcpy(displayName, name, nameLength);
+        displayName[nameLength] = '\0';
+        removeUnneededChars(displayName);
+        trim(displayName);
+
+        return displayName;
+}
 
-        if (lastSlash != NULL && lastDot != NULL && lastDot > lastSlash)
+// The name to show for a track and its width, worked out once and then kept with the track
+const char *getTrackDisplayName(Track *track, int *width)
+{
+        const char *name = atomic_load(&track->tagName);
+
+        if (name == NULL)
         {
-                int nameLength = lastDot - lastSlash - 1;
-                nameLength = (nameLength < bufferSize - 1) ? nameLength : bufferSize - 1;
-
-                strncpy(buffer, lastSlash + 1, nameLength);
-                buffer[nameLength] = '\0';
-                removeUnneededChars(buffer);
-                shortenString(buffer, shortenAmount);
-                trim(buffer);
+                if (track->fileName == NULL)
+                        track->fileName = makeFileDisplayName(track->path);
+
+                name = (track->fileName != NULL) ? track->fileName : "";
         }
-        else
+
+        if (track->displayName != name)
         {
-                buffer[0] = '\0';
+                fitToWidth(name, INT_MAX, &track->displayWidth);
+                track->displayName = name;
         }
+
+        *width = track->displayWidth;
+
+        return name;
 }
 
 int displayPlaylistItems(Node *startNode, int startIter, int maxListSize, int termWidth, int indent, int chosenSong, int *chosenNodeId)
 {
         int numPrintedRows = 0;
+        int maxNameWidth = termWidth - indent - 10;
         Node *node = startNode;
 
-        char *buffer = (char *)malloc(MAXPATHLEN * sizeof(char));
-
-        if (!buffer)
-        {
-                return 0;
-        }
-
         for (int i = startIter; node != NULL && i < startIter + maxListSize; i++)
         {
-                preparePlaylistString(node, buffer, MAXPATHLEN, termWidth - indent - 10);
-                if (buffer[0] != '\0')
-                {
-                        setDefaultTextColor();
-                        printBlankSpaces(indent);
+                int width = 0;
+                const char *name = getTrackDisplayName(node->track, &width);
+
+                setDefaultTextColor();
+                printBlankSpaces(indent);
 
-                        if (i == chosenSong)
-                        {
-                                *chosenNodeId = node->id;
+                if (i == chosenSong)
+                {
+                        *chosenNodeId = node->id;
 
-                                printf("\x1b[7m");
-                        }
+                        printf("\x1b[7m");
+                }
 
-                        if (currentSong != NULL && currentSong->id == node->id)
-                        {
-                                printf("\e[1m\e[39m");
-                        }
+                if (currentSong != NULL && currentSong->id == node->id)
+                {
+                        printf("\e[1m\e[39m");
+                }
 
-                        if (i + 1 < 10)
-                                printf(" ");
+                if (i + 1 < 10)
+                        printf(" ");
 
-                        printf(" %d. %s \n", i + 1, buffer);
+                if (width <= maxNameWidth)
+                        printf(" %d. %s \n", i + 1, name);
+                else
+                        printf(" %d. %.*s \n", i + 1, (int)fitToWidth(name, maxNameWidth, NULL), name);
 
-                        numPrintedRows++;
-                }
+                numPrintedRows++;
 
                 node = node->next;
         }
 
-        free(buffer);
         return numPrintedRows;
 }
 
@@ -114,7 +162,7 @@ int displayPlaylist(PlayList *list, int maxListSize, int indent, int *chosenSong
 
         int foundAt = -1;
         bool startFromCurrent = false;
-        Node *startNode = determineStartNode(list->head, &foundAt, &startFromCurrent, list->count);
+        determineStartNode(list, &foundAt, &startFromCurrent);
 
         // Determine chosen song
         if (*chosenSong >= list->count)
@@ -147,19 +195,10 @@ int displayPlaylist(PlayList *list, int maxListSize, int indent, int *chosenSong
                 startIter = *chosenSong = foundAt;
         }
         
-        // Go up to find the starting node
-        for (int i = foundAt; i > startIter; i--)
-        {
-                if (i > 0 && startNode->prev != NULL)
-                        startNode = startNode->prev;
-        }
-        
-        // Go down to adjust the startNode
-        for (int i = (foundAt == -1) ? 0 : foundAt; i < startIter; i++)
-        {
-                if (startNode->next != NULL)
-                        startNode = startNode->next;
-        }
+        Node *startNode = getNodeAtPosition(list, startIter);
+
+        if (startNode == NULL)
+                startNode = (startIter > 0) ? list->tail : list->head;
 
         int printedRows = displayPlaylistItems(startNode, startIter, maxListSize, termWidth, indent, *chosenSong, chosenNodeId);
 
@@ -0,0 +1,260 @@
+#include <limits.h>
+#include <sched.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include "prefetch.h"
+/*
+
+prefetch.c
+
+ Read-ahead of the songs coming up in the play order. Once the current song
+ has played for a few seconds, a worker thread opens the next few files and
+ asks the kernel to pull them into the page cache, and reads the start of
+ each one outright since that is where the tags and the decoder setup are.
+ By the time a song is loaded as the next one its first reads come from
+ memory, so a sleeping disk or a slow network share is woken up mid-song
+ and not at the track boundary.
+
+ The files are kept open until they drop out of the upcoming songs. All of
+ it is bounded by PREFETCH_BUDGET_BYTES and a newer request cuts an older
+ one short.
+
+*/
+
+#if defined(__linux__) && !defined(SCHED_IDLE)
+#define SCHED_IDLE 5 // Only declared by sched.h under _GNU_SOURCE
+#endif
+
+static pthread_t prefetchThread;
+static bool prefetchRunning = false;
+static _Atomic bool prefetchStopping = false;
+
+static pthread_mutex_t prefetchMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetchCond = PTHREAD_COND_INITIALIZER;
+static const char *wantedPaths[PREFETCH_SONGS]; // Interned track paths
+static int wantedCount = 0;
+static _Atomic unsigned wantedSequence = 0;
+
+// Only touched by the worker
+static const char *openPaths[PREFETCH_SONGS];
+static int openFds[PREFETCH_SONGS];
+static int openCount = 0;
+static char readBuffer[PREFETCH_READ_SIZE];
+
+bool isPrefetchSuperseded(unsigned sequence)
+{
+        return atomic_load(&prefetchStopping) || atomic_load(&wantedSequence) != sequence;
+}
+
+// Closes the files that are no longer among paths
+void closeUnwantedFiles(const char **paths, int count)
+{
+        int kept = 0;
+
+        for (int i = 0; i < openCount; i++)
+        {
+                bool wanted = false;
+
+                for (int j = 0; j < count && !wanted; j++)
+                        wanted = (openPaths[i] == paths[j]);
+
+                if (wanted)
+                {
+                        openPaths[kept] = openPaths[i];
+                        openFds[kept] = openFds[i];
+                        kept++;
+                }
+                else
+                {
+                        close(openFds[i]);
+                }
+        }
+
+        openCount = kept;
+}
+
+int openUpcomingFile(const char *path)
+{
+        for (int i = 0; i < openCount; i++)
+        {
+                if (openPaths[i] == path)
+                        return openFds[i];
+        }
+
+        if (openCount >= PREFETCH_SONGS)
+                return -1;
+
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0)
+                return -1;
+
+        openPaths[openCount] = path;
+        openFds[openCount] = fd;
+        openCount++;
+
+        return fd;
+}
+
+void adviseWillNeed(int fd, off_t length)
+{
+#if defined(POSIX_FADV_WILLNEED)
+        posix_fadvise(fd, 0, length, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+        struct radvisory advice;
+        advice.ra_offset = 0;
+        advice.ra_count = (length > INT_MAX) ? INT_MAX : (int)length;
+        fcntl(fd, F_RDADVISE, &advice);
+#else
+        (void)fd;
+        (void)length;
+#endif
+}
+
+// Some file systems ignore the advice, reading makes sure at least the start is cached
+void readHead(int fd, off_t length, unsigned sequence)
+{
+        off_t offset = 0;
+
+        while (offset < length && !isPrefetchSuperseded(sequence))
+        {
+                size_t chunk = (length - offset < PREFETCH_READ_SIZE) ? (size_t)(length - offset) : PREFETCH_READ_SIZE;
+                ssize_t bytesRead = pread(fd, readBuffer, chunk, offset);
+
+                if (bytesRead <= 0)
+                        break;
+
+                offset += bytesRead;
+        }
+}
+
+void prefetchSongs(const char **paths, int count, unsigned sequence)
+{
+        closeUnwantedFiles(paths, count);
+
+        off_t budget = PREFETCH_BUDGET_BYTES;
+
+        for (int i = 0; i < count && budget > 0; i++)
+        {
+                if (isPrefetchSuperseded(sequence))
+                        return;
+
+                int fd = openUpcomingFile(paths[i]);
+                struct stat st;
+
+                if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+                        continue;
+
+                off_t length = (st.st_size < budget) ? st.st_size : budget;
+                budget -= length;
+
+                adviseWillNeed(fd, length);
+                readHead(fd, (length < PREFETCH_HEAD_BYTES) ? length : PREFETCH_HEAD_BYTES, sequence);
+        }
+}
+
+void lowerPrefetchPriority()
+{
+#ifdef SCHED_IDLE
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+#ifdef __linux__
+        setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+#endif
+#ifdef __APPLE__
+        pthread_set_qos_class_self_np(QOS_CLASS_UTILITY, 0);
+#endif
+}
+
+void *prefetchWorker(void *arg)
+{
+        (void)arg;
+
+        lowerPrefetchPriority();
+
+        unsigned handled = 0;
+
+        while (true)
+        {
+                const char *paths[PREFETCH_SONGS];
+                int count;
+
+                pthread_mutex_lock(&prefetchMutex);
+
+                while (atomic_load(&wantedSequence) == handled && !atomic_load(&prefetchStopping))
+                        pthread_cond_wait(&prefetchCond, &prefetchMutex);
+
+                if (atomic_load(&prefetchStopping))
+                {
+                        pthread_mutex_unlock(&prefetchMutex);
+                        break;
+                }
+
+                handled = atomic_load(&wantedSequence);
+                count = wantedCount;
+                memcpy(paths, wantedPaths, count * sizeof(const char *));
+
+                pthread_mutex_unlock(&prefetchMutex);
+
+                prefetchSongs(paths, count, handled);
+        }
+
+        closeUnwantedFiles(NULL, 0);
+
+        return NULL;
+}
+
+// Called from the main loop, only wakes the worker when the upcoming songs have changed
+void prefetchUpcomingSongs(Node *current, double elapsedSeconds)
+{
+        if (current == NULL || elapsedSeconds < PREFETCH_AFTER_SECONDS)
+                return;
+
+        const char *paths[PREFETCH_SONGS];
+        int count = 0;
+
+        for (Node *node = getListNext(current); node != NULL && count < PREFETCH_SONGS; node = getListNext(node))
+        {
+                if (node->track != NULL && node->track->path != NULL)
+                        paths[count++] = node->track->path;
+        }
+
+        if (count == 0)
+                return;
+
+        pthread_mutex_lock(&prefetchMutex);
+
+        if (count == wantedCount && memcmp(paths, wantedPaths, count * sizeof(const char *)) == 0)
+        {
+                pthread_mutex_unlock(&prefetchMutex);
+                return;
+        }
+
+        memcpy(wantedPaths, paths, count * sizeof(const char *));
+        wantedCount = count;
+        atomic_fetch_add(&wantedSequence, 1);
+
+        pthread_cond_signal(&prefetchCond);
+        pthread_mutex_unlock(&prefetchMutex);
+
+        if (!prefetchRunning && !atomic_load(&prefetchStopping))
+                prefetchRunning = (pthread_create(&prefetchThread, NULL, prefetchWorker, NULL) == 0);
+}
+
+void stopPrefetch()
+{
+        if (!prefetchRunning)
+                return;
+
+        pthread_mutex_lock(&prefetchMutex);
+        atomic_store(&prefetchStopping, true);
+        pthread_cond_signal(&prefetchCond);
+        pthread_mutex_unlock(&prefetchMutex);
+
+        pthread_join(prefetchThread, NULL);
+        prefetchRunning = false;
+}
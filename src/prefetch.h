@@ -0,0 +1,42 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "playlist.h"
+
+#ifndef PREFETCH_AFTER_SECONDS
+#define PREFETCH_AFTER_SECONDS 5 // Into the current song, so skipping through the list doesn't read anything
+#endif
+
+#ifndef PREFETCH_SONGS
+#define PREFETCH_SONGS 3
+#endif
+
+#ifndef PREFETCH_BUDGET_BYTES
+#define PREFETCH_BUDGET_BYTES (128 * 1024 * 1024) // For all upcoming songs together
+#endif
+
+#ifndef PREFETCH_HEAD_BYTES
+#define PREFETCH_HEAD_BYTES (1024 * 1024) // Read outright, tags and decoder setup come from the start of a file
+#endif
+
+#ifndef PREFETCH_READ_SIZE
+#define PREFETCH_READ_SIZE (128 * 1024)
+#endif
+
+void prefetchUpcomingSongs(Node *current, double elapsedSeconds);
+
+void stopPrefetch(void);
+
+#endif
@@ -0,0 +1,312 @@
+#include "rendernull.h"
+/*
+
+rendernull.c
+
+ Headless rendering for --render-null. A custom miniaudio backend that
+ accepts whatever format it is given and never waits, so the regular data
+ source callbacks are pulled as fast as they can decode. Every period written
+ is checksummed and attributed to the track that was playing, and a report of
+ per codec throughput, switch latency and checksums is printed on exit.
+
+*/
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+bool renderNullEnabled = false;
+
+static RenderSegment *segments = NULL;
+static size_t segmentCount = 0;
+static size_t segmentCapacity = 0;
+static uint64_t streamChecksum = FNV_OFFSET_BASIS;
+static pthread_mutex_t renderMutex = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t renderNow()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t fnv1a(uint64_t hash, const unsigned char *data, size_t size)
+{
+        for (size_t i = 0; i < size; i++)
+        {
+                hash ^= data[i];
+                hash *= FNV_PRIME;
+        }
+
+        return hash;
+}
+
+const char *getRenderCodec(const char *path)
+{
+        const char *dot = (path != NULL) ? strrchr(path, '.') : NULL;
+
+        return (dot != NULL) ? dot + 1 : "unknown";
+}
+
+RenderSegment *getRenderSegment(ma_device *pDevice)
+{
+        const char *path = NULL;
+
+        if (audioData.pUserData != NULL && audioData.pUserData->currentSongData != NULL)
+                path = audioData.pUserData->currentSongData->filePath;
+
+        if (segmentCount > 0 && segments[segmentCount - 1].path == path)
+                return &segments[segmentCount - 1];
+
+        if (segmentCount == segmentCapacity)
+        {
+                size_t newCapacity = (segmentCapacity > 0) ? segmentCapacity * 2 : 64;
+                RenderSegment *newSegments = realloc(segments, newCapacity * sizeof(RenderSegment));
+
+                if (newSegments == NULL)
+                        return NULL;
+
+                segments = newSegments;
+                segmentCapacity = newCapacity;
+        }
+
+        RenderSegment *segment = &segments[segmentCount++];
+
+        segment->path = path;
+        segment->format = pDevice->playback.format;
+        segment->channels = pDevice->playback.channels;
+        segment->sampleRate = pDevice->sampleRate;
+        segment->frames = 0;
+        segment->firstWrite = renderNow();
+        segment->lastWrite = segment->firstWrite;
+        segment->checksum = FNV_OFFSET_BASIS;
+
+        return segment;
+}
+
+static ma_result renderNullWrite(ma_device *pDevice, const void *pFrames, ma_uint32 frameCount, ma_uint32 *pFramesWritten)
+{
+        size_t size = (size_t)frameCount * ma_get_bytes_per_frame(pDevice->playback.internalFormat, pDevice->playback.internalChannels);
+
+        pthread_mutex_lock(&renderMutex);
+
+        RenderSegment *segment = getRenderSegment(pDevice);
+
+        if (segment != NULL)
+        {
+                segment->frames += frameCount;
+                segment->checksum = fnv1a(segment->checksum, pFrames, size);
+                segment->lastWrite = renderNow();
+        }
+
+        streamChecksum = fnv1a(streamChecksum, pFrames, size);
+
+        pthread_mutex_unlock(&renderMutex);
+
+        if (pFramesWritten != NULL)
+                *pFramesWritten = frameCount;
+
+        return MA_SUCCESS;
+}
+
+static ma_result renderNullDeviceInit(ma_device *pDevice, const ma_device_config *pConfig, ma_device_descriptor *pDescriptorPlayback, ma_device_descriptor *pDescriptorCapture)
+{
+        (void)pDevice;
+        (void)pDescriptorCapture;
+
+        if (pConfig->deviceType != ma_device_type_playback)
+                return MA_DEVICE_TYPE_NOT_SUPPORTED;
+
+        // Take the format exactly as asked so the checksums see what the callbacks produced
+        pDescriptorPlayback->format = (pDescriptorPlayback->format != ma_format_unknown) ? pDescriptorPlayback->format : ma_format_s32;
+        pDescriptorPlayback->channels = (pDescriptorPlayback->channels != 0) ? pDescriptorPlayback->channels : 2;
+        pDescriptorPlayback->sampleRate = (pDescriptorPlayback->sampleRate != 0) ? pDescriptorPlayback->sampleRate : 44100;
+
+        if (pDescriptorPlayback->channelMap[0] == MA_CHANNEL_NONE)
+                ma_channel_map_init_standard(ma_standard_channel_map_default, pDescriptorPlayback->channelMap, MA_MAX_CHANNELS, pDescriptorPlayback->channels);
+
+        pDescriptorPlayback->periodSizeInFrames = ma_calculate_buffer_size_in_frames_from_descriptor(pDescriptorPlayback, pDescriptorPlayback->sampleRate, pConfig->performanceProfile);
+
+        return MA_SUCCESS;
+}
+
+static ma_result renderNullDeviceUninit(ma_device *pDevice)
+{
+        (void)pDevice;
+        return MA_SUCCESS;
+}
+
+static ma_result renderNullDeviceStart(ma_device *pDevice)
+{
+        (void)pDevice;
+        return MA_SUCCESS;
+}
+
+static ma_result renderNullDeviceStop(ma_device *pDevice)
+{
+        (void)pDevice;
+        return MA_SUCCESS;
+}
+
+static ma_result renderNullEnumerateDevices(ma_context *pContext, ma_enum_devices_callback_proc callback, void *pUserData)
+{
+        ma_device_info deviceInfo;
+
+        memset(&deviceInfo, 0, sizeof(deviceInfo));
+        snprintf(deviceInfo.name, sizeof(deviceInfo.name), "kew null renderer");
+        deviceInfo.isDefault = MA_TRUE;
+        callback(pContext, ma_device_type_playback, &deviceInfo, pUserData);
+
+        return MA_SUCCESS;
+}
+
+static ma_result renderNullGetDeviceInfo(ma_context *pContext, ma_device_type deviceType, const ma_device_id *pDeviceID, ma_device_info *pDeviceInfo)
+{
+        (void)pContext;
+        (void)pDeviceID;
+
+        if (deviceType != ma_device_type_playback)
+                return MA_NO_DEVICE;
+
+        snprintf(pDeviceInfo->name, sizeof(pDeviceInfo->name), "kew null renderer");
+        pDeviceInfo->isDefault = MA_TRUE;
+        pDeviceInfo->nativeDataFormats[0].format = ma_format_unknown;
+        pDeviceInfo->nativeDataFormats[0].channels = 0;
+        pDeviceInfo->nativeDataFormats[0].sampleRate = 0;
+        pDeviceInfo->nativeDataFormats[0].flags = 0;
+        pDeviceInfo->nativeDataFormatCount = 1;
+
+        return MA_SUCCESS;
+}
+
+static ma_result renderNullContextUninit(ma_context *pContext)
+{
+        (void)pContext;
+        return MA_SUCCESS;
+}
+
+static ma_result renderNullContextInit(ma_context *pContext, const ma_context_config *pConfig, ma_backend_callbacks *pCallbacks)
+{
+        (void)pContext;
+        (void)pConfig;
+
+        pCallbacks->onContextInit = renderNullContextInit;
+        pCallbacks->onContextUninit = renderNullContextUninit;
+        pCallbacks->onContextEnumerateDevices = renderNullEnumerateDevices;
+        pCallbacks->onContextGetDeviceInfo = renderNullGetDeviceInfo;
+        pCallbacks->onDeviceInit = renderNullDeviceInit;
+        pCallbacks->onDeviceUninit = renderNullDeviceUninit;
+        pCallbacks->onDeviceStart = renderNullDeviceStart;
+        pCallbacks->onDeviceStop = renderNullDeviceStop;
+        pCallbacks->onDeviceRead = NULL;
+        pCallbacks->onDeviceWrite = renderNullWrite; // Never blocks, miniaudio's worker thread pulls as fast as it can
+        pCallbacks->onDeviceDataLoop = NULL;
+
+        return MA_SUCCESS;
+}
+
+ma_result initRenderNullContext(ma_context *context)
+{
+        ma_backend backends[] = {ma_backend_custom};
+        ma_context_config config = ma_context_config_init();
+
+        config.custom.onContextInit = renderNullContextInit;
+
+        return ma_context_init(backends, 1, &config, context);
+}
+
+typedef struct
+{
+        const char *codec;
+        uint64_t tracks;
+        uint64_t frames;
+        double audioSeconds;
+        double wallSeconds;
+} RenderCodecTotals;
+
+void printRenderNullReport(FILE *file)
+{
+        RenderCodecTotals totals[16];
+        int codecCount = 0;
+        double switchTotal = 0.0;
+        double switchMax = 0.0;
+        int switchCount = 0;
+
+        pthread_mutex_lock(&renderMutex);
+
+        fprintf(file, "Rendered %zu tracks\n\n", segmentCount);
+        fprintf(file, "%-6s %10s %9s %9s %8s %10s %16s  %s\n", "codec", "frames", "audio s", "wall ms", "x real", "switch ms", "checksum", "path");
+
+        for (size_t i = 0; i < segmentCount; i++)
+        {
+                RenderSegment *segment = &segments[i];
+                const char *codec = getRenderCodec(segment->path);
+                double audioSeconds = (segment->sampleRate > 0) ? (double)segment->frames / segment->sampleRate : 0.0;
+                double wallSeconds = (segment->lastWrite - segment->firstWrite) / 1e9;
+                double switchMs = (i > 0) ? (segment->firstWrite - segments[i - 1].lastWrite) / 1e6 : 0.0;
+
+                if (i > 0)
+                {
+                        switchTotal += switchMs;
+                        switchMax = (switchMs > switchMax) ? switchMs : switchMax;
+                        switchCount++;
+                }
+
+                fprintf(file, "%-6s %10llu %9.2f %9.1f %8.1f %10.1f %016llx  %s\n",
+                        codec, (unsigned long long)segment->frames, audioSeconds, wallSeconds * 1000.0,
+                        (wallSeconds > 0.0) ? audioSeconds / wallSeconds : 0.0, switchMs,
+                        (unsigned long long)segment->checksum, (segment->path != NULL) ? segment->path : "(none)");
+
+                int c = 0;
+                while (c < codecCount && strcmp(totals[c].codec, codec) != 0)
+                        c++;
+
+                if (c == codecCount)
+                {
+                        if (codecCount == (int)(sizeof(totals) / sizeof(totals[0])))
+                                continue;
+
+                        totals[c].codec = codec;
+                        totals[c].tracks = 0;
+                        totals[c].frames = 0;
+                        totals[c].audioSeconds = 0.0;
+                        totals[c].wallSeconds = 0.0;
+                        codecCount++;
+                }
+
+                totals[c].tracks++;
+                totals[c].frames += segment->frames;
+                totals[c].audioSeconds += audioSeconds;
+                totals[c].wallSeconds += wallSeconds;
+        }
+
+        fprintf(file, "\n%-6s %7s %12s %14s %8s\n", "codec", "tracks", "frames", "frames/s", "x real");
+
+        for (int c = 0; c < codecCount; c++)
+        {
+                fprintf(file, "%-6s %7llu %12llu %14.0f %8.1f\n", totals[c].codec,
+                        (unsigned long long)totals[c].tracks, (unsigned long long)totals[c].frames,
+                        (totals[c].wallSeconds > 0.0) ? totals[c].frames / totals[c].wallSeconds : 0.0,
+                        (totals[c].wallSeconds > 0.0) ? totals[c].audioSeconds / totals[c].wallSeconds : 0.0);
+        }
+
+        fprintf(file, "\nSwitch latency: mean %.1f ms, max %.1f ms over %d switches\n",
+                (switchCount > 0) ? switchTotal / switchCount : 0.0, switchMax, switchCount);
+        fprintf(file, "Stream checksum: %016llx\n", (unsigned long long)streamChecksum);
+
+        pthread_mutex_unlock(&renderMutex);
+
+        fflush(file);
+}
+
+void freeRenderNull()
+{
+        pthread_mutex_lock(&renderMutex);
+
+        free(segments);
+        segments = NULL;
+        segmentCount = 0;
+        segmentCapacity = 0;
+
+        pthread_mutex_unlock(&renderMutex);
+}
@@ -0,0 +1,37 @@
+#ifndef RENDERNULL_H
+#define RENDERNULL_H
+
+#include <miniaudio.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "soundcommon.h"
+
+#ifndef RENDERSEGMENT_STRUCT
+#define RENDERSEGMENT_STRUCT
+
+// The output of one track, from the first period written while it was current to the last
+typedef struct
+{
+        const char *path; // Interned, stays valid until freePathIndex
+        ma_format format;
+        ma_uint32 channels;
+        ma_uint32 sampleRate;
+        uint64_t frames;
+        uint64_t firstWrite;
+        uint64_t lastWrite;
+        uint64_t checksum;
+} RenderSegment;
+
+#endif
+
+extern bool renderNullEnabled;
+
+ma_result initRenderNullContext(ma_context *context);
+
+void printRenderNullReport(FILE *file);
+
+void freeRenderNull();
+
+#endif
@@ -37,6 +37,11 @@ AppSettings constructAppSettings(KeyValuePair *pairs, int count)
         strncpy(settings.hideLogo, "0", sizeof(settings.hideLogo));
         strncpy(settings.hideHelp, "0", sizeof(settings.hideHelp));
         strncpy(settings.cacheLibrary, "-1", sizeof(settings.cacheLibrary));
+        strncpy(settings.replayGain, "off", sizeof(settings.replayGain));
+        strncpy(settings.crossfade, "0", sizeof(settings.crossfade));
+        strncpy(settings.equalizer, "off", sizeof(settings.equalizer));
+        strncpy(settings.equalizerCustom, "lowshelf:100:3:0.7,peak:1000:0:1.0,highshelf:8000:2:0.7", sizeof(settings.equalizerCustom));
+        strncpy(settings.powerProfile, "default", sizeof(settings.powerProfile));
 
         strncpy(settings.volumeUp, "+", sizeof(settings.volumeUp));
         strncpy(settings.volumeUpAlt, "=", sizeof(settings.volumeUpAlt));
@@ -53,6 +58,8 @@ AppSettings constructAppSettings(KeyValuePair *pairs, int count)
         strncpy(settings.togglePause, "p", sizeof(settings.togglePause));
         strncpy(settings.seekBackward, "a", sizeof(settings.seekBackward));
         strncpy(settings.seekForward, "d", sizeof(settings.seekForward));
+        strncpy(settings.increaseSpeed, ">", sizeof(settings.increaseSpeed));
+        strncpy(settings.decreaseSpeed, "<", sizeof(settings.decreaseSpeed));
         strncpy(settings.savePlaylist, "x", sizeof(settings.savePlaylist));
         strncpy(settings.updateLibrary, "u", sizeof(settings.updateLibrary));
         strncpy(settings.addToMainPlaylist, ".", sizeof(settings.addToMainPlaylist));
@@ -81,6 +88,7 @@ AppSettings constructAppSettings(KeyValuePair *pairs, int count)
         strncpy(settings.hardNextPage, "[6~", sizeof(settings.hardNextPage));
         strncpy(settings.hardPrevPage, "[5~", sizeof(settings.hardPrevPage));
         strncpy(settings.hardRemove, "[3~", sizeof(settings.hardRemove));
+        strncpy(settings.hardToggleAudioStats, "D", sizeof(settings.hardToggleAudioStats));
         strncpy(settings.lastVolume, "100", sizeof(settings.lastVolume));
         strncpy(settings.color, "6", sizeof(settings.color));
         strncpy(settings.artistColor, "6", sizeof(settings.artistColor));
@@ -187,6 +195,14 @@ AppSettings constructAppSettings(KeyValuePair *pairs, int count)
                 {
                         snprintf(settings.seekForward, sizeof(settings.seekForward), "%s", pair->value);
                 }
+                else if (strcmp(stringToLower(pair->key), "increasespeed") == 0)
+                {
+                        snprintf(settings.increaseSpeed, sizeof(settings.increaseSpeed), "%s", pair->value);
+                }
+                else if (strcmp(stringToLower(pair->key), "decreasespeed") == 0)
+                {
+                        snprintf(settings.decreaseSpeed, sizeof(settings.decreaseSpeed), "%s", pair->value);
+                }
                 else if (strcmp(stringToLower(pair->key), "saveplaylist") == 0)
                 {
                         snprintf(settings.savePlaylist, sizeof(settings.savePlaylist), "%s", pair->value);
@@ -231,6 +247,26 @@ AppSettings constructAppSettings(KeyValuePair *pairs, int count)
                 {
                         snprintf(settings.cacheLibrary, sizeof(settings.cacheLibrary), "%s", pair->value);
                 }
+                else if (strcmp(stringToLower(pair->key), "replaygain") == 0)
+                {
+                        snprintf(settings.replayGain, sizeof(settings.replayGain), "%s", pair->value);
+                }
+                else if (strcmp(stringToLower(pair->key), "crossfade") == 0)
+                {
+                        snprintf(settings.crossfade, sizeof(settings.crossfade), "%s", pair->value);
+                }
+                else if (strcmp(stringToLower(pair->key), "equalizer") == 0)
+                {
+                        snprintf(settings.equalizer, sizeof(settings.equalizer), "%s", pair->value);
+                }
+                else if (strcmp(stringToLower(pair->key), "equalizercustom") == 0)
+                {
+                        snprintf(settings.equalizerCustom, sizeof(settings.equalizerCustom), "%s", pair->value);
+                }
+                else if (strcmp(stringToLower(pair->key), "powerprofile") == 0)
+                {
+                        snprintf(settings.powerProfile, sizeof(settings.powerProfile), "%s", pair->value);
+                }
                 else if (strcmp(stringToLower(pair->key), "quit") == 0)
                 {
                         snprintf(settings.quit, sizeof(settings.quit), "%s", pair->value);
@@ -394,6 +430,16 @@ void getConfig(AppSettings *settings)
         if (temp4 >= 0)
                 cacheLibrary = temp4;
 
+        setLoudnessMode(parseLoudnessMode(settings->replayGain));
+
+        setCrossfadeSeconds(atoi(settings->crossfade));
+
+        EqBand bands[EQ_MAX_BANDS];
+        int bandCount = getEqualizerPreset(settings->equalizer, settings->equalizerCustom, bands, EQ_MAX_BANDS);
+        setEqualizerBands(bands, bandCount);
+
+        setPowerProfile(parsePowerProfile(settings->powerProfile));
+
         getMusicLibraryPath(settings->path);
         free(configdir);
 }
@@ -455,6 +501,11 @@ void setConfig(AppSettings *settings)
         settings->hideLogo[1] = '\0';
         settings->hideHelp[1] = '\0';
         settings->cacheLibrary[5] = '\0';
+        settings->replayGain[5] = '\0';
+        settings->crossfade[5] = '\0';
+        settings->equalizer[15] = '\0';
+        settings->equalizerCustom[255] = '\0';
+        settings->powerProfile[15] = '\0';
 
         // Write the settings to the file
         fprintf(file, "# Make sure that kew is closed before editing this file in order for changes to take effect.\n\n");
@@ -474,6 +525,22 @@ void setConfig(AppSettings *settings)
         fprintf(file, "\n# Cache: Set to 1 to use cache of the music library directory tree for faster startup times.\n");
         fprintf(file, "cacheLibrary=%s\n", settings->cacheLibrary);
 
+        fprintf(file, "\n# Loudness normalization: album, track or off. Uses ReplayGain tags when present, otherwise tracks are analyzed in the background.\n");
+        fprintf(file, "replayGain=%s\n", settings->replayGain);
+
+        fprintf(file, "\n# Crossfade: Seconds to fade between songs of the same format, 0 for gapless playback.\n");
+        fprintf(file, "crossfade=%s\n", settings->crossfade);
+
+        fprintf(file, "\n# Equalizer: off, bass, treble, vocal, loudness, lofi or custom.\n");
+        fprintf(file, "# The custom preset is a comma separated list of type:frequency:gain:q, with type peak, lowshelf or highshelf and gain in dB.\n");
+        fprintf(file, "equalizer=%s\n", settings->equalizer);
+        fprintf(file, "equalizerCustom=%s\n", settings->equalizerCustom);
+
+        fprintf(file, "\n# Power profile: default, buffers, quiet or battery.\n");
+        fprintf(file, "# buffers plays from large device buffers so the CPU can sleep longer, quiet redraws once a second while paused,\n");
+        fprintf(file, "# with the visualizer off or when the terminal is out of focus, battery does both.\n");
+        fprintf(file, "powerProfile=%s\n", settings->powerProfile);
+
         fprintf(file, "\n# Color values are 0=Black, 1=Red, 2=Green, 3=Yellow, 4=Blue, 5=Magenta, 6=Cyan, 7=White\n");
         fprintf(file, "# These mostly affect the library view.\n\n");
         fprintf(file, "# Logo color: \n");
@@ -502,6 +569,8 @@ void setConfig(AppSettings *settings)
         fprintf(file, "toggleShuffle=%s\n", settings->toggleShuffle);
         fprintf(file, "seekBackward=%s\n", settings->seekBackward);
         fprintf(file, "seekForward=%s\n", settings->seekForward);
+        fprintf(file, "increaseSpeed=%s\n", settings->increaseSpeed);
+        fprintf(file, "decreaseSpeed=%s\n", settings->decreaseSpeed);
         fprintf(file, "savePlaylist=%s\n", settings->savePlaylist);
         fprintf(file, "addToMainPlaylist=%s\n", settings->addToMainPlaylist);
         fprintf(file, "updateLibrary=%s\n", settings->updateLibrary);
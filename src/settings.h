@@ -8,7 +8,9 @@
 #include <stdlib.h>
 #include <sys/param.h>
 #include <unistd.h>
+#include "equalizer.h"
 #include "file.h"
+#include "loudness.h"
 #include "soundcommon.h"
 #include "player.h"
 #include "utils.h"
@@ -83,14 +83,57 @@ void turnFilePathIntoTitle(const char *filePath, char *title)
         }
 }
 
+// ReplayGain 2.0 tags, or the R128 ones Opus uses, which are Q7.8 relative to -23 LUFS
+void extractReplayGain(AVDictionary *metadata, TagSettings *tag_settings)
+{
+        AVDictionaryEntry *tag = NULL;
+
+        while ((tag = av_dict_get(metadata, "", tag, AV_DICT_IGNORE_SUFFIX)))
+        {
+                if (strcasecmp(tag->key, "replaygain_track_gain") == 0)
+                {
+                        tag_settings->trackGain = strtod(tag->value, NULL);
+                        tag_settings->hasTrackGain = true;
+                }
+                else if (strcasecmp(tag->key, "replaygain_track_peak") == 0)
+                {
+                        tag_settings->trackPeak = strtod(tag->value, NULL);
+                }
+                else if (strcasecmp(tag->key, "replaygain_album_gain") == 0)
+                {
+                        tag_settings->albumGain = strtod(tag->value, NULL);
+                        tag_settings->hasAlbumGain = true;
+                }
+                else if (strcasecmp(tag->key, "replaygain_album_peak") == 0)
+                {
+                        tag_settings->albumPeak = strtod(tag->value, NULL);
+                }
+                else if (strcasecmp(tag->key, "r128_track_gain") == 0 && !tag_settings->hasTrackGain)
+                {
+                        tag_settings->trackGain = atoi(tag->value) / 256.0 + 5.0;
+                        tag_settings->hasTrackGain = true;
+                }
+                else if (strcasecmp(tag->key, "r128_album_gain") == 0 && !tag_settings->hasAlbumGain)
+                {
+                        tag_settings->albumGain = atoi(tag->value) / 256.0 + 5.0;
+                        tag_settings->hasAlbumGain = true;
+                }
+        }
+}
+
 // Extracts metadata, returns -1 if no album cover found, -2 if no file found or if file has errors
+// Writes the embedded cover to coverFilePath unless it is NULL, returns -1 when there is no cover and -2 on errors
 int extractTags(const char *input_file, TagSettings *tag_settings, double *duration, const char *coverFilePath)
 {
+        TRACE_SCOPE("extractTags");
+
         AVFormatContext *fmt_ctx = NULL;
         AVDictionaryEntry *tag = NULL;
         int ret;
 
-        if ((ret = avformat_open_input(&fmt_ctx, input_file, NULL, NULL)) < 0)
+        memset(&tag_settings->gapless, 0, sizeof(tag_settings->gapless));
+
+        if ((ret = openMappedInput(&fmt_ctx, input_file, false)) < 0)
         {
                 fprintf(stderr, "Could not open input file '%s'\n", input_file);
                 return -2;
@@ -98,7 +141,7 @@ int extractTags(const char *input_file, TagSettings *tag_settings, double *durat
         if ((ret = avformat_find_stream_info(fmt_ctx, NULL)) < 0)
         {
                 fprintf(stderr, "Could not find stream information\n");
-                avformat_close_input(&fmt_ctx);
+                closeMappedInput(&fmt_ctx);
                 return -2;
         }
 
@@ -107,6 +150,12 @@ int extractTags(const char *input_file, TagSettings *tag_settings, double *durat
         memset(tag_settings->album_artist, 0, sizeof(tag_settings->album_artist));
         memset(tag_settings->album, 0, sizeof(tag_settings->album));
         memset(tag_settings->date, 0, sizeof(tag_settings->date));
+        tag_settings->trackGain = 0.0;
+        tag_settings->trackPeak = 0.0;
+        tag_settings->albumGain = 0.0;
+        tag_settings->albumPeak = 0.0;
+        tag_settings->hasTrackGain = false;
+        tag_settings->hasAlbumGain = false;
 
         while ((tag = av_dict_get(fmt_ctx->metadata, "", tag, AV_DICT_IGNORE_SUFFIX)))
         {
@@ -130,8 +179,23 @@ int extractTags(const char *input_file, TagSettings *tag_settings, double *durat
                 {
                         snprintf(tag_settings->date, sizeof(tag_settings->date), "%s", tag->value);
                 }
+                else if (strcasecmp(tag->key, "iTunSMPB") == 0)
+                {
+                        parseITunSMPB(tag->value, &tag_settings->gapless);
+                }
         }
 
+        extractReplayGain(fmt_ctx->metadata, tag_settings);
+
+        // Ogg keeps its comments on the stream rather than the container
+        int audio_index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+        if (audio_index >= 0)
+                extractReplayGain(fmt_ctx->streams[audio_index]->metadata, tag_settings);
+
+        char *extension = strrchr(input_file, '.');
+        if (extension != NULL && strcasecmp(extension, ".mp3") == 0)
+                readLameGapless(input_file, &tag_settings->gapless);
+
         if (strlen(tag_settings->title) <= 0)
         {
                 char title[MAXPATHLEN];
@@ -150,11 +214,18 @@ int extractTags(const char *input_file, TagSettings *tag_settings, double *durat
                 return -2;
         }
 
+        // The cover is already cached
+        if (coverFilePath == NULL)
+        {
+                closeMappedInput(&fmt_ctx);
+                return 0;
+        }
+
         int stream_index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
         if (stream_index < 0)
         {
                 fprintf(stderr, "Could not find a video stream in the input file\n");
-                avformat_close_input(&fmt_ctx);
+                closeMappedInput(&fmt_ctx);
                 return -1;
         }
 
@@ -168,22 +239,22 @@ int extractTags(const char *input_file, TagSettings *tag_settings, double *durat
                 if (!file)
                 {
                         fprintf(stderr, "Could not open output file '%s'\n", coverFilePath);
-                        avformat_close_input(&fmt_ctx);
+                        closeMappedInput(&fmt_ctx);
                         return -1;
                 }
                 fwrite(pkt->data, 1, pkt->size, file);
                 fclose(file);
 
-                avformat_close_input(&fmt_ctx);
+                closeMappedInput(&fmt_ctx);
                 return 0;
         }
         else
         {
-                avformat_close_input(&fmt_ctx);
+                closeMappedInput(&fmt_ctx);
                 return -1;
         }
 
-        avformat_close_input(&fmt_ctx);
+        closeMappedInput(&fmt_ctx);
 
         return 0;
 }
@@ -198,6 +269,14 @@ gchar *generateTrackId()
         return trackId;
 }
 
+// Covers are decoded only to be drawn, the extracted file is still kept for MPRIS
+bool coverDecodingEnabled = true;
+
+void setCoverDecodingEnabled(bool enabled)
+{
+        coverDecodingEnabled = enabled;
+}
+
 void loadColor(SongData *songdata)
 {
         getCoverColor(songdata->cover, &(songdata->red), &(songdata->green), &(songdata->blue));
@@ -206,17 +285,32 @@ void loadColor(SongData *songdata)
 void loadMetaData(SongData *songdata)
 {
         char path[MAXPATHLEN];
+        char coverArtPath[MAXPATHLEN];
 
         songdata->metadata = malloc(sizeof(TagSettings));
-        generateTempFilePath(songdata->coverArtPath, "cover", ".jpg");
-        int res = extractTags(songdata->filePath, songdata->metadata, &songdata->duration, songdata->coverArtPath);
+
+        // The cover extracted the last time this song was loaded may still be there
+        bool cached = acquireFromCache(tempCache, songdata->filePath, coverArtPath, sizeof(coverArtPath));
+
+        if (!cached)
+                generateTempFilePath(coverArtPath, "cover", ".jpg");
+
+        int res = extractTags(songdata->filePath, songdata->metadata, &songdata->duration, cached ? NULL : coverArtPath);
 
         if (res == -2)
         {
+                if (cached)
+                        releaseFromCache(tempCache, songdata->filePath);
+
                 songdata->hasErrors = true;
                 return;
         }
-        else if (res == -1)
+
+        songdata->track->duration = songdata->duration;
+        setTrackTagName(songdata->track, songdata->metadata->artist, songdata->metadata->title);
+        songdata->loudnessGain = getSongLoudnessGain(songdata->filePath, songdata->metadata);
+
+        if (res == -1)
         {
                 getDirectoryFromPath(songdata->filePath, path);
                 char *tmp = NULL;
@@ -224,35 +318,60 @@ void loadMetaData(SongData *songdata)
                 tmp = findLargestImageFile(path, tmp, &size);
 
                 if (tmp != NULL)
-                        c_strcpy(songdata->coverArtPath, sizeof(songdata->coverArtPath), tmp);
-                else
-                        c_strcpy(songdata->coverArtPath, sizeof(songdata->coverArtPath), "");
+                {
+                        free(songdata->coverArtPath);
+                        songdata->coverArtPath = tmp;
+                }
         }
         else
         {
-                addToCache(tempCache, songdata->coverArtPath);
+                if (!cached)
+                        addToCache(tempCache, songdata->filePath, coverArtPath, sizeof(coverArtPath));
+
+                char *copy = strdup(coverArtPath);
+
+                if (copy != NULL)
+                {
+                        free(songdata->coverArtPath);
+                        songdata->coverArtPath = copy;
+                }
+
+                songdata->coverInCache = true;
         }
 
-        songdata->cover = getBitmap(songdata->coverArtPath);
+        if (coverDecodingEnabled)
+                songdata->cover = getBitmap(songdata->coverArtPath);
 }
 
 SongData *loadSongData(char *filePath)
 {
+        TRACE_SCOPE("loadSongData");
+
         SongData *songdata = NULL;
         songdata = malloc(sizeof(SongData));
         songdata->trackId = generateTrackId();
         songdata->hasErrors = false;
-        c_strcpy(songdata->filePath, sizeof(songdata->filePath), "");
-        c_strcpy(songdata->coverArtPath, sizeof(songdata->coverArtPath), "");
+        songdata->track = acquireTrack(filePath);
+        songdata->filePath = (songdata->track != NULL) ? songdata->track->path : "";
+        songdata->coverArtPath = strdup("");
+        songdata->coverInCache = false;
         songdata->red = 150;
         songdata->green = 150;
         songdata->blue = 150;
         songdata->metadata = NULL;
         songdata->cover = NULL;
         songdata->duration = 0.0;
-        c_strcpy(songdata->filePath, sizeof(songdata->filePath), filePath);       
+        songdata->loudnessGain = 1.0f;
+
+        if (songdata->track == NULL || songdata->coverArtPath == NULL)
+        {
+                songdata->hasErrors = true;
+                return songdata;
+        }
+
         loadMetaData(songdata);
-        loadColor(songdata);
+        if (coverDecodingEnabled)
+                loadColor(songdata);
         return songdata;
 }
 
@@ -269,13 +388,14 @@ void unloadSongData(SongData **songdata)
                 data->cover = NULL;
         }
 
-        if (existsInCache(tempCache, data->coverArtPath) && isInTempDir(data->coverArtPath))
-        {
-                deleteFile(data->coverArtPath);
-        }
+        // The extracted cover is kept for the next time the song is loaded, the cache deletes it when it has to
+        if (data->coverInCache)
+                releaseFromCache(tempCache, data->filePath);
 
         free(data->metadata);
         free(data->trackId);
+        free(data->coverArtPath);
+        releaseTrack(data->track);
 
         data->cover = NULL;
         data->metadata = NULL;
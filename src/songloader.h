@@ -6,6 +6,9 @@
 #include "cache.h"
 #include "chafafunc.h"
 #include "file.h"
+#include "gapless.h"
+#include "loudness.h"
+#include "mappedio.h"
 #include "sound.h"
 #include "soundcommon.h"
 #include "utils.h"
@@ -35,6 +38,13 @@ typedef struct
         char album_artist[256];
         char album[256];
         char date[256];
+        double trackGain; // ReplayGain tags in dB, valid when hasTrackGain/hasAlbumGain is set
+        double trackPeak;
+        double albumGain;
+        double albumPeak;
+        bool hasTrackGain;
+        bool hasAlbumGain;
+        GaplessInfo gapless; // Encoder delay and padding to trim, zero when the file has none
 } TagSettings;
 
 #endif
@@ -45,14 +55,17 @@ typedef struct
 typedef struct
 {
         gchar *trackId;
-        char filePath[MAXPATHLEN];
-        char coverArtPath[MAXPATHLEN];
+        Track *track;
+        const char *filePath; // The track's path
+        char *coverArtPath;
+        bool coverInCache; // coverArtPath was extracted into tempCache and has to be released there
         unsigned char red;
         unsigned char green;
         unsigned char blue;
         TagSettings *metadata;
         FIBITMAP *cover;
         double duration;
+        float loudnessGain; // Linear normalization gain, 1.0 when off or not yet analyzed
         bool hasErrors;
 } SongData;
 
@@ -60,5 +73,9 @@ typedef struct
 
 extern Cache *tempCache;
 
+int extractTags(const char *input_file, TagSettings *tag_settings, double *duration, const char *coverFilePath);
+
+void setCoverDecodingEnabled(bool enabled);
+
 SongData *loadSongData(char *filePath);
 void unloadSongData(SongData **songdata);
@@ -4,6 +4,7 @@
 
 #include <miniaudio.h>
 #include "mpris.h"
+#include "rendernull.h"
 #include "sound.h"
 
 /*
@@ -34,9 +35,14 @@ int check_aac_codec_support()
 
 ma_result initFirstDatasource(AudioData *pAudioData, UserData *pUserData)
 {
-        char *filePath = NULL;
+        const char *filePath = NULL;
+        const GaplessInfo *gapless = NULL;
+        SongData *songData = (pAudioData->currentFileIndex == 0) ? pUserData->songdataA : pUserData->songdataB;
+
+        filePath = songData->filePath;
 
-        filePath = (pAudioData->currentFileIndex == 0) ? pUserData->songdataA->filePath : pUserData->songdataB->filePath;
+        if (songData->metadata != NULL)
+                gapless = &songData->metadata->gapless;
 
         pAudioData->pUserData = pUserData;
         pAudioData->currentPCMFrame = 0;
@@ -44,7 +50,7 @@ ma_result initFirstDatasource(AudioData *pAudioData, UserData *pUserData)
 
         if (hasBuiltinDecoder(filePath))
         {
-                int result = prepareNextDecoder(filePath);
+                int result = prepareNextDecoder(filePath, gapless);
                 if (result < 0)
                         return -1;
                 ma_decoder *first = getFirstDecoder();
@@ -81,7 +87,7 @@ ma_result initFirstDatasource(AudioData *pAudioData, UserData *pUserData)
         }
         else if (endsWith(filePath, "m4a") || endsWith(filePath, "aac") || endsWith(filePath, "mp4"))
         {
-                int result = prepareNextM4aDecoder(filePath);
+                int result = prepareNextM4aDecoder(filePath, gapless);
                 if (result < 0)
                         return -1;
                 m4a_decoder *first = getFirstM4aDecoder();
@@ -100,6 +106,17 @@ ma_result initFirstDatasource(AudioData *pAudioData, UserData *pUserData)
         return MA_SUCCESS;
 }
 
+// Fewer, larger periods let the CPU sleep longer between callbacks, at the cost of latency on pause and seek
+void configurePeriods(ma_device_config *deviceConfig)
+{
+        if (!usesLargePeriods())
+                return;
+
+        deviceConfig->performanceProfile = ma_performance_profile_conservative;
+        deviceConfig->periodSizeInMilliseconds = POWER_PERIOD_MS;
+        deviceConfig->periods = POWER_PERIODS;
+}
+
 void createDevice(UserData *userData, ma_device *device, ma_context *context, ma_data_source_vtable *vtable, ma_device_data_proc callback)
 {
         ma_result result;
@@ -118,6 +135,8 @@ void createDevice(UserData *userData, ma_device *device, ma_context *context, ma
         deviceConfig.dataCallback = callback;
         deviceConfig.pUserData = &audioData;
 
+        configurePeriods(&deviceConfig);
+
         result = ma_device_init(context, &deviceConfig, device);
         if (result != MA_SUCCESS)
                 return;
@@ -149,6 +168,8 @@ void vorbis_createAudioDevice(UserData *userData, ma_device *device, ma_context
         deviceConfig.dataCallback = vorbis_on_audio_frames;
         deviceConfig.pUserData = vorbis;
 
+        configurePeriods(&deviceConfig);
+
         result = ma_device_init(context, &deviceConfig, device);
         if (result != MA_SUCCESS)
         {
@@ -181,6 +202,8 @@ void m4a_createAudioDevice(UserData *userData, ma_device *device, ma_context *co
         deviceConfig.dataCallback = m4a_on_audio_frames;
         deviceConfig.pUserData = decoder;
 
+        configurePeriods(&deviceConfig);
+
         result = ma_device_init(context, &deviceConfig, device);
         if (result != MA_SUCCESS)
         {
@@ -215,6 +238,8 @@ void opus_createAudioDevice(UserData *userData, ma_device *device, ma_context *c
         deviceConfig.dataCallback = opus_on_audio_frames;
         deviceConfig.pUserData = opus;
 
+        configurePeriods(&deviceConfig);
+
         result = ma_device_init(context, &deviceConfig, device);
         if (result != MA_SUCCESS)
         {
@@ -233,7 +258,7 @@ void opus_createAudioDevice(UserData *userData, ma_device *device, ma_context *c
         emitStringPropertyChanged("PlaybackStatus", "Playing");
 }
 
-bool validFilePath(char *filePath)
+bool validFilePath(const char *filePath)
 {
     if (filePath == NULL || filePath[0] == '\0' || filePath[0] == '\r')
         return false;
@@ -248,6 +273,8 @@ bool tryAgain = false;
 
 int switchAudioImplementation()
 {
+        TRACE_SCOPE("switchAudioImplementation");
+
         if (audioData.endOfListReached)
         {
                 setEOFNotReached();
@@ -284,6 +311,7 @@ int switchAudioImplementation()
                 }
 
                 filePath = strdup(userData.currentSongData->filePath);
+                setLoudnessGain(userData.currentSongData->loudnessGain);
         }
 
         tryAgain = false;        
@@ -485,7 +513,10 @@ void cleanupAudioContext()
 
 int createAudioDevice(UserData *userData)
 {
-        ma_context_init(NULL, 0, NULL, &context);
+        if (renderNullEnabled)
+                initRenderNullContext(&context);
+        else
+                ma_context_init(NULL, 0, NULL, &context);
 
         if (switchAudioImplementation() >= 0)
         {
@@ -52,13 +52,13 @@ extern AudioData audioData;
 
 extern UserData userData;
 
-int prepareNextDecoder(char *filepath);
+int prepareNextDecoder(const char *filepath, const GaplessInfo *gapless);
 
-int prepareNextOpusDecoder(char *filepath);
+int prepareNextOpusDecoder(const char *filepath);
 
-int prepareNextVorbisDecoder(char *filepath);
+int prepareNextVorbisDecoder(const char *filepath);
 
-int prepareNextM4aDecoder(char *filepath);
+int prepareNextM4aDecoder(const char *filepath, const GaplessInfo *gapless);
 
 void setDecoders(bool usingA, char *filePath);
 
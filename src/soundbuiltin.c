@@ -26,7 +26,7 @@ static ma_result builtin_file_data_source_seek(ma_data_source *pDataSource, ma_u
                 return MA_INVALID_ARGS;
         }
 
-        ma_result result = ma_decoder_seek_to_pcm_frame(getCurrentBuiltinDecoder(), frameIndex);
+        ma_result result = ma_data_source_seek_to_pcm_frame(getCurrentBuiltinDecoder(), frameIndex);
 
         if (result == MA_SUCCESS)
         {
@@ -68,7 +68,7 @@ static ma_result builtin_file_data_source_get_length(ma_data_source *pDataSource
                 return MA_INVALID_ARGS;
         }
 
-        ma_result result = ma_decoder_get_length_in_pcm_frames(getCurrentBuiltinDecoder(), &totalFrames);
+        ma_result result = ma_data_source_get_length_in_pcm_frames(getCurrentBuiltinDecoder(), &totalFrames);
 
         if (result != MA_SUCCESS)
         {
@@ -110,11 +110,13 @@ void builtin_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_u
 
                 if (pthread_mutex_trylock(&dataSourceMutex) != 0)
                 {
+                        countAudioEvent(AUDIO_TRYLOCK_MISSES, 1);
                         return;
                 }
 
                 if (isImplSwitchReached() || audioData == NULL)
                 {
+                        countAudioEvent(AUDIO_SWITCH_RETURNS, 1);
                         pthread_mutex_unlock(&dataSourceMutex);
                         return;
                 }
@@ -144,7 +146,7 @@ void builtin_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_u
                         if (seekPercent >= 100.0)
                                 seekPercent = 100.0;
                         ma_uint64 targetFrame = (totalFrames * seekPercent) / 100;
-                        ma_result seekResult = ma_decoder_seek_to_pcm_frame(decoder, targetFrame);
+                        ma_result seekResult = ma_data_source_seek_to_pcm_frame(decoder, targetFrame); // Within the gapless range
 
                         if (seekResult != MA_SUCCESS)
                         {
@@ -154,6 +156,7 @@ void builtin_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_u
                         }
 
                         setSeekRequested(false);
+                        invalidateStretch();
                 }
 
                 ma_uint64 framesToRead = 0;
@@ -167,7 +170,11 @@ void builtin_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_u
                         return;
                 }
 
-                result = ma_data_source_read_pcm_frames(firstDecoder, (ma_int32 *)pFramesOut + framesRead * audioData->channels, remainingFrames, &framesToRead);
+                uint64_t readStart = audioStatsNow();
+                result = readCrossfaded(firstDecoder, decoder, isRepeatEnabled() ? NULL : getNextBuiltinDecoder(),
+                                        audioData->format, audioData->channels, audioData->sampleRate,
+                                        (ma_int32 *)pFramesOut + framesRead * audioData->channels, remainingFrames, &framesToRead);
+                recordAudioTime(AUDIO_DECODER_READ_TIME, readStart);
                 ma_data_source_get_cursor_in_pcm_frames(decoder, &cursor);
 
                 if (((audioData->totalFrames != 0 && cursor != 0 && cursor >= audioData->totalFrames) || framesToRead == 0 || isSkipToNext() || result != MA_SUCCESS) && !isEOFReached())
@@ -183,18 +190,7 @@ void builtin_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_u
                 pthread_mutex_unlock(&dataSourceMutex);
         }
 
-        ma_int32 *audioBuffer = getAudioBuffer();
-        if (audioBuffer == NULL)
-        {
-                audioBuffer = malloc(sizeof(ma_int32) * MAX_BUFFER_SIZE);
-                if (audioBuffer == NULL)
-                {
-                        return;
-                }
-        }
-
-        memcpy(audioBuffer, pFramesOut, sizeof(ma_int32) * framesRead);
-        setAudioBuffer(audioBuffer);
+        copyToAudioBuffer(pFramesOut, framesRead);
 
         if (pFramesRead != NULL)
         {
@@ -206,6 +202,11 @@ void builtin_on_audio_frames(ma_device *pDevice, void *pFramesOut, const void *p
 {
         AudioData *pDataSource = (AudioData *)pDevice->pUserData;
         ma_uint64 framesRead = 0;
-        builtin_read_pcm_frames(&pDataSource->base, pFramesOut, frameCount, &framesRead);
+        uint64_t start = audioStatsNow();
+        readStretched(builtin_read_pcm_frames, &pDataSource->base, pFramesOut, frameCount, pDevice->playback.format, pDevice->playback.channels, pDevice->sampleRate, &framesRead);
+        applyDsp(pFramesOut, framesRead, pDevice->playback.format, pDevice->playback.channels, pDevice->sampleRate);
+        applyGain(pFramesOut, framesRead, pDevice->playback.format, pDevice->playback.channels, pDevice->sampleRate);
+        recordAudioTime(AUDIO_CALLBACK_TIME, start);
+        countAudioCallback(frameCount, framesRead);
         (void)pFramesIn;
 }
@@ -29,6 +29,8 @@ pthread_mutex_t dataSourceMutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t switchMutex = PTHREAD_MUTEX_INITIALIZER;
 ma_device device = {0};
 ma_int32 *audioBuffer = NULL;
+bool audioBufferEnabled = true;
+PowerProfile powerProfile = POWER_DEFAULT;
 AudioData audioData;
 int bufSize;
 ma_event switchAudioImpl;
@@ -42,6 +44,7 @@ double duration;
 double elapsedSeconds = 0.0;
 
 int soundVolume = 100;
+_Atomic int systemVolume = -1;
 
 ma_decoder *firstDecoder;
 ma_decoder *currentDecoder;
@@ -62,14 +65,6 @@ int vorbisDecoderIndex = -1;
 NotifyNotification *previous_notification;
 #endif
 
-void logTime(const char *message)
-{
-        (void)message;
-        // struct timespec ts;
-        // clock_gettime(CLOCK_REALTIME, &ts);
-        // printf("[%ld.%09ld] %s\n", ts.tv_sec, ts.tv_nsec, message);
-}
-
 enum AudioImplementation getCurrentImplementationType()
 {
         return currentImplementation;
@@ -103,6 +98,7 @@ void switchDecoder()
 
 void resetDecoders()
 {
+        resetCrossfade();
         decoderIndex = -1;
 
         if (firstDecoder != NULL && firstDecoder->outputFormat != ma_format_unknown)
@@ -230,6 +226,42 @@ ma_libopus *getCurrentOpusDecoder()
                 return opusDecoders[opusDecoderIndex];
 }
 
+// The decoder in the other slot, which is the next one once it has been prepared
+ma_decoder *getNextBuiltinDecoder()
+{
+        return (decoderIndex == -1) ? decoders[0] : decoders[1 - decoderIndex];
+}
+
+ma_libvorbis *getNextVorbisDecoder()
+{
+        return (vorbisDecoderIndex == -1) ? vorbisDecoders[0] : vorbisDecoders[1 - vorbisDecoderIndex];
+}
+
+m4a_decoder *getNextM4aDecoder()
+{
+        return (m4aDecoderIndex == -1) ? m4aDecoders[0] : m4aDecoders[1 - m4aDecoderIndex];
+}
+
+ma_libopus *getNextOpusDecoder()
+{
+        return (opusDecoderIndex == -1) ? opusDecoders[0] : opusDecoders[1 - opusDecoderIndex];
+}
+
+// Keeps the audio thread off the next decoder while the loader thread replaces it
+void beginNextDecoderChange()
+{
+        setCrossfadeSuspended(true);
+
+        // Wait out a read that may already be using it
+        pthread_mutex_lock(&dataSourceMutex);
+        pthread_mutex_unlock(&dataSourceMutex);
+}
+
+void endNextDecoderChange()
+{
+        setCrossfadeSuspended(false);
+}
+
 ma_format getCurrentFormat()
 {
         ma_format format = ma_format_unknown;
@@ -384,6 +416,7 @@ void setNextOpusDecoder(ma_libopus *decoder)
 
 void resetVorbisDecoders()
 {
+        resetCrossfade();
         vorbisDecoderIndex = -1;
 
         if (firstVorbisDecoder != NULL && firstVorbisDecoder->format != ma_format_unknown)
@@ -410,6 +443,7 @@ void resetVorbisDecoders()
 
 void resetM4aDecoders()
 {
+        resetCrossfade();
         m4aDecoderIndex = -1;
 
         if (firstM4aDecoder != NULL && firstM4aDecoder->format != ma_format_unknown)
@@ -436,6 +470,7 @@ void resetM4aDecoders()
 
 void resetOpusDecoders()
 {
+        resetCrossfade();
         opusDecoderIndex = -1;
 
         if (firstOpusDecoder != NULL && firstOpusDecoder->format != ma_format_unknown)
@@ -599,7 +634,7 @@ MA_API ma_result ma_libvorbis_get_cursor_in_pcm_frames_wrapper(void *pDecoder, l
         return ma_libvorbis_get_cursor_in_pcm_frames((ma_libvorbis *)dec->pUserData, (ma_uint64 *)pCursor);
 }
 
-int prepareNextVorbisDecoder(char *filepath)
+int prepareNextVorbisDecoder(const char *filepath)
 {
         ma_libvorbis *currentDecoder;
 
@@ -661,7 +696,7 @@ int prepareNextVorbisDecoder(char *filepath)
         return 0;
 }
 
-int prepareNextDecoder(char *filepath)
+int prepareNextDecoder(const char *filepath, const GaplessInfo *gapless)
 {
         ma_decoder *currentDecoder;
 
@@ -698,6 +733,8 @@ int prepareNextDecoder(char *filepath)
                 free(decoder);
                 return -1;
         }
+
+        applyGaplessRange(decoder, gapless);
         setNextDecoder(decoder);
 
         if (currentDecoder != NULL)
@@ -706,7 +743,7 @@ int prepareNextDecoder(char *filepath)
         return 0;
 }
 
-int prepareNextM4aDecoder(char *filepath)
+int prepareNextM4aDecoder(const char *filepath, const GaplessInfo *gapless)
 {
         m4a_decoder *currentDecoder;
 
@@ -762,6 +799,9 @@ int prepareNextM4aDecoder(char *filepath)
         decoder->onTell = m4a_get_cursor_in_pcm_frames_wrapper;
         decoder->cursor = 0;
 
+        if (gapless != NULL)
+                decoder->validFrames = gapless->validFrames;
+
         setNextM4aDecoder(decoder);
         if (currentDecoder != NULL)
                 ma_data_source_set_next(currentDecoder, decoder);
@@ -769,7 +809,7 @@ int prepareNextM4aDecoder(char *filepath)
         return 0;
 }
 
-int prepareNextOpusDecoder(char *filepath)
+int prepareNextOpusDecoder(const char *filepath)
 {
         ma_libopus *currentDecoder;
 
@@ -840,7 +880,38 @@ int getBufferSize()
 
 void setBufferSize(int value)
 {
-        bufSize = value;
+        // Periods can be longer than what the visualizer keeps
+        bufSize = (value < MAX_BUFFER_SIZE) ? value : MAX_BUFFER_SIZE;
+}
+
+PowerProfile parsePowerProfile(const char *value)
+{
+        if (value == NULL)
+                return POWER_DEFAULT;
+        else if (strcasecmp(value, "buffers") == 0)
+                return POWER_BUFFERS;
+        else if (strcasecmp(value, "quiet") == 0)
+                return POWER_QUIET;
+        else if (strcasecmp(value, "battery") == 0)
+                return POWER_BATTERY;
+
+        return POWER_DEFAULT;
+}
+
+// Read when a device is created, so a change takes effect from the next one
+void setPowerProfile(PowerProfile profile)
+{
+        powerProfile = profile;
+}
+
+bool usesLargePeriods()
+{
+        return powerProfile == POWER_BUFFERS || powerProfile == POWER_BATTERY;
+}
+
+bool throttlesIdleTicks()
+{
+        return powerProfile == POWER_QUIET || powerProfile == POWER_BATTERY;
 }
 
 void initAudioBuffer()
@@ -866,9 +937,38 @@ void setAudioBuffer(ma_int32 *buf)
         audioBuffer = buf;
 }
 
+// Without a visualizer to show them, the samples aren't copied at all
+void setAudioBufferEnabled(bool enabled)
+{
+        audioBufferEnabled = enabled;
+}
+
+// Keeps the latest samples for the visualizer, no format conversion needed
+void copyToAudioBuffer(const void *frames, ma_uint64 frameCount)
+{
+        if (!audioBufferEnabled)
+                return;
+
+        if (audioBuffer == NULL)
+        {
+                audioBuffer = malloc(sizeof(ma_int32) * MAX_BUFFER_SIZE);
+                if (audioBuffer == NULL)
+                {
+                        // Memory allocation failed
+                        return;
+                }
+        }
+
+        if (frameCount > MAX_BUFFER_SIZE)
+                frameCount = MAX_BUFFER_SIZE;
+
+        memcpy(audioBuffer, frames, sizeof(ma_int32) * frameCount);
+}
+
 void resetAudioBuffer()
 {
-        memset(audioBuffer, 0, sizeof(float) * MAX_BUFFER_SIZE);
+        if (audioBuffer != NULL)
+                memset(audioBuffer, 0, sizeof(float) * MAX_BUFFER_SIZE);
 }
 
 void freeAudioBuffer()
@@ -1041,6 +1141,7 @@ void pausePlayback()
 
 void cleanupPlaybackDevice()
 {
+        countAudioEvent(AUDIO_DEVICE_RESTARTS, 1);
         ma_device_stop(&device);
         while (ma_device_get_state(&device) != ma_device_state_stopped && ma_device_get_state(&device) != ma_device_state_uninitialized)
         {
@@ -1076,6 +1177,7 @@ pthread_cond_t deviceStopped = PTHREAD_COND_INITIALIZER;
 
 void resetDevice()
 {
+        countAudioEvent(AUDIO_DEVICE_RESTARTS, 1);
         pthread_mutex_lock(&deviceMutex);
 
         if (ma_device_get_state(&device) == ma_device_state_started)
@@ -1096,7 +1198,7 @@ ma_device *getDevice()
         return &device;
 }
 
-bool hasBuiltinDecoder(char *filePath)
+bool hasBuiltinDecoder(const char *filePath)
 {
         char *extension = strrchr(filePath, '.');
         return (extension != NULL && (strcasecmp(extension, ".wav") == 0 || strcasecmp(extension, ".flac") == 0 ||
@@ -1260,13 +1362,18 @@ int displaySongNotification(const char *artist, const char *title, const char *c
 
 void executeSwitch(AudioData *pAudioData)
 {
+        TRACE_SCOPE("executeSwitch");
+
         pAudioData->switchFiles = false;
+        completeCrossfade();
+        invalidateStretch();
         switchDecoder();
         switchOpusDecoder();
         switchM4aDecoder();
         switchVorbisDecoder();
 
         pAudioData->pUserData->currentSongData = (pAudioData->currentFileIndex == 0) ? pAudioData->pUserData->songdataA : pAudioData->pUserData->songdataB;
+        setLoudnessGain(pAudioData->pUserData->currentSongData != NULL ? pAudioData->pUserData->currentSongData->loudnessGain : 1.0f);
         pAudioData->totalFrames = 0;
         pAudioData->currentPCMFrame = 0;
 
@@ -1374,17 +1481,46 @@ void setVolume(int volume)
 
         soundVolume = volume;
 
-        ma_device_set_master_volume(getDevice(), (float)volume / 100);
+        setTargetGain((float)volume / 100);
 }
 
-int adjustVolumePercent(int volumeChange)
+static _Atomic bool systemVolumeQueryRunning = false;
+
+void *querySystemVolume(void *arg)
 {
-        int sysVol = getSystemVolume();
+        (void)arg;
 
-        if (sysVol == 0)
-                return 0;
+        atomic_store(&systemVolume, getSystemVolume());
+        atomic_store(&systemVolumeQueryRunning, false);
+
+        return NULL;
+}
+
+// Forking pactl/amixer is slow, so it is done off the main thread, one query at a time
+void refreshSystemVolume()
+{
+        if (atomic_exchange(&systemVolumeQueryRunning, true))
+                return;
+
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, querySystemVolume, NULL) == 0)
+                pthread_detach(thread);
+        else
+                atomic_store(&systemVolumeQueryRunning, false);
+}
+
+void initSystemVolume()
+{
+        refreshSystemVolume();
+}
 
-        int step = 100 / sysVol * 5;
+int adjustVolumePercent(int volumeChange)
+{
+        int sysVol = atomic_load(&systemVolume);
+
+        // Larger steps when the system volume is low, plain steps when it is muted, unknown or not read yet
+        int step = (sysVol > 0 && sysVol < 100) ? 100 / sysVol * 5 : 5;
 
         int relativeVolChange = volumeChange / 5 * step;
 
@@ -1392,6 +1528,9 @@ int adjustVolumePercent(int volumeChange)
 
         setVolume(soundVolume);
 
+        // The system volume may have been changed elsewhere since, the next step uses the new value
+        refreshSystemVolume();
+
         return 0;
 }
 
@@ -1409,10 +1548,14 @@ void m4a_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_uint6
                         return;
 
                 if (isImplSwitchReached())
+                {
+                        countAudioEvent(AUDIO_SWITCH_RETURNS, 1);
                         return;
+                }
 
                 if (pthread_mutex_trylock(&dataSourceMutex) != 0)
                 {
+                        countAudioEvent(AUDIO_TRYLOCK_MISSES, 1);
                         return;
                 }
 
@@ -1458,6 +1601,7 @@ void m4a_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_uint6
                         }
 
                         setSeekRequested(false); // Reset seek flag
+                        invalidateStretch();
                 }
 
                 // Read from the current decoder
@@ -1473,7 +1617,11 @@ void m4a_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_uint6
                         return;
                 }
 
-                result = ma_data_source_read_pcm_frames(firstDecoder, (ma_int32 *)pFramesOut + framesRead * pAudioData->channels, remainingFrames, &framesToRead);
+                uint64_t readStart = audioStatsNow();
+                result = readCrossfaded(firstDecoder, decoder, isRepeatEnabled() ? NULL : getNextM4aDecoder(),
+                                        pAudioData->format, pAudioData->channels, pAudioData->sampleRate,
+                                        (ma_int32 *)pFramesOut + framesRead * pAudioData->channels, remainingFrames, &framesToRead);
+                recordAudioTime(AUDIO_DECODER_READ_TIME, readStart);
 
                 ma_data_source_get_cursor_in_pcm_frames(decoder, &cursor);
 
@@ -1492,20 +1640,7 @@ void m4a_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_uint6
                 pthread_mutex_unlock(&dataSourceMutex);
         }
 
-        ma_int32 *audioBuffer = getAudioBuffer();
-        if (audioBuffer == NULL)
-        {
-                audioBuffer = malloc(sizeof(ma_int32) * MAX_BUFFER_SIZE);
-                if (audioBuffer == NULL)
-                {
-                        // Memory allocation failed
-                        return;
-                }
-        }
-
-        // No format conversion needed, just copy the audio samples
-        memcpy(audioBuffer, pFramesOut, sizeof(ma_int32) * framesRead);
-        setAudioBuffer(audioBuffer);
+        copyToAudioBuffer(pFramesOut, framesRead);
 
         if (pFramesRead != NULL)
         {
@@ -1517,7 +1652,12 @@ void m4a_on_audio_frames(ma_device *pDevice, void *pFramesOut, const void *pFram
 {
         AudioData *pDataSource = (AudioData *)pDevice->pUserData;
         ma_uint64 framesRead = 0;
-        m4a_read_pcm_frames(&pDataSource->base, pFramesOut, frameCount, &framesRead);
+        uint64_t start = audioStatsNow();
+        readStretched(m4a_read_pcm_frames, &pDataSource->base, pFramesOut, frameCount, pDevice->playback.format, pDevice->playback.channels, pDevice->sampleRate, &framesRead);
+        applyDsp(pFramesOut, framesRead, pDevice->playback.format, pDevice->playback.channels, pDevice->sampleRate);
+        applyGain(pFramesOut, framesRead, pDevice->playback.format, pDevice->playback.channels, pDevice->sampleRate);
+        recordAudioTime(AUDIO_CALLBACK_TIME, start);
+        countAudioCallback(frameCount, framesRead);
         (void)pFramesIn;
 }
 
@@ -1534,10 +1674,14 @@ void opus_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_uint
                         return;
 
                 if (isImplSwitchReached())
+                {
+                        countAudioEvent(AUDIO_SWITCH_RETURNS, 1);
                         return;
+                }
 
                 if (pthread_mutex_trylock(&dataSourceMutex) != 0)
                 {
+                        countAudioEvent(AUDIO_TRYLOCK_MISSES, 1);
                         return;
                 }
 
@@ -1581,6 +1725,7 @@ void opus_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_uint
                         }
 
                         setSeekRequested(false); // Reset seek flag
+                        invalidateStretch();
                 }
 
                 // Read from the current decoder
@@ -1596,7 +1741,11 @@ void opus_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_uint
                         return;
                 }
 
-                result = ma_data_source_read_pcm_frames(firstDecoder, (ma_int32 *)pFramesOut + framesRead * pAudioData->channels, remainingFrames, &framesToRead);
+                uint64_t readStart = audioStatsNow();
+                result = readCrossfaded(firstDecoder, decoder, isRepeatEnabled() ? NULL : getNextOpusDecoder(),
+                                        pAudioData->format, pAudioData->channels, pAudioData->sampleRate,
+                                        (ma_int32 *)pFramesOut + framesRead * pAudioData->channels, remainingFrames, &framesToRead);
+                recordAudioTime(AUDIO_DECODER_READ_TIME, readStart);
 
                 ma_data_source_get_cursor_in_pcm_frames(decoder, &cursor);
 
@@ -1613,20 +1762,7 @@ void opus_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_uint
                 pthread_mutex_unlock(&dataSourceMutex);
         }
 
-        ma_int32 *audioBuffer = getAudioBuffer();
-        if (audioBuffer == NULL)
-        {
-                audioBuffer = malloc(sizeof(ma_int32) * MAX_BUFFER_SIZE);
-                if (audioBuffer == NULL)
-                {
-                        // Memory allocation failed
-                        return;
-                }
-        }
-
-        // No format conversion needed, just copy the audio samples
-        memcpy(audioBuffer, pFramesOut, sizeof(ma_int32) * framesRead);
-        setAudioBuffer(audioBuffer);
+        copyToAudioBuffer(pFramesOut, framesRead);
 
         if (pFramesRead != NULL)
         {
@@ -1638,7 +1774,12 @@ void opus_on_audio_frames(ma_device *pDevice, void *pFramesOut, const void *pFra
 {
         AudioData *pDataSource = (AudioData *)pDevice->pUserData;
         ma_uint64 framesRead = 0;
-        opus_read_pcm_frames(&pDataSource->base, pFramesOut, frameCount, &framesRead);
+        uint64_t start = audioStatsNow();
+        readStretched(opus_read_pcm_frames, &pDataSource->base, pFramesOut, frameCount, pDevice->playback.format, pDevice->playback.channels, pDevice->sampleRate, &framesRead);
+        applyDsp(pFramesOut, framesRead, pDevice->playback.format, pDevice->playback.channels, pDevice->sampleRate);
+        applyGain(pFramesOut, framesRead, pDevice->playback.format, pDevice->playback.channels, pDevice->sampleRate);
+        recordAudioTime(AUDIO_CALLBACK_TIME, start);
+        countAudioCallback(frameCount, framesRead);
         (void)pFramesIn;
 }
 
@@ -1655,10 +1796,14 @@ void vorbis_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_ui
                         return;
 
                 if (isImplSwitchReached())
+                {
+                        countAudioEvent(AUDIO_SWITCH_RETURNS, 1);
                         return;
+                }
 
                 if (pthread_mutex_trylock(&dataSourceMutex) != 0)
                 {
+                        countAudioEvent(AUDIO_TRYLOCK_MISSES, 1);
                         return;
                 }
 
@@ -1696,7 +1841,11 @@ void vorbis_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_ui
                         return;
                 }
 
-                result = ma_data_source_read_pcm_frames(firstDecoder, (ma_int32 *)pFramesOut + framesRead * pAudioData->channels, remainingFrames, &framesToRead);
+                uint64_t readStart = audioStatsNow();
+                result = readCrossfaded(firstDecoder, decoder, isRepeatEnabled() ? NULL : getNextVorbisDecoder(),
+                                        pAudioData->format, pAudioData->channels, pAudioData->sampleRate,
+                                        (ma_int32 *)pFramesOut + framesRead * pAudioData->channels, remainingFrames, &framesToRead);
+                recordAudioTime(AUDIO_DECODER_READ_TIME, readStart);
 
                 if ((getPercentageElapsed() >= 1.0 || isSkipToNext() || result != MA_SUCCESS) &&
                     !isEOFReached())
@@ -1712,20 +1861,7 @@ void vorbis_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_ui
                 pthread_mutex_unlock(&dataSourceMutex);
         }
 
-        ma_int32 *audioBuffer = getAudioBuffer();
-        if (audioBuffer == NULL)
-        {
-                audioBuffer = malloc(sizeof(ma_int32) * MAX_BUFFER_SIZE);
-                if (audioBuffer == NULL)
-                {
-                        // Memory allocation failed
-                        return;
-                }
-        }
-
-        // No format conversion needed, just copy the audio samples
-        memcpy(audioBuffer, pFramesOut, sizeof(ma_int32) * framesRead);
-        setAudioBuffer(audioBuffer);
+        copyToAudioBuffer(pFramesOut, framesRead);
 
         if (pFramesRead != NULL)
         {
@@ -1737,6 +1873,11 @@ void vorbis_on_audio_frames(ma_device *pDevice, void *pFramesOut, const void *pF
 {
         AudioData *pDataSource = (AudioData *)pDevice->pUserData;
         ma_uint64 framesRead = 0;
-        vorbis_read_pcm_frames(&pDataSource->base, pFramesOut, frameCount, &framesRead);
+        uint64_t start = audioStatsNow();
+        readStretched(vorbis_read_pcm_frames, &pDataSource->base, pFramesOut, frameCount, pDevice->playback.format, pDevice->playback.channels, pDevice->sampleRate, &framesRead);
+        applyDsp(pFramesOut, framesRead, pDevice->playback.format, pDevice->playback.channels, pDevice->sampleRate);
+        applyGain(pFramesOut, framesRead, pDevice->playback.format, pDevice->playback.channels, pDevice->sampleRate);
+        recordAudioTime(AUDIO_CALLBACK_TIME, start);
+        countAudioCallback(frameCount, framesRead);
         (void)pFramesIn;
 }
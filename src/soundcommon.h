@@ -8,10 +8,19 @@
 #include <miniaudio_libvorbis.h>
 #include <sys/wait.h>
 #include "m4a.h"
+#include "audiostats.h"
+#include "crossfade.h"
+#include "dsp.h"
+#include "timestretch.h"
+#include "gain.h"
+#include "gapless.h"
+#include "trace.h"
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <strings.h>
 #include "file.h"
+#include "pathindex.h"
 #include "utils.h"
 
 #ifdef USE_LIBNOTIFY
@@ -26,6 +35,27 @@
 #define MAX_BUFFER_SIZE 4800
 #endif
 
+#ifndef POWER_PERIOD_MS
+#define POWER_PERIOD_MS 100 // Device period with the buffers power profile
+#endif
+
+#ifndef POWER_PERIODS
+#define POWER_PERIODS 3
+#endif
+
+#ifndef POWER_PROFILE_ENUM
+#define POWER_PROFILE_ENUM
+
+typedef enum
+{
+        POWER_DEFAULT,
+        POWER_BUFFERS, // Large device periods, the audio thread wakes up seldom and decodes a lot each time
+        POWER_QUIET,   // The UI ticks once a second while there is nothing moving on screen
+        POWER_BATTERY  // Both
+} PowerProfile;
+
+#endif
+
 #ifndef TAGSETTINGS_STRUCT
 #define TAGSETTINGS_STRUCT
 
@@ -36,6 +66,13 @@ typedef struct
         char album_artist[256];
         char album[256];
         char date[256];
+        double trackGain; // ReplayGain tags in dB, valid when hasTrackGain/hasAlbumGain is set
+        double trackPeak;
+        double albumGain;
+        double albumPeak;
+        bool hasTrackGain;
+        bool hasAlbumGain;
+        GaplessInfo gapless; // Encoder delay and padding to trim, zero when the file has none
 } TagSettings;
 
 #endif
@@ -46,14 +83,17 @@ typedef struct
 typedef struct
 {
         gchar *trackId;
-        char filePath[MAXPATHLEN];
-        char coverArtPath[MAXPATHLEN];
+        Track *track;
+        const char *filePath; // The track's path
+        char *coverArtPath;
+        bool coverInCache; // coverArtPath was extracted into tempCache and has to be released there
         unsigned char red;
         unsigned char green;
         unsigned char blue;
         TagSettings *metadata;
         FIBITMAP *cover;
         double duration;
+        float loudnessGain; // Linear normalization gain, 1.0 when off or not yet analyzed
         bool hasErrors;
 } SongData;
 
@@ -132,6 +172,8 @@ typedef struct
         char toggleShuffle[6];
         char seekBackward[6];
         char seekForward[6];
+        char increaseSpeed[6];
+        char decreaseSpeed[6];
         char savePlaylist[6];
         char addToMainPlaylist[6];
         char updateLibrary[6];
@@ -162,6 +204,7 @@ typedef struct
         char hardNextPage[6];
         char hardPrevPage[6];
         char hardRemove[6];
+        char hardToggleAudioStats[6];
         char lastVolume[12];
         char allowNotifications[2];
         char color[2];       
@@ -171,6 +214,11 @@ typedef struct
         char hideLogo[2];
         char hideHelp[2];
         char cacheLibrary[6];
+        char replayGain[6];
+        char crossfade[6];
+        char equalizer[16];
+        char equalizerCustom[256];
+        char powerProfile[16];
 } AppSettings;
 
 #endif
@@ -225,6 +273,14 @@ int getBufferSize();
 
 void setBufferSize(int value);
 
+PowerProfile parsePowerProfile(const char *value);
+
+void setPowerProfile(PowerProfile profile);
+
+bool usesLargePeriods(void);
+
+bool throttlesIdleTicks(void);
+
 void setPlayingStatus(bool playing);
 
 bool isPlaying();
@@ -241,6 +297,18 @@ void resetDecoders();
 
 ma_libopus *getCurrentOpusDecoder();
 
+ma_decoder *getNextBuiltinDecoder();
+
+ma_libvorbis *getNextVorbisDecoder();
+
+m4a_decoder *getNextM4aDecoder();
+
+ma_libopus *getNextOpusDecoder();
+
+void beginNextDecoderChange();
+
+void endNextDecoderChange();
+
 void resetOpusDecoders();
 
 m4a_decoder *getCurrentM4aDecoder();
@@ -261,13 +329,13 @@ ma_libvorbis *getCurrentVorbisDecoder();
 
 void switchVorbisDecoder();
 
-int prepareNextOpusDecoder(char *filepath);
+int prepareNextOpusDecoder(const char *filepath);
 
-int prepareNextOpusDecoder(char *filepath);
+int prepareNextOpusDecoder(const char *filepath);
 
-int prepareNextVorbisDecoder(char *filepath);
+int prepareNextVorbisDecoder(const char *filepath);
 
-int prepareNextM4aDecoder(char *filepath);
+int prepareNextM4aDecoder(const char *filepath, const GaplessInfo *gapless);
 
 void resetVorbisDecoders();
 
@@ -283,6 +351,10 @@ ma_int32 *getAudioBuffer();
 
 void setAudioBuffer(ma_int32 *buf);
 
+void setAudioBufferEnabled(bool enabled);
+
+void copyToAudioBuffer(const void *frames, ma_uint64 frameCount);
+
 void resetAudioBuffer();
 
 void freeAudioBuffer();
@@ -345,7 +417,7 @@ void resetDevice();
 
 ma_device *getDevice();
 
-bool hasBuiltinDecoder(char *filePath);
+bool hasBuiltinDecoder(const char *filePath);
 
 void setCurrentFileIndex(AudioData *pAudioData, int index);
 
@@ -361,6 +433,8 @@ int getCurrentVolume(void);
 
 void setVolume(int volume);
 
+void initSystemVolume();
+
 int adjustVolumePercent(int volumeChange);
 
 void m4a_on_audio_frames(ma_device *pDevice, void *pFramesOut, const void *pFramesIn, ma_uint32 frameCount);
@@ -369,6 +443,5 @@ void opus_on_audio_frames(ma_device *pDevice, void *pFramesOut, const void *pFra
 
 void vorbis_on_audio_frames(ma_device *pDevice, void *pFramesOut, const void *pFramesIn, ma_uint32 frameCount);
 
-void logTime(const char *message);
 
 #endif
@@ -130,6 +130,19 @@ void enableScrolling()
         printf("\033[?7h");
 }
 
+// The terminal then sends \033[I when it gains focus and \033[O when it loses it
+void enableFocusReporting()
+{
+        printf("\033[?1004h");
+        fflush(stdout);
+}
+
+void disableFocusReporting()
+{
+        printf("\033[?1004l");
+        fflush(stdout);
+}
+
 void handleResize(int sig)
 {
         (void)sig;
@@ -53,6 +53,10 @@ void clearRestOfScreen(void);
 
 void enableScrolling(void);
 
+void enableFocusReporting(void);
+
+void disableFocusReporting(void);
+
 void handleResize(int sig);
 
 void resetResizeFlag(int sig);
@@ -0,0 +1,361 @@
+#include "timestretch.h"
+/*
+
+timestretch.c
+
+ Playback rate without a change in pitch, using WSOLA (waveform similarity
+ overlap-add). Every output hop crossfades the natural continuation of the
+ last segment into a new segment taken around the nominal input position,
+ at the offset where the two waveforms line up best. Input is consumed
+ rate times faster than output is produced.
+
+ The best offset is found by normalized cross-correlation of a mono mix, a
+ coarse pass over every STRETCH_COARSE_STEP offsets and a fine pass around
+ the winner. The dot products keep eight partial sums so they vectorize
+ without relaxing floating point rules.
+
+ Everything runs on the audio thread from static buffers. At a rate of 1.0
+ the decoders are read directly and nothing here costs anything.
+
+*/
+
+static _Atomic float playbackRate = 1.0f;
+
+// Only touched from the audio thread
+static bool stretchActive = false;
+static ma_format stretchFormat = ma_format_unknown;
+static ma_uint32 stretchChannels = 0;
+static ma_uint32 stretchSampleRate = 0;
+static ma_uint32 overlapFrames = 0;
+static ma_uint32 seekFrames = 0;
+static bool primed = false;
+
+static float inputBuffer[STRETCH_BUFFER_FRAMES * STRETCH_MAX_CHANNELS];
+static float inputMono[STRETCH_BUFFER_FRAMES];
+static ma_uint64 inputFrames = 0;
+static ma_uint64 previousStart = 0;
+static double nominalPosition = 0.0;
+
+static float hopBuffer[(STRETCH_BUFFER_FRAMES / 8) * STRETCH_MAX_CHANNELS];
+static float fadeIn[STRETCH_BUFFER_FRAMES / 8];
+static ma_uint32 hopFrames = 0;
+static ma_uint32 hopPosition = 0;
+
+static ma_uint8 readBuffer[STRETCH_READ_FRAMES * STRETCH_MAX_CHANNELS * sizeof(float)];
+static unsigned flushCount = 0; // Bumped by invalidateStretch, from within the reads on the audio thread
+
+void setPlaybackRate(double rate)
+{
+        if (rate < STRETCH_MIN_RATE)
+                rate = STRETCH_MIN_RATE;
+        else if (rate > STRETCH_MAX_RATE)
+                rate = STRETCH_MAX_RATE;
+
+        // Snap to hundredths so repeated steps come back to exactly 1.0
+        rate = round(rate * 100.0) / 100.0;
+
+        atomic_store(&playbackRate, (float)rate);
+}
+
+double getPlaybackRate()
+{
+        return atomic_load(&playbackRate);
+}
+
+void adjustPlaybackRate(double step)
+{
+        setPlaybackRate(getPlaybackRate() + step);
+}
+
+// Called on a seek or a track switch, so the buffered input and the hop from the old position are dropped
+void invalidateStretch()
+{
+        flushCount++;
+}
+
+void discardStretch()
+{
+        inputFrames = 0;
+        previousStart = 0;
+        nominalPosition = 0.0;
+        hopFrames = 0;
+        hopPosition = 0;
+        primed = false;
+}
+
+bool resetStretch(ma_format format, ma_uint32 channels, ma_uint32 sampleRate)
+{
+        ma_uint32 overlap = sampleRate * STRETCH_OVERLAP_MS / 1000;
+
+        if (channels == 0 || channels > STRETCH_MAX_CHANNELS || overlap == 0 || overlap > STRETCH_BUFFER_FRAMES / 8 ||
+            format == ma_format_unknown || ma_get_bytes_per_sample(format) > sizeof(float))
+                return false;
+
+        stretchFormat = format;
+        stretchChannels = channels;
+        stretchSampleRate = sampleRate;
+        overlapFrames = overlap;
+        seekFrames = sampleRate * STRETCH_SEEK_MS / 1000;
+
+        // Raised cosine, fadeIn[n] + fadeIn[overlap - 1 - n] == 1
+        for (ma_uint32 n = 0; n < overlap; n++)
+        {
+                double s = sin(M_PI / 2.0 * (n + 0.5) / overlap);
+                fadeIn[n] = (float)(s * s);
+        }
+
+        discardStretch();
+
+        return true;
+}
+
+float dotProduct(const float *restrict a, const float *restrict b, ma_uint32 count)
+{
+        float partial[8] = {0};
+        ma_uint32 i = 0;
+
+        for (; i + 8 <= count; i += 8)
+        {
+                for (int j = 0; j < 8; j++)
+                        partial[j] += a[i + j] * b[i + j];
+        }
+
+        float sum = 0.0f;
+
+        for (; i < count; i++)
+                sum += a[i] * b[i];
+
+        for (int j = 0; j < 8; j++)
+                sum += partial[j];
+
+        return sum;
+}
+
+float getMatchScore(ma_uint64 candidate, ma_uint64 reference)
+{
+        const float *x = inputMono + candidate;
+        float correlation = dotProduct(x, inputMono + reference, overlapFrames);
+        float energy = dotProduct(x, x, overlapFrames);
+
+        return correlation / sqrtf(energy + 1e-9f);
+}
+
+ma_uint64 findBestOffset()
+{
+        ma_uint64 reference = previousStart + overlapFrames;
+        ma_uint64 center = (ma_uint64)nominalPosition;
+        ma_uint64 low = (center > seekFrames) ? center - seekFrames : 0;
+        ma_uint64 high = center + seekFrames;
+        ma_uint64 best = low;
+        float bestScore = -INFINITY;
+
+        for (ma_uint64 candidate = low; candidate <= high; candidate += STRETCH_COARSE_STEP)
+        {
+                float score = getMatchScore(candidate, reference);
+
+                if (score > bestScore)
+                {
+                        bestScore = score;
+                        best = candidate;
+                }
+        }
+
+        ma_uint64 fineLow = (best > low + STRETCH_COARSE_STEP) ? best - STRETCH_COARSE_STEP + 1 : low;
+        ma_uint64 fineHigh = (best + STRETCH_COARSE_STEP - 1 < high) ? best + STRETCH_COARSE_STEP - 1 : high;
+        ma_uint64 coarseBest = best;
+
+        for (ma_uint64 candidate = fineLow; candidate <= fineHigh; candidate++)
+        {
+                if (candidate == coarseBest)
+                        continue;
+
+                float score = getMatchScore(candidate, reference);
+
+                if (score > bestScore)
+                {
+                        bestScore = score;
+                        best = candidate;
+                }
+        }
+
+        return best;
+}
+
+// Reads from the decoders until the input buffer holds at least needed frames
+bool fillInput(StretchReadProc read, ma_data_source *pDataSource, ma_uint64 needed)
+{
+        if (needed > STRETCH_BUFFER_FRAMES)
+                return false;
+
+        while (inputFrames < needed)
+        {
+                ma_uint64 chunk = STRETCH_BUFFER_FRAMES - inputFrames;
+                ma_uint64 framesRead = 0;
+
+                if (chunk > STRETCH_READ_FRAMES)
+                        chunk = STRETCH_READ_FRAMES;
+
+                unsigned flushes = flushCount;
+
+                read(pDataSource, readBuffer, chunk, &framesRead);
+
+                bool flushed = (flushCount != flushes);
+
+                // Only what was just read belongs to the new position
+                if (flushed)
+                        discardStretch();
+
+                if (framesRead == 0)
+                        return false;
+
+                float *frames = inputBuffer + inputFrames * stretchChannels;
+
+                ma_pcm_convert(frames, ma_format_f32, readBuffer, stretchFormat, framesRead * stretchChannels, ma_dither_mode_none);
+
+                for (ma_uint64 i = 0; i < framesRead; i++)
+                {
+                        float sum = 0.0f;
+
+                        for (ma_uint32 c = 0; c < stretchChannels; c++)
+                                sum += frames[i * stretchChannels + c];
+
+                        inputMono[inputFrames + i] = sum;
+                }
+
+                inputFrames += framesRead;
+
+                if (flushed)
+                        return false;
+        }
+
+        return true;
+}
+
+// Drops input that no later hop can reach
+void discardInput()
+{
+        ma_uint64 lowest = previousStart;
+
+        if (nominalPosition - seekFrames < (double)lowest)
+                lowest = (nominalPosition > seekFrames) ? (ma_uint64)(nominalPosition - seekFrames) : 0;
+
+        if (lowest < STRETCH_READ_FRAMES * 4 || lowest > inputFrames)
+                return;
+
+        memmove(inputBuffer, inputBuffer + lowest * stretchChannels, (inputFrames - lowest) * stretchChannels * sizeof(float));
+        memmove(inputMono, inputMono + lowest, (inputFrames - lowest) * sizeof(float));
+
+        inputFrames -= lowest;
+        previousStart -= lowest;
+        nominalPosition -= lowest;
+}
+
+bool produceHop(StretchReadProc read, ma_data_source *pDataSource, float rate)
+{
+        ma_uint32 channels = stretchChannels;
+
+        if (!primed)
+        {
+                if (!fillInput(read, pDataSource, 2 * overlapFrames))
+                        return false;
+
+                memcpy(hopBuffer, inputBuffer, overlapFrames * channels * sizeof(float));
+
+                previousStart = 0;
+                nominalPosition = overlapFrames * rate;
+                primed = true;
+        }
+        else
+        {
+                ma_uint64 needed = previousStart + 2 * overlapFrames;
+                ma_uint64 searchEnd = (ma_uint64)nominalPosition + seekFrames + overlapFrames;
+
+                if (searchEnd > needed)
+                        needed = searchEnd;
+
+                if (!fillInput(read, pDataSource, needed + 1))
+                        return false;
+
+                ma_uint64 start = findBestOffset();
+                const float *fadingOut = inputBuffer + (previousStart + overlapFrames) * channels;
+                const float *fadingIn = inputBuffer + start * channels;
+
+                for (ma_uint32 n = 0; n < overlapFrames; n++)
+                {
+                        float in = fadeIn[n];
+                        float out = 1.0f - in;
+
+                        for (ma_uint32 c = 0; c < channels; c++)
+                                hopBuffer[n * channels + c] = fadingOut[n * channels + c] * out + fadingIn[n * channels + c] * in;
+                }
+
+                previousStart = start;
+                nominalPosition += overlapFrames * rate;
+        }
+
+        discardInput();
+
+        hopFrames = overlapFrames;
+        hopPosition = 0;
+
+        return true;
+}
+
+// Reads frameCount frames at the current playback rate, in place of calling read directly
+void readStretched(StretchReadProc read, ma_data_source *pDataSource, void *pFramesOut, ma_uint64 frameCount,
+                   ma_format format, ma_uint32 channels, ma_uint32 sampleRate, ma_uint64 *pFramesRead)
+{
+        float rate = atomic_load(&playbackRate);
+
+        if (fabsf(rate - 1.0f) < 0.001f)
+        {
+                stretchActive = false;
+                read(pDataSource, pFramesOut, frameCount, pFramesRead);
+                return;
+        }
+
+        if (!stretchActive || format != stretchFormat || channels != stretchChannels || sampleRate != stretchSampleRate)
+        {
+                stretchActive = resetStretch(format, channels, sampleRate);
+
+                if (!stretchActive)
+                {
+                        read(pDataSource, pFramesOut, frameCount, pFramesRead);
+                        return;
+                }
+        }
+
+        ma_uint32 bytesPerFrame = ma_get_bytes_per_frame(format, channels);
+        ma_uint64 produced = 0;
+
+        while (produced < frameCount)
+        {
+                if (hopPosition >= hopFrames)
+                {
+                        unsigned flushes = flushCount;
+
+                        if (!produceHop(read, pDataSource, rate))
+                        {
+                                // Start over from the new position
+                                if (flushCount != flushes)
+                                        continue;
+
+                                break;
+                        }
+                }
+
+                ma_uint64 count = hopFrames - hopPosition;
+
+                if (count > frameCount - produced)
+                        count = frameCount - produced;
+
+                ma_pcm_convert((ma_uint8 *)pFramesOut + produced * bytesPerFrame, format, hopBuffer + hopPosition * channels,
+                               ma_format_f32, count * channels, ma_dither_mode_none);
+
+                produced += count;
+                hopPosition += count;
+        }
+
+        if (pFramesRead != NULL)
+                *pFramesRead = produced;
+}
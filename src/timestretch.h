@@ -0,0 +1,59 @@
+#ifndef TIMESTRETCH_H
+#define TIMESTRETCH_H
+
+#include <math.h>
+#include <miniaudio.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifndef STRETCH_MIN_RATE
+#define STRETCH_MIN_RATE 0.5
+#endif
+
+#ifndef STRETCH_MAX_RATE
+#define STRETCH_MAX_RATE 3.0
+#endif
+
+#ifndef STRETCH_RATE_STEP
+#define STRETCH_RATE_STEP 0.1
+#endif
+
+#ifndef STRETCH_OVERLAP_MS
+#define STRETCH_OVERLAP_MS 15 // Output hop, and the length of each crossfade between segments
+#endif
+
+#ifndef STRETCH_SEEK_MS
+#define STRETCH_SEEK_MS 10 // How far either way from the nominal position to look for the best match
+#endif
+
+#ifndef STRETCH_COARSE_STEP
+#define STRETCH_COARSE_STEP 4 // The search first looks at every fourth offset, then refines around the best one
+#endif
+
+#ifndef STRETCH_MAX_CHANNELS
+#define STRETCH_MAX_CHANNELS 8
+#endif
+
+#ifndef STRETCH_BUFFER_FRAMES
+#define STRETCH_BUFFER_FRAMES 32768 // Enough input for 3x at 192 kHz
+#endif
+
+#ifndef STRETCH_READ_FRAMES
+#define STRETCH_READ_FRAMES 1024 // Stays below the visualizer's MAX_BUFFER_SIZE
+#endif
+
+typedef void (*StretchReadProc)(ma_data_source *pDataSource, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead);
+
+void setPlaybackRate(double rate);
+
+double getPlaybackRate();
+
+void adjustPlaybackRate(double step);
+
+void invalidateStretch(void);
+
+void readStretched(StretchReadProc read, ma_data_source *pDataSource, void *pFramesOut, ma_uint64 frameCount,
+                   ma_format format, ma_uint32 channels, ma_uint32 sampleRate, ma_uint64 *pFramesRead);
+
+#endif
@@ -0,0 +1,138 @@
+#include "trace.h"
+/*
+
+trace.c
+
+ Optional span tracing, built with make TRACE=1. Every thread records into
+ its own ring buffer without locking, and on exit the buffers are written
+ out in the Chrome trace event format, which chrome://tracing and Perfetto
+ can open.
+
+*/
+
+#ifdef TRACE
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static __thread TraceBuffer *threadBuffer = NULL;
+static TraceBuffer *traceBuffers = NULL;
+static int traceThreadCount = 0;
+static pthread_mutex_t traceMutex = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t traceNow()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+TraceBuffer *registerTraceBuffer()
+{
+        TraceBuffer *buffer = (TraceBuffer *)calloc(1, sizeof(TraceBuffer));
+
+        if (buffer == NULL)
+                return NULL;
+
+        // Only taken once per thread, recording itself never locks
+        pthread_mutex_lock(&traceMutex);
+        buffer->threadId = ++traceThreadCount;
+        buffer->next = traceBuffers;
+        traceBuffers = buffer;
+        pthread_mutex_unlock(&traceMutex);
+
+        return buffer;
+}
+
+void traceEvent(const char *name, char phase)
+{
+        if (threadBuffer == NULL)
+        {
+                threadBuffer = registerTraceBuffer();
+
+                if (threadBuffer == NULL)
+                        return;
+        }
+
+        uint64_t written = atomic_load_explicit(&threadBuffer->written, memory_order_relaxed);
+        TraceEvent *event = &threadBuffer->events[written % TRACE_BUFFER_EVENTS];
+
+        event->name = name;
+        event->timestamp = traceNow();
+        event->phase = phase;
+
+        atomic_store_explicit(&threadBuffer->written, written + 1, memory_order_release);
+}
+
+void traceScopeEnd(const char **name)
+{
+        traceEvent(*name, 'E');
+}
+
+void writeTrace(const char *path)
+{
+        FILE *file = fopen(path, "w");
+
+        if (file == NULL)
+        {
+                perror("Failed to write trace");
+                return;
+        }
+
+        int pid = (int)getpid();
+        bool first = true;
+
+        pthread_mutex_lock(&traceMutex);
+
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+        for (TraceBuffer *buffer = traceBuffers; buffer != NULL; buffer = buffer->next)
+        {
+                uint64_t written = atomic_load_explicit(&buffer->written, memory_order_acquire);
+                uint64_t start = (written > TRACE_BUFFER_EVENTS) ? written - TRACE_BUFFER_EVENTS : 0;
+
+                fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                        first ? "" : ",\n", pid, buffer->threadId, buffer->threadId);
+                first = false;
+
+                for (uint64_t i = start; i < written; i++)
+                {
+                        TraceEvent *event = &buffer->events[i % TRACE_BUFFER_EVENTS];
+
+                        fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d%s}",
+                                event->name, event->phase, event->timestamp / 1000.0, pid, buffer->threadId,
+                                event->phase == 'i' ? ",\"s\":\"t\"" : "");
+                }
+        }
+
+        fprintf(file, "\n]}\n");
+
+        pthread_mutex_unlock(&traceMutex);
+
+        fclose(file);
+}
+
+void freeTrace()
+{
+        pthread_mutex_lock(&traceMutex);
+
+        TraceBuffer *buffer = traceBuffers;
+
+        while (buffer != NULL)
+        {
+                TraceBuffer *next = buffer->next;
+                free(buffer);
+                buffer = next;
+        }
+
+        traceBuffers = NULL;
+        threadBuffer = NULL;
+
+        pthread_mutex_unlock(&traceMutex);
+}
+
+#endif
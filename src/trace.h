@@ -0,0 +1,58 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef TRACE
+
+#include <stdatomic.h>
+
+#ifndef TRACE_BUFFER_EVENTS
+#define TRACE_BUFFER_EVENTS 16384 // Per thread, the oldest events are overwritten when full
+#endif
+
+#ifndef TRACE_FILE
+#define TRACE_FILE "kewtrace.json"
+#endif
+
+typedef struct
+{
+        const char *name; // Must be a string literal, only the pointer is stored
+        uint64_t timestamp;
+        char phase;
+} TraceEvent;
+
+typedef struct TraceBuffer
+{
+        TraceEvent events[TRACE_BUFFER_EVENTS];
+        _Atomic uint64_t written;
+        int threadId;
+        struct TraceBuffer *next;
+} TraceBuffer;
+
+void traceEvent(const char *name, char phase);
+
+void traceScopeEnd(const char **name);
+
+void writeTrace(const char *path);
+
+void freeTrace();
+
+#define TRACE_BEGIN(name) traceEvent(name, 'B')
+#define TRACE_END(name) traceEvent(name, 'E')
+#define TRACE_INSTANT(name) traceEvent(name, 'i')
+
+// Traces from here to the end of the enclosing block, whichever way it is left
+#define TRACE_SCOPE(name) const char *traceScopeName __attribute__((cleanup(traceScopeEnd))) = (traceEvent(name, 'B'), name)
+
+#else
+
+#define TRACE_BEGIN(name) ((void)0)
+#define TRACE_END(name) ((void)0)
+#define TRACE_INSTANT(name) ((void)0)
+#define TRACE_SCOPE(name) ((void)0)
+
+#endif
+
+#endif
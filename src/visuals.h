@@ -26,6 +26,8 @@ void initVisuals();
 
 void freeVisuals();
 
+void calc(int height, int numBars, ma_int32 *audioBuffer, int bitDepth, fftwf_complex *fftInput, fftwf_complex *fftOutput, float *magnitudes, fftwf_plan plan);
+
 void drawSpectrumVisualizer(int height, int width, PixelData c, int indentation, bool useProfileColors);
 
 PixelData increaseLuminosity(PixelData pixel, int amount);